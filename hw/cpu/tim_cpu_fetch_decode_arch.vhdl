@@ -248,6 +248,18 @@ begin
         when opcode_FMULR =>decoded_instruction<=FMULR;decoded_instruction_size<=opcode_width_FMULR;
         when opcode_FDIVR =>decoded_instruction<=FDIVR;decoded_instruction_size<=opcode_width_FDIVR;
         when opcode_FASRR =>decoded_instruction<=FASRR;decoded_instruction_size<=opcode_width_FASRR;
+        when opcode_JUMPS =>decoded_instruction<=JUMPS;decoded_instruction_size<=opcode_width_JUMPS;
+        when opcode_CALLS =>decoded_instruction<=CALLS;decoded_instruction_size<=opcode_width_CALLS;
+        when opcode_MOVIS =>decoded_instruction<=MOVIS;decoded_instruction_size<=opcode_width_MOVIS;
+        when opcode_MOVIM =>decoded_instruction<=MOVIM;decoded_instruction_size<=opcode_width_MOVIM;
+        when opcode_ANDIS =>decoded_instruction<=ANDIS;decoded_instruction_size<=opcode_width_ANDIS;
+        when opcode_ORIS  =>decoded_instruction<=ORIS ;decoded_instruction_size<=opcode_width_ORIS ;
+        when opcode_XORIS =>decoded_instruction<=XORIS;decoded_instruction_size<=opcode_width_XORIS;
+        when opcode_LSLIS =>decoded_instruction<=LSLIS;decoded_instruction_size<=opcode_width_LSLIS;
+        when opcode_LSRIS =>decoded_instruction<=LSRIS;decoded_instruction_size<=opcode_width_LSRIS;
+        when opcode_IADDIS =>decoded_instruction<=IADDIS;decoded_instruction_size<=opcode_width_IADDIS;
+        when opcode_ISUBIS =>decoded_instruction<=ISUBIS;decoded_instruction_size<=opcode_width_ISUBIS;
+        when opcode_NOPS  =>decoded_instruction<=NOPS ;decoded_instruction_size<=opcode_width_NOPS ;
         when others =>
         -- Default to a NOP.
         decoded_instruction <= ANDR;
@@ -31,7 +31,9 @@ package tim_instructions is
                               CALLR ,CALLI ,RET   ,TEST  ,HALT  ,ANDR  ,NANDR ,ORR   ,NORR  ,XORR,
                               LSLR  ,LSRR  ,NOTR  ,ANDI  ,NANDI ,ORI   ,NORI  ,XORI  ,LSLI  ,LSRI,
                               IADDI ,ISUBI ,IMULI ,IDIVI ,IASRI ,IADDR ,ISUBR ,IMULR ,IDIVR ,IASRR,
-                              FADDI ,FSUBI ,FMULI ,FDIVI ,FASRI ,FADDR ,FSUBR ,FMULR ,FDIVR ,FASRR);
+                              FADDI ,FSUBI ,FMULI ,FDIVI ,FASRI ,FADDR ,FSUBR ,FMULR ,FDIVR ,FASRR,
+                              JUMPS ,CALLS ,MOVIS ,MOVIM ,ANDIS ,ORIS  ,XORIS ,LSLIS ,LSRIS ,IADDIS,
+                              ISUBIS,NOPS);
 
     
     --! An easy way to encode the conditional execution bits of an instruction.
@@ -343,5 +345,77 @@ package tim_instructions is
  
     --! The length in bytes of the instruction 
     constant opcode_width_SLEEP : integer := 2;
+ 
+    --! Jump by a signed 8 bit offset from the address of the next instruction.
+    constant opcode_JUMPS : std_logic_vector(opcode_width-1 downto 0) := std_logic_vector(to_unsigned(51,opcode_width));
+ 
+    --! The length in bytes of the instruction 
+    constant opcode_width_JUMPS : integer := 2;
+ 
+    --! Call a function a signed 8 bit offset from the address of the next instruction.
+    constant opcode_CALLS : std_logic_vector(opcode_width-1 downto 0) := std_logic_vector(to_unsigned(52,opcode_width));
+ 
+    --! The length in bytes of the instruction 
+    constant opcode_width_CALLS : integer := 2;
+ 
+    --! Move a 4 bit immediate into general register X.
+    constant opcode_MOVIS : std_logic_vector(opcode_width-1 downto 0) := std_logic_vector(to_unsigned(53,opcode_width));
+ 
+    --! The length in bytes of the instruction 
+    constant opcode_width_MOVIS : integer := 2;
+ 
+    --! Move an 11 bit immediate into register X.
+    constant opcode_MOVIM : std_logic_vector(opcode_width-1 downto 0) := std_logic_vector(to_unsigned(54,opcode_width));
+ 
+    --! The length in bytes of the instruction 
+    constant opcode_width_MOVIM : integer := 3;
+ 
+    --! Bitwise AND register Y with an 8 bit immediate.
+    constant opcode_ANDIS : std_logic_vector(opcode_width-1 downto 0) := std_logic_vector(to_unsigned(55,opcode_width));
+ 
+    --! The length in bytes of the instruction 
+    constant opcode_width_ANDIS : integer := 3;
+ 
+    --! Bitwise OR register Y with an 8 bit immediate.
+    constant opcode_ORIS : std_logic_vector(opcode_width-1 downto 0) := std_logic_vector(to_unsigned(56,opcode_width));
+ 
+    --! The length in bytes of the instruction 
+    constant opcode_width_ORIS : integer := 3;
+ 
+    --! Bitwise XOR register Y with an 8 bit immediate.
+    constant opcode_XORIS : std_logic_vector(opcode_width-1 downto 0) := std_logic_vector(to_unsigned(57,opcode_width));
+ 
+    --! The length in bytes of the instruction 
+    constant opcode_width_XORIS : integer := 3;
+ 
+    --! Logical shift left register Y by an 8 bit immediate.
+    constant opcode_LSLIS : std_logic_vector(opcode_width-1 downto 0) := std_logic_vector(to_unsigned(58,opcode_width));
+ 
+    --! The length in bytes of the instruction 
+    constant opcode_width_LSLIS : integer := 3;
+ 
+    --! Logical shift right register Y by an 8 bit immediate.
+    constant opcode_LSRIS : std_logic_vector(opcode_width-1 downto 0) := std_logic_vector(to_unsigned(59,opcode_width));
+ 
+    --! The length in bytes of the instruction 
+    constant opcode_width_LSRIS : integer := 3;
+ 
+    --! Integer Add an 8 bit immediate to register Y.
+    constant opcode_IADDIS : std_logic_vector(opcode_width-1 downto 0) := std_logic_vector(to_unsigned(60,opcode_width));
+ 
+    --! The length in bytes of the instruction 
+    constant opcode_width_IADDIS : integer := 3;
+ 
+    --! Integer Subtract an 8 bit immediate from register Y.
+    constant opcode_ISUBIS : std_logic_vector(opcode_width-1 downto 0) := std_logic_vector(to_unsigned(61,opcode_width));
+ 
+    --! The length in bytes of the instruction 
+    constant opcode_width_ISUBIS : integer := 3;
+ 
+    --! Do nothing, in a single byte.
+    constant opcode_NOPS : std_logic_vector(opcode_width-1 downto 0) := std_logic_vector(to_unsigned(62,opcode_width));
+ 
+    --! The length in bytes of the instruction 
+    constant opcode_width_NOPS : integer := 1;
 
 end package;
@@ -17,6 +17,28 @@ void usage(int argc, char ** argv)
     tprintf("-------------------------------------------------------------------\n");
     tprintf("                                                                   \n");
     tprintf("Usage: $> %s -i <input file> -o <output file> -f format\n", argv[0]);
+    tprintf("       Use '-i -' to read the source from stdin.\n");
+    tprintf("       $> %s --encodings\n", argv[0]);
+    tprintf("       Lists the name, opcode and byte length of every instruction.\n");
+    tprintf("Options: --stats              Print the time and memory used by each phase.\n");
+    tprintf("         --stats-json <file>  Write the same statistics to a file as JSON.\n");
+    tprintf("         -O                   Remove redundant statements with the peephole\n");
+    tprintf("                              optimiser, reporting the bytes each rule saved.\n");
+    tprintf("                              PUSH then POP of another register becomes a MOV,\n");
+    tprintf("                              so nothing may read the stack below SP.\n");
+    tprintf("         --narrow             Encode MOV and ALU immediates which fit in the two\n");
+    tprintf("                              and three byte narrow forms.\n");
+    tprintf("         --dce                Remove statements which can never be reached from the\n");
+    tprintf("                              start of the program.\n");
+    tprintf("         --relax              Encode jumps and calls to labels within reach as two\n");
+    tprintf("                              byte PC relative JUMPS and CALLS.\n");
+    tprintf("         --align <bytes>      Word align the targets of jumps and calls which need\n");
+    tprintf("                              at most this much padding, from 1 to 3 bytes.\n");
+    tprintf("                              Every jump and call target is treated as hot.\n");
+    tprintf("         -O, --narrow, --dce, --relax and --align move code, so they are\n");
+    tprintf("         ignored with a warning if any JUMP or CALL has a numeric target.\n");
+    tprintf("         --lines <file>       Write the address, length and source line of every\n");
+    tprintf("                              instruction to a file, for tim-sim -p.\n");
     tprintf("\n");
 }
 
@@ -78,6 +100,72 @@ void parse_cmd_args(int argc, char ** argv, asm_context * cxt)
                 exit(1);
             }
         }
+        else if(strcmp(argv[arg], "--stats") == 0)
+        {
+            cxt -> print_stats = TRUE;
+        }
+        else if(strcmp(argv[arg], "--stats-json") == 0)
+        {
+            if(arg+1 < argc)
+            {
+                cxt -> stats_file = argv[arg+1];
+                arg++;
+            }
+            else
+            {
+                usage(argc, argv);
+                exit(1);
+            }
+        }
+        else if(strcmp(argv[arg], "-O") == 0)
+        {
+            cxt -> optimise = TRUE;
+        }
+        else if(strcmp(argv[arg], "--narrow") == 0)
+        {
+            cxt -> narrow_immediates = TRUE;
+        }
+        else if(strcmp(argv[arg], "--dce") == 0)
+        {
+            cxt -> eliminate_dead_code = TRUE;
+        }
+        else if(strcmp(argv[arg], "--relax") == 0)
+        {
+            cxt -> relax_branches = TRUE;
+        }
+        else if(strcmp(argv[arg], "--align") == 0)
+        {
+            if(arg+1 < argc)
+            {
+                cxt -> align_padding = strtoul(argv[arg+1], NULL, 0);
+                if(cxt -> align_padding < 1 || cxt -> align_padding > 3)
+                    fatal("Alignment padding must be from 1 to 3 bytes: %s\n", argv[arg+1]);
+                arg++;
+            }
+            else
+            {
+                usage(argc, argv);
+                exit(1);
+            }
+        }
+        else if(strcmp(argv[arg], "--lines") == 0)
+        {
+            if(arg+1 < argc)
+            {
+                cxt -> lines_file = argv[arg+1];
+                arg++;
+            }
+            else
+            {
+                usage(argc, argv);
+                exit(1);
+            }
+        }
+        else if(strcmp(argv[arg], "--encodings") == 0)
+        {
+            asm_print_encodings(stdout);
+            exit(0);
+        }
         else
         {
             warning("Unknown argument: '%s'\n", argv[arg]);
@@ -109,11 +197,14 @@ int main(int argc, char ** argv)
 
     log("Source File:\t %s\n", cxt -> input_file);
     log("Output File:\t %s\n", cxt -> output_file);
-    cxt -> source = fopen(cxt -> input_file, "r");
+
+    if(strcmp(cxt -> input_file, "-") == 0)
+        cxt -> source = stdin;
+    else
+        cxt -> source = fopen(cxt -> input_file, "r");
     
-    if(ferror(cxt -> source))
+    if(cxt -> source == NULL || ferror(cxt -> source))
     {
-        error("Error code %d opening source file.\n", ferror(cxt -> source));
         fatal("Could not open input file: %s\n", cxt -> input_file);
     }
 
@@ -122,37 +213,150 @@ int main(int argc, char ** argv)
     else if(cxt -> format == BINARY)
         cxt -> binary = fopen(cxt -> output_file, "wb");
 
-    if(ferror(cxt -> binary))
+    if(cxt -> binary == NULL)
+    {
+        fatal("Could not open output file: %s\n", cxt -> output_file);
+    }
+    else if(ferror(cxt -> binary))
     {
         error("Error code %d opening output file.\n", ferror(cxt -> binary));
         fatal("Could not open output file: %s\n", cxt -> output_file);
     }
 
-    cxt -> statements = NULL;
-    cxt -> symbol_table = calloc(1, sizeof(asm_hash_table));
-    asm_hash_table_new(25, cxt -> symbol_table);
+    asm_arena_new(1 << 20, &cxt -> arena);
+    asm_intern_new(&cxt -> arena, &cxt -> symbol_table.names);
 
     int error_count = 0;
+    asm_stats_new(&cxt -> stats);
     
     log("Lexing Input File...\n");
-    asm_lex_token * token_stream = asm_lex_input_file(cxt -> source, &error_count);
+    asm_stats_begin(&cxt -> stats);
+    if(!asm_lex_source_open(cxt -> source, &cxt -> text))
+        fatal("Could not read input file: %s\n", cxt -> input_file);
+    asm_lex_source_tokens(&cxt -> text, &cxt -> arena, &cxt -> symbol_table.names, &cxt -> tokens,
+                          &error_count);
+    asm_stats_end(&cxt -> stats, ASM_PHASE_LEX);
     if(error_count > 0) fatal("%d Lexer Errors\n", error_count);
 
     log("Parsing Token Stream...\n");
-    cxt -> statements   = asm_parse_token_stream(token_stream, cxt -> symbol_table, &error_count);
+    asm_stats_begin(&cxt -> stats);
+    asm_parse_token_stream(&cxt -> tokens, &cxt -> symbol_table, &cxt -> statements, &error_count);
+    asm_stats_end(&cxt -> stats, ASM_PHASE_PARSE);
     if(error_count > 0) fatal("%d Parser Errors\n", error_count);
+
+    // Every pass which moves code is skipped rather than break branches to fixed addresses.
+    if((cxt -> eliminate_dead_code || cxt -> optimise || cxt -> narrow_immediates ||
+        cxt -> relax_branches || cxt -> align_padding > 0) &&
+       asm_count_numeric_branches(&cxt -> statements) > 0)
+    {
+        warning("Ignoring -O, --narrow, --dce, --relax and --align, which would move the code "
+                "these branches jump into.\n");
+        cxt -> eliminate_dead_code = FALSE;
+        cxt -> optimise            = FALSE;
+        cxt -> narrow_immediates   = FALSE;
+        cxt -> relax_branches      = FALSE;
+        cxt -> align_padding       = 0;
+    }
+
+    if(cxt -> eliminate_dead_code)
+    {
+        log("Eliminating Dead Code...\n");
+        asm_stats_begin(&cxt -> stats);
+        asm_eliminate_dead_code(&cxt -> statements, &cxt -> symbol_table);
+        asm_stats_end(&cxt -> stats, ASM_PHASE_DCE);
+    }
+
+    if(cxt -> optimise)
+    {
+        log("Optimising...\n");
+        asm_stats_begin(&cxt -> stats);
+        asm_peephole_optimise(&cxt -> statements, &cxt -> symbol_table);
+        asm_stats_end(&cxt -> stats, ASM_PHASE_OPTIMISE);
+    }
     
+    if(cxt -> narrow_immediates)
+    {
+        log("Narrowing Immediates...\n");
+        asm_stats_begin(&cxt -> stats);
+        asm_narrow_immediates(&cxt -> statements);
+        asm_stats_end(&cxt -> stats, ASM_PHASE_NARROW);
+    }
+
+    if(cxt -> relax_branches)
+    {
+        log("Relaxing Branches...\n");
+        asm_stats_begin(&cxt -> stats);
+        asm_relax_branches(&cxt -> statements, 0, &cxt -> symbol_table);
+        asm_stats_end(&cxt -> stats, ASM_PHASE_RELAX);
+    }
+
+    if(cxt -> align_padding > 0)
+    {
+        log("Aligning Branch Targets...\n");
+        asm_stats_begin(&cxt -> stats);
+        asm_align_branch_targets(&cxt -> statements, 0, &cxt -> symbol_table,
+                                 cxt -> align_padding);
+        asm_stats_end(&cxt -> stats, ASM_PHASE_ALIGN);
+    }
+
     log("Calculating Addresses...\n");
-    error_count = asm_calculate_addresses(cxt -> statements, 0, cxt -> symbol_table);
+    asm_stats_begin(&cxt -> stats);
+    error_count = asm_calculate_addresses(&cxt -> statements, 0, &cxt -> symbol_table);
+    asm_stats_end(&cxt -> stats, ASM_PHASE_ADDRESS);
     if(error_count > 0) fatal("%d Address Calculation Errors\n", error_count);
     
     log("Emitting Binary...\n");
-    error_count = asm_emit_instructions(cxt -> statements, cxt -> binary, cxt -> format);
+    asm_stats_begin(&cxt -> stats);
+    error_count = asm_emit_instructions(&cxt -> statements, cxt -> binary, cxt -> format);
+    fflush(cxt -> binary);
+    asm_stats_end(&cxt -> stats, ASM_PHASE_EMIT);
     if(error_count > 0) fatal("%d Code Emission Errors\n", error_count);
 
+    if(cxt -> lines_file != NULL)
+    {
+        FILE * lines = fopen(cxt -> lines_file, "w");
+        if(lines == NULL)
+            fatal("Could not open line table file: %s\n", cxt -> lines_file);
+        error_count = asm_emit_line_table(&cxt -> statements, cxt -> input_file, lines);
+        fclose(lines);
+        if(error_count > 0) fatal("Could not write line table: %s\n", cxt -> lines_file);
+    }
+
     log("[DONE]\n");
 
-    fclose(cxt -> source);
+    if(cxt -> print_stats || cxt -> stats_file != NULL)
+    {
+        asm_stats * stats = &cxt -> stats;
+        stats -> source_bytes = cxt -> text.length;
+        stats -> tokens       = cxt -> tokens.count;
+        stats -> statements   = cxt -> statements.count;
+        stats -> labels       = cxt -> symbol_table.names.count;
+        if(cxt -> statements.count > 0)
+        {
+            asm_statement * last = &cxt -> statements.items[cxt -> statements.count - 1];
+            stats -> program_bytes = last -> address + last -> size -
+                                     cxt -> statements.items[0].address;
+        }
+    }
+
+    if(cxt -> print_stats)
+        asm_stats_print(&cxt -> stats, stdout);
+
+    if(cxt -> stats_file != NULL)
+    {
+        FILE * json = strcmp(cxt -> stats_file, "-") == 0 ? stdout : fopen(cxt -> stats_file, "w");
+        if(json == NULL)
+            fatal("Could not open statistics file: %s\n", cxt -> stats_file);
+        asm_stats_print_json(&cxt -> stats, json);
+        if(json != stdout)
+            fclose(json);
+    }
+
+    asm_intern_free(&cxt -> symbol_table.names);
+    asm_arena_free(&cxt -> arena);
+    asm_lex_source_close(&cxt -> text);
+    if(cxt -> source != stdin)
+        fclose(cxt -> source);
     fclose(cxt -> binary);
     free(cxt);
 
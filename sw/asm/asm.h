@@ -13,7 +13,12 @@
 
 #include "common.h"
 
+#include "asm_arena.h"
+#include "asm_hash_table.h"
+#include "asm_intern.h"
 #include "asm_lex.h"
+#include "asm_scan.h"
+#include "asm_stats.h"
 
 #ifndef ASM_H
 #define ASM_H
@@ -23,134 +28,148 @@
 #endif
 #define TIM_PRINT_PROMPT "\e[1;36masm>\e[0m "
 
-//! Register arguments structure for opcodes with only a single register argument.
-typedef struct asm_args_reg_single_t{
-    tim_register reg_1;
-} asm_args_reg_single;
-
-//! Register arguments structure for opcodes with two register arguments
-typedef struct asm_args_reg_double_t{
-    tim_register reg_1;
-    tim_register reg_2;
-} asm_args_reg_double;
-
-//! Register arguments structure for opcodes with three register arguments.
-typedef struct asm_args_reg_tripple_t{
-    tim_register reg_1;
-    tim_register reg_2;
-    tim_register reg_3;
-} asm_args_reg_tripple;
-
-//! Register arguments structure for opcodes with two register arguments and an immediate.
-typedef struct asm_args_reg_double_imm_t{
-    tim_register reg_1;
-    tim_register reg_2;
-    tim_immediate immediate;
-} asm_args_reg_double_imm;
-
-//! Register arguments structure for opcodes with one register argument and an immediate.
-typedef struct asm_args_reg_single_imm{
-    tim_register reg_1;
-    tim_immediate immediate;
-} asm_args_reg_single_imm;
-
-//! Register arguments structure for opcodes with one immediate.
-typedef struct asm_args_single_imm{
-    tim_immediate immediate;
-} asm_args_single_imm;
-
-//! Register arguments structure for opcodes with one immediate who's value is a label.
-typedef struct asm_args_single_imm_label{
-    char * label;
-} asm_args_single_imm_label;
-
-//! Union types for all different types of argument/operand combinations used.
-typedef union asm_opcode_args_u{
-    asm_args_reg_single reg;
-    asm_args_reg_double reg_reg;
-    asm_args_reg_tripple reg_reg_reg;
-    asm_args_reg_double_imm reg_reg_immediate;
-    asm_args_reg_single_imm reg_immediate;
-    asm_args_single_imm immediate;
-    asm_args_single_imm_label immediate_label;
-} asm_opcode_args;
+//! Statement flag set while the immediate operand of a statement is a label still to be resolved.
+#define ASM_STATEMENT_RESOLVE_LABEL 0x01
+
+//! Statement flag set on the NOPS a NOP pseudo instruction assembles into.
+#define ASM_STATEMENT_NOP           0x02
+
+//! Statement flag set on alignment padding, a run of NOPS whose length is chosen each time the
+//! program is laid out, up to the immediate operand.
+#define ASM_STATEMENT_PAD           0x04
 
 /*!
 @brief Stores all information on a single ASM instruction.
 @details Stores the opcode and arguments of an ASM instruction. This includes instructions that
 are not actually emitted such as DATA instructions. It also contains the memory address of the
-instruction for any label pointers too it.
+instruction for any label pointers too it. Enumerated fields are stored as single bytes so that a
+whole statement packs into 20 bytes, and operands an instruction does not use are left as zero.
 */
 typedef struct asm_statement_t asm_statement;
 struct asm_statement_t
 {
-    //! The opcode of the instruction.
-    tim_instruction_opcode opcode;
+    //! The opcode of the instruction, a tim_instruction_opcode.
+    unsigned char opcode;
 
     //! The size in bytes of this instruction.
-    tim_instruction_size   size;
-
-    //! The conditional execution code for this statement.
-    tim_condition           condition;
-
-    //! Arguments to the instruction.
-    asm_opcode_args args;
-
-    //! set to true IFF the statement needs an immediate resolving.
-    BOOL label_to_resolve;
+    tim_instruction_size size;
+
+    //! The conditional execution code for this statement, a tim_condition.
+    unsigned char condition;
+
+    //! Any of the ASM_STATEMENT_* flags.
+    unsigned char flags;
+
+    //! The first register operand, a tim_register.
+    unsigned char reg_1;
+    //! The second register operand, a tim_register.
+    unsigned char reg_2;
+    //! The third register operand, a tim_register.
+    unsigned char reg_3;
+    //! Unused, keeps the immediate aligned.
+    unsigned char reserved;
+
+    union
+    {
+        //! The immediate operand of the instruction.
+        tim_immediate immediate;
+        //! The label operand, while ASM_STATEMENT_RESOLVE_LABEL is set.
+        asm_symbol    label;
+    };
 
     //! The address of the instruction in byte-aligned memory.
     unsigned int address;
 
     //! The line number of the source file the instruction came from.
     unsigned int line_number;
-
-    //! The next statement to be executed in the program.
-    asm_statement * next;
-    //! The previously executed statement in the program.
-    asm_statement * prev;
 };
 
+/*!
+@brief A program as a contiguous vector of statements in program order.
+@details The vector is allocated from an arena and grows geometrically. Statements refer to each
+other, and labels to statements, by index.
+*/
+typedef struct asm_statements_t
+{
+    //! The number of statements in the program.
+    unsigned int    count;
+    //! The number of statements the vector has room for.
+    unsigned int    capacity;
+    //! The statements themselves.
+    asm_statement * items;
+    //! The arena which owns the vector.
+    asm_arena     * arena;
+} asm_statements;
+
+//! The number of entries in the asm_encodings table, one per tim_instruction_opcode.
+#define ASM_ENCODING_COUNT (NOT_EMITTED + 1)
+
+//! The encoder may write this many bytes past the end of the program.
+#define ASM_ENCODE_SLACK 3
 
-//! Typedef masking an integer to be the asm hash table key type.
-typedef int asm_hash_key;
+/*!
+@brief Describes how one instruction is laid out in memory.
+@details The instruction word is built left aligned in 32 bits. Each operand, in the order reg_1,
+reg_2, reg_3, immediate, is ANDed with its mask and shifted left into place.
+*/
+typedef struct asm_encoding_t
+{
+    //! The mnemonic of the opcode, as named in hw/instructions.vhdl.
+    const char   * name;
+    //! The length in bytes of the instruction.
+    unsigned char  size;
+    //! How far left each operand is shifted.
+    unsigned char  shift[4];
+    //! The bits of each operand which are encoded. Zero for operands the instruction lacks.
+    unsigned int   mask[4];
+    //! Constant bits set in every instance of the instruction.
+    unsigned int   fixed;
+    //! Mask applied to the opcode and condition bits. Zero for raw data words.
+    unsigned int   header;
+} asm_encoding;
+
+//! The encoding of every instruction, indexed by tim_instruction_opcode.
+extern const asm_encoding asm_encodings[ASM_ENCODING_COUNT];
+
+//! The first of the narrow immediate forms, which are numbered consecutively.
+#define ASM_NARROW_FIRST MOVIS
+
+//! The number of narrow immediate forms.
+#define ASM_NARROW_COUNT (ISUBIS + 1 - ASM_NARROW_FIRST)
+
+//! Returns TRUE if an opcode is one of the narrow immediate forms.
+#define ASM_IS_NARROW(opcode) ((opcode) >= ASM_NARROW_FIRST && \
+                               (opcode) < ASM_NARROW_FIRST + ASM_NARROW_COUNT)
 
-//! Typedef for as asm hash table.
-typedef struct asm_hash_table_bin_t asm_hash_table_bin;
+/*!
+@brief The instruction each narrow immediate form stands for, indexed by its opcode less
+ASM_NARROW_FIRST.
+@details A narrow form behaves exactly as its wide form, with the same immediate zero extended
+from fewer bits, so the simulator decodes it straight to the wide form.
+*/
+extern const tim_instruction_opcode asm_wide_forms[ASM_NARROW_COUNT];
 
 //! Describes whether to output the parsed asm code as binary or ascii code.
 typedef enum asm_format_e {BINARY, ASCII} asm_format;
 
 
 /*!
-@brief Contains a single bin in the hashtable.
-*/
-struct asm_hash_table_bin_t
-{
-    char used;
-    //! The key of the data.
-    char * key;
-    //! Pointer to the data item inserted.
-    void        * data;
-    //! Pointer to the next data item in a linked list.
-    asm_hash_table_bin * next;
-} ;
-
-/*!
-@brief Keeps a key,value pairing of elements. It's a hash table folks.
+@brief Maps every label in a program to the statement it marks.
+@details Label names are interned by the lexer, and the index of the statement each one marks is
+found by indexing targets with its symbol id, so resolving a label reference never hashes or
+compares strings.
 */
-typedef struct asm_hash_table_t
+typedef struct asm_symbol_table_t
 {
-    //! A running count of the number of elements in the hashtable.
-    int         element_count;
+    //! The interned name of every label seen in the program, declared or not.
+    asm_intern_pool   names;
 
-    //! The current size of the hash tables internal data structure.
-    int         current_size;
+    //! The index of the statement following each label's declaration, indexed by symbol id. A
+    //! label at the very end of the program holds the statement count. ASM_SYMBOL_NONE if the
+    //! label is referenced but never declared.
+    unsigned int    * targets;
 
-    //! Holds the internal data.
-    asm_hash_table_bin * buckets;
-
-} asm_hash_table;
+} asm_symbol_table;
 
 /*!
 @brief Contains all information for the program in a format that can be easily passed around.
@@ -167,79 +186,177 @@ typedef struct asm_context_t
     
     //! The opened source file stream.
     FILE * source;
+    //! The entire text of the source file, mapped or read into memory.
+    asm_lex_source text;
     //! THe opened output file stream.
     FILE * binary;
 
-    //! The asm program in linked list form.
-    asm_statement * statements;
+    //! The asm program as a vector of statements.
+    asm_statements statements;
     //! The tokens stream parsed from the raw file.
-    asm_lex_token * token_stream;
+    asm_lex_tokens tokens;
+
+    //! Owns the token stream and any other bulk allocations made while assembling.
+    asm_arena arena;
 
     //! Stores all of the (label, asm_statement) pairs for the program where the labels are
     //! all of the jump target labels.
-    asm_hash_table * symbol_table;
+    asm_symbol_table symbol_table;
+
+    //! Print the timing and memory statistics of each phase once assembly is done?
+    BOOL print_stats;
+    //! Where to write the statistics as JSON, or NULL if they are not wanted as JSON.
+    char * stats_file;
+    //! The timing and memory statistics of each phase.
+    asm_stats stats;
+
+    //! Where to write the address to source line table, or NULL if it is not wanted.
+    char * lines_file;
+
+    //! Shorten branches to labels in reach to their PC relative forms?
+    BOOL relax_branches;
+
+    //! Run the peephole optimiser over the parsed program?
+    BOOL optimise;
+
+    //! Encode immediates which fit in the narrow MOV and ALU forms?
+    BOOL narrow_immediates;
+
+    //! The most padding to word align each branch target with, or zero to leave them be.
+    unsigned int align_padding;
+
+    //! Remove statements which can never be reached from the start of the program?
+    BOOL eliminate_dead_code;
 
 } asm_context;
 
 
 /*!
 @brief Responsible for writing all statements to the supplied file.
-@param statements - Linked list of statements to emit binary code for.
+@param statements - The program to emit binary code for.
 @param file - The file to write the code too.
 @param format - Whether to emit the code as raw bytes or ascii binary strings. This is used to
 feed the VHDL testbenches.
 @returns An integer representing the number of errors encountered, if any.
 */
-int asm_emit_instructions(asm_statement * statements, FILE * file, asm_format format);
+int asm_emit_instructions(asm_statements * statements, FILE * file, asm_format format);
 
 /*!
-@brief Assigns addresses to each statement so that jumps and calls can be calculated.
-@param statements - head of a linked list of asm statements.
-@param base_address - Where the addresses of the program should start.
-@returns The number of errors encountered such as missing labels. 0 means everything was okay.
+@brief Writes the address, length and source line number of every statement to a text file, so
+tools running the program can map addresses back to the source.
+@param statements - The program. Addresses must already have been calculated.
+@param source - The name of the source file, as given to the assembler.
+@param file - The file to write the table to.
+@returns An integer representing the number of errors encountered, if any.
+*/
+int asm_emit_line_table(asm_statements * statements, const char * source, FILE * file);
+
+/*!
+@brief Encodes a whole program into a buffer of machine code.
+@param statements - The program to encode. Addresses must already have been calculated.
+@param buffer - Where to write the machine code. It must have room for the whole program plus
+ASM_ENCODE_SLACK bytes.
+@returns The number of bytes of machine code written.
 */
-int asm_calculate_addresses(asm_statement * statements, unsigned int base_address, asm_hash_table * labels);
+size_t asm_encode_statements(asm_statements * statements, unsigned char * buffer);
 
+/*!
+@brief Prints the encoding table, one instruction per line, as its name, opcode value and length
+in bytes. Used to check the table against hw/instructions.vhdl.
+@param file - Where to print the table.
+*/
+void asm_print_encodings(FILE * file);
 
 /*!
-@brief Top function to trigger the parsing of an input source file.
-@details Takes an opened for reading text file and parses it into a series of asm statements,
-filling out their arguments and parameters as it goes. It also populates the hash-table of
-labels used for calculating jump target addresses.
-@see The ISA Specification contains more information on the grammar of the assembly language.
-@param [inout] labels - Hashtable which is apopulated with any encountered labels.
-@param [inout] errors - Pointer to a error counter. If the counter has the same value before
-and after being called, all of the parsing was a success.
-@returns The parsed statements as a doublely linked list.
+@brief Runs the peephole optimiser over a parsed program, then reports how many times each rule
+matched and the bytes it saved.
+@details Removes moves of a register to itself, NOPs, jumps to the next statement and PUSH then
+POP of the same register, and turns PUSH then POP of another register into a MOV. Rules never
+match across a label.
+@param statements - The program to optimise. Label operands must not yet have been resolved.
+@param labels - The symbol table populated by the parser, whose targets are moved to match.
+@returns The number of bytes saved.
+*/
+unsigned int asm_peephole_optimise(asm_statements * statements, asm_symbol_table * labels);
+
+/*!
+@brief Gives every MOV and ALU instruction with an immediate operand the shortest encoding its
+operands fit, then reports how many instructions of each narrow form were chosen.
+@param statements - The program to narrow. Addresses must not yet have been assigned.
+@returns The number of bytes saved.
+*/
+unsigned int asm_narrow_immediates(asm_statements * statements);
+
+/*!
+@brief Warns about every JUMP and CALL whose target is a plain number rather than a label.
+@param statements - The program to check.
+@returns The number of JUMPs and CALLs with numeric targets.
+*/
+unsigned int asm_count_numeric_branches(asm_statements * statements);
+
+/*!
+@brief Removes every statement which control can never reach from the start of the program,
+then reports how many statements and bytes went.
+@details Control is followed through fall-through, conditional execution and JUMPs and CALLs to
+labels. DATA statements are always kept, and labels used as DATA operands are reachable. The
+program is left as it is if a JUMP or CALL is to a plain number, or a JUMPR or CALLR is used with
+no label taken by DATA.
+@param statements - The program to prune. Label operands must not yet have been resolved.
+@param labels - The symbol table populated by the parser, whose targets are moved to match.
+@returns The number of bytes removed.
 */
-asm_statement * asm_parse_token_stream(asm_lex_token * tokens, asm_hash_table * labels, int * errors);
+unsigned int asm_eliminate_dead_code(asm_statements * statements, asm_symbol_table * labels);
 
+/*!
+@brief Gives every JUMP and CALL to a label the shortest encoding which reaches it, the two byte
+PC relative JUMPS and CALLS where they can, laying out the program again until it settles.
+@param statements - The program to relax. Label operands must not yet have been resolved.
+@param base_address - Where the addresses of the program should start.
+@param labels - The symbol table populated by the parser.
+@returns The number of branches left in their short form.
+*/
+unsigned int asm_relax_branches(asm_statements * statements, unsigned int base_address,
+                                asm_symbol_table * labels);
 
 /*!
-@brief Inserts an element into the hash table associated with the provided key.
-@param table - Pointer to the hash table to insert into.
-@param key - The key to the data.
-@param data - Pointer to the data the table will contain.
-@returns a status code. Zero if it worked, otherwise some integer.
-@todo Check that the key will fit!!
+@brief Pads the statements which JUMPs and CALLs reach so they start on a word boundary, where it
+takes no more than a given number of bytes, then reports the padding added.
+@param statements - The program to align. Label operands must not yet have been resolved.
+@param base_address - Where the addresses of the program should start.
+@param labels - The symbol table populated by the parser, whose targets are moved to match.
+@param max_padding - The most bytes of padding to put before any one target, from 1 to 3.
+@returns The number of bytes of padding added.
 */
-int asm_hash_table_insert(asm_hash_table * table, char * key, void * data);
+unsigned int asm_align_branch_targets(asm_statements * statements, unsigned int base_address,
+                                      asm_symbol_table * labels, unsigned int max_padding);
 
 /*!
-@brief Creates and returns a new pointer to a hash table.
-@param initial_size - The initial size of the hash table's internal data structure.
-@param tr - The newly initialised and returned hashtable. Memory space should already be declared.
+@brief Assigns addresses to each statement so that jumps and calls can be calculated.
+@param statements - The program to assign addresses to.
+@param base_address - Where the addresses of the program should start.
+@param labels - The symbol table populated by the parser.
+@returns The number of errors encountered such as missing labels. 0 means everything was okay.
 */
-void asm_hash_table_new(int initial_size, asm_hash_table * tr);
+int asm_calculate_addresses(asm_statements * statements, unsigned int base_address, asm_symbol_table * labels);
+
 
 /*!
-@brief Returns a pointer to the data stored in a hash table with the given key or NULL if no such
-       element exists.
-@param table - The table to fetch the data from.
-@param strkey - The key to the data to fetch.
-@todo Make sure the key fits into the table.
+@brief Top function to trigger the parsing of an input source file.
+@details Takes a lexed token stream and parses it into a series of asm statements,
+filling out their arguments and parameters as it goes. It also populates the symbol table of
+labels used for calculating jump target addresses.
+@see The ISA Specification contains more information on the grammar of the assembly language.
+@param tokens - Stream of tokens to parse into a program IR.
+@param [inout] labels - Symbol table whose names were interned by the lexer. Its targets array
+is allocated and populated with the declaration of every encountered label.
+@param [out] statements - The parsed program. Memory space should already be declared. The vector
+is allocated from the same arena as the tokens.
+@param [inout] errors - Pointer to a error counter. If the counter has the same value before
+and after being called, all of the parsing was a success.
 */
-void * asm_hash_table_get(asm_hash_table * table, char * strkey);
+void asm_parse_token_stream(asm_lex_tokens * tokens, asm_symbol_table * labels,
+                            asm_statements * statements, int * errors);
+
 
 #endif
 
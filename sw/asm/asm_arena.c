@@ -0,0 +1,149 @@
+/*!
+@ingroup sw-asm
+@{
+@file asm_arena.c
+@brief Contains all functions that operate on the asm_arena region allocator.
+*/
+
+#include "asm.h"
+
+//! Rounds a size up to the arena alignment.
+#define ASM_ARENA_ROUND(x) (((x) + ASM_ARENA_ALIGNMENT - 1) & ~((size_t)ASM_ARENA_ALIGNMENT - 1))
+
+//! The space taken at the head of every block by the block header.
+#define ASM_ARENA_HEADER ASM_ARENA_ROUND(sizeof(asm_arena_block))
+
+/*!
+@brief Returns a pointer to the first usable byte of a block.
+*/
+static char * asm_arena_block_data(asm_arena_block * block)
+{
+    return (char*)block + ASM_ARENA_HEADER;
+}
+
+/*!
+@brief Initialises a new, empty arena.
+@param block_size - The minimum size of the blocks the arena requests from the system.
+@param tr - The newly initialised arena. Memory space should already be declared.
+*/
+void asm_arena_new(size_t block_size, asm_arena * tr)
+{
+    tr -> blocks         = NULL;
+    tr -> block_size     = block_size;
+    tr -> block_count    = 0;
+    tr -> bytes_reserved = 0;
+}
+
+/*!
+@brief Allocates memory from an arena. The memory is not zeroed.
+@param arena - The arena to allocate from.
+@param size - The number of bytes to allocate.
+@returns A pointer to the allocated memory, aligned to ASM_ARENA_ALIGNMENT bytes.
+*/
+void * asm_arena_alloc(asm_arena * arena, size_t size)
+{
+    asm_arena_block * block = arena -> blocks;
+    size = ASM_ARENA_ROUND(size);
+
+    if(block == NULL || block -> size - block -> used < size)
+    {
+        size_t block_size = arena -> block_size;
+        if(size > block_size)
+            block_size = size;
+
+        block = malloc(ASM_ARENA_HEADER + block_size);
+        if(block == NULL)
+            fatal("Could not allocate %lu bytes for the arena.\n", (unsigned long)block_size);
+
+        block -> next = arena -> blocks;
+        block -> size = block_size;
+        block -> used = 0;
+
+        arena -> blocks          = block;
+        arena -> block_count    += 1;
+        arena -> bytes_reserved += ASM_ARENA_HEADER + block_size;
+    }
+
+    void * tr = asm_arena_block_data(block) + block -> used;
+    block -> used += size;
+    ASM_STATS_ALLOCATED(size);
+    return tr;
+}
+
+/*!
+@brief Grows an allocation previously returned by asm_arena_alloc.
+@param arena - The arena the allocation came from.
+@param old - The existing allocation, or NULL.
+@param old_size - The size in bytes of the existing allocation.
+@param new_size - The required size in bytes.
+@returns A pointer to the grown allocation.
+*/
+void * asm_arena_grow(asm_arena * arena, void * old, size_t old_size, size_t new_size)
+{
+    asm_arena_block * block = arena -> blocks;
+
+    if(old != NULL && block != NULL)
+    {
+        size_t old_rounded = ASM_ARENA_ROUND(old_size);
+        size_t new_rounded = ASM_ARENA_ROUND(new_size);
+        char * block_top   = asm_arena_block_data(block) + block -> used;
+
+        if((char*)old + old_rounded == block_top &&
+           block -> used - old_rounded + new_rounded <= block -> size)
+        {
+            block -> used = block -> used - old_rounded + new_rounded;
+            ASM_STATS_ALLOCATED(new_rounded - old_rounded);
+            return old;
+        }
+    }
+
+    // An allocation that has a block to itself, as large grown arrays do, is resized with realloc
+    // rather than copied so that the old copy does not stay resident until the arena is freed.
+    if(old != NULL)
+    {
+        size_t old_rounded = ASM_ARENA_ROUND(old_size);
+        size_t new_rounded = ASM_ARENA_ROUND(new_size);
+        asm_arena_block ** link = &arena -> blocks;
+
+        while(*link != NULL && asm_arena_block_data(*link) != (char*)old)
+            link = &(*link) -> next;
+
+        if(*link != NULL && (*link) -> used == old_rounded && old_rounded >= arena -> block_size)
+        {
+            asm_arena_block * grown = realloc(*link, ASM_ARENA_HEADER + new_rounded);
+            if(grown == NULL)
+                fatal("Could not allocate %lu bytes for the arena.\n", (unsigned long)new_rounded);
+
+            arena -> bytes_reserved += new_rounded - grown -> size;
+            grown -> size = new_rounded;
+            grown -> used = new_rounded;
+            *link = grown;
+            ASM_STATS_ALLOCATED(new_rounded - old_rounded);
+            return asm_arena_block_data(grown);
+        }
+    }
+
+    void * tr = asm_arena_alloc(arena, new_size);
+    if(old != NULL)
+        memcpy(tr, old, old_size);
+    return tr;
+}
+
+/*!
+@brief Releases all memory held by an arena. Every allocation made from it becomes invalid.
+@param arena - The arena to free.
+*/
+void asm_arena_free(asm_arena * arena)
+{
+    asm_arena_block * walker = arena -> blocks;
+    while(walker != NULL)
+    {
+        asm_arena_block * next = walker -> next;
+        free(walker);
+        walker = next;
+    }
+
+    arena -> blocks = NULL;
+}
+
+//! }@
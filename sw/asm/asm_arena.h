@@ -0,0 +1,77 @@
+/*!
+@ingroup sw-asm
+@{
+@file asm_arena.h
+@brief Header file for the region based memory allocator used by the assembler.
+*/
+
+#ifndef ASM_ARENA_H
+#define ASM_ARENA_H
+
+//! The alignment in bytes of every allocation made from an arena.
+#define ASM_ARENA_ALIGNMENT 16
+
+//! Typedef for a single block of memory owned by an arena.
+typedef struct asm_arena_block_t asm_arena_block;
+struct asm_arena_block_t
+{
+    //! The previously allocated block, or NULL if this is the first.
+    asm_arena_block * next;
+    //! The number of usable bytes in this block.
+    size_t            size;
+    //! The number of bytes of this block handed out so far.
+    size_t            used;
+};
+
+/*!
+@brief A region allocator. Memory is handed out from large blocks and is only ever released all at
+once when the arena is freed.
+*/
+typedef struct asm_arena_t
+{
+    //! The block currently being allocated from, at the head of a list of all blocks.
+    asm_arena_block * blocks;
+    //! The minimum size in bytes of each new block.
+    size_t            block_size;
+    //! The number of blocks requested from the system allocator so far.
+    unsigned int      block_count;
+    //! The total number of bytes requested from the system allocator so far.
+    size_t            bytes_reserved;
+} asm_arena;
+
+/*!
+@brief Initialises a new, empty arena.
+@param block_size - The minimum size of the blocks the arena requests from the system.
+@param tr - The newly initialised arena. Memory space should already be declared.
+*/
+void asm_arena_new(size_t block_size, asm_arena * tr);
+
+/*!
+@brief Allocates memory from an arena. The memory is not zeroed.
+@param arena - The arena to allocate from.
+@param size - The number of bytes to allocate.
+@returns A pointer to the allocated memory, aligned to ASM_ARENA_ALIGNMENT bytes.
+*/
+void * asm_arena_alloc(asm_arena * arena, size_t size);
+
+/*!
+@brief Grows an allocation previously returned by asm_arena_alloc.
+@details If the allocation is the most recent one in the current block and there is room, it is
+extended in place. Otherwise a new allocation is made and the old contents copied into it.
+@param arena - The arena the allocation came from.
+@param old - The existing allocation, or NULL.
+@param old_size - The size in bytes of the existing allocation.
+@param new_size - The required size in bytes.
+@returns A pointer to the grown allocation.
+*/
+void * asm_arena_grow(asm_arena * arena, void * old, size_t old_size, size_t new_size);
+
+/*!
+@brief Releases all memory held by an arena. Every allocation made from it becomes invalid.
+@param arena - The arena to free.
+*/
+void asm_arena_free(asm_arena * arena);
+
+#endif
+
+//! }@
@@ -7,58 +7,492 @@
 
 #include "asm.h"
 
+//! The furthest back a JUMPS or CALLS reaches, from the address of the next instruction.
+#define ASM_SHORT_BRANCH_MIN (-128)
+//! The furthest forward a JUMPS or CALLS reaches, from the address of the next instruction.
+#define ASM_SHORT_BRANCH_MAX 127
+
+//! The size in bytes of the aligned words the core fetches instructions in.
+#define ASM_FETCH_WORD 4
+
+/*!
+@brief Lays out the statements one after another from an address.
+@details Alignment padding takes whatever its address needs to reach the next word boundary, or
+nothing if that is more than it is allowed.
+@returns The address following the last statement.
+*/
+static unsigned int asm_assign_addresses(asm_statements * statements, unsigned int base_address)
+{
+    unsigned int current_address = base_address;
+    unsigned int i;
+
+    for(i = 0; i < statements -> count; i ++)
+    {
+        asm_statement * s = &statements -> items[i];
+
+        s -> address = current_address;
+        if(s -> flags & ASM_STATEMENT_PAD)
+        {
+            unsigned int padding = (ASM_FETCH_WORD - current_address % ASM_FETCH_WORD) %
+                                   ASM_FETCH_WORD;
+            s -> size = padding <= (unsigned int)s -> immediate ? padding : 0;
+        }
+        current_address += s -> size;
+    }
+    return current_address;
+}
+
+/*!
+@brief Returns the address of the statement a label marks, where a label after the last
+statement marks the end of the program.
+*/
+static inline unsigned int asm_target_address(asm_statements * statements, unsigned int target,
+                                              unsigned int end_address)
+{
+    return target < statements -> count ? statements -> items[target].address : end_address;
+}
+
+/*!
+@brief Returns TRUE if a JUMPS or CALLS at an address, of the given size, can reach a target.
+*/
+static inline BOOL asm_short_branch_reaches(unsigned int address, unsigned int size,
+                                            unsigned int target)
+{
+    int offset = (int)(target - (address + size));
+    return offset >= ASM_SHORT_BRANCH_MIN && offset <= ASM_SHORT_BRANCH_MAX;
+}
+
+/*!
+@brief Lays out a program, then grows each JUMPS and CALLS which cannot reach its label to the
+absolute JUMPI or CALLI, over and over until a layout needs no more to grow.
+@param statements - The program to lay out. Label operands must not yet have been resolved.
+@param base_address - Where the addresses of the program should start.
+@param labels - The symbol table populated by the parser.
+@param [out] grown - The number of branches grown.
+@returns The number of layouts it took.
+*/
+static unsigned int asm_grow_short_branches(asm_statements * statements, unsigned int base_address,
+                                            asm_symbol_table * labels, unsigned int * grown)
+{
+    unsigned int passes = 0;
+    unsigned int i;
+    BOOL         changed;
+
+    *grown = 0;
+    do
+    {
+        unsigned int end_address = asm_assign_addresses(statements, base_address);
+
+        changed = FALSE;
+        passes ++;
+        for(i = 0; i < statements -> count; i ++)
+        {
+            asm_statement * s = &statements -> items[i];
+
+            if(s -> opcode != JUMPS && s -> opcode != CALLS)
+                continue;
+
+            unsigned int target = asm_target_address(statements, labels -> targets[s -> label],
+                                                     end_address);
+            if(!asm_short_branch_reaches(s -> address, s -> size, target))
+            {
+                s -> opcode = s -> opcode == JUMPS ? JUMPI : CALLI;
+                s -> size   = asm_encodings[s -> opcode].size;
+                changed     = TRUE;
+                (*grown) ++;
+            }
+        }
+    } while(changed);
+
+    return passes;
+}
+
+/*!
+@brief Gives every JUMP and CALL to a label the shortest encoding which reaches it.
+@details Every such branch starts out as a two byte, PC relative JUMPS or CALLS. The program is
+then laid out and each short branch which cannot reach its label grows to the four byte absolute
+JUMPI or CALLI, over and over until a layout needs no more to grow. Branches only ever grow, so
+this always stops, and shrinking one never moves a label out of reach of another.
+@param statements - The program to relax. Label operands must not yet have been resolved.
+@param base_address - Where the addresses of the program should start.
+@param labels - The symbol table populated by the parser.
+@returns The number of branches left in their short form.
+*/
+unsigned int asm_relax_branches(asm_statements * statements, unsigned int base_address,
+                                asm_symbol_table * labels)
+{
+    unsigned int candidates = 0;
+    unsigned int shortened  = 0;
+    unsigned int passes     = 0;
+    unsigned int saved      = 0;
+    unsigned int grown      = 0;
+    unsigned int i;
+
+    for(i = 0; i < statements -> count; i ++)
+    {
+        asm_statement * s = &statements -> items[i];
+
+        // Labels which are never declared are reported when addresses are calculated.
+        if(!(s -> flags & ASM_STATEMENT_RESOLVE_LABEL) ||
+           (s -> opcode != JUMPI && s -> opcode != CALLI) ||
+           labels -> targets[s -> label] == ASM_SYMBOL_NONE)
+            continue;
+
+        s -> opcode = s -> opcode == JUMPI ? JUMPS : CALLS;
+        s -> size   = asm_encodings[s -> opcode].size;
+        candidates ++;
+    }
+
+    passes = asm_grow_short_branches(statements, base_address, labels, &grown);
+
+    for(i = 0; i < statements -> count; i ++)
+    {
+        asm_statement * s = &statements -> items[i];
+        if(s -> opcode == JUMPS || s -> opcode == CALLS)
+        {
+            shortened ++;
+            saved += asm_encodings[s -> opcode == JUMPS ? JUMPI : CALLI].size - s -> size;
+        }
+    }
+
+    log("Relaxed %u of %u label branches, saving %u bytes in %u passes\n", shortened, candidates,
+        saved, passes);
+    return shortened;
+}
+
+/*!
+@brief Pads the statements which JUMPs and CALLs reach so they start on a word boundary, where it
+takes no more than a given number of bytes, then reports the padding added.
+@details The fetcher loads aligned words, so a branch target which starts part way through a word
+costs a bus transaction for fewer than four bytes of it. There is no profile to say which targets
+are hot, so every statement a JUMP or CALL reaches is treated as one. A padding statement is put
+before each target, behind any labels on it so that the labels still mark the target itself, and
+is given its length each time the program is laid out. Padding moves everything after it, which may
+leave a JUMPS or CALLS out of reach, so they are grown until the layout settles as they are by
+asm_relax_branches. The padding is executed when control falls through into a target, so
+max_padding trades the size and time spent on it against how many targets end up aligned.
+@param statements - The program to align. Label operands must not yet have been resolved.
+@param base_address - Where the addresses of the program should start.
+@param labels - The symbol table populated by the parser, whose targets are moved to match.
+@param max_padding - The most bytes of padding to put before any one target, from 1 to 3.
+@returns The number of bytes of padding added.
+*/
+unsigned int asm_align_branch_targets(asm_statements * statements, unsigned int base_address,
+                                      asm_symbol_table * labels, unsigned int max_padding)
+{
+    unsigned int   count   = statements -> count;
+    unsigned int   targets = 0;
+    unsigned int   aligned = 0;
+    unsigned int   padded  = 0;
+    unsigned int   padding = 0;
+    unsigned int   grown   = 0;
+    unsigned int   i, j;
+
+    // Which statements are reached by a branch, and where each statement ends up.
+    unsigned char * targeted = calloc(count + 1, 1);
+    unsigned int  * moved    = malloc((count + 1) * sizeof(unsigned int));
+    if(targeted == NULL || moved == NULL)
+    {
+        warning("Could not allocate the alignment tables, skipping alignment.\n");
+        free(targeted);
+        free(moved);
+        return 0;
+    }
+
+    for(i = 0; i < count; i ++)
+    {
+        asm_statement * s = &statements -> items[i];
+
+        if(!(s -> flags & ASM_STATEMENT_RESOLVE_LABEL) || s -> opcode == NOT_EMITTED ||
+           labels -> targets[s -> label] == ASM_SYMBOL_NONE)
+            continue;
+
+        unsigned int target = labels -> targets[s -> label];
+        targets  += target < count && !targeted[target];
+        targeted[target] = target < count;
+    }
+
+    if(statements -> count + targets > statements -> capacity)
+    {
+        statements -> items = asm_arena_grow(statements -> arena, statements -> items,
+                                             statements -> capacity * sizeof(asm_statement),
+                                             (count + targets) * sizeof(asm_statement));
+        statements -> capacity = count + targets;
+    }
+
+    // Spread the program out from the back, putting padding before each target as it goes.
+    j = count + targets;
+    moved[count] = j;
+    for(i = count; i -- > 0;)
+    {
+        statements -> items[-- j] = statements -> items[i];
+        moved[i] = j;
+        if(targeted[i])
+        {
+            asm_statement * pad = &statements -> items[-- j];
+            memset(pad, 0, sizeof(asm_statement));
+            pad -> opcode      = NOPS;
+            pad -> flags       = ASM_STATEMENT_PAD;
+            pad -> immediate   = max_padding;
+            pad -> line_number = statements -> items[j + 1].line_number;
+        }
+    }
+    statements -> count = count + targets;
+
+    for(i = 0; i < labels -> names.count; i ++)
+        if(labels -> targets[i] != ASM_SYMBOL_NONE)
+            labels -> targets[i] = moved[labels -> targets[i]];
+
+    free(targeted);
+    free(moved);
+
+    asm_grow_short_branches(statements, base_address, labels, &grown);
+
+    for(i = 0; i < statements -> count; i ++)
+    {
+        asm_statement * s = &statements -> items[i];
+
+        if(!(s -> flags & ASM_STATEMENT_PAD))
+            continue;
+        aligned += (statements -> items[i + 1].address % ASM_FETCH_WORD) == 0;
+        padded  += s -> size > 0;
+        padding += s -> size;
+    }
+
+    log("Aligned %u of %u branch targets, padding %u with %u bytes\n", aligned, targets, padded,
+        padding);
+    if(grown > 0)
+        log("Grew %u short branches put out of reach by the padding\n", grown);
+    return padding;
+}
+
+/*!
+@brief Returns TRUE if a statement is a JUMP or CALL to an address given as a plain number.
+*/
+static inline BOOL asm_numeric_branch(asm_statement * s)
+{
+    return (s -> opcode == JUMPI || s -> opcode == CALLI) &&
+           !(s -> flags & ASM_STATEMENT_RESOLVE_LABEL);
+}
+
+/*!
+@brief Warns about every JUMP and CALL whose target is a plain number rather than a label.
+@details Passes which add, remove or resize statements move code away from the numbers such
+branches were written against, so they must not run on a program which has any.
+@param statements - The program to check.
+@returns The number of JUMPs and CALLs with numeric targets.
+*/
+unsigned int asm_count_numeric_branches(asm_statements * statements)
+{
+    unsigned int count = 0;
+    unsigned int i;
+
+    for(i = 0; i < statements -> count; i ++)
+    {
+        asm_statement * s = &statements -> items[i];
+        if(!asm_numeric_branch(s))
+            continue;
+        warning("Line %u: %s to the numeric address 0x%x.\n", s -> line_number,
+                asm_encodings[s -> opcode].name, (unsigned int)s -> immediate);
+        count ++;
+    }
+    return count;
+}
+
+/*!
+@brief Returns TRUE if control never passes from a statement to the one after it.
+*/
+static inline BOOL asm_ends_flow(asm_statement * s)
+{
+    if(s -> condition != ALWAYS)
+        return FALSE;
+    switch(s -> opcode)
+    {
+        case JUMPI: case JUMPR: case JUMPS: case RETURN: case HALT:
+            return TRUE;
+        default:
+            return FALSE;
+    }
+}
+
+/*!
+@brief Removes every statement which control can never reach from the start of the program,
+then reports how many statements and bytes went.
+@details The control flow graph is walked straight from the statements. Each statement leads on to
+the one after it unless it is an unconditional JUMP, RETURN or HALT, and a JUMP or CALL to a label
+also leads to the statement the label marks. A conditional statement always leads on to the next
+one, whether or not it runs. DATA is never executed, so every DATA statement is kept, and a label
+used as a DATA operand is reachable, since its address is taken and may be jumped or called to
+through a register. JUMPR and CALLR are assumed to only reach labels taken in this way. Where
+control cannot be followed, because a JUMP or CALL is to a plain number, or a JUMPR or CALLR is
+used with no label taken by DATA, the program is left as it is.
+@param statements - The program to prune. Label operands must not yet have been resolved.
+@param labels - The symbol table populated by the parser, whose targets are moved to match.
+@returns The number of bytes removed.
+*/
+unsigned int asm_eliminate_dead_code(asm_statements * statements, asm_symbol_table * labels)
+{
+    unsigned int   count    = statements -> count;
+    unsigned int   pending  = 0;
+    unsigned int   kept     = 0;
+    unsigned int   removed  = 0;
+    unsigned int   numeric  = 0;
+    unsigned int   indirect = 0;
+    unsigned int   taken    = 0;
+    unsigned int   i;
+
+    // Find the branches whose targets cannot be known before addresses are assigned.
+    for(i = 0; i < count; i ++)
+    {
+        asm_statement * s = &statements -> items[i];
+        numeric  += asm_numeric_branch(s);
+        indirect += s -> opcode == JUMPR || s -> opcode == CALLR;
+        taken    += s -> opcode == NOT_EMITTED && (s -> flags & ASM_STATEMENT_RESOLVE_LABEL);
+    }
+
+    if(numeric > 0 || (indirect > 0 && taken == 0))
+    {
+        warning("Branches to addresses which are not labels cannot be followed, "
+                "keeping unreachable code.\n");
+        return 0;
+    }
+
+    // Which statements are reachable, those waiting to be walked from, and where each one ends up.
+    unsigned char * reached = calloc(count + 1, 1);
+    unsigned int  * stack   = malloc((count + 1) * sizeof(unsigned int));
+    unsigned int  * moved   = malloc((count + 1) * sizeof(unsigned int));
+    if(reached == NULL || stack == NULL || moved == NULL)
+    {
+        warning("Could not allocate the control flow tables, keeping unreachable code.\n");
+        free(reached);
+        free(stack);
+        free(moved);
+        return 0;
+    }
+
+    // Statements are marked as they are pushed, so each is pushed at most once.
+    for(i = 0; i < count; i ++)
+    {
+        if(i == 0 || statements -> items[i].opcode == NOT_EMITTED)
+        {
+            reached[i] = TRUE;
+            stack[pending ++] = i;
+        }
+    }
+
+    while(pending > 0)
+    {
+        unsigned int    at = stack[-- pending];
+        asm_statement * s  = &statements -> items[at];
+
+        if((s -> flags & ASM_STATEMENT_RESOLVE_LABEL) &&
+           labels -> targets[s -> label] != ASM_SYMBOL_NONE)
+        {
+            unsigned int target = labels -> targets[s -> label];
+            if(target < count && !reached[target])
+            {
+                reached[target] = TRUE;
+                stack[pending ++] = target;
+            }
+        }
+
+        // DATA is never executed, so nothing falls through from it.
+        if(s -> opcode != NOT_EMITTED && !asm_ends_flow(s) && at + 1 < count && !reached[at + 1])
+        {
+            reached[at + 1] = TRUE;
+            stack[pending ++] = at + 1;
+        }
+    }
+
+    for(i = 0; i < count; i ++)
+    {
+        moved[i] = kept;
+        if(reached[i])
+            statements -> items[kept ++] = statements -> items[i];
+        else
+            removed += statements -> items[i].size;
+    }
+    moved[count] = kept;
+
+    // A label on a removed statement now marks whatever follows it.
+    for(i = 0; i < labels -> names.count; i ++)
+        if(labels -> targets[i] != ASM_SYMBOL_NONE)
+            labels -> targets[i] = moved[labels -> targets[i]];
+    statements -> count = kept;
+
+    free(reached);
+    free(stack);
+    free(moved);
+
+    log("Removed %u of %u statements as unreachable, %u bytes\n", count - kept, count, removed);
+    return removed;
+}
+
 /*!
 @brief Assigns addresses to each statement so that jumps and calls can be calculated.
-@param statements - head of a linked list of asm statements.
+@param statements - The program to assign addresses to.
 @param base_address - Where the addresses of the program should start.
+@param labels - The symbol table populated by the parser.
 @returns The number of errors encountered such as missing labels. 0 means everything was okay.
 */
-int asm_calculate_addresses(asm_statement * statements, unsigned int base_address, asm_hash_table * labels)
+int asm_calculate_addresses(asm_statements * statements, unsigned int base_address, asm_symbol_table * labels)
 {
     int errors = 0;
-    unsigned int current_address = base_address;
+    unsigned int i;
 
     // First walk over the program assigning addresses to the statements.
-    asm_statement * walker = statements;
-    while(walker != NULL)
-    {
-        walker -> address = current_address;
-        current_address += walker -> size;
-        walker = walker -> next;
-    }
-    
+    unsigned int current_address = asm_assign_addresses(statements, base_address);
+
     // Now walk over the program replacing jump label targets with the proper immediate
     // values.
-    walker = statements;
-    while(walker != NULL)
+    for(i = 0; i < statements -> count; i ++)
     {
-        if(walker -> label_to_resolve)
+        asm_statement * walker = &statements -> items[i];
+
+        if(walker -> flags & ASM_STATEMENT_RESOLVE_LABEL)
         {
-            asm_statement * target = NULL;
+            unsigned int target = ASM_SYMBOL_NONE;
 
             switch(walker -> opcode)
             {
                 case(CALLI):
                 case(JUMPI):
+                case(CALLS):
+                case(JUMPS):
                 case(NOT_EMITTED):
-                    target = asm_hash_table_get(labels, walker -> args.immediate_label.label);
-                    if(target == NULL)
+                    target = labels -> targets[walker -> label];
+                    if(target == ASM_SYMBOL_NONE)
                     {
-                        error("Could not find label declaration for %s\n", walker -> args.immediate_label.label);
+                        error("Could not find label declaration for %s\n",
+                              asm_intern_name(&labels -> names, walker -> label));
                         return errors + 1;
                     }
-                    target = target -> next;
                     break;
                 default:
                     error("Cannot resolve label for instruction opcode %d\n", walker -> opcode);
-                    break;
+                    errors += 1;
+                    continue;
             }
 
-            unsigned int address_difference = target -> address;
+            // A label after the last statement refers to the end of the program.
+            unsigned int address_difference = asm_target_address(statements, target,
+                                                                 current_address);
             //log("Calculated jump to %d\n", address_difference);
-            walker -> args.immediate.immediate = address_difference;
+            if(walker -> opcode == JUMPS || walker -> opcode == CALLS)
+            {
+                // Short branches are relative to the instruction after them.
+                if(!asm_short_branch_reaches(walker -> address, walker -> size, address_difference))
+                {
+                    error("Short branch at 0x%08X cannot reach %s\n", walker -> address,
+                          asm_intern_name(&labels -> names, walker -> label));
+                    errors += 1;
+                    continue;
+                }
+                address_difference -= walker -> address + walker -> size;
+            }
+            walker -> immediate = address_difference;
+            walker -> flags &= ~ASM_STATEMENT_RESOLVE_LABEL;
         }
-        walker = walker -> next;
     }
     
     log("Program Size: %d Bytes\n", current_address - base_address);
@@ -1,788 +1,453 @@
 /*!
 @ingroup sw-asm
 @{
-@file asm_emit.h
+@file asm_emit.c
 @brief Code responsible for emitting code as binary or ascii codes.
+@details Every instruction is described by one entry of the asm_encodings table, giving its length
+in bytes and where each operand sits in the instruction word. Instruction words are built left
+aligned in 32 bits, opcode in the top six bits followed by the two condition bits, and only the
+top `size` bytes are emitted, most significant first. The sizes and opcode values mirror the
+opcode_* and opcode_width_* constants in hw/instructions.vhdl, which `tim-asm --encodings` lists
+for comparison.
 */
 
 #include "asm.h"
 
-int asm_ascii_counter = 0;
+//! Index into asm_encoding shift and mask arrays of each operand.
+#define ASM_OPERAND_REG_1     0
+#define ASM_OPERAND_REG_2     1
+#define ASM_OPERAND_REG_3     2
+#define ASM_OPERAND_IMMEDIATE 3
+
+//! A mask of the lowest w bits.
+#define ASM_BITS(w) ((unsigned int)(((unsigned long long)1 << (w)) - 1))
+
+//! The header mask for instructions which carry an opcode and condition code.
+#define ASM_HEADER 0xFF000000u
+
+/*!
+@brief Builds an asm_encoding entry.
+@param n - The mnemonic, as it appears in hw/instructions.vhdl.
+@param sz - The length of the instruction in bytes.
+@param s1,w1,s2,w2,s3,w3 - The shift and width of each register operand. A width of zero means
+the operand is not encoded.
+@param si,wi - The shift and width of the immediate operand.
+@param fx - Constant bits ORed into every instruction word.
+@param hd - Mask applied to the opcode and condition header.
+*/
+#define ASM_ENCODING(n, sz, s1, w1, s2, w2, s3, w3, si, wi, fx, hd) { \
+    .name  = n,                                                     \
+    .size  = sz,                                                    \
+    .shift = {s1, s2, s3, si},                                      \
+    .mask  = {ASM_BITS(w1), ASM_BITS(w2), ASM_BITS(w3), ASM_BITS(wi)}, \
+    .fixed = fx,                                                    \
+    .header= hd }
+
+//! Opcode and condition code only.
+#define ASM_LAYOUT_NONE(n)       ASM_ENCODING(n, 1,  0,0,  0,0,  0,0,  0,0,  0, ASM_HEADER)
+//! One 5 bit register, any register including the special ones.
+#define ASM_LAYOUT_R5(n)         ASM_ENCODING(n, 2, 19,5,  0,0,  0,0,  0,0,  0, ASM_HEADER)
+//! Two 5 bit registers.
+#define ASM_LAYOUT_R5_R5(n, sz)  ASM_ENCODING(n, sz,19,5, 14,5,  0,0,  0,0,  0, ASM_HEADER)
+//! One 5 bit register and a 19 bit immediate.
+#define ASM_LAYOUT_R5_I19(n)     ASM_ENCODING(n, 4, 19,5,  0,0,  0,0,  0,19, 0, ASM_HEADER)
+//! An immediate filling the rest of a 4 byte instruction.
+#define ASM_LAYOUT_I(n, w)       ASM_ENCODING(n, 4,  0,0,  0,0,  0,0,  0,w,  0, ASM_HEADER)
+//! An 8 bit immediate, filling the rest of a 2 byte instruction.
+#define ASM_LAYOUT_I8(n)         ASM_ENCODING(n, 2,  0,0,  0,0,  0,0, 16,8,  0, ASM_HEADER)
+//! One 4 bit general purpose register and a 4 bit immediate.
+#define ASM_LAYOUT_R4_I4(n)      ASM_ENCODING(n, 2, 20,4,  0,0,  0,0, 16,4,  0, ASM_HEADER)
+//! One 5 bit register and an 11 bit immediate.
+#define ASM_LAYOUT_R5_I11(n)     ASM_ENCODING(n, 3, 19,5,  0,0,  0,0,  8,11, 0, ASM_HEADER)
+//! Two 4 bit general purpose registers.
+#define ASM_LAYOUT_R4_R4(n)      ASM_ENCODING(n, 2, 20,4, 16,4,  0,0,  0,0,  0, ASM_HEADER)
+//! Three 4 bit general purpose registers, followed by a constant nibble.
+#define ASM_LAYOUT_R4_R4_R4(n, nibble) \
+                                 ASM_ENCODING(n, 3, 20,4, 16,4, 12,4,  0,0, (nibble) << 8, ASM_HEADER)
+//! Two 4 bit general purpose registers and a 16 bit immediate.
+#define ASM_LAYOUT_R4_R4_I16(n)  ASM_ENCODING(n, 4, 20,4, 16,4,  0,0,  0,16, 0, ASM_HEADER)
+//! Two 4 bit general purpose registers and an 8 bit immediate.
+#define ASM_LAYOUT_R4_R4_I8(n)   ASM_ENCODING(n, 3, 20,4, 16,4,  0,0,  8,8,  0, ASM_HEADER)
+//! A raw 32 bit data word, with no opcode or condition code.
+#define ASM_LAYOUT_DATA(n)       ASM_ENCODING(n, 4,  0,0,  0,0,  0,0,  0,32, 0, 0)
 
 /*!
-@brief Writes out ascii code instead of binary to the supplied file.
-@param to_write - the entire instruction to write to file right aligned in the 32 bit unsigned int.
-@param length - The number of BITS in the instruction. This number of upper bits from the to_write
-field will be emitted.
+@brief The encoding of every instruction, indexed by tim_instruction_opcode.
+@details Built entirely at compile time. LOADR and STORR carry the default all-bytes mask in their
+final nibble.
+*/
+const asm_encoding asm_encodings[ASM_ENCODING_COUNT] = {
+    [LOADR ] = ASM_LAYOUT_R4_R4_R4("LOADR", 0xF),
+    [LOADI ] = ASM_LAYOUT_R4_R4_I16("LOADI"),
+    [STORI ] = ASM_LAYOUT_R4_R4_I16("STORI"),
+    [STORR ] = ASM_LAYOUT_R4_R4_R4("STORR", 0xF),
+    [PUSH  ] = ASM_LAYOUT_R5("PUSH"),
+    [POP   ] = ASM_LAYOUT_R5("POP"),
+    [MOVR  ] = ASM_LAYOUT_R5_R5("MOVR", 3),
+    [MOVI  ] = ASM_LAYOUT_R5_I19("MOVI"),
+    [JUMPR ] = ASM_LAYOUT_R5("JUMPR"),
+    [JUMPI ] = ASM_LAYOUT_I("JUMPI", 24),
+    [CALLR ] = ASM_LAYOUT_R5("CALLR"),
+    [CALLI ] = ASM_LAYOUT_I("CALLI", 23),
+    [RETURN] = ASM_LAYOUT_NONE("RETURN"),
+    [TEST  ] = ASM_LAYOUT_R5_R5("TEST", 4),
+    [HALT  ] = ASM_LAYOUT_NONE("HALT"),
+    [ANDR  ] = ASM_LAYOUT_R4_R4_R4("ANDR", 0),
+    [NANDR ] = ASM_LAYOUT_R4_R4_R4("NANDR", 0),
+    [ORR   ] = ASM_LAYOUT_R4_R4_R4("ORR", 0),
+    [NORR  ] = ASM_LAYOUT_R4_R4_R4("NORR", 0),
+    [XORR  ] = ASM_LAYOUT_R4_R4_R4("XORR", 0),
+    [LSLR  ] = ASM_LAYOUT_R4_R4_R4("LSLR", 0),
+    [LSRR  ] = ASM_LAYOUT_R4_R4_R4("LSRR", 0),
+    [NOTR  ] = ASM_LAYOUT_R4_R4("NOTR"),
+    [ANDI  ] = ASM_LAYOUT_R4_R4_I16("ANDI"),
+    [NANDI ] = ASM_LAYOUT_R4_R4_I16("NANDI"),
+    [ORI   ] = ASM_LAYOUT_R4_R4_I16("ORI"),
+    [NORI  ] = ASM_LAYOUT_R4_R4_I16("NORI"),
+    [XORI  ] = ASM_LAYOUT_R4_R4_I16("XORI"),
+    [LSLI  ] = ASM_LAYOUT_R4_R4_I16("LSLI"),
+    [LSRI  ] = ASM_LAYOUT_R4_R4_I16("LSRI"),
+    [IADDI ] = ASM_LAYOUT_R4_R4_I16("IADDI"),
+    [ISUBI ] = ASM_LAYOUT_R4_R4_I16("ISUBI"),
+    [IMULI ] = ASM_LAYOUT_R4_R4_I16("IMULI"),
+    [IDIVI ] = ASM_LAYOUT_R4_R4_I16("IDIVI"),
+    [IASRI ] = ASM_LAYOUT_R4_R4_I16("IASRI"),
+    [IADDR ] = ASM_LAYOUT_R4_R4_R4("IADDR", 0),
+    [ISUBR ] = ASM_LAYOUT_R4_R4_R4("ISUBR", 0),
+    [IMULR ] = ASM_LAYOUT_R4_R4_R4("IMULR", 0),
+    [IDIVR ] = ASM_LAYOUT_R4_R4_R4("IDIVR", 0),
+    [IASRR ] = ASM_LAYOUT_R4_R4_R4("IASRR", 0),
+    [FADDI ] = ASM_LAYOUT_R4_R4_I16("FADDI"),
+    [FSUBI ] = ASM_LAYOUT_R4_R4_I16("FSUBI"),
+    [FMULI ] = ASM_LAYOUT_R4_R4_I16("FMULI"),
+    [FDIVI ] = ASM_LAYOUT_R4_R4_I16("FDIVI"),
+    [FASRI ] = ASM_LAYOUT_R4_R4_I16("FASRI"),
+    [FADDR ] = ASM_LAYOUT_R4_R4_R4("FADDR", 0),
+    [FSUBR ] = ASM_LAYOUT_R4_R4_R4("FSUBR", 0),
+    [FMULR ] = ASM_LAYOUT_R4_R4_R4("FMULR", 0),
+    [FDIVR ] = ASM_LAYOUT_R4_R4_R4("FDIVR", 0),
+    [FASRR ] = ASM_LAYOUT_R4_R4_R4("FASRR", 0),
+    [SLEEP ] = ASM_LAYOUT_R5("SLEEP"),
+    [JUMPS ] = ASM_LAYOUT_I8("JUMPS"),
+    [CALLS ] = ASM_LAYOUT_I8("CALLS"),
+    [MOVIS ] = ASM_LAYOUT_R4_I4("MOVIS"),
+    [MOVIM ] = ASM_LAYOUT_R5_I11("MOVIM"),
+    [ANDIS ] = ASM_LAYOUT_R4_R4_I8("ANDIS"),
+    [ORIS  ] = ASM_LAYOUT_R4_R4_I8("ORIS"),
+    [XORIS ] = ASM_LAYOUT_R4_R4_I8("XORIS"),
+    [LSLIS ] = ASM_LAYOUT_R4_R4_I8("LSLIS"),
+    [LSRIS ] = ASM_LAYOUT_R4_R4_I8("LSRIS"),
+    [IADDIS] = ASM_LAYOUT_R4_R4_I8("IADDIS"),
+    [ISUBIS] = ASM_LAYOUT_R4_R4_I8("ISUBIS"),
+    [NOPS  ] = ASM_LAYOUT_NONE("NOPS"),
+    [NOT_EMITTED] = ASM_LAYOUT_DATA("DATA")
+};
+
+//! The instruction each narrow immediate form stands for.
+const tim_instruction_opcode asm_wide_forms[ASM_NARROW_COUNT] = {
+    [MOVIS  - ASM_NARROW_FIRST] = MOVI,
+    [MOVIM  - ASM_NARROW_FIRST] = MOVI,
+    [ANDIS  - ASM_NARROW_FIRST] = ANDI,
+    [ORIS   - ASM_NARROW_FIRST] = ORI,
+    [XORIS  - ASM_NARROW_FIRST] = XORI,
+    [LSLIS  - ASM_NARROW_FIRST] = LSLI,
+    [LSRIS  - ASM_NARROW_FIRST] = LSRI,
+    [IADDIS - ASM_NARROW_FIRST] = IADDI,
+    [ISUBIS - ASM_NARROW_FIRST] = ISUBI
+};
+
+//! The eight ASCII bits of a byte, most significant first.
+#define ASM_BYTE_BITS(b) { '0' + (((b) >> 7) & 1), '0' + (((b) >> 6) & 1), '0' + (((b) >> 5) & 1), \
+                           '0' + (((b) >> 4) & 1), '0' + (((b) >> 3) & 1), '0' + (((b) >> 2) & 1), \
+                           '0' + (((b) >> 1) & 1), '0' + ((b) & 1) }
+#define ASM_BYTE_BITS_4(b)   ASM_BYTE_BITS(b), ASM_BYTE_BITS((b) + 1), ASM_BYTE_BITS((b) + 2), \
+                             ASM_BYTE_BITS((b) + 3)
+#define ASM_BYTE_BITS_16(b)  ASM_BYTE_BITS_4(b), ASM_BYTE_BITS_4((b) + 4), \
+                             ASM_BYTE_BITS_4((b) + 8), ASM_BYTE_BITS_4((b) + 12)
+#define ASM_BYTE_BITS_64(b)  ASM_BYTE_BITS_16(b), ASM_BYTE_BITS_16((b) + 16), \
+                             ASM_BYTE_BITS_16((b) + 32), ASM_BYTE_BITS_16((b) + 48)
+
+//! The ASCII bit string of every byte value, built at compile time.
+static const char asm_emit_byte_bits[256][8] = {
+    ASM_BYTE_BITS_64(0), ASM_BYTE_BITS_64(64), ASM_BYTE_BITS_64(128), ASM_BYTE_BITS_64(192)
+};
+
+//! The size of the buffer ASCII output is built up in before being written out.
+#define ASM_EMIT_ASCII_BUFFER (1 << 20)
+
+//! The number of bytes of machine code written on each line of ASCII output.
+#define ASM_EMIT_ASCII_LINE 4
+
+/*!
+@brief Writes a program out as ascii code instead of binary to the supplied file.
+@details Each line holds 32 bits as '1' and '0' characters. The final line is padded out with zeros,
+and is a whole line of zeros if the program fills its last line exactly, with no newline after it.
+Lines are built in a large buffer from the byte to bit string table and written out with a
+few large writes.
+@param code - The machine code to write. It must be followed by at least ASM_EMIT_ASCII_LINE zero
+bytes of padding.
+@param length - The number of bytes of machine code.
+@param file - The file to write to.
+@returns An integer representing the number of errors encountered, if any.
 */
-int asm_emit_ascii(unsigned int to_write, unsigned char length, FILE * file)
+static int asm_emit_ascii(unsigned char * code, size_t length, FILE * file)
 {
-    int i;
-    for(i = 31; i > 31- length; i--)
+    char * buffer = malloc(ASM_EMIT_ASCII_BUFFER);
+    if(buffer == NULL)
     {
-        to_write & ((unsigned int)1)<<i ? fprintf(file,"1") : fprintf(file,"0");
-        asm_ascii_counter += 1;
-        if(asm_ascii_counter >=32)
-        {
-            asm_ascii_counter = 0;
-            fprintf(file, "\n");
-        }
+        error("Could not allocate the output buffer.\n");
+        return 1;
     }
-    
-    return 0;
-}
-
-int asm_emit_opcode_LOADR (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (31-5);
-    to_write |= ((unsigned int)statement -> condition) << (31-6-1);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_1) << (31-6-2-3);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_2) << (31-6-2-4-3);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_3) << (31-6-2-4-4-3);
-    to_write |= 0xF;
-
-    if(format == ASCII) asm_emit_ascii(to_write, 24, file); else
-    fwrite(&to_write, 3, 1, file);
-    return 0;
-}
-
-int asm_emit_opcode_LOADI (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (31-5);
-    to_write |= ((unsigned int)statement -> condition) << (31-6-1);
-    to_write |= ((unsigned int)statement -> args.reg_reg_immediate.reg_1) << (31-6-2-3);
-    to_write |= ((unsigned int)statement -> args.reg_reg_immediate.reg_2) << (31-6-2-4-3);
-    to_write |= ((unsigned short)statement -> args.reg_reg_immediate.immediate);
-
-    if(format == ASCII) asm_emit_ascii(to_write, 32, file); else
-    fwrite(&to_write, sizeof(to_write), 1, file);
-    return 0;
-}
-
-int asm_emit_opcode_STORI (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (31-5);
-    to_write |= ((unsigned int)statement -> condition) << (31-6-1);
-    to_write |= ((unsigned int)statement -> args.reg_reg_immediate.reg_1) << (31-6-2-3);
-    to_write |= ((unsigned int)statement -> args.reg_reg_immediate.reg_2) << (31-6-2-4-3);
-    to_write |= ((unsigned short)statement -> args.reg_reg_immediate.immediate);
-
-    if(format == ASCII) asm_emit_ascii(to_write, 32, file); else
-    fwrite(&to_write, sizeof(to_write), 1, file);
-    return 0;
-}
-
-int asm_emit_opcode_STORR (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (31-5);
-    to_write |= ((unsigned int)statement -> condition) << (31-6-1);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_1) << (31-6-2-3);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_2) << (31-6-2-4-3);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_3) << (31-6-2-4-4-3);
-    to_write |= 0xF;
-
-    if(format == ASCII) asm_emit_ascii(to_write, 24, file); else
-    fwrite(&to_write, 3, 1, file);
-    return 0;
-}
-
-int asm_emit_opcode_PUSH  (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (31-5);
-    to_write |= ((unsigned int)statement -> condition) << (31-6-1);
-    to_write |= ((unsigned int)statement -> args.reg.reg_1) << (31-6-2-4);
-
-    if(format == ASCII) asm_emit_ascii(to_write, 16, file); else
-    fwrite(&to_write, 2, 1, file);
-    return 0;
-}
-
-int asm_emit_opcode_POP   (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (31-5);
-    to_write |= ((unsigned int)statement -> condition) << (31-6-1);
-    to_write |= ((unsigned int)statement -> args.reg.reg_1) << (31-6-2-4);
-
-    if(format == ASCII) asm_emit_ascii(to_write, 16, file); else
-    fwrite(&to_write, 2, 1, file);
-    return 0;
-}
-
-int asm_emit_opcode_MOVR  (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (31-5);
-    to_write |= ((unsigned int)statement -> condition) << (31-6-1);
-    to_write |= ((unsigned int)statement -> args.reg_reg.reg_1) << (31-6-2-4);
-    to_write |= ((unsigned int)statement -> args.reg_reg.reg_2) << (31-6-2-5-4);
-
-    if(format == ASCII) asm_emit_ascii(to_write, 24, file); else
-    fwrite(&to_write, 3 , 1, file);
-    return 0;
-}
-
-int asm_emit_opcode_MOVI  (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (31-5);
-    to_write |= ((unsigned int)statement -> condition) << (31-6-1);
-    to_write |= ((unsigned int)statement -> args.reg_immediate.reg_1) << (31-6-2-4);
-    to_write |= ((unsigned int)statement -> args.reg_immediate.immediate);
-
-    if(format == ASCII) asm_emit_ascii(to_write, 32, file); else
-    fwrite(&to_write, sizeof(to_write), 1, file);
-    return 0;
-}
-
-int asm_emit_opcode_JUMPR (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (31-5);
-    to_write |= ((unsigned int)statement -> condition) << (31-6-1);
-    to_write |= ((unsigned int)statement -> args.reg.reg_1) << (31-6-2-4);
-
-    if(format == ASCII) asm_emit_ascii(to_write, 31, file); else
-    fwrite(&to_write, 2, 1, file);
-    return 0;
-}
-
-int asm_emit_opcode_JUMPI (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (31-5);
-    to_write |= ((unsigned int)statement -> condition) << (31-6-1);
-    to_write |= ((unsigned int)statement -> args.immediate.immediate);
-
-    if(format == ASCII) asm_emit_ascii(to_write, 32, file); else
-    fwrite(&to_write, sizeof(to_write), 1, file);
-    return 0;
-}
-
-int asm_emit_opcode_CALLR (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (31-5);
-    to_write |= ((unsigned int)statement -> condition) << (31-6-1);
-    to_write |= ((unsigned int)statement -> args.reg.reg_1) << (31-6-2-4);
-
-    if(format == ASCII) asm_emit_ascii(to_write, 16, file); else
-    fwrite(&to_write, 2, 1, file);
-    return 0;
-}
-
-int asm_emit_opcode_CALLI (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (31-5);
-    to_write |= ((unsigned int)statement -> condition) << (31-6-1);
-    to_write |= ((unsigned int)statement -> args.immediate.immediate);
-
-    if(format == ASCII) asm_emit_ascii(to_write, 32, file); else
-    fwrite(&to_write, sizeof(to_write), 1, file);
-    return 0;
-}
-
-int asm_emit_opcode_RETURN(asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (31-5);
-    to_write |= ((unsigned int)statement -> condition) << (31-6-1);
-     
-    if(format == ASCII) asm_emit_ascii(to_write, 8, file); else
-    fwrite(&to_write, 1, 1, file);
-    return 0;
-}
-
-int asm_emit_opcode_TEST  (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (31-5);
-    to_write |= ((unsigned int)statement -> condition) << (31-6-1);
-    to_write |= ((unsigned int)statement -> args.reg_reg.reg_1) << (31-6-2-4);
-    to_write |= ((unsigned int)statement -> args.reg_reg.reg_2) << (31-6-2-5-4);
-
-    if(format == ASCII) asm_emit_ascii(to_write, 32, file); else
-    fwrite(&to_write, 4 , 1, file);
-    return 0;
-}
-
-int asm_emit_opcode_HALT  (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (31-5);
-    to_write |= ((unsigned int)statement -> condition) << (31-6-1);
-     
-    if(format == ASCII) asm_emit_ascii(to_write, 8, file); else
-    fwrite(&to_write, 1, 1, file);
-    return 0;
-}
-
-int asm_emit_opcode_ANDR  (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (31-5);
-    to_write |= ((unsigned int)statement -> condition) << (31-6-1);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_1) << (31-6-2-3);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_2) << (31-6-2-4-3);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_3) << (31-6-2-4-4-3);
-    to_write |= 0xF;
-
-    if(format == ASCII) asm_emit_ascii(to_write, 24, file); else
-    fwrite(&to_write, sizeof(to_write), 1, file);
-    return 0;
-}
-
-int asm_emit_opcode_NANDR (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (31-5);
-    to_write |= ((unsigned int)statement -> condition) << (31-6-1);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_1) << (31-6-2-3);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_2) << (31-6-2-4-3);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_3) << (31-6-2-4-4-3);
-    to_write |= 0xF;
-
-    if(format == ASCII) asm_emit_ascii(to_write, 24, file); else
-    fwrite(&to_write, sizeof(to_write), 1, file);
-    return 0;
-}
-
-int asm_emit_opcode_ORR   (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (31-5);
-    to_write |= ((unsigned int)statement -> condition) << (31-6-1);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_1) << (31-6-2-3);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_2) << (31-6-2-4-3);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_3) << (31-6-2-4-4-3);
-    to_write |= 0xF;
-
-    if(format == ASCII) asm_emit_ascii(to_write, 24, file); else
-    fwrite(&to_write, sizeof(to_write), 1, file);
-    return 0;
-}
-
-int asm_emit_opcode_NORR  (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (31-5);
-    to_write |= ((unsigned int)statement -> condition) << (31-6-1);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_1) << (31-6-2-3);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_2) << (31-6-2-4-3);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_3) << (31-6-2-4-4-3);
-    to_write |= 0xF;
-
-    if(format == ASCII) asm_emit_ascii(to_write, 24, file); else
-    fwrite(&to_write, sizeof(to_write), 1, file);
-    return 0;
-}
-
-int asm_emit_opcode_XORR  (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (31-5);
-    to_write |= ((unsigned int)statement -> condition) << (31-6-1);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_1) << (31-6-2-3);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_2) << (31-6-2-4-3);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_3) << (31-6-2-4-4-3);
-    to_write |= 0xF;
-
-    if(format == ASCII) asm_emit_ascii(to_write, 24, file); else
-    fwrite(&to_write, sizeof(to_write), 1, file);
-    return 0;
-}
-
-int asm_emit_opcode_LSLR  (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (31-5);
-    to_write |= ((unsigned int)statement -> condition) << (31-6-1);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_1) << (31-6-2-3);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_2) << (31-6-2-4-3);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_3) << (31-6-2-4-4-3);
-    to_write |= 0xF;
-
-    if(format == ASCII) asm_emit_ascii(to_write, 24, file); else
-    fwrite(&to_write, sizeof(to_write), 1, file);
-    return 0;
-}
-
-int asm_emit_opcode_LSRR  (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (31-5);
-    to_write |= ((unsigned int)statement -> condition) << (31-6-1);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_1) << (31-6-2-3);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_2) << (31-6-2-4-3);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_3) << (31-6-2-4-4-3);
-    to_write |= 0xF;
-
-    if(format == ASCII) asm_emit_ascii(to_write, 24, file); else
-    fwrite(&to_write, sizeof(to_write), 1, file);
-    return 0;
-}
-
-int asm_emit_opcode_NOTR  (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (31-5);
-    to_write |= ((unsigned int)statement -> condition) << (31-6-1);
-    to_write |= ((unsigned int)statement -> args.reg_reg.reg_1) << (31-6-2-4);
-    to_write |= ((unsigned int)statement -> args.reg_reg.reg_2) << (31-6-2-5-4);
-
-    if(format == ASCII) asm_emit_ascii(to_write, 16, file); else
-    fwrite(&to_write, 3 , 1, file);
-    return 0;
-}
-
-int asm_emit_opcode_ANDI  (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (32-6);
-    to_write |= ((unsigned int)statement -> condition) << (32-6-2);
-    to_write |= ((unsigned int)statement -> args.reg_reg_immediate.reg_1) << (32-6-2-4);
-    to_write |= ((unsigned int)statement -> args.reg_reg_immediate.reg_2) << (32-6-2-4-4);
-    to_write |= ((unsigned short)statement -> args.reg_reg_immediate.immediate);
-
-    if(format == ASCII) asm_emit_ascii(to_write, 24, file); else
-    fwrite(&to_write, sizeof(to_write), 1, file);
-    return 0;
-}
-
-int asm_emit_opcode_NANDI (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (32-6);
-    to_write |= ((unsigned int)statement -> condition) << (32-6-2);
-    to_write |= ((unsigned int)statement -> args.reg_reg_immediate.reg_1) << (32-6-2-4);
-    to_write |= ((unsigned int)statement -> args.reg_reg_immediate.reg_2) << (32-6-2-4-4);
-    to_write |= ((unsigned short)statement -> args.reg_reg_immediate.immediate);
-
-    if(format == ASCII) asm_emit_ascii(to_write, 32, file); else
-    fwrite(&to_write, sizeof(to_write), 1, file);
-    return 0;
-}
-
-int asm_emit_opcode_ORI   (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (32-6);
-    to_write |= ((unsigned int)statement -> condition) << (32-6-2);
-    to_write |= ((unsigned int)statement -> args.reg_reg_immediate.reg_1) << (32-6-2-4);
-    to_write |= ((unsigned int)statement -> args.reg_reg_immediate.reg_2) << (32-6-2-4-4);
-    to_write |= ((unsigned short)statement -> args.reg_reg_immediate.immediate);
-
-    if(format == ASCII) asm_emit_ascii(to_write, 32, file); else
-    fwrite(&to_write, sizeof(to_write), 1, file);
-    return 0;
-}
-
-int asm_emit_opcode_NORI  (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (32-6);
-    to_write |= ((unsigned int)statement -> condition) << (32-6-2);
-    to_write |= ((unsigned int)statement -> args.reg_reg_immediate.reg_1) << (32-6-2-4);
-    to_write |= ((unsigned int)statement -> args.reg_reg_immediate.reg_2) << (32-6-2-4-4);
-    to_write |= ((unsigned short)statement -> args.reg_reg_immediate.immediate);
-
-    if(format == ASCII) asm_emit_ascii(to_write, 32, file); else
-    fwrite(&to_write, sizeof(to_write), 1, file);
-    return 0;
-}
-
-int asm_emit_opcode_XORI  (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (32-6);
-    to_write |= ((unsigned int)statement -> condition) << (32-6-2);
-    to_write |= ((unsigned int)statement -> args.reg_reg_immediate.reg_1) << (32-6-2-4);
-    to_write |= ((unsigned int)statement -> args.reg_reg_immediate.reg_2) << (32-6-2-4-4);
-    to_write |= ((unsigned short)statement -> args.reg_reg_immediate.immediate);
-
-    if(format == ASCII) asm_emit_ascii(to_write, 32, file); else
-    fwrite(&to_write, sizeof(to_write), 1, file);
-    return 0;
-}
-
-int asm_emit_opcode_LSLI  (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (32-6);
-    to_write |= ((unsigned int)statement -> condition) << (32-6-2);
-    to_write |= ((unsigned int)statement -> args.reg_reg_immediate.reg_1) << (32-6-2-4);
-    to_write |= ((unsigned int)statement -> args.reg_reg_immediate.reg_2) << (32-6-2-4-4);
-    to_write |= ((unsigned short)statement -> args.reg_reg_immediate.immediate);
-
-    if(format == ASCII) asm_emit_ascii(to_write, 32, file); else
-    fwrite(&to_write, sizeof(to_write), 1, file);
-    return 0;
-}
-
-int asm_emit_opcode_LSRI  (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (32-6);
-    to_write |= ((unsigned int)statement -> condition) << (32-6-2);
-    to_write |= ((unsigned int)statement -> args.reg_reg_immediate.reg_1) << (32-6-2-4);
-    to_write |= ((unsigned int)statement -> args.reg_reg_immediate.reg_2) << (32-6-2-4-4);
-    to_write |= ((unsigned short)statement -> args.reg_reg_immediate.immediate);
-
-    if(format == ASCII) asm_emit_ascii(to_write, 32, file); else
-    fwrite(&to_write, sizeof(to_write), 1, file);
-    return 0;
-}
-
-int asm_emit_opcode_IADDI (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (32-6);
-    to_write |= ((unsigned int)statement -> condition) << (32-6-2);
-    to_write |= ((unsigned int)statement -> args.reg_reg_immediate.reg_1) << (32-6-2-4);
-    to_write |= ((unsigned int)statement -> args.reg_reg_immediate.reg_2) << (32-6-2-4-4);
-    to_write |= ((unsigned short)statement -> args.reg_reg_immediate.immediate);
-
-    if(format == ASCII) asm_emit_ascii(to_write, 32, file); else
-    fwrite(&to_write, sizeof(to_write), 1, file);
-    return 0;
-}
-
-int asm_emit_opcode_ISUBI (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (32-6);
-    to_write |= ((unsigned int)statement -> condition) << (32-6-2);
-    to_write |= ((unsigned int)statement -> args.reg_reg_immediate.reg_1) << (32-6-2-4);
-    to_write |= ((unsigned int)statement -> args.reg_reg_immediate.reg_2) << (32-6-2-4-4);
-    to_write |= ((unsigned short)statement -> args.reg_reg_immediate.immediate);
-
-    if(format == ASCII) asm_emit_ascii(to_write, 32, file); else
-    fwrite(&to_write, sizeof(to_write), 1, file);
-    return 0;
-}
-
-int asm_emit_opcode_IMULI (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (32-6);
-    to_write |= ((unsigned int)statement -> condition) << (32-6-2);
-    to_write |= ((unsigned int)statement -> args.reg_reg_immediate.reg_1) << (32-6-2-4);
-    to_write |= ((unsigned int)statement -> args.reg_reg_immediate.reg_2) << (32-6-2-4-4);
-    to_write |= ((unsigned short)statement -> args.reg_reg_immediate.immediate);
-
-    if(format == ASCII) asm_emit_ascii(to_write, 32, file); else
-    fwrite(&to_write, sizeof(to_write), 1, file);
-    return 0;
-}
-
-int asm_emit_opcode_IDIVI (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (32-6);
-    to_write |= ((unsigned int)statement -> condition) << (32-6-2);
-    to_write |= ((unsigned int)statement -> args.reg_reg_immediate.reg_1) << (32-6-2-4);
-    to_write |= ((unsigned int)statement -> args.reg_reg_immediate.reg_2) << (32-6-2-4-4);
-    to_write |= ((unsigned short)statement -> args.reg_reg_immediate.immediate);
-
-    if(format == ASCII) asm_emit_ascii(to_write, 32, file); else
-    fwrite(&to_write, sizeof(to_write), 1, file);
-    return 0;
-}
-
-int asm_emit_opcode_IALSI (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (32-6);
-    to_write |= ((unsigned int)statement -> condition) << (32-6-2);
-    to_write |= ((unsigned int)statement -> args.reg_reg_immediate.reg_1) << (32-6-2-4);
-    to_write |= ((unsigned int)statement -> args.reg_reg_immediate.reg_2) << (32-6-2-4-4);
-    to_write |= ((unsigned short)statement -> args.reg_reg_immediate.immediate);
-
-    if(format == ASCII) asm_emit_ascii(to_write, 32, file); else
-    fwrite(&to_write, sizeof(to_write), 1, file);
-    return 0;
-}
-
-int asm_emit_opcode_IASRI (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (32-6);
-    to_write |= ((unsigned int)statement -> condition) << (32-6-2);
-    to_write |= ((unsigned int)statement -> args.reg_reg_immediate.reg_1) << (32-6-2-4);
-    to_write |= ((unsigned int)statement -> args.reg_reg_immediate.reg_2) << (32-6-2-4-4);
-    to_write |= ((unsigned short)statement -> args.reg_reg_immediate.immediate);
-
-    if(format == ASCII) asm_emit_ascii(to_write, 32, file); else
-    fwrite(&to_write, sizeof(to_write), 1, file);
-    return 0;
-}
-
-int asm_emit_opcode_IADDR (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (32-6);
-    to_write |= ((unsigned int)statement -> condition) << (32-6-2);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_1) << (32-6-2-4);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_2) << (32-6-2-4-4);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_3) << (32-6-2-4-4);
-    to_write |= 0xF;
-
-    if(format == ASCII) asm_emit_ascii(to_write, 24, file); else
-    fwrite(&to_write, sizeof(to_write), 1, file);
-    return 0;
-}
-
-int asm_emit_opcode_ISUBR (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (32-6);
-    to_write |= ((unsigned int)statement -> condition) << (32-6-2);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_1) << (32-6-2-4);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_2) << (32-6-2-4-4);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_3) << (32-6-2-4-4);
-    to_write |= 0xF;
-
-    if(format == ASCII) asm_emit_ascii(to_write, 24, file); else
-    fwrite(&to_write, sizeof(to_write), 1, file);
-    return 0;
-}
+    ASM_STATS_ALLOCATED(ASM_EMIT_ASCII_BUFFER);
 
-int asm_emit_opcode_IMULR (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (32-6);
-    to_write |= ((unsigned int)statement -> condition) << (32-6-2);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_1) << (32-6-2-4);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_2) << (32-6-2-4-4);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_3) << (32-6-2-4-4);
-    to_write |= 0xF;
+    size_t lines    = length / ASM_EMIT_ASCII_LINE + 1;
+    size_t used     = 0;
+    int    errors   = 0;
+    size_t line;
 
-    if(format == ASCII) asm_emit_ascii(to_write, 24, file); else
-    fwrite(&to_write, sizeof(to_write), 1, file);
-    return 0;
-}
-
-int asm_emit_opcode_IDIVR (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (32-6);
-    to_write |= ((unsigned int)statement -> condition) << (32-6-2);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_1) << (32-6-2-4);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_2) << (32-6-2-4-4);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_3) << (32-6-2-4-4);
-    to_write |= 0xF;
-
-    if(format == ASCII) asm_emit_ascii(to_write, 24, file); else
-    fwrite(&to_write, sizeof(to_write), 1, file);
-    return 0;
-}
-
-int asm_emit_opcode_IASLR (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (32-6);
-    to_write |= ((unsigned int)statement -> condition) << (32-6-2);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_1) << (32-6-2-4);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_2) << (32-6-2-4-4);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_3) << (32-6-2-4-4);
-    to_write |= 0xF;
-
-    if(format == ASCII) asm_emit_ascii(to_write, 24, file); else
-    fwrite(&to_write, sizeof(to_write), 1, file);
-    return 0;
-}
-
-int asm_emit_opcode_IASRR (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (32-6);
-    to_write |= ((unsigned int)statement -> condition) << (32-6-2);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_1) << (32-6-2-4);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_2) << (32-6-2-4-4);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_3) << (32-6-2-4-4);
-    to_write |= 0xF;
-
-    if(format == ASCII) asm_emit_ascii(to_write, 24, file); else
-    fwrite(&to_write, sizeof(to_write), 1, file);
-    return 0;
-}
-
-int asm_emit_opcode_FADDI (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (32-6);
-    to_write |= ((unsigned int)statement -> condition) << (32-6-2);
-    to_write |= ((unsigned int)statement -> args.reg_reg_immediate.reg_1) << (32-6-2-4);
-    to_write |= ((unsigned int)statement -> args.reg_reg_immediate.reg_2) << (32-6-2-4-4);
-    to_write |= ((unsigned short)statement -> args.reg_reg_immediate.immediate);
-
-    if(format == ASCII) asm_emit_ascii(to_write, 32, file); else
-    fwrite(&to_write, sizeof(to_write), 1, file);
-    return 0;
-}
-
-int asm_emit_opcode_FSUBI (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (32-6);
-    to_write |= ((unsigned int)statement -> condition) << (32-6-2);
-    to_write |= ((unsigned int)statement -> args.reg_reg_immediate.reg_1) << (32-6-2-4);
-    to_write |= ((unsigned int)statement -> args.reg_reg_immediate.reg_2) << (32-6-2-4-4);
-    to_write |= ((unsigned short)statement -> args.reg_reg_immediate.immediate);
-
-    if(format == ASCII) asm_emit_ascii(to_write, 32, file); else
-    fwrite(&to_write, sizeof(to_write), 1, file);
-    return 0;
-}
-
-int asm_emit_opcode_FMULI (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (32-6);
-    to_write |= ((unsigned int)statement -> condition) << (32-6-2);
-    to_write |= ((unsigned int)statement -> args.reg_reg_immediate.reg_1) << (32-6-2-4);
-    to_write |= ((unsigned int)statement -> args.reg_reg_immediate.reg_2) << (32-6-2-4-4);
-    to_write |= ((unsigned short)statement -> args.reg_reg_immediate.immediate);
-
-    if(format == ASCII) asm_emit_ascii(to_write, 32, file); else
-    fwrite(&to_write, sizeof(to_write), 1, file);
-    return 0;
-}
-
-int asm_emit_opcode_FDIVI (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (32-6);
-    to_write |= ((unsigned int)statement -> condition) << (32-6-2);
-    to_write |= ((unsigned int)statement -> args.reg_reg_immediate.reg_1) << (32-6-2-4);
-    to_write |= ((unsigned int)statement -> args.reg_reg_immediate.reg_2) << (32-6-2-4-4);
-    to_write |= ((unsigned short)statement -> args.reg_reg_immediate.immediate);
+    for(line = 0; line < lines; line ++)
+    {
+        unsigned char * bytes = code + line * ASM_EMIT_ASCII_LINE;
 
-    if(format == ASCII) asm_emit_ascii(to_write, 32, file); else
-    fwrite(&to_write, sizeof(to_write), 1, file);
-    return 0;
-}
+        memcpy(buffer + used,      asm_emit_byte_bits[bytes[0]], 8);
+        memcpy(buffer + used + 8,  asm_emit_byte_bits[bytes[1]], 8);
+        memcpy(buffer + used + 16, asm_emit_byte_bits[bytes[2]], 8);
+        memcpy(buffer + used + 24, asm_emit_byte_bits[bytes[3]], 8);
+        buffer[used + 32] = '\n';
+        used += line + 1 < lines ? 33 : 32;
 
-int asm_emit_opcode_FASLI (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (32-6);
-    to_write |= ((unsigned int)statement -> condition) << (32-6-2);
-    to_write |= ((unsigned int)statement -> args.reg_reg_immediate.reg_1) << (32-6-2-4);
-    to_write |= ((unsigned int)statement -> args.reg_reg_immediate.reg_2) << (32-6-2-4-4);
-    to_write |= ((unsigned short)statement -> args.reg_reg_immediate.immediate);
+        if(used > ASM_EMIT_ASCII_BUFFER - 33 || line + 1 == lines)
+        {
+            if(fwrite(buffer, 1, used, file) != used)
+            {
+                error("Could not write the program to the output file.\n");
+                errors += 1;
+                break;
+            }
+            used = 0;
+        }
+    }
 
-    if(format == ASCII) asm_emit_ascii(to_write, 32, file); else
-    fwrite(&to_write, sizeof(to_write), 1, file);
-    return 0;
+    free(buffer);
+    return errors;
 }
 
-int asm_emit_opcode_FASRI (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (32-6);
-    to_write |= ((unsigned int)statement -> condition) << (32-6-2);
-    to_write |= ((unsigned int)statement -> args.reg_reg_immediate.reg_1) << (32-6-2-4);
-    to_write |= ((unsigned int)statement -> args.reg_reg_immediate.reg_2) << (32-6-2-4-4);
-    to_write |= ((unsigned short)statement -> args.reg_reg_immediate.immediate);
-
-    if(format == ASCII) asm_emit_ascii(to_write, 32, file); else
-    fwrite(&to_write, sizeof(to_write), 1, file);
-    return 0;
-}
+/*!
+@brief Encodes a whole program into a buffer of machine code.
+@details Each statement is encoded with the same few operations whatever its opcode: the operands
+are masked and shifted into place as described by its asm_encodings entry, and all four bytes of
+the instruction word are stored before the output pointer is moved on by the instruction's actual
+size. There is no per-opcode dispatch and no per-field branching.
+@param statements - The program to encode. Addresses must already have been calculated.
+@param buffer - Where to write the machine code. It must have room for the whole program plus
+ASM_ENCODE_SLACK bytes.
+@returns The number of bytes of machine code written.
+*/
+size_t asm_encode_statements(asm_statements * statements, unsigned char * buffer)
+{
+    unsigned char * out = buffer;
+    unsigned int i;
 
-int asm_emit_opcode_FADDR (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (32-6);
-    to_write |= ((unsigned int)statement -> condition) << (32-6-2);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_1) << (32-6-2-4);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_2) << (32-6-2-4-4);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_3) << (32-6-2-4-4);
-    to_write |= 0xF;
+    for(i = 0; i < statements -> count; i ++)
+    {
+        asm_statement      * s = &statements -> items[i];
+        const asm_encoding * e = &asm_encodings[s -> opcode];
 
-    if(format == ASCII) asm_emit_ascii(to_write, 24, file); else
-    fwrite(&to_write, sizeof(to_write), 1, file);
-    return 0;
-}
+        if(s -> flags & ASM_STATEMENT_PAD)
+        {
+            // Padding is as many one byte NOPS as it was laid out to need.
+            memset(out, NOPS << 2, s -> size);
+            out += s -> size;
+            continue;
+        }
 
-int asm_emit_opcode_FSUBR (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (32-6);
-    to_write |= ((unsigned int)statement -> condition) << (32-6-2);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_1) << (32-6-2-4);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_2) << (32-6-2-4-4);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_3) << (32-6-2-4-4);
-    to_write |= 0xF;
+        unsigned int word = ((((unsigned int)s -> opcode << 26) |
+                              ((unsigned int)s -> condition << 24)) & e -> header) |
+                            e -> fixed |
+                            ((s -> reg_1 & e -> mask[ASM_OPERAND_REG_1]) << e -> shift[ASM_OPERAND_REG_1]) |
+                            ((s -> reg_2 & e -> mask[ASM_OPERAND_REG_2]) << e -> shift[ASM_OPERAND_REG_2]) |
+                            ((s -> reg_3 & e -> mask[ASM_OPERAND_REG_3]) << e -> shift[ASM_OPERAND_REG_3]) |
+                            (((unsigned int)s -> immediate & e -> mask[ASM_OPERAND_IMMEDIATE])
+                                << e -> shift[ASM_OPERAND_IMMEDIATE]);
+
+        out[0] = (unsigned char)(word >> 24);
+        out[1] = (unsigned char)(word >> 16);
+        out[2] = (unsigned char)(word >> 8);
+        out[3] = (unsigned char)(word);
+        out   += e -> size;
+    }
 
-    if(format == ASCII) asm_emit_ascii(to_write, 24, file); else
-    fwrite(&to_write, sizeof(to_write), 1, file);
-    return 0;
+    return out - buffer;
 }
 
-int asm_emit_opcode_FMULR (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (32-6);
-    to_write |= ((unsigned int)statement -> condition) << (32-6-2);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_1) << (32-6-2-4);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_2) << (32-6-2-4-4);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_3) << (32-6-2-4-4);
-    to_write |= 0xF;
-
-    if(format == ASCII) asm_emit_ascii(to_write, 24, file); else
-    fwrite(&to_write, sizeof(to_write), 1, file);
-    return 0;
+/*!
+@brief Prints the encoding table, one instruction per line, as its name, opcode value and length
+in bytes. Used to check the table against hw/instructions.vhdl.
+@param file - Where to print the table.
+*/
+void asm_print_encodings(FILE * file)
+{
+    unsigned int i;
+    for(i = 0; i < ASM_ENCODING_COUNT; i ++)
+        if(i != NOT_EMITTED)
+            fprintf(file, "%-8s %2u %u\n", asm_encodings[i].name, i, asm_encodings[i].size);
 }
 
-int asm_emit_opcode_FDIVR (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (32-6);
-    to_write |= ((unsigned int)statement -> condition) << (32-6-2);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_1) << (32-6-2-4);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_2) << (32-6-2-4-4);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_3) << (32-6-2-4-4);
-    to_write |= 0xF;
+/*!
+@brief Returns TRUE if every operand of a statement, as its wide form would encode it, survives
+being encoded in a narrow form.
+*/
+static BOOL asm_narrow_fits(asm_statement * s, const asm_encoding * wide,
+                            const asm_encoding * narrow)
+{
+    unsigned int operands[4] = {s -> reg_1, s -> reg_2, s -> reg_3, s -> immediate};
+    unsigned int o;
 
-    if(format == ASCII) asm_emit_ascii(to_write, 24, file); else
-    fwrite(&to_write, sizeof(to_write), 1, file);
-    return 0;
+    for(o = 0; o < 4; o ++)
+        if(operands[o] & wide -> mask[o] & ~narrow -> mask[o])
+            return FALSE;
+    return TRUE;
 }
 
-int asm_emit_opcode_FASLR (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (32-6);
-    to_write |= ((unsigned int)statement -> condition) << (32-6-2);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_1) << (32-6-2-4);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_2) << (32-6-2-4-4);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_3) << (32-6-2-4-4);
-    to_write |= 0xF;
+/*!
+@brief Gives every MOV and ALU instruction with an immediate operand the shortest encoding its
+operands fit, then reports how many instructions of each narrow form were chosen.
+@details Runs before addresses are assigned, so nothing needs laying out again. Immediates are
+zero extended, so a value fits a narrow form if it has no bits set above the narrow immediate
+that the wide form would have kept. Labels only ever appear as branch and DATA operands, so
+every immediate seen here is already a constant.
+@param statements - The program to narrow. Addresses must not yet have been assigned.
+@returns The number of bytes saved.
+*/
+unsigned int asm_narrow_immediates(asm_statements * statements)
+{
+    unsigned int chosen[ASM_NARROW_COUNT];
+    unsigned int candidates = 0;
+    unsigned int narrowed   = 0;
+    unsigned int saved      = 0;
+    unsigned int i, n;
 
-    if(format == ASCII) asm_emit_ascii(to_write, 24, file); else
-    fwrite(&to_write, sizeof(to_write), 1, file);
-    return 0;
-}
+    memset(chosen, 0, sizeof(chosen));
 
-int asm_emit_opcode_FASRR (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (32-6);
-    to_write |= ((unsigned int)statement -> condition) << (32-6-2);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_1) << (32-6-2-4);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_2) << (32-6-2-4-4);
-    to_write |= ((unsigned int)statement -> args.reg_reg_reg.reg_3) << (32-6-2-4-4);
-    to_write |= 0xF;
+    for(i = 0; i < statements -> count; i ++)
+    {
+        asm_statement      * s    = &statements -> items[i];
+        const asm_encoding * wide = &asm_encodings[s -> opcode];
+        unsigned int         best = ASM_NARROW_COUNT;
+        BOOL                 has_narrow = FALSE;
 
-    if(format == ASCII) asm_emit_ascii(to_write, 24, file); else
-    fwrite(&to_write, sizeof(to_write), 1, file);
-    return 0;
-}
+        if(s -> flags & ASM_STATEMENT_RESOLVE_LABEL)
+            continue;
 
-int asm_emit_opcode_SLEEP (asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> opcode)    << (32-6);
-    to_write |= ((unsigned int)statement -> condition) << (32-6-2);
-    to_write |= ((unsigned int)statement -> args.reg.reg_1) << (32-6-2-5);
+        for(n = 0; n < ASM_NARROW_COUNT; n ++)
+        {
+            const asm_encoding * narrow = &asm_encodings[ASM_NARROW_FIRST + n];
+
+            if(asm_wide_forms[n] != s -> opcode)
+                continue;
+            has_narrow = TRUE;
+            if(asm_narrow_fits(s, wide, narrow) && (best == ASM_NARROW_COUNT ||
+               narrow -> size < asm_encodings[ASM_NARROW_FIRST + best].size))
+                best = n;
+        }
 
-    if(format == ASCII) asm_emit_ascii(to_write, 16, file); else
-    fwrite(&to_write, 2, 1, file);
-    return 0;
-}
+        candidates += has_narrow;
+        if(best == ASM_NARROW_COUNT)
+            continue;
 
-int asm_emit_opcode_NOT_EMITTED(asm_statement * statement, FILE * file, asm_format format){
-    unsigned int to_write  = ((unsigned int)statement -> args.immediate.immediate);
+        s -> opcode = ASM_NARROW_FIRST + best;
+        s -> size   = asm_encodings[s -> opcode].size;
+        saved      += wide -> size - s -> size;
+        narrowed   ++;
+        chosen[best] ++;
+    }
 
-    if(format == ASCII) asm_emit_ascii(to_write, 32, file); else
-    fwrite(&to_write, sizeof(to_write), 1, file);
-    return 0;
+    for(n = 0; n < ASM_NARROW_COUNT; n ++)
+        log("Narrowed %-8s %6u instructions\n", asm_encodings[ASM_NARROW_FIRST + n].name,
+            chosen[n]);
+    log("Narrowed %u of %u immediate instructions, saving %u bytes\n", narrowed, candidates,
+        saved);
+    return saved;
 }
 
-
 /*!
 @brief Responsible for writing all statements to the supplied file.
-@param statements - Linked list of statements to emit binary code for.
+@param statements - The program to emit binary code for.
 @param file - The file to write the code too.
 @param format - Whether to emit the code as raw bytes or ascii binary strings. This is used to
 feed the VHDL testbenches.
 @returns An integer representing the number of errors encountered, if any.
 */
-int asm_emit_instructions(asm_statement * statements, FILE * file, asm_format format)
+int asm_emit_instructions(asm_statements * statements, FILE * file, asm_format format)
 {
     int errors = 0;
-    asm_statement * walker = statements;
+    size_t program_size = 0;
 
-    asm_ascii_counter = 0;
+    if(statements -> count > 0)
+    {
+        asm_statement * last = &statements -> items[statements -> count - 1];
+        program_size = last -> address + last -> size - statements -> items[0].address;
+    }
 
-    while(walker != NULL)
+    // Room for the encoder's slack, and for the zero padding the ASCII writer reads.
+    size_t padding = ASM_ENCODE_SLACK > ASM_EMIT_ASCII_LINE ? ASM_ENCODE_SLACK : ASM_EMIT_ASCII_LINE;
+    unsigned char * buffer = malloc(program_size + padding);
+    if(buffer == NULL)
     {
-        switch(walker -> opcode)
-        {
-            case (LOADR ):   asm_emit_opcode_LOADR(walker, file, format); break; 
-            case (LOADI ):   asm_emit_opcode_LOADI(walker, file, format); break;  
-            case (STORI ):   asm_emit_opcode_STORI(walker, file, format); break;  
-            case (STORR ):   asm_emit_opcode_STORR(walker, file, format); break;  
-            case (PUSH  ):   asm_emit_opcode_PUSH (walker, file, format); break;  
-            case (POP   ):   asm_emit_opcode_POP  (walker, file, format); break;  
-            case (MOVR  ):   asm_emit_opcode_MOVR (walker, file, format); break;  
-            case (MOVI  ):   asm_emit_opcode_MOVI (walker, file, format); break;  
-            case (JUMPR ):   asm_emit_opcode_JUMPR(walker, file, format); break;  
-            case (JUMPI ):   asm_emit_opcode_JUMPI(walker, file, format); break;  
-            case (CALLR ):   asm_emit_opcode_CALLR(walker, file, format); break;  
-            case (CALLI ):   asm_emit_opcode_CALLI(walker, file, format); break;  
-            case (RETURN):   asm_emit_opcode_RETURN(walker, file, format); break;
-            case (TEST  ):   asm_emit_opcode_TEST (walker, file, format); break;  
-            case (HALT  ):   asm_emit_opcode_HALT (walker, file, format); break;  
-            case (ANDR  ):   asm_emit_opcode_ANDR (walker, file, format); break;  
-            case (NANDR ):   asm_emit_opcode_NANDR(walker, file, format); break;  
-            case (ORR   ):   asm_emit_opcode_ORR  (walker, file, format); break;  
-            case (NORR  ):   asm_emit_opcode_NORR (walker, file, format); break;  
-            case (XORR  ):   asm_emit_opcode_XORR (walker, file, format); break;  
-            case (LSLR  ):   asm_emit_opcode_LSLR (walker, file, format); break;  
-            case (LSRR  ):   asm_emit_opcode_LSRR (walker, file, format); break;  
-            case (NOTR  ):   asm_emit_opcode_NOTR (walker, file, format); break;  
-            case (ANDI  ):   asm_emit_opcode_ANDI (walker, file, format); break;  
-            case (NANDI ):   asm_emit_opcode_NANDI(walker, file, format); break;  
-            case (ORI   ):   asm_emit_opcode_ORI  (walker, file, format); break;  
-            case (NORI  ):   asm_emit_opcode_NORI (walker, file, format); break;  
-            case (XORI  ):   asm_emit_opcode_XORI (walker, file, format); break;  
-            case (LSLI  ):   asm_emit_opcode_LSLI (walker, file, format); break;  
-            case (LSRI  ):   asm_emit_opcode_LSRI (walker, file, format); break;  
-            case (IADDI ):   asm_emit_opcode_IADDI(walker, file, format); break;  
-            case (ISUBI ):   asm_emit_opcode_ISUBI(walker, file, format); break;  
-            case (IMULI ):   asm_emit_opcode_IMULI(walker, file, format); break;  
-            case (IDIVI ):   asm_emit_opcode_IDIVI(walker, file, format); break;  
-            case (IASRI ):   asm_emit_opcode_IASRI(walker, file, format); break;  
-            case (IADDR ):   asm_emit_opcode_IADDR(walker, file, format); break;  
-            case (ISUBR ):   asm_emit_opcode_ISUBR(walker, file, format); break;  
-            case (IMULR ):   asm_emit_opcode_IMULR(walker, file, format); break;  
-            case (IDIVR ):   asm_emit_opcode_IDIVR(walker, file, format); break;  
-            case (IASRR ):   asm_emit_opcode_IASRR(walker, file, format); break;  
-            case (FADDI ):   asm_emit_opcode_FADDI(walker, file, format); break;  
-            case (FSUBI ):   asm_emit_opcode_FSUBI(walker, file, format); break;  
-            case (FMULI ):   asm_emit_opcode_FMULI(walker, file, format); break;  
-            case (FDIVI ):   asm_emit_opcode_FDIVI(walker, file, format); break;  
-            case (FASRI ):   asm_emit_opcode_FASRI(walker, file, format); break;  
-            case (FADDR ):   asm_emit_opcode_FADDR(walker, file, format); break;  
-            case (FSUBR ):   asm_emit_opcode_FSUBR(walker, file, format); break;  
-            case (FMULR ):   asm_emit_opcode_FMULR(walker, file, format); break;  
-            case (FDIVR ):   asm_emit_opcode_FDIVR(walker, file, format); break;  
-            case (FASRR ):   asm_emit_opcode_FASRR(walker, file, format); break;  
-            case (SLEEP ):   asm_emit_opcode_SLEEP(walker, file, format); break;  
-            case (NOT_EMITTED): asm_emit_opcode_NOT_EMITTED(walker, file,format); break;
-
-            default:
-                error("Cannot emit opcode type: %d\n", walker -> opcode);
-                errors += 1;
-                break;
-        }
-        walker = walker -> next;
+        error("Could not allocate %lu bytes for the program.\n", (unsigned long)program_size);
+        return 1;
     }
+    ASM_STATS_ALLOCATED(program_size + padding);
+
+    size_t length = asm_encode_statements(statements, buffer);
+    memset(buffer + length, 0, padding);
 
-    while(asm_ascii_counter < 32)
+    if(format == ASCII)
     {
-        fprintf(file,"0");
-        asm_ascii_counter += 1;
+        errors += asm_emit_ascii(buffer, length, file);
+    }
+    else if(fwrite(buffer, 1, length, file) != length)
+    {
+        error("Could not write the program to the output file.\n");
+        errors += 1;
     }
 
+    free(buffer);
     return errors;
 }
+
+/*!
+@brief Writes the address, length and source line number of every statement to a text file, so
+tools running the program can map addresses back to the source.
+@details The first line names the source file, as `source <path>`. Every line after that is one
+statement, as its address in hex, its length in bytes and its line number, in program order.
+Statements which take up no space, such as alignment padding that was not needed, are left out.
+Lines starting with # are comments.
+@param statements - The program. Addresses must already have been calculated.
+@param source - The name of the source file, as given to the assembler.
+@param file - The file to write the table to.
+@returns An integer representing the number of errors encountered, if any.
+*/
+int asm_emit_line_table(asm_statements * statements, const char * source, FILE * file)
+{
+    unsigned int i;
+
+    fprintf(file, "# tim-asm line table: address, bytes, source line\n");
+    fprintf(file, "source %s\n", source);
+    for(i = 0; i < statements -> count; i ++)
+    {
+        asm_statement * s = &statements -> items[i];
+        if(s -> size == 0)
+            continue;
+        fprintf(file, "0x%08X %u %u\n", s -> address, s -> size, s -> line_number);
+    }
+
+    if(ferror(file))
+    {
+        error("Could not write the line table.\n");
+        return 1;
+    }
+    return 0;
+}
+
+//! }@
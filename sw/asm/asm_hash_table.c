@@ -3,89 +3,211 @@
 @{
 @file asm_hash_table.c
 @brief Contains all functions that operate on the asm_hash_table datastructure.
+@details The table uses open addressing with Robin Hood probing. Every bin stores the full hash
+of its key, so probes only compare strings when the hashes match, and an element is never further
+from its home bin than the element it displaced. The table doubles in size whenever it becomes
+more than ASM_HASH_TABLE_LOAD_PERCENT full, so lookups stay flat however many labels a program
+declares.
 */
 
 #include "asm.h"
 
+//! The smallest number of bins a table will be created with.
+#define ASM_HASH_TABLE_MIN_SIZE 16
+
+//! The table grows once more than this percentage of its bins are in use.
+#define ASM_HASH_TABLE_LOAD_PERCENT 80
+
+/*!
+@brief Returns how far the element with the given hash sits from its home bin.
+*/
+static inline int asm_hash_table_distance(asm_hash_table * table, asm_hash_key hash, int bin)
+{
+    return (bin - (int)(hash & (table -> current_size - 1))) & (table -> current_size - 1);
+}
+
+/*!
+@brief Places an element into the table, which must have room for it, without checking for
+       duplicate keys.
+*/
+static void asm_hash_table_place(asm_hash_table * table, asm_hash_key hash, char * key, void * data)
+{
+    int mask     = table -> current_size - 1;
+    int bin      = hash & mask;
+    int distance = 0;
+
+    while(table -> buckets[bin].hash != 0)
+    {
+        int resident = asm_hash_table_distance(table, table -> buckets[bin].hash, bin);
+
+        // Robin Hood: take the bin from any element closer to home than we are, and carry on
+        // looking for a home for that one instead.
+        if(resident < distance)
+        {
+            asm_hash_table_bin evicted = table -> buckets[bin];
+            table -> buckets[bin].hash = hash;
+            table -> buckets[bin].key  = key;
+            table -> buckets[bin].data = data;
+
+            hash     = evicted.hash;
+            key      = evicted.key;
+            data     = evicted.data;
+            distance = resident;
+        }
+
+        bin = (bin + 1) & mask;
+        distance ++;
+    }
+
+    table -> buckets[bin].hash = hash;
+    table -> buckets[bin].key  = key;
+    table -> buckets[bin].data = data;
+}
+
 /*!
 @brief Creates and returns a new pointer to a hash table.
-@param initial_size - The initial size of the hash table's internal data structure.
+@param initial_size - The initial size of the hash table's internal data structure. It is rounded
+       up to a power of two.
 @param tr - The newly initialised and returned hashtable. Memory space should already be declared.
 */
 void asm_hash_table_new(int initial_size, asm_hash_table * tr)
 {
+    int size = ASM_HASH_TABLE_MIN_SIZE;
+    while(size < initial_size)
+        size <<= 1;
+
     tr -> element_count = 0;
-    tr -> current_size  = initial_size;
+    tr -> current_size  = size;
 
-    tr -> buckets = calloc(initial_size, sizeof(asm_hash_table_bin));
+    tr -> buckets = calloc(size, sizeof(asm_hash_table_bin));
+    if(tr -> buckets == NULL)
+        fatal("Could not allocate a hash table of %d bins\n", size);
+    ASM_STATS_ALLOCATED(size * sizeof(asm_hash_table_bin));
 }
 
+/*!
+@brief Frees the internal data structure of a hash table. The keys and data are not freed.
+@param table - The table to free.
+*/
+void asm_hash_table_free(asm_hash_table * table)
+{
+    free(table -> buckets);
+    table -> buckets       = NULL;
+    table -> element_count = 0;
+    table -> current_size  = 0;
+}
 
-/*
+/*!
 @brief This function expands the internal datastructure of a hash table.
+@param table - The table to expand.
+@param new_size - The new number of bins. Must be a power of two and hold every element.
+@returns a status code. Zero if it worked, otherwise some integer.
 */
 int asm_hash_table_expand(asm_hash_table * table, int new_size)
 {
-    warning("Hash table expansion not implemented yet\n");
+    asm_hash_table_bin * old_buckets = table -> buckets;
+    int                  old_size    = table -> current_size;
+    int i;
+
+    table -> buckets = calloc(new_size, sizeof(asm_hash_table_bin));
+    if(table -> buckets == NULL)
+    {
+        error("Could not expand hash table to %d bins\n", new_size);
+        table -> buckets = old_buckets;
+        return 1;
+    }
+
+    table -> current_size = new_size;
+    ASM_STATS_ALLOCATED(new_size * sizeof(asm_hash_table_bin));
+
+    for(i = 0; i < old_size; i ++)
+        if(old_buckets[i].hash != 0)
+            asm_hash_table_place(table, old_buckets[i].hash, old_buckets[i].key,
+                                 old_buckets[i].data);
+
+    free(old_buckets);
     return 0;
 }
 
 /*!
-@brief Returns a hash key of a string.
+@brief Returns a hash key of a string of the given length.
+@details FNV-1a over the bytes of the string, finished with a 64 bit avalanche mix so that similar
+labels (loop_1, loop_2, ...) spread evenly over the low bits used to pick a bin. Zero is reserved
+to mark empty bins, so is never returned.
 */
-asm_hash_key asm_hash_key_string(char * string, int table_size)
+static asm_hash_key asm_hash_key_string(char * string, unsigned int length)
 {
-    int keylen = 0;
-    char start = string[keylen];
-    while(start != ';' && start != '\0')
+    unsigned long long h = 0xcbf29ce484222325ULL;
+    unsigned int i;
+
+    for(i = 0; i < length; i ++)
     {
-        keylen++;
-        start = string[keylen];
+        h ^= (unsigned char)string[i];
+        h *= 0x100000001b3ULL;
     }
 
-    int i = 0;
-    asm_hash_key tr = 0;
-    while(i < keylen)
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    asm_hash_key tr = (asm_hash_key)h;
+    return tr == 0 ? 1 : tr;
+}
+
+/*!
+@brief Returns the bin holding the given key, or NULL if the key is not in the table.
+*/
+static asm_hash_table_bin * asm_hash_table_find(asm_hash_table * table, char * key,
+                                                unsigned int length, asm_hash_key hash)
+{
+    int mask     = table -> current_size - 1;
+    int bin      = hash & mask;
+    int distance = 0;
+
+    // An element can be no further from home than any element it passes, so the search stops at
+    // the first empty bin or the first element closer to its own home than we are to ours.
+    while(table -> buckets[bin].hash != 0 &&
+          asm_hash_table_distance(table, table -> buckets[bin].hash, bin) >= distance)
     {
-        tr = (tr << 3) ^ string[i];
-        tr = tr % table_size;
-        i ++;
+        asm_hash_table_bin * candidate = &table -> buckets[bin];
+        if(candidate -> hash == hash && strncmp(candidate -> key, key, length) == 0 &&
+           candidate -> key[length] == '\0')
+            return candidate;
+
+        bin = (bin + 1) & mask;
+        distance ++;
     }
 
-    return tr;
+    return NULL;
 }
 
 /*!
 @brief Inserts an element into the hash table associated with the provided key.
 @param table - Pointer to the hash table to insert into.
-@param key - The key to the data.
+@param key - The key to the data. It is not copied, so must outlive the table.
 @param data - Pointer to the data the table will contain.
-@returns a status code. Zero if it worked, otherwise some integer.
-@todo Check that the key will fit!!
+@returns a status code. Zero if it worked, otherwise some integer. Inserting a key which is
+         already in the table fails and leaves the existing data in place.
 */
 int asm_hash_table_insert(asm_hash_table * table, char * key, void * data)
 {
+    unsigned int length = strlen(key);
+    asm_hash_key hash   = asm_hash_key_string(key, length);
 
-    asm_hash_key binkey = asm_hash_key_string(key,table -> current_size);
+    if(asm_hash_table_find(table, key, length, hash) != NULL)
+        return 1;
 
-    if(table -> buckets [binkey].data == NULL)
-    {
-        table -> buckets[binkey].data = data;
-        table -> buckets[binkey].key = key;
-        table -> buckets[binkey].used = 1;
-    }
-    else
+    if((long)(table -> element_count + 1) * 100 >
+       (long)table -> current_size * ASM_HASH_TABLE_LOAD_PERCENT)
     {
-        asm_hash_table_bin * walker = &table -> buckets[binkey];
-        while(walker -> next != NULL)
-            walker = walker -> next;
-
-        walker -> next = calloc(1, sizeof(asm_hash_table_bin));
-        walker -> next -> key = key;
-        walker -> next -> data = data;
-        walker -> next -> used = 1;
+        if(asm_hash_table_expand(table, table -> current_size * 2) != 0)
+            return 2;
     }
 
+    asm_hash_table_place(table, hash, key, data);
+
     table -> element_count ++;
     return 0;
 }
@@ -95,31 +217,24 @@ int asm_hash_table_insert(asm_hash_table * table, char * key, void * data)
        element exists.
 @param table - The table to fetch the data from.
 @param strkey - The key to the data to fetch.
-@todo Make sure the key fits into the table.
 */
 void * asm_hash_table_get(asm_hash_table * table, char * strkey)
 {
-    void * tr = NULL;
-    asm_hash_key binkey = asm_hash_key_string(strkey, table->current_size);
-    
-    if(table -> buckets[binkey].used != 0)
-    {
-        if(strcmp(table -> buckets [binkey].key, strkey)==0)
-        {
-            tr = table -> buckets[binkey].data;
-        }
-        else
-        {
-            asm_hash_table_bin * walker = &table -> buckets[binkey];
-            while(walker -> next != NULL && *walker -> key != binkey)
-                walker = walker -> next;
-
-            if(*walker -> key == binkey)
-                tr = walker -> data;
-        }
-    }
+    return asm_hash_table_get_length(table, strkey, strlen(strkey));
+}
 
-    return tr;
+/*!
+@brief As asm_hash_table_get, but the key is given as a length rather than null terminated, so it
+       may be looked up directly in the source text.
+@param table - The table to fetch the data from.
+@param key - The first character of the key.
+@param length - The number of characters in the key.
+*/
+void * asm_hash_table_get_length(asm_hash_table * table, char * key, unsigned int length)
+{
+    asm_hash_table_bin * bin = asm_hash_table_find(table, key, length,
+                                                   asm_hash_key_string(key, length));
+    return bin == NULL ? NULL : bin -> data;
 }
 
 //! }@
@@ -0,0 +1,89 @@
+/*!
+@ingroup sw-asm
+@{
+@file asm_hash_table.h
+@brief Header file for the string keyed hash table used by the assembler.
+*/
+
+#ifndef ASM_HASH_TABLE_H
+#define ASM_HASH_TABLE_H
+
+//! Typedef masking an integer to be the asm hash table key type, the full hash of a key string.
+typedef unsigned int asm_hash_key;
+
+//! Typedef for as asm hash table.
+typedef struct asm_hash_table_bin_t asm_hash_table_bin;
+
+/*!
+@brief Contains a single bin in the hashtable.
+*/
+struct asm_hash_table_bin_t
+{
+    //! The full hash of the key, or zero if the bin is empty.
+    asm_hash_key hash;
+    //! The key of the data.
+    char * key;
+    //! Pointer to the data item inserted.
+    void        * data;
+} ;
+
+/*!
+@brief Keeps a key,value pairing of elements. It's a hash table folks.
+*/
+typedef struct asm_hash_table_t
+{
+    //! A running count of the number of elements in the hashtable.
+    int         element_count;
+
+    //! The current size of the hash tables internal data structure. Always a power of two.
+    int         current_size;
+
+    //! Holds the internal data.
+    asm_hash_table_bin * buckets;
+
+} asm_hash_table;
+
+/*!
+@brief Inserts an element into the hash table associated with the provided key.
+@param table - Pointer to the hash table to insert into.
+@param key - The key to the data.
+@param data - Pointer to the data the table will contain.
+@returns a status code. Zero if it worked, otherwise some integer. Inserting a key which is
+         already in the table fails and leaves the existing data in place.
+*/
+int asm_hash_table_insert(asm_hash_table * table, char * key, void * data);
+
+/*!
+@brief Creates and returns a new pointer to a hash table.
+@param initial_size - The initial size of the hash table's internal data structure. It is rounded
+       up to a power of two, and the table grows as elements are inserted.
+@param tr - The newly initialised and returned hashtable. Memory space should already be declared.
+*/
+void asm_hash_table_new(int initial_size, asm_hash_table * tr);
+
+/*!
+@brief Frees the internal data structure of a hash table. The keys and data are not freed.
+@param table - The table to free.
+*/
+void asm_hash_table_free(asm_hash_table * table);
+
+/*!
+@brief Returns a pointer to the data stored in a hash table with the given key or NULL if no such
+       element exists.
+@param table - The table to fetch the data from.
+@param strkey - The key to the data to fetch.
+*/
+void * asm_hash_table_get(asm_hash_table * table, char * strkey);
+
+/*!
+@brief As asm_hash_table_get, but the key is given as a length rather than null terminated, so it
+       may be looked up directly in the source text.
+@param table - The table to fetch the data from.
+@param key - The first character of the key.
+@param length - The number of characters in the key.
+*/
+void * asm_hash_table_get_length(asm_hash_table * table, char * key, unsigned int length);
+
+#endif
+
+//! }@
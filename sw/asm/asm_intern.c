@@ -0,0 +1,73 @@
+/*!
+@ingroup sw-asm
+@{
+@file asm_intern.c
+@brief Contains all functions that operate on the asm_intern_pool datastructure.
+*/
+
+#include "asm.h"
+
+//! The number of symbols a new pool has room for before it first grows.
+#define ASM_INTERN_INITIAL_CAPACITY 256
+
+/*!
+@brief Initialises a new, empty interning pool.
+@param arena - The arena to allocate strings from. It must outlive the pool.
+@param tr - The newly initialised pool. Memory space should already be declared.
+*/
+void asm_intern_new(asm_arena * arena, asm_intern_pool * tr)
+{
+    tr -> arena    = arena;
+    tr -> count    = 0;
+    tr -> capacity = ASM_INTERN_INITIAL_CAPACITY;
+    tr -> names    = asm_arena_alloc(arena, tr -> capacity * sizeof(char*));
+
+    asm_hash_table_new(ASM_INTERN_INITIAL_CAPACITY * 2, &tr -> index);
+}
+
+/*!
+@brief Returns the symbol id of a string, interning a copy of it if it has not been seen before.
+@param pool - The pool to intern into.
+@param string - The first character of the string. It need not be null terminated.
+@param length - The number of characters in the string.
+@returns The symbol id of the string.
+*/
+asm_symbol asm_intern(asm_intern_pool * pool, char * string, unsigned int length)
+{
+    void * found = asm_hash_table_get_length(&pool -> index, string, length);
+    if(found != NULL)
+        return (asm_symbol)((size_t)found - 1);
+
+    if(pool -> count == pool -> capacity)
+    {
+        pool -> names     = asm_arena_grow(pool -> arena, pool -> names,
+                                           pool -> capacity * sizeof(char*),
+                                           pool -> capacity * 2 * sizeof(char*));
+        pool -> capacity *= 2;
+    }
+
+    char * copy = asm_arena_alloc(pool -> arena, length + 1);
+    memcpy(copy, string, length);
+    copy[length] = '\0';
+
+    asm_symbol tr = pool -> count;
+    pool -> names[tr] = copy;
+    pool -> count ++;
+
+    asm_hash_table_insert(&pool -> index, copy, (void*)((size_t)tr + 1));
+    return tr;
+}
+
+/*!
+@brief Releases the index held by a pool. The strings are released with the pool's arena.
+@param pool - The pool to free.
+*/
+void asm_intern_free(asm_intern_pool * pool)
+{
+    asm_hash_table_free(&pool -> index);
+    pool -> names    = NULL;
+    pool -> count    = 0;
+    pool -> capacity = 0;
+}
+
+//! }@
@@ -0,0 +1,71 @@
+/*!
+@ingroup sw-asm
+@{
+@file asm_intern.h
+@brief Header file for the string interning pool which gives every distinct label a symbol id.
+*/
+
+#ifndef ASM_INTERN_H
+#define ASM_INTERN_H
+
+//! A 32 bit id standing in for an interned string. Ids are handed out densely from zero.
+typedef unsigned int asm_symbol;
+
+//! Returned in place of a symbol when no symbol applies.
+#define ASM_SYMBOL_NONE 0xFFFFFFFFu
+
+/*!
+@brief Stores each distinct string once, and maps between strings and their symbol ids.
+@details The string bytes and the id to string array are allocated from an arena. The string to
+id index is an asm_hash_table whose data pointers hold the id plus one, so that a missing key
+(NULL) can be told apart from symbol zero.
+*/
+typedef struct asm_intern_pool_t
+{
+    //! The number of distinct strings interned so far, and the next id to be handed out.
+    unsigned int   count;
+    //! The number of ids the names array has room for.
+    unsigned int   capacity;
+    //! The null terminated string for each symbol id.
+    char        ** names;
+    //! Maps strings to their symbol ids.
+    asm_hash_table index;
+    //! The arena which owns the strings and the names array.
+    asm_arena    * arena;
+} asm_intern_pool;
+
+/*!
+@brief Initialises a new, empty interning pool.
+@param arena - The arena to allocate strings from. It must outlive the pool.
+@param tr - The newly initialised pool. Memory space should already be declared.
+*/
+void asm_intern_new(asm_arena * arena, asm_intern_pool * tr);
+
+/*!
+@brief Returns the symbol id of a string, interning a copy of it if it has not been seen before.
+@param pool - The pool to intern into.
+@param string - The first character of the string. It need not be null terminated.
+@param length - The number of characters in the string.
+@returns The symbol id of the string.
+*/
+asm_symbol asm_intern(asm_intern_pool * pool, char * string, unsigned int length);
+
+/*!
+@brief Returns the null terminated string for a symbol id.
+@param pool - The pool the symbol was interned into.
+@param symbol - The symbol id, which must have come from this pool.
+*/
+static inline char * asm_intern_name(asm_intern_pool * pool, asm_symbol symbol)
+{
+    return pool -> names[symbol];
+}
+
+/*!
+@brief Releases the index held by a pool. The strings are released with the pool's arena.
+@param pool - The pool to free.
+*/
+void asm_intern_free(asm_intern_pool * pool);
+
+#endif
+
+//! }@
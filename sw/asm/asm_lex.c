@@ -5,59 +5,159 @@
 @brief Contains all functions for turning an input text file into a token stream.
 */
 
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "asm.h"
 #include "asm_lex.h"
 
+//! The most bytes of source which can be lexed, since token offsets are unsigned ints.
+#define ASM_LEX_MAX_SOURCE UINT_MAX
+
+//! The fewest tokens a token stream starts out with room for.
+#define ASM_LEX_MIN_TOKENS 1024
+
+//! The most tokens a token stream starts out with room for, before it has to grow.
+#define ASM_LEX_MAX_INITIAL_TOKENS (1 << 20)
+
 /*!
-@brief reads and returns the rest of the current line in the file from the current cursor
-position.
-@param [in] source - The opened source code file.
-@returns The read line or NULL if the end of the file is reached.
+@brief Loads the entire contents of an input file into memory ready for lexing.
+@details Regular files are mapped read only. The mapping is placed over an anonymous reservation
+one byte longer than the file so that the trailing null character is always backed by a zeroed
+page.
+Anything which cannot be mapped is read in one go into a growing heap buffer. Sources longer than
+ASM_LEX_MAX_SOURCE bytes are refused, as token offsets could not address all of them.
+@param input - The opened input file with the seeker at the beginning of the file.
+@param source - The source structure to fill out. Memory space should already be declared.
+@returns TRUE if the file was loaded, otherwise FALSE.
 */
-char * asm_lex_file_readline(FILE * source)
+BOOL asm_lex_source_open(FILE * input, asm_lex_source * source)
 {
-    long int line_start = ftell(source);
-    int character = fgetc(source);
-    char breakout = 0;
-    char * line = NULL;
+    struct stat info;
+    int fd = fileno(input);
+
+    source -> text     = NULL;
+    source -> length   = 0;
+    source -> capacity = 0;
+    source -> mapped   = FALSE;
+
+    if(fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0)
+    {
+        if((unsigned long long)info.st_size > ASM_LEX_MAX_SOURCE)
+        {
+            error("Source is %llu bytes, more than the %u bytes that can be assembled.\n",
+                  (unsigned long long)info.st_size, ASM_LEX_MAX_SOURCE);
+            return FALSE;
+        }
+
+        size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+        size_t capacity  = (((size_t)info.st_size + 1 + page_size - 1) / page_size) * page_size;
+
+        char * reserved = mmap(NULL, capacity, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(reserved != MAP_FAILED)
+        {
+            char * text = mmap(reserved, (size_t)info.st_size, PROT_READ,
+                               MAP_PRIVATE | MAP_FIXED, fd, 0);
+            if(text != MAP_FAILED)
+            {
+                madvise(text, (size_t)info.st_size, MADV_SEQUENTIAL);
+                ASM_STATS_ALLOCATED(capacity);
+                source -> text     = text;
+                source -> length   = (size_t)info.st_size;
+                source -> capacity = capacity;
+                source -> mapped   = TRUE;
+                return TRUE;
+            }
+            munmap(reserved, capacity);
+        }
+    }
 
-    while(character != '\n' && feof(source) == 0 && character != '\r')
-        character = fgetc(source);
+    // Fall back to reading the whole stream. Used for pipes, stdin and empty files.
+    size_t capacity = 1 << 16;
+    size_t length   = 0;
+    char * text     = malloc(capacity);
 
-    long int line_end = ftell(source);
-    fgetc(source);
+    if(text == NULL)
+        return FALSE;
+    ASM_STATS_ALLOCATED(capacity);
 
-    if(feof(source))
-        breakout = 1;
+    while(1)
+    {
+        size_t read = fread(text + length, 1, capacity - length - 1, input);
+        length += read;
+
+        if(read == 0)
+            break;
+
+        if(length > ASM_LEX_MAX_SOURCE)
+        {
+            error("Source is more than the %u bytes that can be assembled.\n", ASM_LEX_MAX_SOURCE);
+            free(text);
+            return FALSE;
+        }
 
-    int line_length = line_end-line_start;
-    fseek(source, line_start, SEEK_SET);
-    line = calloc(line_length + 1, sizeof(char));
+        if(capacity - length - 1 == 0)
+        {
+            capacity *= 2;
+            char * grown = realloc(text, capacity);
+            if(grown == NULL)
+            {
+                free(text);
+                return FALSE;
+            }
+            text = grown;
+            ASM_STATS_ALLOCATED(capacity);
+        }
+    }
 
-    int i = 0;
-    for(i =0; i < line_length; i++)
-        line[i] = (char)fgetc(source);
+    if(ferror(input))
+    {
+        free(text);
+        return FALSE;
+    }
 
-    line[line_length] = '\0';
-    
-    while(character == '\n' && feof(source) != 0 && character == '\r')
-        fgetc(source);
+    text[length] = '\0';
+    source -> text     = text;
+    source -> length   = length;
+    source -> capacity = capacity;
+    source -> mapped   = FALSE;
+    return TRUE;
+}
 
-    if(breakout)
-        return NULL;
+/*!
+@brief Releases the memory held by a source opened with asm_lex_source_open.
+@param source - The source to close.
+*/
+void asm_lex_source_close(asm_lex_source * source)
+{
+    if(source -> text == NULL)
+        return;
+
+    if(source -> mapped)
+        munmap(source -> text, source -> capacity);
     else
-        return line;
+        free(source -> text);
+
+    source -> text     = NULL;
+    source -> length   = 0;
+    source -> capacity = 0;
 }
 
 /*!
-@brief Takes a three letter string and returns either an assembly register code or NO_REG if the
+@brief Takes a register string and returns either an assembly register code or REG_ERROR if the
 character code is invalid.
+@details Rather than comparing against every register name in turn, the name is decoded directly
+from its length and characters, so classification takes constant time.
 @param str - Pointer to the head of a string to check.
+@param length - The length of the string in characters.
 @returns an asm_register representing the passed two letter code. If the input code is invalid then
 REG__ERROR is returned.
 */
-tim_register asm_lex_register(char * str, int * errors, unsigned int line_number)
+tim_register asm_lex_register(char * str, unsigned int length, int * errors, unsigned int line_number)
 {
+    tim_register tr = REG_ERROR;
 
     if (str == NULL)
     {
@@ -65,234 +165,361 @@ tim_register asm_lex_register(char * str, int * errors, unsigned int line_number
         error("Line %d: NULL string passed to register lexer.\n", line_number);
         return REG_ERROR;
     }
-    else if(strcmp(str, "$R0")==0) return R0;
-    else if(strcmp(str, "$R1")==0) return R1;
-    else if(strcmp(str, "$R2")==0) return R2;
-    else if(strcmp(str, "$R3")==0) return R3;
-    else if(strcmp(str, "$R4")==0) return R4;
-    else if(strcmp(str, "$R5")==0) return R5;
-    else if(strcmp(str, "$R6")==0) return R6;
-    else if(strcmp(str, "$R7")==0) return R7;
-    else if(strcmp(str, "$R8")==0) return R8;
-    else if(strcmp(str, "$R9")==0) return R9;
-    else if(strcmp(str, "$R10")==0) return R10;
-    else if(strcmp(str, "$R11")==0) return R11;
-    else if(strcmp(str, "$R12")==0) return R12;
-    else if(strcmp(str, "$R13")==0) return R13;
-    else if(strcmp(str, "$R14")==0) return R14;
-    else if(strcmp(str, "$R15")==0) return R15;
-    else if(strcmp(str, "$PC")==0) return PC;
-    else if(strcmp(str, "$SP")==0) return SP;
-    else if(strcmp(str, "$LR")==0) return LR;
-    else if(strcmp(str, "$TR")==0) return TR;
-    else if(strcmp(str, "$SR")==0) return SR;
-    else if(strcmp(str, "$IR")==0) return IR;
-    else if(strcmp(str, "$IS")==0) return IS;
-    else if(strcmp(str, "$T0")==0) return T0;
-    else if(strcmp(str, "$T1")==0) return T1;
-    else if(strcmp(str, "$T2")==0) return T2;
-    else if(strcmp(str, "$T3")==0) return T3;
-    else if(strcmp(str, "$T4")==0) return T4;
-    else if(strcmp(str, "$T5")==0) return T5;
-    else if(strcmp(str, "$T6")==0) return T6;
-    else if(strcmp(str, "$T7")==0) return T7;
-    else 
+    else if(length == 3)
+    {
+        char c = str[2];
+        switch(str[1])
+        {
+            case 'R':
+                if(c >= '0' && c <= '9') tr = R0 + (c - '0');
+                break;
+            case 'T':
+                if(c >= '0' && c <= '7') tr = T0 + (c - '0');
+                else if(c == 'R')        tr = TR;
+                break;
+            case 'P': if(c == 'C') tr = PC; break;
+            case 'L': if(c == 'R') tr = LR; break;
+            case 'S':
+                if(c == 'P')      tr = SP;
+                else if(c == 'R') tr = SR;
+                break;
+            case 'I':
+                if(c == 'R')      tr = IR;
+                else if(c == 'S') tr = IS;
+                break;
+            default:
+                break;
+        }
+    }
+    else if(length == 4 && str[1] == 'R' && str[2] == '1' && str[3] >= '0' && str[3] <= '5')
+    {
+        tr = R10 + (str[3] - '0');
+    }
+
+    if(tr == REG_ERROR)
     {
         *errors +=1;
-        error("Line %d: Could not parse register '%s'\n", line_number, str);
-        return REG_ERROR;
+        error("Line %d: Could not parse register '%.*s'\n", line_number, length, str);
     }
+
+    return tr;
 }
 
 
 /*!
 @brief Parses a character array into an asm_immediate and returns it as a 32 bit integer.
+@details Immediates are written as a zero, a base character and then at least one digit, e.g.
+0b1010, 0d42 or 0xAB4. Digits are accumulated directly since the text is not null terminated, and
+a value which does not fit in 32 bits is an error rather than being wrapped.
 @note The value returned is not nessecerily correct. It simply has the right
 bits set to represent the immediate in memory.
 @param [in] immediate - The character representation of the immediate value.
+@param [in] length - The length of the immediate in characters.
 @param [inout] errors - pointer to an error counter for syntax errors.
 @param [in] line_num - The line number of the instruction, used for error reporting.
 @returns A tim_immediate representing the passed char array.
 */
-tim_immediate asm_lex_immediate(char * immediate, int * errors, int line_num)
+tim_immediate asm_lex_immediate(char * immediate, unsigned int length, int * errors, int line_num)
 {
-    switch(immediate[1])
+    unsigned int base;
+    unsigned int value = 0;
+    unsigned int i;
+
+    switch(length > 1 ? immediate[1] : '\0')
     {
-        case 'b':
-            return (int)strtol(&immediate[1], NULL,  2);
-        case 'd':
-            return (int)strtol(&immediate[1], NULL, 10);
-        case 'x':
-            return (int)strtol(&immediate[1], NULL, 16);
+        case 'b': base = 2;  break;
+        case 'd': base = 10; break;
+        case 'x': base = 16; break;
         default:
-            error("Could not parse immediate '%s' on line %d\n", immediate, line_num);
+            error("Could not parse immediate '%.*s' on line %d\n", length, immediate, line_num);
             *errors += 1;
-            break;
+            return 0;
+    }
+
+    if(length == 2)
+    {
+        error("Immediate '%.*s' on line %d has no digits\n", length, immediate, line_num);
+        *errors += 1;
+        return 0;
     }
 
-    return 0;
+    for(i = 2; i < length; i ++)
+    {
+        char c = immediate[i];
+        unsigned int digit;
+
+        if(c >= '0' && c <= '9')      digit = c - '0';
+        else if(c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+        else if(c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+        else                          digit = base;
+
+        if(digit >= base)
+        {
+            error("Could not parse immediate '%.*s' on line %d\n", length, immediate, line_num);
+            *errors += 1;
+            return 0;
+        }
+
+        if(value > (UINT_MAX - digit) / base)
+        {
+            error("Immediate '%.*s' on line %d does not fit in 32 bits\n", length, immediate,
+                  line_num);
+            *errors += 1;
+            return 0;
+        }
+
+        value = value * base + digit;
+    }
+
+    return (tim_immediate)value;
 }
 
+//! Packs the first six characters of a token into an integer, first character in the low byte.
+#define ASM_LEX_KEY(a,b,c,d,e,f) ((unsigned long long)(a)       | (unsigned long long)(b) <<  8 | \
+                                  (unsigned long long)(c) << 16 | (unsigned long long)(d) << 24 | \
+                                  (unsigned long long)(e) << 32 | (unsigned long long)(f) << 40)
+
+//! Multiplier for the mnemonic hash. Found by search so that no two mnemonics share a slot.
+#define ASM_LEX_MNEMONIC_MAGIC 0x5d25e22c6ae1645bULL
+
+//! Maps a packed mnemonic to its slot in the 64 entry mnemonic table.
+#define ASM_LEX_MNEMONIC_SLOT(key) ((unsigned int)(((key) * ASM_LEX_MNEMONIC_MAGIC) >> 58))
+
+//! The longest mnemonic, in characters.
+#define ASM_LEX_MNEMONIC_MAX 6
+
+//! A single slot in the mnemonic perfect hash table.
+typedef struct asm_lex_mnemonic_t{
+    //! The packed mnemonic, or zero if the slot is empty.
+    unsigned long long  key;
+    //! The opcode the mnemonic lexes to.
+    asm_lex_opcode      opcode;
+} asm_lex_mnemonic;
+
+/*!
+@brief Perfect hash table of all the lex_tok_* mnemonics, laid out at compile time.
+*/
+static const asm_lex_mnemonic asm_lex_mnemonics[64] = {
+    [ASM_LEX_MNEMONIC_SLOT(ASM_LEX_KEY('L','O','A','D',0,0))] = {ASM_LEX_KEY('L','O','A','D',0,0), LEX_LOAD},
+    [ASM_LEX_MNEMONIC_SLOT(ASM_LEX_KEY('S','T','O','R','E',0))] = {ASM_LEX_KEY('S','T','O','R','E',0), LEX_STORE},
+    [ASM_LEX_MNEMONIC_SLOT(ASM_LEX_KEY('P','U','S','H',0,0))] = {ASM_LEX_KEY('P','U','S','H',0,0), LEX_PUSH},
+    [ASM_LEX_MNEMONIC_SLOT(ASM_LEX_KEY('P','O','P',0,0,0))] = {ASM_LEX_KEY('P','O','P',0,0,0), LEX_POP},
+    [ASM_LEX_MNEMONIC_SLOT(ASM_LEX_KEY('M','O','V',0,0,0))] = {ASM_LEX_KEY('M','O','V',0,0,0), LEX_MOV},
+    [ASM_LEX_MNEMONIC_SLOT(ASM_LEX_KEY('J','U','M','P',0,0))] = {ASM_LEX_KEY('J','U','M','P',0,0), LEX_JUMP},
+    [ASM_LEX_MNEMONIC_SLOT(ASM_LEX_KEY('C','A','L','L',0,0))] = {ASM_LEX_KEY('C','A','L','L',0,0), LEX_CALL},
+    [ASM_LEX_MNEMONIC_SLOT(ASM_LEX_KEY('R','E','T','U','R','N'))] = {ASM_LEX_KEY('R','E','T','U','R','N'), LEX_RETURN},
+    [ASM_LEX_MNEMONIC_SLOT(ASM_LEX_KEY('T','E','S','T',0,0))] = {ASM_LEX_KEY('T','E','S','T',0,0), LEX_TEST},
+    [ASM_LEX_MNEMONIC_SLOT(ASM_LEX_KEY('H','A','L','T',0,0))] = {ASM_LEX_KEY('H','A','L','T',0,0), LEX_HALT},
+    [ASM_LEX_MNEMONIC_SLOT(ASM_LEX_KEY('A','N','D',0,0,0))] = {ASM_LEX_KEY('A','N','D',0,0,0), LEX_AND},
+    [ASM_LEX_MNEMONIC_SLOT(ASM_LEX_KEY('N','A','N','D',0,0))] = {ASM_LEX_KEY('N','A','N','D',0,0), LEX_NAND},
+    [ASM_LEX_MNEMONIC_SLOT(ASM_LEX_KEY('O','R',0,0,0,0))] = {ASM_LEX_KEY('O','R',0,0,0,0), LEX_OR},
+    [ASM_LEX_MNEMONIC_SLOT(ASM_LEX_KEY('N','O','R',0,0,0))] = {ASM_LEX_KEY('N','O','R',0,0,0), LEX_NOR},
+    [ASM_LEX_MNEMONIC_SLOT(ASM_LEX_KEY('X','O','R',0,0,0))] = {ASM_LEX_KEY('X','O','R',0,0,0), LEX_XOR},
+    [ASM_LEX_MNEMONIC_SLOT(ASM_LEX_KEY('L','S','L',0,0,0))] = {ASM_LEX_KEY('L','S','L',0,0,0), LEX_LSL},
+    [ASM_LEX_MNEMONIC_SLOT(ASM_LEX_KEY('L','S','R',0,0,0))] = {ASM_LEX_KEY('L','S','R',0,0,0), LEX_LSR},
+    [ASM_LEX_MNEMONIC_SLOT(ASM_LEX_KEY('N','O','T',0,0,0))] = {ASM_LEX_KEY('N','O','T',0,0,0), LEX_NOT},
+    [ASM_LEX_MNEMONIC_SLOT(ASM_LEX_KEY('I','A','D','D',0,0))] = {ASM_LEX_KEY('I','A','D','D',0,0), LEX_IADD},
+    [ASM_LEX_MNEMONIC_SLOT(ASM_LEX_KEY('I','S','U','B',0,0))] = {ASM_LEX_KEY('I','S','U','B',0,0), LEX_ISUB},
+    [ASM_LEX_MNEMONIC_SLOT(ASM_LEX_KEY('I','M','U','L',0,0))] = {ASM_LEX_KEY('I','M','U','L',0,0), LEX_IMUL},
+    [ASM_LEX_MNEMONIC_SLOT(ASM_LEX_KEY('I','D','I','V',0,0))] = {ASM_LEX_KEY('I','D','I','V',0,0), LEX_IDIV},
+    [ASM_LEX_MNEMONIC_SLOT(ASM_LEX_KEY('I','A','S','R',0,0))] = {ASM_LEX_KEY('I','A','S','R',0,0), LEX_IASR},
+    [ASM_LEX_MNEMONIC_SLOT(ASM_LEX_KEY('F','A','D','D',0,0))] = {ASM_LEX_KEY('F','A','D','D',0,0), LEX_FADD},
+    [ASM_LEX_MNEMONIC_SLOT(ASM_LEX_KEY('F','S','U','B',0,0))] = {ASM_LEX_KEY('F','S','U','B',0,0), LEX_FSUB},
+    [ASM_LEX_MNEMONIC_SLOT(ASM_LEX_KEY('F','M','U','L',0,0))] = {ASM_LEX_KEY('F','M','U','L',0,0), LEX_FMUL},
+    [ASM_LEX_MNEMONIC_SLOT(ASM_LEX_KEY('F','D','I','V',0,0))] = {ASM_LEX_KEY('F','D','I','V',0,0), LEX_FDIV},
+    [ASM_LEX_MNEMONIC_SLOT(ASM_LEX_KEY('F','A','S','R',0,0))] = {ASM_LEX_KEY('F','A','S','R',0,0), LEX_FASR},
+    [ASM_LEX_MNEMONIC_SLOT(ASM_LEX_KEY('N','O','P',0,0,0))] = {ASM_LEX_KEY('N','O','P',0,0,0), LEX_NOP},
+    [ASM_LEX_MNEMONIC_SLOT(ASM_LEX_KEY('S','L','E','E','P',0))] = {ASM_LEX_KEY('S','L','E','E','P',0), LEX_SLEEP},
+    [ASM_LEX_MNEMONIC_SLOT(ASM_LEX_KEY('D','A','T','A',0,0))] = {ASM_LEX_KEY('D','A','T','A',0,0), LEX_DATA},
+};
+
 /*!
 @brief parses a string instruction into its token typed declaration.
+@details The mnemonic is packed into an integer and looked up in a perfect hash table, so every
+opcode is classified with a single multiply and compare.
 @param instruction - head of the string containing the token
+@param length - The length of the token in characters.
 @param errors - Pointer to an error counter.
 @param line_num - The line number of the token being parsed. Helps with error reporting.
 @returns A parsed asm_lex_opcode or LEX_ERROR if no such opcode exists.
 */
-asm_lex_opcode asm_lex_instruction(char * instruction, int * errors, int line_num)
+asm_lex_opcode asm_lex_instruction(char * instruction, unsigned int length, int * errors, int line_num)
 {
-         if(strcmp(lex_tok_LOAD  , instruction) == 0) return LEX_LOAD ;   
-    else if(strcmp(lex_tok_STORE , instruction) == 0) return LEX_STORE; 
-    else if(strcmp(lex_tok_PUSH  , instruction) == 0) return LEX_PUSH ; 
-    else if(strcmp(lex_tok_POP   , instruction) == 0) return LEX_POP  ; 
-    else if(strcmp(lex_tok_MOV   , instruction) == 0) return LEX_MOV  ; 
-    else if(strcmp(lex_tok_JUMP  , instruction) == 0) return LEX_JUMP ; 
-    else if(strcmp(lex_tok_CALL  , instruction) == 0) return LEX_CALL ; 
-    else if(strcmp(lex_tok_RETURN, instruction) == 0) return LEX_RETURN; 
-    else if(strcmp(lex_tok_TEST  , instruction) == 0) return LEX_TEST ;  
-    else if(strcmp(lex_tok_HALT  , instruction) == 0) return LEX_HALT ; 
-    else if(strcmp(lex_tok_AND   , instruction) == 0) return LEX_AND  ; 
-    else if(strcmp(lex_tok_NAND  , instruction) == 0) return LEX_NAND ; 
-    else if(strcmp(lex_tok_OR    , instruction) == 0) return LEX_OR   ; 
-    else if(strcmp(lex_tok_NOR   , instruction) == 0) return LEX_NOR  ;  
-    else if(strcmp(lex_tok_XOR   , instruction) == 0) return LEX_XOR  ;  
-    else if(strcmp(lex_tok_LSL   , instruction) == 0) return LEX_LSL  ; 
-    else if(strcmp(lex_tok_LSR   , instruction) == 0) return LEX_LSR  ;  
-    else if(strcmp(lex_tok_NOT   , instruction) == 0) return LEX_NOT  ;  
-    else if(strcmp(lex_tok_IADD  , instruction) == 0) return LEX_IADD ;  
-    else if(strcmp(lex_tok_ISUB  , instruction) == 0) return LEX_ISUB ; 
-    else if(strcmp(lex_tok_IMUL  , instruction) == 0) return LEX_IMUL ; 
-    else if(strcmp(lex_tok_IDIV  , instruction) == 0) return LEX_IDIV ;
-    else if(strcmp(lex_tok_IASR  , instruction) == 0) return LEX_IASR ; 
-    else if(strcmp(lex_tok_FADD  , instruction) == 0) return LEX_FADD ;  
-    else if(strcmp(lex_tok_FSUB  , instruction) == 0) return LEX_FSUB ; 
-    else if(strcmp(lex_tok_FMUL  , instruction) == 0) return LEX_FMUL ; 
-    else if(strcmp(lex_tok_FDIV  , instruction) == 0) return LEX_FDIV ;
-    else if(strcmp(lex_tok_FASR  , instruction) == 0) return LEX_FASR ;  
-    else if(strcmp(lex_tok_NOP   , instruction) == 0) return LEX_NOP  ; 
-    else if(strcmp(lex_tok_SLEEP , instruction) == 0) return LEX_SLEEP; 
-    else if(strcmp(lex_tok_DATA  , instruction) == 0) return LEX_DATA ; 
-    else return LEX_ERROR;
+    unsigned long long key = 0;
+    unsigned int i;
+
+    if(length == 0 || length > ASM_LEX_MNEMONIC_MAX)
+        return LEX_ERROR;
+
+    for(i = 0; i < length; i ++)
+        key |= (unsigned long long)(unsigned char)instruction[i] << (8 * i);
+
+    const asm_lex_mnemonic * slot = &asm_lex_mnemonics[ASM_LEX_MNEMONIC_SLOT(key)];
+    return slot -> key == key ? slot -> opcode : LEX_ERROR;
 }
 
 /*!
-@brief Parses an entire input file into a single lexical token stream.
-@param input - The input file with the seeker at the beginning of the file.
+@brief Grows the arrays of a token stream so they can hold at least one more token.
+*/
+static void asm_lex_tokens_grow(asm_lex_tokens * tokens)
+{
+    unsigned int old = tokens -> capacity;
+    unsigned int new = old * 2;
+    asm_arena * arena = tokens -> arena;
+
+    tokens -> types        = asm_arena_grow(arena, tokens -> types, old * sizeof(unsigned char),
+                                            new * sizeof(unsigned char));
+    tokens -> values       = asm_arena_grow(arena, tokens -> values,
+                                            old * sizeof(asm_lex_token_value),
+                                            new * sizeof(asm_lex_token_value));
+    tokens -> line_numbers = asm_arena_grow(arena, tokens -> line_numbers,
+                                            old * sizeof(unsigned int), new * sizeof(unsigned int));
+    tokens -> offsets      = asm_arena_grow(arena, tokens -> offsets,
+                                            old * sizeof(unsigned int), new * sizeof(unsigned int));
+    tokens -> lengths      = asm_arena_grow(arena, tokens -> lengths,
+                                            old * sizeof(unsigned int), new * sizeof(unsigned int));
+    tokens -> capacity     = new;
+}
+
+/*!
+@brief Initialises an empty token stream with room for a number of tokens.
+*/
+static void asm_lex_tokens_new(asm_arena * arena, unsigned int capacity, asm_lex_tokens * tr)
+{
+    tr -> arena        = arena;
+    tr -> count        = 0;
+    tr -> capacity     = capacity;
+    tr -> types        = asm_arena_alloc(arena, capacity * sizeof(unsigned char));
+    tr -> values       = asm_arena_alloc(arena, capacity * sizeof(asm_lex_token_value));
+    tr -> line_numbers = asm_arena_alloc(arena, capacity * sizeof(unsigned int));
+    tr -> offsets      = asm_arena_alloc(arena, capacity * sizeof(unsigned int));
+    tr -> lengths      = asm_arena_alloc(arena, capacity * sizeof(unsigned int));
+}
+
+/*!
+@brief Lexes an entire source file into a single lexical token stream in one forward pass.
+@details Tokens are never copied out of the source text, except that each distinct label name is
+copied once into the interning pool. Each token records its offset and length in the
+struct-of-arrays token stream. The arrays start with room for one token per eight bytes of
+source, a little more than typical code needs, capped so that huge sources do not reserve more
+than they are likely to use, and double whenever they fill up. The ends of tokens and comments are
+found with the vectorised kernels in asm_scan.c. Newlines are only ever counted here, one at a
+time, as the kernels always stop at them, so line numbers stay exact.
+@param source - The source text to lex, as loaded by asm_lex_source_open.
+@param arena - The arena which will own the token arrays.
+@param labels - The pool every label name is interned into.
+@param tokens - The token stream to fill out. Memory space should already be declared.
 @param errors - pointer to an error counter.
-@returns The head of a linked list of lexer tokens representing the parsed file.
 */
-asm_lex_token *  asm_lex_input_file(FILE * input, int * errors)
+void asm_lex_source_tokens(asm_lex_source * source, asm_arena * arena, asm_intern_pool * labels,
+                           asm_lex_tokens * tokens, int * errors)
 {
-    asm_lex_token * to_return = NULL;
-    asm_lex_token * walker    = NULL;
+    char * text   = source -> text;
+    char * cursor = text;
+    char * end    = text + source -> length;
+
+    unsigned int line_number = 1;
+    size_t       capacity    = source -> length / 8 + 1;
+
+    if(capacity < ASM_LEX_MIN_TOKENS)
+        capacity = ASM_LEX_MIN_TOKENS;
+    if(capacity > ASM_LEX_MAX_INITIAL_TOKENS)
+        capacity = ASM_LEX_MAX_INITIAL_TOKENS;
 
-    char * current_line = asm_lex_file_readline(input);
-    unsigned int line_number = 0;
+    asm_lex_tokens_new(arena, capacity, tokens);
 
-    while(current_line != NULL && feof(input) == 0)
+    while(cursor < end)
     {
-        char * raw_token = strtok(current_line, "\r\n ");
+        char c = *cursor;
 
-        while (raw_token != NULL)
+        if(c == '\n')
+        {
+            line_number ++;
+            cursor ++;
+            continue;
+        }
+        else if((unsigned char)c <= ' ')
+        {
+            cursor ++;
+            continue;
+        }
+        else if(c == ';')
         {
-            char * token = NULL;
-            int token_size = 0;
+            // It is a comment, so skip the rest of this line.
+            cursor = asm_scan_newline(cursor, end);
+            continue;
+        }
 
-            if(raw_token != NULL)
-            {
-                while(raw_token[token_size] != '\0' &&
-                      raw_token[token_size] != '\r' &&
-                      raw_token[token_size] != '\n' &&
-                      raw_token[token_size] != ' ')
-                    token_size ++;
-                token = calloc(token_size+1, sizeof(char));
-                strncpy(token, raw_token, token_size);
-                token[token_size] = '\0';
-            }
+        char * token = cursor;
+        cursor = asm_scan_delimiter(cursor + 1, end);
+        unsigned int token_size = cursor - token;
 
-            char skip = 0;
-            asm_lex_token * to_add = calloc(1, sizeof(asm_lex_token));
-            to_add -> line_number = line_number;
+        char skip = 0;
+        asm_lex_token_type  type;
+        asm_lex_token_value value;
 
-            if(token[0] == ';')
-            {
-                // It is a comment, so skip the rest of this line.
-                free(to_add);
-                skip = 1;
-                break;
-            }
-            else if(token[0] == '?')
-            {
-                to_add -> type = CONDITION;
-                switch(token[1])
-                {
-                    case('A'): to_add -> value.condition = ALWAYS; break;
-                    case('T'): to_add -> value.condition = IFTRUE; break;
-                    case('F'): to_add -> value.condition = IFFALSE; break;
-                    case('Z'): to_add -> value.condition = IFZERO; break;
-                    default:
-                        error("Unknown condition code: '%c'\n", token[1]);
-                        break;
-                }
-            }
-            else if(token[0] == '$')
-            {
-                // It is a register!
-                to_add -> type = REGISTER;
-                to_add -> value.reg = asm_lex_register(token, errors, line_number);
-            }
-            else if(token[0] == '0')
-            {
-                // It is an immediate.
-                to_add -> type = IMMEDIATE;
-                to_add -> value.immediate = asm_lex_immediate(token, errors, line_number);
-            }
-            else if(token[0] == '.')
-            {
-                // It is a label
-                to_add -> type = LABEL;
-                to_add -> value.label = token;
-            }
-            else
+        if(token[0] == '?')
+        {
+            type = CONDITION;
+            switch(token_size == 2 ? token[1] : '\0')
             {
-                // Assume it is an instruction!
-                to_add -> type = OPCODE;
-                to_add -> value.opcode = asm_lex_instruction(token, errors, line_number);
-
-                if(to_add -> value.opcode == LEX_ERROR)
-                {
-                    // we don't know what it is so output an error.
-                    error("Line %d: Could not determine token type of '%s'\n", line_number, token);
+                case('A'): value.condition = ALWAYS; break;
+                case('T'): value.condition = IFTRUE; break;
+                case('F'): value.condition = IFFALSE; break;
+                case('Z'): value.condition = IFZERO; break;
+                default:
+                    error("Line %d: Unknown condition code: '%.*s'\n", line_number, token_size, token);
                     *errors += 1;
-                    free(to_add);
                     skip = 1;
-                }
+                    break;
             }
-        
-            // If it was a valid token then add it to the list.
-            if(skip == 0)
+        }
+        else if(token[0] == '$')
+        {
+            // It is a register!
+            type = REGISTER;
+            value.reg = asm_lex_register(token, token_size, errors, line_number);
+        }
+        else if(token[0] == '0')
+        {
+            // It is an immediate.
+            type = IMMEDIATE;
+            value.immediate = asm_lex_immediate(token, token_size, errors, line_number);
+        }
+        else if(token[0] == '.')
+        {
+            // It is a label, so intern its name.
+            type = LABEL;
+            value.label = asm_intern(labels, token, token_size);
+        }
+        else
+        {
+            // Assume it is an instruction!
+            type = OPCODE;
+            value.opcode = asm_lex_instruction(token, token_size, errors, line_number);
+
+            if(value.opcode == LEX_ERROR)
             {
-                if(to_return == NULL)
-                {
-                    to_return = to_add;
-                    walker    = to_add;
-                }
-                else
-                {
-                    walker -> next = to_add;
-                    walker         = to_add;
-                }
+                // we don't know what it is so output an error.
+                error("Line %d: Could not determine token type of '%.*s'\n", line_number, token_size, token);
+                *errors += 1;
+                skip = 1;
             }
+        }
 
+        // If it was a valid token then add it to the stream.
+        if(skip == 0)
+        {
+            if(tokens -> count == tokens -> capacity)
+                asm_lex_tokens_grow(tokens);
 
-            raw_token = strtok(NULL, "\r\n ");
+            unsigned int i = tokens -> count;
+            tokens -> types[i]        = (unsigned char)type;
+            tokens -> values[i]       = value;
+            tokens -> line_numbers[i] = line_number;
+            tokens -> offsets[i]      = token - text;
+            tokens -> lengths[i]      = token_size;
+            tokens -> count ++;
         }
-
-        line_number ++;
-        free(current_line);
-        current_line = asm_lex_file_readline(input);
     }
-
-    return to_return;
 }
@@ -78,16 +78,13 @@ typedef enum asm_lex_opcode_e{
     LEX_ERROR = 32
 } asm_lex_opcode;
 
-//! Type mask for a character array.
-typedef char asm_lex_label;
-
 //! Union to hold the correct value of an instruction.
 typedef union asm_lex_token_value_e{
     tim_register     reg;
     tim_immediate    immediate;
     tim_condition    condition;
     asm_lex_opcode   opcode;
-    asm_lex_label  * label;
+    asm_symbol       label;
 } asm_lex_token_value;
 
 //! The type of token that a lexer token can be.
@@ -96,25 +93,162 @@ typedef enum asm_lex_token_type_e{
     LABEL,
     REGISTER,
     IMMEDIATE,
-    CONDITION
+    CONDITION,
+    END_OF_STREAM //!< Returned when looking past the last token in a stream.
 } asm_lex_token_type;
 
 
-//! Typedef for the asm lexer token structure
-typedef struct asm_lex_token_t asm_lex_token;
-struct asm_lex_token_t{
-    asm_lex_token_type    type;
-    asm_lex_token_value   value;
-    asm_lex_token       * next;
-    unsigned int          line_number;
-};
+/*!
+@brief A stream of lexer tokens stored as a structure of arrays.
+@details Each field of the i'th token is found at index i of the corresponding array. All of the
+arrays are allocated from, and owned by, a single arena, and grow together geometrically.
+*/
+typedef struct asm_lex_tokens_t{
+    //! The number of tokens in the stream.
+    unsigned int          count;
+    //! The number of tokens the arrays have room for.
+    unsigned int          capacity;
+    //! The asm_lex_token_type of each token.
+    unsigned char       * types;
+    //! The value of each token.
+    asm_lex_token_value * values;
+    //! The source line each token was found on.
+    unsigned int        * line_numbers;
+    //! Offset in bytes of the first character of each token in the source text.
+    unsigned int        * offsets;
+    //! Length in bytes of each token in the source text.
+    unsigned int        * lengths;
+    //! The arena which owns the arrays.
+    asm_arena           * arena;
+} asm_lex_tokens;
+
+/*!
+@brief An index based position within a token stream, used by the parser to walk it.
+*/
+typedef struct asm_lex_cursor_t{
+    //! The stream being walked.
+    asm_lex_tokens      * tokens;
+    //! The index of the current token.
+    unsigned int          index;
+} asm_lex_cursor;
+
+/*!
+@brief Returns TRUE if the cursor has moved past the last token in its stream.
+*/
+static inline BOOL asm_lex_cursor_done(asm_lex_cursor * cursor)
+{
+    return cursor -> index >= cursor -> tokens -> count;
+}
+
+/*!
+@brief Returns the type of the token a number of places ahead of the cursor.
+@returns The token type, or END_OF_STREAM if that would be past the end of the stream.
+*/
+static inline asm_lex_token_type asm_lex_cursor_type(asm_lex_cursor * cursor, unsigned int ahead)
+{
+    unsigned int i = cursor -> index + ahead;
+    return i < cursor -> tokens -> count ? (asm_lex_token_type)cursor -> tokens -> types[i] :
+                                           END_OF_STREAM;
+}
+
+/*!
+@brief Returns the value of the token a number of places ahead of the cursor.
+@returns The token value, or a zeroed value if that would be past the end of the stream.
+*/
+static inline asm_lex_token_value asm_lex_cursor_value(asm_lex_cursor * cursor, unsigned int ahead)
+{
+    unsigned int i = cursor -> index + ahead;
+    asm_lex_token_value none = {0};
+    return i < cursor -> tokens -> count ? cursor -> tokens -> values[i] : none;
+}
+
+/*!
+@brief Returns the source line number of the current token, or of the last token if the cursor
+has reached the end of the stream.
+*/
+static inline unsigned int asm_lex_cursor_line(asm_lex_cursor * cursor)
+{
+    asm_lex_tokens * tokens = cursor -> tokens;
+    if(tokens -> count == 0)
+        return 0;
+    return tokens -> line_numbers[cursor -> index < tokens -> count ? cursor -> index :
+                                                                     tokens -> count - 1];
+}
+
+/*!
+@brief Moves the cursor forward a number of tokens, stopping at the end of the stream.
+*/
+static inline void asm_lex_cursor_advance(asm_lex_cursor * cursor, unsigned int count)
+{
+    cursor -> index += count;
+    if(cursor -> index > cursor -> tokens -> count)
+        cursor -> index = cursor -> tokens -> count;
+}
+
+/*!
+@brief Classifies a register token such as `$R4` or `$PC` in constant time.
+@param str - The token text, which need not be null terminated.
+@param length - The length of the token in characters.
+@param errors - Pointer to an error counter, incremented if the register is unknown.
+@param line_number - The source line of the token, used for error reporting.
+@returns The register, or REG_ERROR if the token does not name one.
+*/
+tim_register asm_lex_register(char * str, unsigned int length, int * errors, unsigned int line_number);
+
+/*!
+@brief Classifies an opcode mnemonic such as `LOAD` in constant time.
+@param instruction - The token text, which need not be null terminated.
+@param length - The length of the token in characters.
+@param errors - Pointer to an error counter.
+@param line_num - The source line of the token.
+@returns The opcode, or LEX_ERROR if the token is not a mnemonic.
+*/
+asm_lex_opcode asm_lex_instruction(char * instruction, unsigned int length, int * errors, int line_num);
+
+/*!
+@brief Holds the entire text of a source file in memory.
+@details Regular files are memory mapped, anything else (pipes, stdin) is read into a single
+heap buffer. Either way the text is always followed by a null character so the lexer can scan it
+without bounds checks, and tokens can refer to it by offset and length rather than by copies.
+*/
+typedef struct asm_lex_source_t{
+    //! The text of the source file, followed by a null character.
+    char        * text;
+    //! The length of the text in bytes, not including the trailing null character.
+    size_t        length;
+    //! The number of bytes mapped or allocated for text.
+    size_t        capacity;
+    //! TRUE if text is a memory mapping, FALSE if it is a heap buffer.
+    BOOL          mapped;
+} asm_lex_source;
+
+/*!
+@brief Loads the entire contents of an input file into memory ready for lexing.
+@param input - The opened input file with the seeker at the beginning of the file.
+@param source - The source structure to fill out. Memory space should already be declared.
+@returns TRUE if the file was loaded, otherwise FALSE.
+*/
+BOOL asm_lex_source_open(FILE * input, asm_lex_source * source);
+
+/*!
+@brief Releases the memory held by a source opened with asm_lex_source_open.
+@details Any tokens lexed from the source refer to its text, so they must not be used once it has
+been closed.
+@param source - The source to close.
+*/
+void asm_lex_source_close(asm_lex_source * source);
 
 /*!
-@brief Parses an entire input file into a single lexical token stream.
-@param input - The input file with the seeker at the beginning of the file.
+@brief Lexes an entire source file into a single lexical token stream in one forward pass.
+@details Label tokens are interned, so each carries the symbol id of its name rather than a
+pointer into the source text.
+@param source - The source text to lex, as loaded by asm_lex_source_open.
+@param arena - The arena which will own the token arrays.
+@param labels - The pool every label name is interned into.
+@param tokens - The token stream to fill out. Memory space should already be declared.
 @param errors - pointer to an error counter.
-@returns The head of a linked list of lexer tokens representing the parsed file.
 */
-asm_lex_token *  asm_lex_input_file(FILE * input, int * errors);
+void asm_lex_source_tokens(asm_lex_source * source, asm_arena * arena, asm_intern_pool * labels,
+                           asm_lex_tokens * tokens, int * errors);
 
 #endif
@@ -10,68 +10,61 @@
 /*!
 @brief Responsible for parsing Jump and call instructions.
 @param [inout] statement - Resulting statment to set members of.
-@param [in] token - The token which to parse into a statement. Several subsequent tokens may also
-be eaten.
+@param [inout] cursor - Points at the opcode token to parse into a statement. It is moved past the
+last token eaten by this function.
 @param errors - Error counter pointer.
-@returns The next token that should be parsed, i.e. the one following the last token eaten by this
-function.
 */
-asm_lex_token * asm_parse_call_jump(asm_statement * statement, asm_lex_token * token, int * errors)
+void asm_parse_call_jump(asm_statement * statement, asm_lex_cursor * cursor, int * errors)
 {
-    asm_lex_token * opcode  = token;
-    asm_lex_token * operand = opcode -> next;
+    asm_lex_opcode      opcode       = asm_lex_cursor_value(cursor, 0).opcode;
+    asm_lex_token_type  operand_type = asm_lex_cursor_type(cursor, 1);
+    asm_lex_token_value operand      = asm_lex_cursor_value(cursor, 1);
 
-    if(opcode -> value.opcode == LEX_JUMP)
+    if(opcode == LEX_JUMP)
     {
-        if(operand -> type == REGISTER)
+        if(operand_type == REGISTER)
         {
             statement -> opcode = JUMPR;
-            statement -> args.reg.reg_1 = operand -> value.reg;
-            statement -> size = 2;
+            statement -> reg_1 = operand.reg;
         }
-        else if(operand -> type == IMMEDIATE)
+        else if(operand_type == IMMEDIATE)
         {
             statement -> opcode = JUMPI;
-            statement -> args.immediate.immediate = operand -> value.immediate;
-            statement -> size = 4;
+            statement -> immediate = operand.immediate;
         }
-        else if(operand -> type == LABEL)
+        else if(operand_type == LABEL)
         {
             statement -> opcode = JUMPI;
-            statement -> args.immediate_label.label = operand -> value.label;
-            statement -> label_to_resolve = TRUE;
-            statement -> size = 4;
+            statement -> label = operand.label;
+            statement -> flags |= ASM_STATEMENT_RESOLVE_LABEL;
         }
         else
         {
-            error("Invalid operand to JUMP instruction of type %d\n", operand -> type);
+            error("Invalid operand to JUMP instruction of type %d\n", operand_type);
             *errors+=1;
         }
     }
-    else if(opcode -> value.opcode == LEX_CALL)
+    else if(opcode == LEX_CALL)
     {
-        if(operand -> type == REGISTER)
+        if(operand_type == REGISTER)
         {
             statement -> opcode = CALLR;
-            statement -> args.reg.reg_1 = operand -> value.reg;
-            statement -> size = 2;
+            statement -> reg_1 = operand.reg;
         }
-        else if(operand -> type == IMMEDIATE)
+        else if(operand_type == IMMEDIATE)
         {
             statement -> opcode = CALLI;
-            statement -> args.immediate.immediate = operand -> value.immediate;
-            statement -> size = 4;
+            statement -> immediate = operand.immediate;
         }
-        else if(operand -> type == LABEL)
+        else if(operand_type == LABEL)
         {
             statement -> opcode = CALLI;
-            statement -> args.immediate_label.label = operand -> value.label;
-            statement -> label_to_resolve = TRUE;
-            statement -> size = 4;
+            statement -> label = operand.label;
+            statement -> flags |= ASM_STATEMENT_RESOLVE_LABEL;
         }
         else
         {
-            error("Invalid operand to CALL instruction of type %d\n", operand -> type);
+            error("Invalid operand to CALL instruction of type %d\n", operand_type);
             *errors+=1;
         }
     }
@@ -81,38 +74,33 @@ asm_lex_token * asm_parse_call_jump(asm_statement * statement, asm_lex_token * t
         *errors+=1;
     }
 
-    return operand -> next;
+    asm_lex_cursor_advance(cursor, 2);
 }
 
 
 /*!
 @brief Responsible for parsing instructions with three register operands.
 @param [inout] statement - Resulting statment to set members of.
-@param [in] token - The token which to parse into a statement. Several subsequent tokens may also
-be eaten.
+@param [inout] cursor - Points at the opcode token to parse into a statement. It is moved past the
+last token eaten by this function.
 @param errors - Error counter pointer.
-@returns The next token that should be parsed, i.e. the one following the last token eaten by this
-function.
 */
-asm_lex_token * asm_parse_three_register_operands(asm_statement * statement, asm_lex_token * token, int * errors)
+void asm_parse_three_register_operands(asm_statement * statement, asm_lex_cursor * cursor, int * errors)
 {
-    asm_lex_token * opcode    = token;
-    asm_lex_token * operand_1 = opcode    -> next;
-    asm_lex_token * operand_2 = operand_1 -> next;
-    asm_lex_token * operand_3 = operand_2 -> next;
-    
-    assert(opcode -> type == OPCODE);
-    assert(operand_1 -> type == REGISTER);
-    assert(operand_2 -> type == REGISTER);
-    assert(operand_3 -> type == REGISTER);
-
-    statement -> args.reg_reg_reg.reg_1 = operand_1 -> value.reg;
-    statement -> args.reg_reg_reg.reg_2 = operand_2 -> value.reg;
-    statement -> args.reg_reg_reg.reg_3 = operand_3 -> value.reg;
-
-    statement -> size = 3;
-    
-    switch(opcode -> value.opcode)
+    asm_lex_opcode opcode = asm_lex_cursor_value(cursor, 0).opcode;
+
+    assert(asm_lex_cursor_type(cursor, 0) == OPCODE);
+    assert(asm_lex_cursor_type(cursor, 1) == REGISTER);
+    assert(asm_lex_cursor_type(cursor, 2) == REGISTER);
+    assert(asm_lex_cursor_type(cursor, 3) == REGISTER);
+
+    statement -> reg_1 = asm_lex_cursor_value(cursor, 1).reg;
+    statement -> reg_2 = asm_lex_cursor_value(cursor, 2).reg;
+    statement -> reg_3 = asm_lex_cursor_value(cursor, 3).reg;
+
+    asm_lex_cursor_advance(cursor, 4);
+
+    switch(opcode)
     {
         case(LEX_LOAD):  statement -> opcode = LOADR; break;
         case(LEX_STORE): statement -> opcode = STORR; break;
@@ -136,45 +124,38 @@ asm_lex_token * asm_parse_three_register_operands(asm_statement * statement, asm
 
         case(LEX_ERROR):
             error("Bad Token!\n");
-            return operand_3 -> next;
+            return;
 
         default:
-            error("This function doesnt support parsing of asm opcode %d \n", opcode -> value.opcode);
-            return operand_3 -> next;
+            error("This function doesnt support parsing of asm opcode %d \n", opcode);
+            return;
 
     }
-
-    return operand_3 -> next;
 }
 
 /*!
 @brief Responsible for parsing instructions with two register operands and one immediate operand.
 @param [inout] statement - Resulting statment to set members of.
-@param [in] token - The token which to parse into a statement. Several subsequent tokens may also
-be eaten.
+@param [inout] cursor - Points at the opcode token to parse into a statement. It is moved past the
+last token eaten by this function.
 @param errors - Error counter pointer.
-@returns The next token that should be parsed, i.e. the one following the last token eaten by this
-function.
 */
-asm_lex_token * asm_parse_two_register_one_immediate(asm_statement * statement, asm_lex_token * token, int * errors)
+void asm_parse_two_register_one_immediate(asm_statement * statement, asm_lex_cursor * cursor, int * errors)
 {
-    asm_lex_token * opcode    = token;
-    asm_lex_token * operand_1 = opcode    -> next;
-    asm_lex_token * operand_2 = operand_1 -> next;
-    asm_lex_token * operand_3 = operand_2 -> next;
-    
-    assert(opcode -> type == OPCODE);
-    assert(operand_1 -> type == REGISTER);
-    assert(operand_2 -> type == REGISTER);
-    assert(operand_3 -> type == IMMEDIATE);
-
-    statement -> args.reg_reg_immediate.reg_1 = operand_1 -> value.reg;
-    statement -> args.reg_reg_immediate.reg_2 = operand_2 -> value.reg;
-    statement -> args.reg_reg_immediate.immediate = operand_3 -> value.immediate;
-
-    statement -> size = 3;
-    
-    switch(opcode -> value.opcode)
+    asm_lex_opcode opcode = asm_lex_cursor_value(cursor, 0).opcode;
+
+    assert(asm_lex_cursor_type(cursor, 0) == OPCODE);
+    assert(asm_lex_cursor_type(cursor, 1) == REGISTER);
+    assert(asm_lex_cursor_type(cursor, 2) == REGISTER);
+    assert(asm_lex_cursor_type(cursor, 3) == IMMEDIATE);
+
+    statement -> reg_1 = asm_lex_cursor_value(cursor, 1).reg;
+    statement -> reg_2 = asm_lex_cursor_value(cursor, 2).reg;
+    statement -> immediate = asm_lex_cursor_value(cursor, 3).immediate;
+
+    asm_lex_cursor_advance(cursor, 4);
+
+    switch(opcode)
     {
         case(LEX_LOAD):  statement -> opcode = LOADI; break;
         case(LEX_STORE): statement -> opcode = STORI; break;
@@ -198,46 +179,40 @@ asm_lex_token * asm_parse_two_register_one_immediate(asm_statement * statement,
 
         case(LEX_ERROR):
             error("Bad Token!\n");
-            return operand_3 -> next;
+            return;
 
         default:
-            error("This function doesnt support parsing of asm opcode %d \n", opcode -> value.opcode);
-            return operand_3 -> next;
+            error("This function doesnt support parsing of asm opcode %d \n", opcode);
+            return;
 
     }
-
-    return operand_3 -> next;
 }
 
 
 /*!
 @brief Responsible for parsing instructions with three operands..
 @param [inout] statement - Resulting statment to set members of.
-@param [in] token - The token which to parse into a statement. Several subsequent tokens may also
-be eaten.
+@param [inout] cursor - Points at the opcode token to parse into a statement. It is moved past the
+last token eaten by this function.
 @param errors - Error counter pointer.
-@returns The next token that should be parsed, i.e. the one following the last token eaten by this
-function.
 */
-asm_lex_token * asm_parse_three_operand(asm_statement * statement, asm_lex_token * token, int * errors)
+void asm_parse_three_operand(asm_statement * statement, asm_lex_cursor * cursor, int * errors)
 {
-    asm_lex_token * opcode    = token;
-    asm_lex_token * operand_1 = opcode    -> next;
-    asm_lex_token * operand_2 = operand_1 -> next;
-    asm_lex_token * operand_3 = operand_2 -> next;
+    asm_lex_token_type operand_3 = asm_lex_cursor_type(cursor, 3);
 
-    if(operand_3->type == IMMEDIATE)
+    if(operand_3 == IMMEDIATE)
     {
-        return asm_parse_two_register_one_immediate(statement, opcode, errors);
+        asm_parse_two_register_one_immediate(statement, cursor, errors);
     }
-    else if(operand_3->type == REGISTER)
+    else if(operand_3 == REGISTER)
     {
-        return asm_parse_three_register_operands(statement, opcode, errors);
+        asm_parse_three_register_operands(statement, cursor, errors);
     }
     else
     {
-        error("Line %d: Expected immediate or register, but got token type %d\n", operand_3->line_number, operand_3->type);
-        return operand_3 -> next;
+        error("Line %d: Expected immediate or register, but got token type %d\n",
+              asm_lex_cursor_line(cursor), operand_3);
+        asm_lex_cursor_advance(cursor, 4);
     }
 
 }
@@ -246,325 +221,348 @@ asm_lex_token * asm_parse_three_operand(asm_statement * statement, asm_lex_token
 /*!
 @brief Parses instructions that take two operands. NOT, TEST, MOV
 @param [inout] statement - Resulting statment to set members of.
-@param [in] token - The token which to parse into a statement. Several subsequent tokens may also
-be eaten.
+@param [inout] cursor - Points at the opcode token to parse into a statement. It is moved past the
+last token eaten by this function.
 @param errors - Error counter pointer.
-@returns The next token that should be parsed, i.e. the one following the last token eaten by this
-function.
 */
-asm_lex_token * asm_parse_two_operand(asm_statement * statement, asm_lex_token * token, int * errors)
+void asm_parse_two_operand(asm_statement * statement, asm_lex_cursor * cursor, int * errors)
 {
-    asm_lex_token * opcode    = token;
-    asm_lex_token * operand_1 = opcode    -> next;
-    asm_lex_token * operand_2 = operand_1 -> next;
+    asm_lex_opcode      opcode    = asm_lex_cursor_value(cursor, 0).opcode;
+    asm_lex_token_value operand_1 = asm_lex_cursor_value(cursor, 1);
+    asm_lex_token_value operand_2 = asm_lex_cursor_value(cursor, 2);
 
-    if(opcode -> value.opcode == LEX_NOT)
+    if(opcode == LEX_NOT)
     {
         statement -> opcode = NOTR;
-        statement -> size   = 2;
-        statement -> args.reg_reg.reg_1 = operand_1 -> value.reg;
-        statement -> args.reg_reg.reg_2 = operand_2 -> value.reg;
+        statement -> reg_1 = operand_1.reg;
+        statement -> reg_2 = operand_2.reg;
     }
-    else if(opcode -> value.opcode == LEX_TEST)
+    else if(opcode == LEX_TEST)
     {
         statement -> opcode = TEST;
-        statement -> size   = 3;
-        statement -> args.reg_reg.reg_1 = operand_1 -> value.reg;
-        statement -> args.reg_reg.reg_2 = operand_2 -> value.reg;
+        statement -> reg_1 = operand_1.reg;
+        statement -> reg_2 = operand_2.reg;
     }
-    else if(opcode -> value.opcode == LEX_MOV)
+    else if(opcode == LEX_MOV)
     {
-        if(operand_2 -> type == IMMEDIATE)
+        if(asm_lex_cursor_type(cursor, 2) == IMMEDIATE)
         {
             statement -> opcode = MOVI;
-            statement -> size   = 4;
-            statement -> args.reg_immediate.reg_1 = operand_1 -> value.reg;
-            statement -> args.reg_immediate.immediate= operand_2 -> value.immediate;
+            statement -> reg_1 = operand_1.reg;
+            statement -> immediate= operand_2.immediate;
         }
         else
         {
             statement -> opcode = MOVR;
-            statement -> size   = 3;
-            statement -> args.reg_reg.reg_1 = operand_1 -> value.reg;
-            statement -> args.reg_reg.reg_2 = operand_2 -> value.reg;
+            statement -> reg_1 = operand_1.reg;
+            statement -> reg_2 = operand_2.reg;
         }
     }
     else
     {
-        error("This function doesnt support parsing of asm opcode %d \n", opcode -> value.opcode);
+        error("This function doesnt support parsing of asm opcode %d \n", opcode);
         *errors += 1;
     }
 
-    return operand_2 -> next;
+    asm_lex_cursor_advance(cursor, 3);
 }
 
 /*!
 @brief Responsible for parsing DATA elements
 @param [inout] statement - Resulting statment to set members of.
-@param [in] token - The token which to parse into a statement. Several subsequent tokens may also
-be eaten.
+@param [inout] cursor - Points at the opcode token to parse into a statement. It is moved past the
+last token eaten by this function.
 @param errors - Error counter pointer.
-@returns The next token that should be parsed, i.e. the one following the last token eaten by this
-function.
 */
-asm_lex_token * asm_parse_data(asm_statement * statement, asm_lex_token * token, int * errors)
+void asm_parse_data(asm_statement * statement, asm_lex_cursor * cursor, int * errors)
 {
-    asm_lex_token * opcode    = token;
-    asm_lex_token * operand_1 = opcode    -> next;
+    asm_lex_token_type  operand_type = asm_lex_cursor_type(cursor, 1);
+    asm_lex_token_value operand_1    = asm_lex_cursor_value(cursor, 1);
 
     statement -> opcode = NOT_EMITTED;
-    statement -> size = 4;
-    if(operand_1 -> type == IMMEDIATE)
+    if(operand_type == IMMEDIATE)
     {
-        statement -> args.immediate.immediate = operand_1 -> value.immediate;
-        statement -> label_to_resolve = FALSE;
+        statement -> immediate = operand_1.immediate;
     }
-    else if(operand_1 -> type == LABEL)
+    else if(operand_type == LABEL)
     {
-        statement -> args.immediate_label.label = operand_1 -> value.label;
-        statement -> label_to_resolve = TRUE;
+        statement -> label = operand_1.label;
+        statement -> flags |= ASM_STATEMENT_RESOLVE_LABEL;
     }
     else
     {
-        error("Invalid operand type for DATA instruction: %d\n", operand_1 -> type);
+        error("Invalid operand type for DATA instruction: %d\n", operand_type);
         *errors += 1;
     }
 
-    return operand_1 -> next;
+    asm_lex_cursor_advance(cursor, 2);
 }
 
 /*!
 @brief Responsible for parsing SLEEP instructions.
 @param [inout] statement - Resulting statment to set members of.
-@param [in] token - The token which to parse into a statement. Several subsequent tokens may also
-be eaten.
+@param [inout] cursor - Points at the opcode token to parse into a statement. It is moved past the
+last token eaten by this function.
 @param errors - Error counter pointer.
-@returns The next token that should be parsed, i.e. the one following the last token eaten by this
-function.
 */
-asm_lex_token * asm_parse_sleep(asm_statement * statement, asm_lex_token * token, int * errors)
+void asm_parse_sleep(asm_statement * statement, asm_lex_cursor * cursor, int * errors)
 {
-    asm_lex_token * opcode    = token;
-    asm_lex_token * operand_1 = opcode    -> next;
-
     statement -> opcode = SLEEP;
-    statement -> size = 2;
-    statement -> args.reg.reg_1= operand_1 -> value.reg;
+    statement -> reg_1= asm_lex_cursor_value(cursor, 1).reg;
 
-    return operand_1 -> next;
+    asm_lex_cursor_advance(cursor, 2);
 }
 
 /*!
 @brief Responsible for parsing NOP instructions.
-@details NOP is actually a pseudo instruction which assembles into `ANDR $R0 $R0 $R0`
+@details NOP is actually a pseudo instruction which assembles into the one byte NOPS, which unlike
+an ANDR leaves the status register alone.
 @param [inout] statement - Resulting statment to set members of.
-@param [in] token - The token which to parse into a statement. Several subsequent tokens may also
-be eaten.
+@param [inout] cursor - Points at the opcode token to parse into a statement. It is moved past the
+last token eaten by this function.
 @param errors - Error counter pointer.
-@returns The next token that should be parsed, i.e. the one following the last token eaten by this
-function.
 */
-asm_lex_token * asm_parse_nop(asm_statement * statement, asm_lex_token * token, int * errors)
+void asm_parse_nop(asm_statement * statement, asm_lex_cursor * cursor, int * errors)
 {
-    asm_lex_token * opcode    = token;
-
-    statement -> opcode = ANDR;
-    statement -> size = 3;
-    statement -> args.reg_reg_reg.reg_1= R0;
-    statement -> args.reg_reg_reg.reg_2= R0;
-    statement -> args.reg_reg_reg.reg_3= R0;
+    statement -> opcode = NOPS;
+    statement -> flags |= ASM_STATEMENT_NOP;
 
-    return opcode -> next;
+    asm_lex_cursor_advance(cursor, 1);
 }
 
 /*!
 @brief Responsible for parsing PUSH and POP instructions.
 @param [inout] statement - Resulting statment to set members of.
-@param [in] token - The token which to parse into a statement. Several subsequent tokens may also
-be eaten.
+@param [inout] cursor - Points at the opcode token to parse into a statement. It is moved past the
+last token eaten by this function.
 @param errors - Error counter pointer.
-@returns The next token that should be parsed, i.e. the one following the last token eaten by this
-function.
 */
-asm_lex_token * asm_parse_push_pop(asm_statement * statement, asm_lex_token * token, int * errors)
+void asm_parse_push_pop(asm_statement * statement, asm_lex_cursor * cursor, int * errors)
 {
-    asm_lex_token * opcode    = token;
-    asm_lex_token * operand_1 = opcode    -> next;
+    asm_lex_opcode opcode = asm_lex_cursor_value(cursor, 0).opcode;
 
-    statement -> size = 2;
-    statement -> args.reg.reg_1 = operand_1 -> value.reg;
+    statement -> reg_1 = asm_lex_cursor_value(cursor, 1).reg;
 
-    if(opcode -> value.opcode == LEX_POP)
+    if(opcode == LEX_POP)
     {
         statement -> opcode = POP;
     }
-    else if(opcode -> value.opcode == LEX_PUSH)
+    else if(opcode == LEX_PUSH)
     {
         statement -> opcode = PUSH;
     }
     else
     {
-        error("This function doesnt support parsing of asm opcode %d \n", opcode -> value.opcode);
+        error("This function doesnt support parsing of asm opcode %d \n", opcode);
     }
 
-    return operand_1 -> next;
+    asm_lex_cursor_advance(cursor, 2);
 }
 
 
 /*!
-@brief Responsible for selecting which function should parse the next few tokens.:w
-@param token - The token containing the  label value
+@brief Responsible for selecting which function should parse the next few tokens.
 @param statement - The statement to parse the tokens into.
+@param cursor - Points at the opcode token. It is moved past the last token of the instruction.
 @param errors - Pointer to an error counter.
-@returns the next token to be parsed.
 */
-asm_lex_token * asm_parse_opcode(asm_statement * statement, asm_lex_token * token, int * errors)
+void asm_parse_opcode(asm_statement * statement, asm_lex_cursor * cursor, int * errors)
 {
-    assert(token -> type == OPCODE);
+    if(asm_lex_cursor_type(cursor, 0) != OPCODE)
+    {
+        error("Line %d: Expected an opcode but got token type %d\n", asm_lex_cursor_line(cursor),
+              asm_lex_cursor_type(cursor, 0));
+        *errors += 1;
+        asm_lex_cursor_advance(cursor, 1);
+        return;
+    }
+
+    asm_lex_opcode opcode = asm_lex_cursor_value(cursor, 0).opcode;
 
-    switch(token -> value.opcode)
+    switch(opcode)
     {
         case(LEX_JUMP):
         case(LEX_CALL):
-            return asm_parse_call_jump(statement, token, errors);
+            asm_parse_call_jump(statement, cursor, errors);
+            return;
 
         case(LEX_MOV):
         case(LEX_NOT):
         case(LEX_TEST):
-            return asm_parse_two_operand(statement, token, errors);
-        
+            asm_parse_two_operand(statement, cursor, errors);
+            return;
+
         case(LEX_LOAD):
         case(LEX_STORE):
-        case(LEX_AND ): 
-        case(LEX_NAND): 
-        case(LEX_OR  ): 
-        case(LEX_NOR ): 
-        case(LEX_XOR ): 
-        case(LEX_LSL ): 
-        case(LEX_LSR ): 
-        case(LEX_IADD): 
-        case(LEX_ISUB): 
-        case(LEX_IMUL): 
-        case(LEX_IDIV): 
-        case(LEX_IASR): 
-        case(LEX_FADD): 
-        case(LEX_FSUB): 
-        case(LEX_FMUL): 
-        case(LEX_FDIV): 
-        case(LEX_FASR): 
-            return asm_parse_three_operand(statement, token,errors);
+        case(LEX_AND ):
+        case(LEX_NAND):
+        case(LEX_OR  ):
+        case(LEX_NOR ):
+        case(LEX_XOR ):
+        case(LEX_LSL ):
+        case(LEX_LSR ):
+        case(LEX_IADD):
+        case(LEX_ISUB):
+        case(LEX_IMUL):
+        case(LEX_IDIV):
+        case(LEX_IASR):
+        case(LEX_FADD):
+        case(LEX_FSUB):
+        case(LEX_FMUL):
+        case(LEX_FDIV):
+        case(LEX_FASR):
+            asm_parse_three_operand(statement, cursor, errors);
+            return;
 
         case(LEX_PUSH):
         case(LEX_POP):
-            return asm_parse_push_pop(statement, token, errors);
+            asm_parse_push_pop(statement, cursor, errors);
+            return;
 
         case(LEX_HALT):
             statement -> opcode = HALT;
-            statement -> size = 1;
-            return token -> next;
+            asm_lex_cursor_advance(cursor, 1);
+            return;
 
         case(LEX_DATA):
-            return asm_parse_data(statement, token, errors);
+            asm_parse_data(statement, cursor, errors);
+            return;
 
         case(LEX_SLEEP):
-            return asm_parse_sleep(statement, token, errors);
+            asm_parse_sleep(statement, cursor, errors);
+            return;
 
         case(LEX_NOP):
-            return asm_parse_nop(statement, token, errors);
+            asm_parse_nop(statement, cursor, errors);
+            return;
 
         case(LEX_RETURN):
             warning("RETURN opcode not yet implemented correctly.\n");
             statement -> opcode = RETURN;
-            return token -> next;
+            asm_lex_cursor_advance(cursor, 1);
+            return;
 
         case(LEX_ERROR):
             error("Bad Token!\n");
-            return token -> next;
+            asm_lex_cursor_advance(cursor, 1);
+            return;
 
         default:
-            error("Unknown asm opcode: %d\n", token -> value.opcode);
-            return token -> next;
+            error("Unknown asm opcode: %d\n", opcode);
+            asm_lex_cursor_advance(cursor, 1);
+            return;
     }
 }
 
 
 /*!
-@brief Responsible for adding a label declaration and associated statement to the symbol table.
-@param token - The token containing the  label value
+@brief Responsible for adding a label declaration to the symbol table.
+@param cursor - Points at the token containing the label value. It is moved past it.
 @param labels - The symbol table.
 @param errors - Pointer to an error counter.
-@returns the next token to be parsed.
+@param target - The index of the statement the label marks, the next one to be parsed.
 */
-asm_lex_token * asm_parse_label_declaration(asm_lex_token * token, asm_hash_table * labels, int * errors, asm_statement * statement)
+void asm_parse_label_declaration(asm_lex_cursor * cursor, asm_symbol_table * labels, int * errors, unsigned int target)
 {
-    assert(token -> type == LABEL);
+    assert(asm_lex_cursor_type(cursor, 0) == LABEL);
 
-    asm_hash_table_insert(labels, token -> value.label, statement);
+    asm_symbol label = asm_lex_cursor_value(cursor, 0).label;
 
-    return token -> next;
+    if(labels -> targets[label] != ASM_SYMBOL_NONE)
+    {
+        error("Line %d: Label '%s' is declared more than once\n", asm_lex_cursor_line(cursor),
+              asm_intern_name(&labels -> names, label));
+        (*errors) ++;
+    }
+    else
+    {
+        labels -> targets[label] = target;
+    }
+
+    asm_lex_cursor_advance(cursor, 1);
 }
 
 
 /*!
 @brief Top function to trigger the parsing of an input source file.
-@details Takes an opened for reading text file and parses it into a series of asm statements,
-filling out their arguments and parameters as it goes. It also populates the hash-table of
-labels used for calculating jump target addresses.
+@details Takes a lexed token stream and parses it into a series of asm statements,
+filling out their arguments and parameters as it goes. It also populates the symbol table of
+labels used for calculating jump target addresses. Every statement starts with exactly one opcode
+token, so the statement vector is sized exactly from a count of them before parsing begins.
 @see The ISA Specification contains more information on the grammar of the assembly language.
-@param [inout] labels - Hashtable which is apopulated with any encountered labels.
+@param tokens - Stream of tokens to parse into a program IR.
+@param [inout] labels - Symbol table whose names were interned by the lexer. Its targets array
+is allocated and populated with the declaration of every encountered label.
+@param [out] statements - The parsed program. Memory space should already be declared. The vector
+is allocated from the same arena as the tokens.
 @param [inout] errors - Pointer to a error counter. If the counter has the same value before
-@param tokens - Linked list of tokens to parse into a program IR.
 and after being called, all of the parsing was a success.
-@returns The parsed statements as a doublely linked list.
 */
-asm_statement * asm_parse_token_stream(asm_lex_token * tokens, asm_hash_table * labels, int * errors)
+void asm_parse_token_stream(asm_lex_tokens * tokens, asm_symbol_table * labels,
+                            asm_statements * statements, int * errors)
 {
-    asm_statement * to_return = NULL;
-    asm_statement * walker    = NULL;
-    asm_lex_token * current_token = tokens;
+    asm_lex_cursor cursor;
+    unsigned int   i;
+
+    cursor.tokens = tokens;
+    cursor.index  = 0;
+
+    labels -> targets = asm_arena_alloc(tokens -> arena, labels -> names.count * sizeof(unsigned int));
+    for(i = 0; i < labels -> names.count; i ++)
+        labels -> targets[i] = ASM_SYMBOL_NONE;
+
+    unsigned int opcodes = 0;
+    for(i = 0; i < tokens -> count; i ++)
+        opcodes += tokens -> types[i] == OPCODE;
+
+    statements -> arena    = tokens -> arena;
+    statements -> count    = 0;
+    statements -> capacity = opcodes;
+    statements -> items    = asm_arena_alloc(tokens -> arena, opcodes * sizeof(asm_statement));
 
     // Iterate over all of the tokens in the stream.
-    while(current_token != NULL)
+    while(!asm_lex_cursor_done(&cursor))
     {
-        asm_statement * to_add = calloc(1, sizeof(asm_statement));
-        to_add -> prev = walker;
+        asm_lex_token_type type = asm_lex_cursor_type(&cursor, 0);
 
-        switch(current_token -> type)
+        if(type == LABEL)
         {
-            case (CONDITION):
-                to_add -> condition = current_token -> value.condition;
-                current_token = asm_parse_opcode(to_add, current_token -> next, errors);
-                break;
-
-            case (OPCODE):
-                current_token = asm_parse_opcode(to_add, current_token, errors);
-                to_add -> condition = ALWAYS;
-                break;
-
-            case (LABEL):
-                current_token = asm_parse_label_declaration(current_token, labels, errors, to_add -> prev);
-                free(to_add);
-                continue;
-
-            default:
-                error("Unexpected token type: %d\n", current_token -> type);
-                *errors += 1;
-                current_token = current_token -> next;
-                free(to_add);
-                continue;
+            asm_parse_label_declaration(&cursor, labels, errors, statements -> count);
+            continue;
+        }
+        else if(type != CONDITION && type != OPCODE)
+        {
+            error("Line %d: Unexpected token type: %d\n", asm_lex_cursor_line(&cursor), type);
+            *errors += 1;
+            asm_lex_cursor_advance(&cursor, 1);
+            continue;
+        }
+        else if(type == CONDITION && asm_lex_cursor_type(&cursor, 1) != OPCODE)
+        {
+            error("Line %d: Expected an opcode after a condition code\n", asm_lex_cursor_line(&cursor));
+            *errors += 1;
+            asm_lex_cursor_advance(&cursor, 1);
+            continue;
         }
 
-        if(walker == NULL)
+        asm_statement * to_add = &statements -> items[statements -> count];
+        memset(to_add, 0, sizeof(asm_statement));
+        to_add -> line_number = asm_lex_cursor_line(&cursor);
+
+        if(type == CONDITION)
         {
-            walker = to_add;
-            to_return = walker;
+            to_add -> condition = asm_lex_cursor_value(&cursor, 0).condition;
+            asm_lex_cursor_advance(&cursor, 1);
+            asm_parse_opcode(to_add, &cursor, errors);
         }
         else
         {
-            walker -> next = to_add;
-            walker = walker -> next;
+            asm_parse_opcode(to_add, &cursor, errors);
+            to_add -> condition = ALWAYS;
         }
-    }
 
-    return to_return;
+        to_add -> size = asm_encodings[to_add -> opcode].size;
+
+        statements -> count ++;
+    }
 }
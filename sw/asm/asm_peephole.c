@@ -0,0 +1,250 @@
+/*!
+@ingroup sw-asm
+@{
+@file asm_peephole.c
+@brief A peephole optimiser, which removes or rewrites short runs of statements that do nothing,
+or do less than they cost.
+@details The pass runs between parsing and address calculation, so statements can be removed
+and rewritten freely: every label is still the index of the statement it marks, and is moved
+along with the statements around it. Each rule of the pattern table looks at a window of
+statements starting at the current one. A rule whose window is longer than one statement never
+matches across a label, since control may arrive at the labelled statement without passing
+through the ones before it. The whole program is scanned again until no rule matches, as
+removing one pattern can bring the statements either side of it together into another.
+
+The rules assume, as generated code does, that nothing reads the stack below SP, so a PUSH
+whose value is popped straight back off need never have been made.
+*/
+
+#include "asm.h"
+
+//! The most statements any rule looks at.
+#define ASM_PEEPHOLE_WINDOW 2
+
+/*!
+@brief A rule of the pattern table.
+@details apply is given the window of statements starting at index, and returns FALSE if they do
+not match. Otherwise it writes what they are replaced with to out, which may be nothing, and sets
+produced to the number of statements written.
+*/
+typedef struct asm_peephole_rule_t{
+    //! The name of the rule in the report.
+    const char   * name;
+    //! The number of statements the rule looks at.
+    unsigned int   window;
+    //! Matches and rewrites a window of statements.
+    BOOL        (* apply)(asm_statement * in, unsigned int index, asm_symbol_table * labels,
+                          asm_statement * out, unsigned int * produced);
+} asm_peephole_rule;
+
+//! Returns TRUE for the registers a rule can move freely, every one but PC and SP.
+static inline BOOL asm_peephole_plain_register(unsigned int reg)
+{
+    return reg != PC && reg != SP;
+}
+
+//! `MOV $Rx $Rx` does nothing, whatever its condition.
+static BOOL asm_peephole_self_move(asm_statement * in, unsigned int index,
+                                   asm_symbol_table * labels, asm_statement * out,
+                                   unsigned int * produced)
+{
+    (void)index; (void)labels; (void)out;
+
+    if(in[0].opcode != MOVR || in[0].reg_1 != in[0].reg_2)
+        return FALSE;
+    *produced = 0;
+    return TRUE;
+}
+
+//! A NOP, which only exists to take up space.
+static BOOL asm_peephole_nop(asm_statement * in, unsigned int index, asm_symbol_table * labels,
+                             asm_statement * out, unsigned int * produced)
+{
+    (void)index; (void)labels; (void)out;
+
+    if(!(in[0].flags & ASM_STATEMENT_NOP))
+        return FALSE;
+    *produced = 0;
+    return TRUE;
+}
+
+//! A jump to the statement after it goes there anyway, taken or not.
+static BOOL asm_peephole_jump_next(asm_statement * in, unsigned int index,
+                                   asm_symbol_table * labels, asm_statement * out,
+                                   unsigned int * produced)
+{
+    (void)out;
+
+    if(in[0].opcode != JUMPI || !(in[0].flags & ASM_STATEMENT_RESOLVE_LABEL) ||
+       labels -> targets[in[0].label] != index + 1)
+        return FALSE;
+    *produced = 0;
+    return TRUE;
+}
+
+//! `PUSH $Rx` then `POP $Rx` leaves Rx as it was.
+static BOOL asm_peephole_push_pop(asm_statement * in, unsigned int index,
+                                  asm_symbol_table * labels, asm_statement * out,
+                                  unsigned int * produced)
+{
+    (void)index; (void)labels; (void)out;
+
+    if(in[0].opcode != PUSH || in[1].opcode != POP ||
+       in[0].condition != ALWAYS || in[1].condition != ALWAYS ||
+       in[0].reg_1 != in[1].reg_1 || !asm_peephole_plain_register(in[0].reg_1))
+        return FALSE;
+    *produced = 0;
+    return TRUE;
+}
+
+/*!
+@brief `PUSH $Rx` then `POP $Ry` is `MOV $Ry $Rx`, without going through memory.
+@details This goes further than removing redundant statements: the word the PUSH wrote below SP
+is no longer written at all, which is only safe because nothing reads the stack below SP.
+*/
+static BOOL asm_peephole_push_pop_move(asm_statement * in, unsigned int index,
+                                       asm_symbol_table * labels, asm_statement * out,
+                                       unsigned int * produced)
+{
+    (void)index; (void)labels;
+
+    if(in[0].opcode != PUSH || in[1].opcode != POP ||
+       in[0].condition != ALWAYS || in[1].condition != ALWAYS ||
+       !asm_peephole_plain_register(in[0].reg_1) || !asm_peephole_plain_register(in[1].reg_1))
+        return FALSE;
+
+    memset(out, 0, sizeof(asm_statement));
+    out -> opcode      = MOVR;
+    out -> size        = asm_encodings[MOVR].size;
+    out -> condition   = ALWAYS;
+    out -> reg_1       = in[1].reg_1;
+    out -> reg_2       = in[0].reg_1;
+    out -> line_number = in[0].line_number;
+    *produced = 1;
+    return TRUE;
+}
+
+//! The pattern table, tried in order at every statement.
+static const asm_peephole_rule asm_peephole_rules[] = {
+    {"self-move",     1, asm_peephole_self_move},
+    {"nop",           1, asm_peephole_nop},
+    {"jump-next",     1, asm_peephole_jump_next},
+    {"push-pop",      2, asm_peephole_push_pop},
+    {"push-pop-move", 2, asm_peephole_push_pop_move}
+};
+
+//! The number of rules in the pattern table.
+#define ASM_PEEPHOLE_RULES (sizeof(asm_peephole_rules) / sizeof(asm_peephole_rule))
+
+/*!
+@brief Runs the peephole optimiser over a parsed program, then reports how many times each rule
+matched and the bytes it saved.
+@param statements - The program to optimise. Label operands must not yet have been resolved.
+@param labels - The symbol table populated by the parser, whose targets are moved to match.
+@returns The number of bytes saved.
+*/
+unsigned int asm_peephole_optimise(asm_statements * statements, asm_symbol_table * labels)
+{
+    unsigned int   matches[ASM_PEEPHOLE_RULES];
+    unsigned int   saved[ASM_PEEPHOLE_RULES];
+    unsigned int   total = 0;
+    unsigned int   i, r;
+    BOOL           changed;
+
+    // Where each statement ends up, indexed by its old index, and which statements are labelled.
+    unsigned int  * moved    = malloc((statements -> count + 1) * sizeof(unsigned int));
+    unsigned char * labelled = malloc(statements -> count + 1);
+    if(moved == NULL || labelled == NULL)
+    {
+        warning("Could not allocate the peephole optimiser's tables, skipping it.\n");
+        free(moved);
+        free(labelled);
+        return 0;
+    }
+
+    memset(matches, 0, sizeof(matches));
+    memset(saved, 0, sizeof(saved));
+
+    do
+    {
+        unsigned int count   = statements -> count;
+        unsigned int written = 0;
+
+        memset(labelled, 0, count + 1);
+        for(i = 0; i < labels -> names.count; i ++)
+            if(labels -> targets[i] != ASM_SYMBOL_NONE)
+                labelled[labels -> targets[i]] = TRUE;
+
+        changed = FALSE;
+        i = 0;
+        while(i < count)
+        {
+            asm_statement window[ASM_PEEPHOLE_WINDOW];
+            asm_statement out[ASM_PEEPHOLE_WINDOW];
+            unsigned int  produced = 0;
+
+            moved[i] = written;
+            for(r = 0; r < ASM_PEEPHOLE_RULES; r ++)
+            {
+                const asm_peephole_rule * rule = &asm_peephole_rules[r];
+                unsigned int              j;
+
+                if(i + rule -> window > count)
+                    continue;
+                for(j = 1; j < rule -> window && !labelled[i + j]; j ++);
+                if(j < rule -> window)
+                    continue;
+
+                memcpy(window, &statements -> items[i], rule -> window * sizeof(asm_statement));
+                if(rule -> apply(window, i, labels, out, &produced))
+                    break;
+            }
+
+            if(r == ASM_PEEPHOLE_RULES)
+            {
+                statements -> items[written ++] = statements -> items[i ++];
+                continue;
+            }
+
+            const asm_peephole_rule * rule   = &asm_peephole_rules[r];
+            unsigned int              before = 0;
+            unsigned int              after  = 0;
+            unsigned int              j;
+
+            for(j = 0; j < rule -> window; j ++)
+            {
+                before        += window[j].size;
+                moved[i + j]   = written;
+            }
+            for(j = 0; j < produced; j ++)
+            {
+                after += out[j].size;
+                statements -> items[written ++] = out[j];
+            }
+
+            matches[r] ++;
+            saved[r] += before - after;
+            total    += before - after;
+            i        += rule -> window;
+            changed   = TRUE;
+        }
+        moved[count] = written;
+
+        // A label on a removed statement now marks whatever follows it.
+        for(i = 0; i < labels -> names.count; i ++)
+            if(labels -> targets[i] != ASM_SYMBOL_NONE)
+                labels -> targets[i] = moved[labels -> targets[i]];
+        statements -> count = written;
+    } while(changed);
+
+    free(moved);
+    free(labelled);
+
+    for(r = 0; r < ASM_PEEPHOLE_RULES; r ++)
+        log("Peephole %-14s %6u matches, %6u bytes saved\n", asm_peephole_rules[r].name,
+            matches[r], saved[r]);
+    log("Peephole total         %6u bytes saved\n", total);
+    return total;
+}
+
+//! }@
@@ -0,0 +1,239 @@
+/*!
+@ingroup sw-asm
+@{
+@file asm_scan.c
+@brief Scalar, SSE2 and AVX2 implementations of the lexer's text scanning kernels.
+@details Each vector kernel compares a whole register of characters against the delimiter set at
+once, turns the result into a bit mask and uses the position of its lowest set bit. Any tail too
+short for a full vector is handled by the scalar kernel. The AVX2 kernels are compiled with a
+target attribute and only selected if the CPU reports support at runtime.
+*/
+
+#include "asm.h"
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+    #define ASM_SCAN_X86
+    #include <immintrin.h>
+#endif
+
+/*!
+@brief Scalar delimiter scan.
+*/
+static char * asm_scan_delimiter_scalar(char * start, char * end)
+{
+    while(start < end && !asm_scan_is_delimiter(*start))
+        start ++;
+    return start;
+}
+
+/*!
+@brief Scalar newline scan.
+*/
+static char * asm_scan_newline_scalar(char * start, char * end)
+{
+    while(start < end && *start != '\n')
+        start ++;
+    return start;
+}
+
+#ifdef ASM_SCAN_X86
+
+/*!
+@brief SSE2 delimiter scan, sixteen characters per iteration.
+*/
+static char * asm_scan_delimiter_sse2(char * start, char * end)
+{
+    const __m128i space     = _mm_set1_epi8(' ');
+    const __m128i semicolon = _mm_set1_epi8(';');
+
+    while(end - start >= 16)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)start);
+        // Unsigned chunk <= ' ' is the same as min(chunk, ' ') == chunk.
+        __m128i blank = _mm_cmpeq_epi8(_mm_min_epu8(chunk, space), chunk);
+        __m128i found = _mm_or_si128(blank, _mm_cmpeq_epi8(chunk, semicolon));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(found);
+
+        if(mask != 0)
+            return start + __builtin_ctz(mask);
+        start += 16;
+    }
+
+    return asm_scan_delimiter_scalar(start, end);
+}
+
+/*!
+@brief SSE2 newline scan, sixteen characters per iteration.
+*/
+static char * asm_scan_newline_sse2(char * start, char * end)
+{
+    const __m128i newline = _mm_set1_epi8('\n');
+
+    while(end - start >= 16)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)start);
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline));
+
+        if(mask != 0)
+            return start + __builtin_ctz(mask);
+        start += 16;
+    }
+
+    return asm_scan_newline_scalar(start, end);
+}
+
+/*!
+@brief AVX2 delimiter scan, thirty two characters per iteration.
+*/
+__attribute__((target("avx2")))
+static char * asm_scan_delimiter_avx2(char * start, char * end)
+{
+    const __m256i space     = _mm256_set1_epi8(' ');
+    const __m256i semicolon = _mm256_set1_epi8(';');
+
+    while(end - start >= 32)
+    {
+        __m256i chunk = _mm256_loadu_si256((const __m256i*)start);
+        __m256i blank = _mm256_cmpeq_epi8(_mm256_min_epu8(chunk, space), chunk);
+        __m256i found = _mm256_or_si256(blank, _mm256_cmpeq_epi8(chunk, semicolon));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(found);
+
+        if(mask != 0)
+            return start + __builtin_ctz(mask);
+        start += 32;
+    }
+
+    return asm_scan_delimiter_sse2(start, end);
+}
+
+/*!
+@brief AVX2 newline scan, thirty two characters per iteration.
+*/
+__attribute__((target("avx2")))
+static char * asm_scan_newline_avx2(char * start, char * end)
+{
+    const __m256i newline = _mm256_set1_epi8('\n');
+
+    while(end - start >= 32)
+    {
+        __m256i chunk = _mm256_loadu_si256((const __m256i*)start);
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, newline));
+
+        if(mask != 0)
+            return start + __builtin_ctz(mask);
+        start += 32;
+    }
+
+    return asm_scan_newline_sse2(start, end);
+}
+
+#endif
+
+//! The kernel implementation currently selected, or SCAN_AUTO if none has been selected yet.
+static asm_scan_kernel asm_scan_current = SCAN_AUTO;
+
+//! The selected delimiter scanning kernel.
+static char * (*asm_scan_delimiter_kernel)(char * start, char * end) = NULL;
+
+//! The selected newline scanning kernel.
+static char * (*asm_scan_newline_kernel)(char * start, char * end) = NULL;
+
+/*!
+@brief Selects which kernel implementation subsequent scans use.
+@param kernel - The kernel to use. SCAN_AUTO picks the best one available at runtime.
+@returns TRUE if the kernel is supported on this machine and was selected, otherwise FALSE.
+*/
+BOOL asm_scan_select(asm_scan_kernel kernel)
+{
+    if(kernel == SCAN_AUTO)
+    {
+#ifdef ASM_SCAN_X86
+        if(asm_scan_select(SCAN_AVX2))
+            return TRUE;
+        return asm_scan_select(SCAN_SSE2);
+#else
+        return asm_scan_select(SCAN_SCALAR);
+#endif
+    }
+
+    switch(kernel)
+    {
+        case SCAN_SCALAR:
+            asm_scan_delimiter_kernel = asm_scan_delimiter_scalar;
+            asm_scan_newline_kernel   = asm_scan_newline_scalar;
+            break;
+
+#ifdef ASM_SCAN_X86
+        case SCAN_SSE2:
+            asm_scan_delimiter_kernel = asm_scan_delimiter_sse2;
+            asm_scan_newline_kernel   = asm_scan_newline_sse2;
+            break;
+
+        case SCAN_AVX2:
+            __builtin_cpu_init();
+            if(!__builtin_cpu_supports("avx2"))
+                return FALSE;
+            asm_scan_delimiter_kernel = asm_scan_delimiter_avx2;
+            asm_scan_newline_kernel   = asm_scan_newline_avx2;
+            break;
+#endif
+
+        default:
+            return FALSE;
+    }
+
+    asm_scan_current = kernel;
+    return TRUE;
+}
+
+/*!
+@brief Returns the kernel implementation currently in use.
+*/
+asm_scan_kernel asm_scan_selected()
+{
+    if(asm_scan_current == SCAN_AUTO)
+        asm_scan_select(SCAN_AUTO);
+    return asm_scan_current;
+}
+
+/*!
+@brief Returns the name of a kernel implementation, for reporting.
+*/
+char * asm_scan_kernel_name(asm_scan_kernel kernel)
+{
+    switch(kernel)
+    {
+        case SCAN_SCALAR: return "scalar";
+        case SCAN_SSE2:   return "sse2";
+        case SCAN_AVX2:   return "avx2";
+        default:          return "auto";
+    }
+}
+
+/*!
+@brief Finds the first token delimiter in a range of text.
+@param start - The first character to examine.
+@param end - One past the last character to examine.
+@returns A pointer to the first delimiter, or end if there is none.
+*/
+char * asm_scan_delimiter(char * start, char * end)
+{
+    if(asm_scan_delimiter_kernel == NULL)
+        asm_scan_select(SCAN_AUTO);
+    return asm_scan_delimiter_kernel(start, end);
+}
+
+/*!
+@brief Finds the first newline character in a range of text.
+@param start - The first character to examine.
+@param end - One past the last character to examine.
+@returns A pointer to the first newline, or end if there is none.
+*/
+char * asm_scan_newline(char * start, char * end)
+{
+    if(asm_scan_newline_kernel == NULL)
+        asm_scan_select(SCAN_AUTO);
+    return asm_scan_newline_kernel(start, end);
+}
+
+//! }@
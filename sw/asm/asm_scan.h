@@ -0,0 +1,66 @@
+/*!
+@ingroup sw-asm
+@{
+@file asm_scan.h
+@brief Header file for the vectorised text scanning kernels used by the lexer.
+*/
+
+#ifndef ASM_SCAN_H
+#define ASM_SCAN_H
+
+/*!
+@brief The implementations of the scanning kernels which can be selected.
+*/
+typedef enum asm_scan_kernel_e{
+    SCAN_AUTO   = 0, //!< Pick the fastest kernel the CPU supports.
+    SCAN_SCALAR = 1, //!< One character at a time. Always available.
+    SCAN_SSE2   = 2, //!< Sixteen characters at a time.
+    SCAN_AVX2   = 3  //!< Thirty two characters at a time.
+} asm_scan_kernel;
+
+/*!
+@brief Returns TRUE if the character ends a token. Spaces, control characters (including newlines
+and the null terminator) and comment markers are all delimiters.
+*/
+static inline BOOL asm_scan_is_delimiter(char c)
+{
+    return (unsigned char)c <= ' ' || c == ';';
+}
+
+/*!
+@brief Selects which kernel implementation subsequent scans use.
+@param kernel - The kernel to use. SCAN_AUTO picks the best one available at runtime.
+@returns TRUE if the kernel is supported on this machine and was selected, otherwise FALSE and the
+current selection is left unchanged.
+*/
+BOOL asm_scan_select(asm_scan_kernel kernel);
+
+/*!
+@brief Returns the kernel implementation currently in use.
+*/
+asm_scan_kernel asm_scan_selected();
+
+/*!
+@brief Returns the name of a kernel implementation, for reporting.
+*/
+char * asm_scan_kernel_name(asm_scan_kernel kernel);
+
+/*!
+@brief Finds the first token delimiter in a range of text.
+@param start - The first character to examine.
+@param end - One past the last character to examine.
+@returns A pointer to the first delimiter, or end if there is none.
+*/
+char * asm_scan_delimiter(char * start, char * end);
+
+/*!
+@brief Finds the first newline character in a range of text.
+@param start - The first character to examine.
+@param end - One past the last character to examine.
+@returns A pointer to the first newline, or end if there is none.
+*/
+char * asm_scan_newline(char * start, char * end);
+
+#endif
+
+//! }@
@@ -0,0 +1,182 @@
+/*!
+@ingroup sw-asm
+@{
+@file asm_stats.c
+@brief Contains the per phase timing and memory instrumentation reported by --stats.
+@details Allocations are counted by the ASM_STATS_ALLOCATED macro at each place the assembler
+allocates memory: every arena allocation, and every buffer taken directly from the system.
+Arena blocks are not counted separately, as the allocations made from them already are.
+*/
+
+#include <time.h>
+#include <sys/resource.h>
+
+#include "asm.h"
+
+unsigned long      asm_stats_allocations     = 0;
+unsigned long long asm_stats_allocated_bytes = 0;
+
+//! The names of each phase, indexed by asm_stats_phase.
+static const char * asm_stats_phase_names[ASM_PHASE_COUNT] = {
+    "lex", "parse", "dce", "optimise", "narrow", "relax", "align", "address", "emit"
+};
+
+//! Returns the current wall clock time in seconds.
+static double asm_stats_wall_seconds()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+//! Returns the CPU time used by the process so far in seconds.
+static double asm_stats_cpu_seconds()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+//! Returns the peak resident set size of the process so far in kilobytes.
+static long asm_stats_peak_rss_kb()
+{
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+    return usage.ru_maxrss;
+}
+
+/*!
+@brief Initialises a new set of statistics with every measurement zeroed.
+@param tr - The statistics to initialise. Memory space should already be declared.
+*/
+void asm_stats_new(asm_stats * tr)
+{
+    memset(tr, 0, sizeof(asm_stats));
+}
+
+/*!
+@brief Marks the start of a phase.
+@param stats - The statistics to record into.
+*/
+void asm_stats_begin(asm_stats * stats)
+{
+    stats -> allocations_start     = asm_stats_allocations;
+    stats -> allocated_bytes_start = asm_stats_allocated_bytes;
+    stats -> cpu_start             = asm_stats_cpu_seconds();
+    stats -> wall_start            = asm_stats_wall_seconds();
+}
+
+/*!
+@brief Marks the end of a phase, recording everything measured since asm_stats_begin.
+@param stats - The statistics to record into.
+@param phase - The phase which has just finished.
+*/
+void asm_stats_end(asm_stats * stats, asm_stats_phase phase)
+{
+    asm_stats_record * record = &stats -> phases[phase];
+
+    record -> wall_seconds    = asm_stats_wall_seconds() - stats -> wall_start;
+    record -> cpu_seconds     = asm_stats_cpu_seconds() - stats -> cpu_start;
+    record -> allocations     = asm_stats_allocations - stats -> allocations_start;
+    record -> allocated_bytes = asm_stats_allocated_bytes - stats -> allocated_bytes_start;
+    record -> peak_rss_kb     = asm_stats_peak_rss_kb();
+}
+
+/*!
+@brief Sums the measurements of every phase.
+*/
+static void asm_stats_total(asm_stats * stats, asm_stats_record * tr)
+{
+    int phase;
+
+    memset(tr, 0, sizeof(asm_stats_record));
+    for(phase = 0; phase < ASM_PHASE_COUNT; phase ++)
+    {
+        tr -> wall_seconds    += stats -> phases[phase].wall_seconds;
+        tr -> cpu_seconds     += stats -> phases[phase].cpu_seconds;
+        tr -> allocations     += stats -> phases[phase].allocations;
+        tr -> allocated_bytes += stats -> phases[phase].allocated_bytes;
+        if(stats -> phases[phase].peak_rss_kb > tr -> peak_rss_kb)
+            tr -> peak_rss_kb  = stats -> phases[phase].peak_rss_kb;
+    }
+}
+
+//! Returns count per second over the given time, or zero if no time was measured.
+static double asm_stats_rate(double count, double seconds)
+{
+    return seconds > 0 ? count / seconds : 0;
+}
+
+/*!
+@brief Prints a human readable table of the statistics.
+@param stats - The statistics to print.
+@param file - Where to print them.
+*/
+void asm_stats_print(asm_stats * stats, FILE * file)
+{
+    asm_stats_record total;
+    int phase;
+
+    asm_stats_total(stats, &total);
+
+    fprintf(file, "%-8s %10s %10s %12s %14s %12s\n",
+            "phase", "wall ms", "cpu ms", "allocations", "allocated KB", "peak RSS KB");
+
+    for(phase = 0; phase <= ASM_PHASE_COUNT; phase ++)
+    {
+        asm_stats_record * record = phase < ASM_PHASE_COUNT ? &stats -> phases[phase] : &total;
+        fprintf(file, "%-8s %10.3f %10.3f %12lu %14.1f %12ld\n",
+                phase < ASM_PHASE_COUNT ? asm_stats_phase_names[phase] : "total",
+                record -> wall_seconds * 1e3, record -> cpu_seconds * 1e3, record -> allocations,
+                record -> allocated_bytes / 1024.0, record -> peak_rss_kb);
+    }
+
+    fprintf(file, "\n");
+    fprintf(file, "source bytes   %lu\n", (unsigned long)stats -> source_bytes);
+    fprintf(file, "program bytes  %lu\n", (unsigned long)stats -> program_bytes);
+    fprintf(file, "tokens         %u\n", stats -> tokens);
+    fprintf(file, "statements     %u\n", stats -> statements);
+    fprintf(file, "labels         %u\n", stats -> labels);
+    fprintf(file, "throughput     %.2f MB/s, %.0f instructions/s\n",
+            asm_stats_rate(stats -> source_bytes / 1e6, total.wall_seconds),
+            asm_stats_rate(stats -> statements, total.wall_seconds));
+}
+
+/*!
+@brief Prints the statistics as a single JSON object, for consumption by scripts.
+@param stats - The statistics to print.
+@param file - Where to print them.
+*/
+void asm_stats_print_json(asm_stats * stats, FILE * file)
+{
+    asm_stats_record total;
+    int phase;
+
+    asm_stats_total(stats, &total);
+
+    fprintf(file, "{\n  \"phases\": {\n");
+    for(phase = 0; phase <= ASM_PHASE_COUNT; phase ++)
+    {
+        asm_stats_record * record = phase < ASM_PHASE_COUNT ? &stats -> phases[phase] : &total;
+        fprintf(file, "    \"%s\": {\"wall_seconds\": %.9f, \"cpu_seconds\": %.9f, "
+                      "\"allocations\": %lu, \"allocated_bytes\": %llu, \"peak_rss_kb\": %ld}%s\n",
+                phase < ASM_PHASE_COUNT ? asm_stats_phase_names[phase] : "total",
+                record -> wall_seconds, record -> cpu_seconds, record -> allocations,
+                record -> allocated_bytes, record -> peak_rss_kb,
+                phase < ASM_PHASE_COUNT ? "," : "");
+    }
+    fprintf(file, "  },\n");
+    fprintf(file, "  \"source_bytes\": %lu,\n", (unsigned long)stats -> source_bytes);
+    fprintf(file, "  \"program_bytes\": %lu,\n", (unsigned long)stats -> program_bytes);
+    fprintf(file, "  \"tokens\": %u,\n", stats -> tokens);
+    fprintf(file, "  \"statements\": %u,\n", stats -> statements);
+    fprintf(file, "  \"labels\": %u,\n", stats -> labels);
+    fprintf(file, "  \"megabytes_per_second\": %.3f,\n",
+            asm_stats_rate(stats -> source_bytes / 1e6, total.wall_seconds));
+    fprintf(file, "  \"instructions_per_second\": %.1f\n",
+            asm_stats_rate(stats -> statements, total.wall_seconds));
+    fprintf(file, "}\n");
+}
+
+//! }@
@@ -0,0 +1,116 @@
+/*!
+@ingroup sw-asm
+@{
+@file asm_stats.h
+@brief Header file for the per phase timing and memory instrumentation reported by --stats.
+*/
+
+#ifndef ASM_STATS_H
+#define ASM_STATS_H
+
+/*!
+@brief The phases of assembly which are timed separately.
+*/
+typedef enum asm_stats_phase_e{
+    ASM_PHASE_LEX      = 0, //!< Reading the source and lexing it into tokens.
+    ASM_PHASE_PARSE    = 1, //!< Parsing tokens into statements.
+    ASM_PHASE_DCE      = 2, //!< Removing unreachable statements, when --dce is given.
+    ASM_PHASE_OPTIMISE = 3, //!< Running the peephole optimiser, when -O is given.
+    ASM_PHASE_NARROW   = 4, //!< Choosing narrow immediate forms, when --narrow is given.
+    ASM_PHASE_RELAX    = 5, //!< Relaxing branches to labels within reach, when --relax is given.
+    ASM_PHASE_ALIGN    = 6, //!< Padding branch targets to word boundaries, when --align is given.
+    ASM_PHASE_ADDRESS  = 7, //!< Calculating addresses and resolving labels.
+    ASM_PHASE_EMIT     = 8, //!< Encoding and writing the program.
+    ASM_PHASE_COUNT    = 9  //!< The number of phases.
+} asm_stats_phase;
+
+/*!
+@brief The cost of a single phase.
+*/
+typedef struct asm_stats_record_t{
+    //! Elapsed wall clock time in seconds.
+    double             wall_seconds;
+    //! User plus system CPU time in seconds.
+    double             cpu_seconds;
+    //! The number of allocations made during the phase.
+    unsigned long      allocations;
+    //! The number of bytes allocated during the phase.
+    unsigned long long allocated_bytes;
+    //! The peak resident set size of the process in kilobytes at the end of the phase.
+    long               peak_rss_kb;
+} asm_stats_record;
+
+/*!
+@brief Everything measured over one run of the assembler.
+*/
+typedef struct asm_stats_t{
+    //! The measurements of each phase, indexed by asm_stats_phase.
+    asm_stats_record   phases[ASM_PHASE_COUNT];
+
+    //! Wall clock time at the start of the phase being measured.
+    double             wall_start;
+    //! CPU time at the start of the phase being measured.
+    double             cpu_start;
+    //! Allocation count at the start of the phase being measured.
+    unsigned long      allocations_start;
+    //! Allocated bytes at the start of the phase being measured.
+    unsigned long long allocated_bytes_start;
+
+    //! The length of the source text in bytes.
+    size_t             source_bytes;
+    //! The number of bytes of machine code emitted.
+    size_t             program_bytes;
+    //! The number of tokens lexed.
+    unsigned int       tokens;
+    //! The number of statements parsed.
+    unsigned int       statements;
+    //! The number of distinct labels seen.
+    unsigned int       labels;
+} asm_stats;
+
+//! The number of allocations made by the assembler so far.
+extern unsigned long      asm_stats_allocations;
+
+//! The number of bytes allocated by the assembler so far.
+extern unsigned long long asm_stats_allocated_bytes;
+
+//! Records an allocation of the given number of bytes. Called wherever the assembler allocates.
+#define ASM_STATS_ALLOCATED(bytes) {asm_stats_allocations += 1; \
+                                    asm_stats_allocated_bytes += (bytes);}
+
+/*!
+@brief Initialises a new set of statistics with every measurement zeroed.
+@param tr - The statistics to initialise. Memory space should already be declared.
+*/
+void asm_stats_new(asm_stats * tr);
+
+/*!
+@brief Marks the start of a phase.
+@param stats - The statistics to record into.
+*/
+void asm_stats_begin(asm_stats * stats);
+
+/*!
+@brief Marks the end of a phase, recording everything measured since asm_stats_begin.
+@param stats - The statistics to record into.
+@param phase - The phase which has just finished.
+*/
+void asm_stats_end(asm_stats * stats, asm_stats_phase phase);
+
+/*!
+@brief Prints a human readable table of the statistics.
+@param stats - The statistics to print.
+@param file - Where to print them.
+*/
+void asm_stats_print(asm_stats * stats, FILE * file);
+
+/*!
+@brief Prints the statistics as a single JSON object, for consumption by scripts.
+@param stats - The statistics to print.
+@param file - Where to print them.
+*/
+void asm_stats_print_json(asm_stats * stats, FILE * file);
+
+#endif
+
+//! }@
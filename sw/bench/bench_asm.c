@@ -0,0 +1,464 @@
+/*!
+@ingroup sw-bench
+@{
+@file bench_asm.c
+@brief End to end benchmark of the assembler, and the synthetic program generator it runs on.
+@details The generator writes reproducible, valid programs of a given size, with a configurable
+density of labels and comments and a mix of ALU, memory and control flow instructions. The
+harness assembles a generated program at each size from the smallest to the largest, growing by a
+factor of ten each step, timing every phase the same way `tim-asm --stats` does, and prints one
+row per size as CSV or JSON.
+*/
+
+#include <time.h>
+#include <unistd.h>
+
+#include "asm.h"
+
+#ifdef TIM_PRINT_PROMPT
+    #undef TIM_PRINT_PROMPT
+#endif
+#define TIM_PRINT_PROMPT "\e[1;36mbench>\e[0m "
+
+//! Describes the programs the generator writes.
+typedef struct bench_program_t{
+    //! The number of instructions in the program.
+    unsigned int instructions;
+    //! Labels declared per hundred instructions.
+    unsigned int label_percent;
+    //! The percentage of instructions followed by a comment.
+    unsigned int comment_percent;
+    //! The relative weight of ALU instructions.
+    unsigned int alu_weight;
+    //! The relative weight of memory and register move instructions.
+    unsigned int memory_weight;
+    //! The relative weight of jumps, calls and tests.
+    unsigned int control_weight;
+    //! The seed of the pseudo random number generator.
+    unsigned int seed;
+} bench_program;
+
+//! Register-register-register ALU mnemonics.
+static char * bench_alu_mnemonics[] = {
+    "AND", "NAND", "OR", "NOR", "XOR", "LSL", "LSR", "IADD", "ISUB", "IMUL", "IDIV", "IASR",
+    "FADD", "FSUB", "FMUL", "FDIV", "FASR"
+};
+
+//! The ALU mnemonics which also take an immediate third operand.
+#define BENCH_ALU_IMMEDIATES 7
+
+//! The number of ALU mnemonics.
+#define BENCH_ALU_MNEMONICS (sizeof(bench_alu_mnemonics) / sizeof(char*))
+
+//! The condition codes a control flow instruction may be prefixed with.
+static char * bench_conditions[] = {"?A", "?T", "?F", "?Z"};
+
+//! A small deterministic pseudo random number generator, so runs are reproducible.
+static unsigned int bench_random(unsigned int * state)
+{
+    unsigned int x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+//! Returns the current time in seconds.
+static double bench_now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/*!
+@brief Writes one ALU instruction.
+*/
+static void bench_write_alu(FILE * file, unsigned int * state)
+{
+    unsigned int mnemonic = bench_random(state) % BENCH_ALU_MNEMONICS;
+    unsigned int r1 = bench_random(state) % 16;
+    unsigned int r2 = bench_random(state) % 16;
+
+    if(mnemonic < BENCH_ALU_IMMEDIATES && bench_random(state) % 2)
+        fprintf(file, "    %-5s $R%u $R%u 0x%X", bench_alu_mnemonics[mnemonic], r1, r2,
+                bench_random(state) & 0xFFFF);
+    else
+        fprintf(file, "    %-5s $R%u $R%u $R%u", bench_alu_mnemonics[mnemonic], r1, r2,
+                bench_random(state) % 16);
+}
+
+/*!
+@brief Writes one memory access or register move instruction.
+*/
+static void bench_write_memory(FILE * file, unsigned int * state)
+{
+    unsigned int r1 = bench_random(state) % 16;
+    unsigned int r2 = bench_random(state) % 16;
+
+    switch(bench_random(state) % 7)
+    {
+        case 0: fprintf(file, "    LOAD  $R%u $R%u $R%u", r1, r2, bench_random(state) % 16); break;
+        case 1: fprintf(file, "    LOAD  $R%u $R%u 0x%X", r1, r2, bench_random(state) & 0xFFFF); break;
+        case 2: fprintf(file, "    STORE $R%u $R%u $R%u", r1, r2, bench_random(state) % 16); break;
+        case 3: fprintf(file, "    STORE $R%u $R%u 0x%X", r1, r2, bench_random(state) & 0xFFFF); break;
+        case 4: fprintf(file, "    PUSH  $R%u", r1); break;
+        case 5: fprintf(file, "    POP   $R%u", r1); break;
+        case 6: fprintf(file, "    MOV   $R%u 0x%X", r1, bench_random(state) & 0x7FFFF); break;
+    }
+}
+
+/*!
+@brief Writes one jump, call or test instruction. Jumps and calls target a random label if the
+program has any, otherwise a register.
+*/
+static void bench_write_control(FILE * file, unsigned int * state, unsigned int labels)
+{
+    char * condition = bench_conditions[bench_random(state) % 4];
+    unsigned int kind = bench_random(state) % 3;
+
+    if(kind == 2)
+        fprintf(file, "    TEST  $R%u $R%u", bench_random(state) % 16, bench_random(state) % 16);
+    else if(labels > 0)
+        fprintf(file, "    %s %-5s .L%u", condition, kind ? "CALL" : "JUMP",
+                bench_random(state) % labels);
+    else
+        fprintf(file, "    %s %-5s $R%u", condition, kind ? "CALL" : "JUMP",
+                bench_random(state) % 16);
+}
+
+/*!
+@brief Writes a synthetic program. The same description always produces the same text.
+@param program - Describes the program to write.
+@param file - Where to write it.
+*/
+static void bench_generate(bench_program * program, FILE * file)
+{
+    unsigned int state  = program -> seed ? program -> seed : 1;
+    unsigned int labels = (unsigned int)((unsigned long long)program -> instructions *
+                                         program -> label_percent / 100);
+    unsigned int total  = program -> alu_weight + program -> memory_weight +
+                          program -> control_weight;
+    unsigned int declared = 0;
+    unsigned int i;
+
+    if(total == 0)
+        total = program -> alu_weight = 1;
+
+    fprintf(file, "; Synthetic program: %u instructions, %u labels, seed %u.\n",
+            program -> instructions, labels, program -> seed);
+
+    for(i = 0; i < program -> instructions; i ++)
+    {
+        // Spread the label declarations evenly, so every label is declared exactly once.
+        while(declared < labels &&
+              (unsigned long long)declared * program -> instructions <=
+              (unsigned long long)i * labels)
+        {
+            fprintf(file, ".L%u\n", declared);
+            declared ++;
+        }
+
+        unsigned int pick = bench_random(&state) % total;
+        if(pick < program -> alu_weight)
+            bench_write_alu(file, &state);
+        else if(pick < program -> alu_weight + program -> memory_weight)
+            bench_write_memory(file, &state);
+        else
+            bench_write_control(file, &state, labels);
+
+        if(bench_random(&state) % 100 < program -> comment_percent)
+            fprintf(file, " ; comment %u", i);
+        fputc('\n', file);
+    }
+
+    for(; declared < labels; declared ++)
+        fprintf(file, ".L%u\n", declared);
+
+    fprintf(file, "    HALT\n");
+}
+
+/*!
+@brief Assembles a source file once, timing each phase into stats.
+@returns The number of errors encountered.
+*/
+static int bench_assemble(char * path, asm_format format, asm_stats * stats)
+{
+    asm_arena       arena;
+    asm_symbol_table symbol_table;
+    asm_lex_source  text;
+    asm_lex_tokens  tokens;
+    asm_statements  statements;
+    int             errors = 0;
+
+    FILE * source = fopen(path, "r");
+    FILE * output = fopen("/dev/null", "wb");
+    if(source == NULL || output == NULL)
+        fatal("Could not open %s or /dev/null\n", path);
+
+    asm_stats_new(stats);
+    asm_arena_new(1 << 20, &arena);
+    asm_intern_new(&arena, &symbol_table.names);
+
+    asm_stats_begin(stats);
+    if(!asm_lex_source_open(source, &text))
+        fatal("Could not read %s\n", path);
+    asm_lex_source_tokens(&text, &arena, &symbol_table.names, &tokens, &errors);
+    asm_stats_end(stats, ASM_PHASE_LEX);
+
+    if(errors == 0)
+    {
+        asm_stats_begin(stats);
+        asm_parse_token_stream(&tokens, &symbol_table, &statements, &errors);
+        asm_stats_end(stats, ASM_PHASE_PARSE);
+    }
+
+    if(errors == 0)
+    {
+        asm_stats_begin(stats);
+        errors += asm_calculate_addresses(&statements, 0, &symbol_table);
+        asm_stats_end(stats, ASM_PHASE_ADDRESS);
+    }
+
+    if(errors == 0)
+    {
+        asm_stats_begin(stats);
+        errors += asm_emit_instructions(&statements, output, format);
+        fflush(output);
+        asm_stats_end(stats, ASM_PHASE_EMIT);
+
+        asm_statement * last = &statements.items[statements.count - 1];
+        stats -> program_bytes = last -> address + last -> size - statements.items[0].address;
+        stats -> statements    = statements.count;
+    }
+
+    stats -> source_bytes = text.length;
+    stats -> tokens       = tokens.count;
+    stats -> labels       = symbol_table.names.count;
+
+    asm_intern_free(&symbol_table.names);
+    asm_arena_free(&arena);
+    asm_lex_source_close(&text);
+    fclose(source);
+    fclose(output);
+    return errors;
+}
+
+//! Keeps the fastest of two runs, phase by phase.
+static void bench_keep_best(asm_stats * best, asm_stats * run, BOOL first)
+{
+    int phase;
+
+    if(first)
+    {
+        *best = *run;
+        return;
+    }
+
+    for(phase = 0; phase < ASM_PHASE_COUNT; phase ++)
+        if(run -> phases[phase].wall_seconds < best -> phases[phase].wall_seconds)
+            best -> phases[phase] = run -> phases[phase];
+}
+
+//! Returns the total wall time of every phase.
+static double bench_total_seconds(asm_stats * stats)
+{
+    double total = 0;
+    int phase;
+    for(phase = 0; phase < ASM_PHASE_COUNT; phase ++)
+        total += stats -> phases[phase].wall_seconds;
+    return total;
+}
+
+//! Prints one result row.
+static void bench_print_row(FILE * file, BOOL json, BOOL first, unsigned int instructions,
+                            asm_stats * stats)
+{
+    double total = bench_total_seconds(stats);
+    double mbps  = total > 0 ? stats -> source_bytes / total / 1e6 : 0;
+    double ips   = total > 0 ? stats -> statements / total : 0;
+
+    if(json)
+    {
+        fprintf(file, "%s  {\"instructions\": %u, \"source_bytes\": %lu, \"program_bytes\": %lu, "
+                      "\"tokens\": %u, \"statements\": %u, \"labels\": %u, "
+                      "\"lex_seconds\": %.9f, \"parse_seconds\": %.9f, "
+                      "\"address_seconds\": %.9f, \"emit_seconds\": %.9f, "
+                      "\"total_seconds\": %.9f, \"megabytes_per_second\": %.3f, "
+                      "\"instructions_per_second\": %.1f, \"peak_rss_kb\": %ld}",
+                first ? "" : ",\n", instructions, (unsigned long)stats -> source_bytes,
+                (unsigned long)stats -> program_bytes, stats -> tokens, stats -> statements,
+                stats -> labels, stats -> phases[ASM_PHASE_LEX].wall_seconds,
+                stats -> phases[ASM_PHASE_PARSE].wall_seconds,
+                stats -> phases[ASM_PHASE_ADDRESS].wall_seconds,
+                stats -> phases[ASM_PHASE_EMIT].wall_seconds, total, mbps, ips,
+                stats -> phases[ASM_PHASE_EMIT].peak_rss_kb);
+    }
+    else
+    {
+        if(first)
+            fprintf(file, "instructions,source_bytes,program_bytes,tokens,statements,labels,"
+                          "lex_seconds,parse_seconds,address_seconds,emit_seconds,"
+                          "total_seconds,megabytes_per_second,instructions_per_second,"
+                          "peak_rss_kb\n");
+        fprintf(file, "%u,%lu,%lu,%u,%u,%u,%.9f,%.9f,%.9f,%.9f,%.9f,%.3f,%.1f,%ld\n",
+                instructions, (unsigned long)stats -> source_bytes,
+                (unsigned long)stats -> program_bytes, stats -> tokens, stats -> statements,
+                stats -> labels, stats -> phases[ASM_PHASE_LEX].wall_seconds,
+                stats -> phases[ASM_PHASE_PARSE].wall_seconds,
+                stats -> phases[ASM_PHASE_ADDRESS].wall_seconds,
+                stats -> phases[ASM_PHASE_EMIT].wall_seconds, total, mbps, ips,
+                stats -> phases[ASM_PHASE_EMIT].peak_rss_kb);
+    }
+    fflush(file);
+}
+
+/*!
+@brief prints usage instructions for the program.
+*/
+static void usage(char ** argv)
+{
+    tprintf("Usage: $> %s [options]\n", argv[0]);
+    tprintf("  --min <n>            Smallest program, in instructions. Default 1000.\n");
+    tprintf("  --max <n>            Largest program, in instructions. Default 10000000.\n");
+    tprintf("  --labels <percent>   Labels declared per 100 instructions. Default 5.\n");
+    tprintf("  --comments <percent> Instructions followed by a comment. Default 20.\n");
+    tprintf("  --mix <a:m:c>        Weights of ALU, memory and control instructions. Default 60:30:10.\n");
+    tprintf("  --seed <n>           Seed for the generator. Default 1.\n");
+    tprintf("  --repeat <n>         Runs per size, keeping the fastest of each phase. Default 3.\n");
+    tprintf("  --format <csv|json>  Result format. Default csv.\n");
+    tprintf("  --ascii              Emit ascii rather than binary output.\n");
+    tprintf("  --generate <file>    Write a single program of --max instructions and exit.\n");
+    tprintf("  -o <file>            Where to write the results. Default stdout, which the\n");
+    tprintf("                       assembler also logs to.\n");
+}
+
+int main(int argc, char ** argv)
+{
+    bench_program program = {0, 5, 20, 60, 30, 10, 1};
+    unsigned int  min     = 1000;
+    unsigned int  max     = 10000000;
+    unsigned int  repeat  = 3;
+    BOOL          json    = FALSE;
+    asm_format    format  = BINARY;
+    char        * generate = NULL;
+    char        * results_path = NULL;
+    int arg;
+
+    for(arg = 1; arg < argc; arg ++)
+    {
+        BOOL has_value = arg + 1 < argc;
+
+        if(strcmp(argv[arg], "--min") == 0 && has_value)
+            min = strtoul(argv[++arg], NULL, 10);
+        else if(strcmp(argv[arg], "--max") == 0 && has_value)
+            max = strtoul(argv[++arg], NULL, 10);
+        else if(strcmp(argv[arg], "--labels") == 0 && has_value)
+            program.label_percent = strtoul(argv[++arg], NULL, 10);
+        else if(strcmp(argv[arg], "--comments") == 0 && has_value)
+            program.comment_percent = strtoul(argv[++arg], NULL, 10);
+        else if(strcmp(argv[arg], "--mix") == 0 && has_value)
+        {
+            if(sscanf(argv[++arg], "%u:%u:%u", &program.alu_weight, &program.memory_weight,
+                      &program.control_weight) != 3)
+            {
+                usage(argv);
+                return 1;
+            }
+        }
+        else if(strcmp(argv[arg], "--seed") == 0 && has_value)
+            program.seed = strtoul(argv[++arg], NULL, 10);
+        else if(strcmp(argv[arg], "--repeat") == 0 && has_value)
+            repeat = strtoul(argv[++arg], NULL, 10);
+        else if(strcmp(argv[arg], "--format") == 0 && has_value)
+            json = strcmp(argv[++arg], "json") == 0;
+        else if(strcmp(argv[arg], "--ascii") == 0)
+            format = ASCII;
+        else if(strcmp(argv[arg], "--generate") == 0 && has_value)
+            generate = argv[++arg];
+        else if(strcmp(argv[arg], "-o") == 0 && has_value)
+            results_path = argv[++arg];
+        else
+        {
+            usage(argv);
+            return 1;
+        }
+    }
+
+    if(max == 0 || (generate == NULL && (min == 0 || max < min || repeat == 0)))
+    {
+        usage(argv);
+        return 1;
+    }
+
+    if(generate != NULL)
+    {
+        FILE * file = fopen(generate, "w");
+        if(file == NULL)
+            fatal("Could not open %s\n", generate);
+        program.instructions = max;
+        bench_generate(&program, file);
+        fclose(file);
+        return 0;
+    }
+
+    char path[] = "/tmp/tim-asm-bench-XXXXXX";
+    int fd = mkstemp(path);
+    if(fd < 0)
+        fatal("Could not create a temporary file\n");
+    close(fd);
+
+    FILE * results = results_path == NULL ? stdout : fopen(results_path, "w");
+    if(results == NULL)
+        fatal("Could not open %s\n", results_path);
+
+    if(json)
+        fprintf(results, "[\n");
+
+    unsigned long long size;
+    BOOL first = TRUE;
+    int errors = 0;
+
+    for(size = min; size <= max; size *= 10)
+    {
+        FILE * file = fopen(path, "w");
+        if(file == NULL)
+            fatal("Could not open %s\n", path);
+        program.instructions = (unsigned int)size;
+        bench_generate(&program, file);
+        fclose(file);
+
+        asm_stats best, run;
+        unsigned int r;
+        double start = bench_now();
+        memset(&best, 0, sizeof(asm_stats));
+
+        for(r = 0; r < repeat && errors == 0; r ++)
+        {
+            errors += bench_assemble(path, format, &run);
+            bench_keep_best(&best, &run, r == 0);
+        }
+
+        if(errors > 0)
+        {
+            fprintf(stderr, "Generated program of %llu instructions failed to assemble\n", size);
+            break;
+        }
+
+        bench_print_row(results, json, first, (unsigned int)size, &best);
+        fprintf(stderr, "%llu instructions: %.3f s for %u runs\n", size, bench_now() - start,
+                repeat);
+        first = FALSE;
+    }
+
+    if(json)
+        fprintf(results, "\n]\n");
+    if(results != stdout)
+        fclose(results);
+
+    unlink(path);
+    return errors > 0;
+}
+
+//! }@
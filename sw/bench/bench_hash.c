@@ -0,0 +1,89 @@
+/*!
+@ingroup sw-bench
+@{
+@file bench_hash.c
+@brief Benchmark for the assembler's symbol table.
+@details Inserts an increasing number of generated label names into an asm_hash_table, starting
+from the small initial size the assembler uses, and times inserting and then looking up every
+label, plus the same number of lookups for labels which are not in the table. The time per
+operation should stay roughly flat as the number of labels grows.
+*/
+
+#include <time.h>
+
+#include "asm.h"
+
+#ifdef TIM_PRINT_PROMPT
+    #undef TIM_PRINT_PROMPT
+#endif
+#define TIM_PRINT_PROMPT "\e[1;36mbench>\e[0m "
+
+//! The largest number of labels timed when none is given on the command line.
+#define BENCH_DEFAULT_LABELS 1000000
+
+//! Returns the current time in seconds.
+static double bench_now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+int main(int argc, char ** argv)
+{
+    unsigned int max_labels = BENCH_DEFAULT_LABELS;
+    if(argc > 1)
+        max_labels = (unsigned int)strtoul(argv[1], NULL, 10);
+
+    // Names in the style of compiler generated labels, which differ only in their last few
+    // characters, and the same number of names which are never inserted.
+    char * names   = malloc((size_t)max_labels * 2 * 24);
+    char ** labels = malloc((size_t)max_labels * 2 * sizeof(char*));
+    unsigned int i;
+
+    for(i = 0; i < max_labels * 2; i ++)
+    {
+        labels[i] = names + (size_t)i * 24;
+        sprintf(labels[i], "%s_%u", i < max_labels ? "L_block" : "L_missing", i);
+    }
+
+    printf("%-10s %12s %12s %12s %10s\n", "labels", "insert ns", "hit ns", "miss ns", "bins");
+
+    int failed = 0;
+    unsigned int count;
+
+    for(count = 1000; count <= max_labels; count *= 10)
+    {
+        asm_hash_table table;
+        asm_hash_table_new(1024, &table);
+
+        double start = bench_now();
+        for(i = 0; i < count; i ++)
+            failed |= asm_hash_table_insert(&table, labels[i], labels[i]);
+        double insert = bench_now() - start;
+
+        start = bench_now();
+        for(i = 0; i < count; i ++)
+            failed |= asm_hash_table_get(&table, labels[i]) != labels[i];
+        double hit = bench_now() - start;
+
+        start = bench_now();
+        for(i = 0; i < count; i ++)
+            failed |= asm_hash_table_get(&table, labels[max_labels + i]) != NULL;
+        double miss = bench_now() - start;
+
+        printf("%-10u %12.1f %12.1f %12.1f %10d\n", count, insert / count * 1e9,
+               hit / count * 1e9, miss / count * 1e9, table.current_size);
+
+        asm_hash_table_free(&table);
+    }
+
+    if(failed)
+        printf("MISMATCH: the table lost or invented a label!\n");
+
+    free(labels);
+    free(names);
+    return failed;
+}
+
+//! }@
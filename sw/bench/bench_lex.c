@@ -0,0 +1,188 @@
+/*!
+@ingroup sw-bench
+@{
+@file bench_lex.c
+@brief Microbenchmark for the assembler lexer.
+@details Generates a synthetic program in memory, lexes it, and then times classifying every
+opcode and register token with the lexer's constant time classifiers against a reference copy of
+the strcmp chains they replaced.
+*/
+
+#include <time.h>
+
+#include "asm.h"
+
+#ifdef TIM_PRINT_PROMPT
+    #undef TIM_PRINT_PROMPT
+#endif
+#define TIM_PRINT_PROMPT "\e[1;36mbench>\e[0m "
+
+//! The number of instructions generated when none is given on the command line.
+#define BENCH_DEFAULT_INSTRUCTIONS 1000000
+
+//! Every mnemonic the generator picks from.
+static char * bench_mnemonics[] = {
+    "LOAD", "STORE", "PUSH", "POP", "MOV", "JUMP", "CALL", "RETURN", "TEST", "HALT", "AND",
+    "NAND", "OR", "NOR", "XOR", "LSL", "LSR", "NOT", "IADD", "ISUB", "IMUL", "IDIV", "IASR",
+    "FADD", "FSUB", "FMUL", "FDIV", "FASR", "NOP", "SLEEP", "DATA"
+};
+
+//! Every register name the generator picks from.
+static char * bench_registers[] = {
+    "$R0", "$R1", "$R2", "$R3", "$R4", "$R5", "$R6", "$R7", "$R8", "$R9", "$R10", "$R11",
+    "$R12", "$R13", "$R14", "$R15", "$PC", "$SP", "$LR", "$TR", "$SR", "$IR", "$IS", "$T0",
+    "$T1", "$T2", "$T3", "$T4", "$T5", "$T6", "$T7"
+};
+
+//! Returns the current time in seconds.
+static double bench_now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+//! A small deterministic pseudo random number generator, so runs are reproducible.
+static unsigned int bench_random(unsigned int * state)
+{
+    unsigned int x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+/*!
+@brief Generates a program of random opcodes each followed by three register operands.
+@details The text does not need to assemble, only to lex, so operand counts are not matched to
+the opcodes.
+*/
+static void bench_generate(unsigned int instructions, asm_lex_source * source)
+{
+    size_t capacity = (size_t)instructions * 24 + 1;
+    char * text     = malloc(capacity);
+    size_t length   = 0;
+    unsigned int state = 0x12345678;
+    unsigned int i;
+
+    for(i = 0; i < instructions; i ++)
+    {
+        length += sprintf(text + length, "    %s %s %s %s\n",
+            bench_mnemonics[bench_random(&state) % 31],
+            bench_registers[bench_random(&state) % 31],
+            bench_registers[bench_random(&state) % 31],
+            bench_registers[bench_random(&state) % 31]);
+    }
+
+    source -> text     = text;
+    source -> length   = length;
+    source -> capacity = capacity;
+    source -> mapped   = FALSE;
+}
+
+//! Reference register classifier, as the lexer used to do it.
+static tim_register bench_strcmp_register(char * str)
+{
+    unsigned int i;
+    for(i = 0; i < 31; i ++)
+        if(strcmp(str, bench_registers[i]) == 0)
+            return i < 23 ? (tim_register)i : (tim_register)(i + 1);
+    return REG_ERROR;
+}
+
+//! Reference opcode classifier, as the lexer used to do it.
+static asm_lex_opcode bench_strcmp_instruction(char * str)
+{
+    unsigned int i;
+    for(i = 0; i < 31; i ++)
+        if(strcmp(str, bench_mnemonics[i]) == 0)
+            return (asm_lex_opcode)(i + 1);
+    return LEX_ERROR;
+}
+
+int main(int argc, char ** argv)
+{
+    unsigned int instructions = BENCH_DEFAULT_INSTRUCTIONS;
+    if(argc > 1)
+        instructions = (unsigned int)strtoul(argv[1], NULL, 10);
+
+    asm_lex_source  source;
+    asm_lex_tokens  tokens;
+    asm_arena       arena;
+    asm_intern_pool labels;
+    int             errors = 0;
+
+    bench_generate(instructions, &source);
+    asm_arena_new(1 << 20, &arena);
+    asm_intern_new(&arena, &labels);
+
+    printf("instructions:            %u\n", instructions);
+    printf("source bytes:            %lu\n", (unsigned long)source.length);
+
+    double start = bench_now();
+    asm_lex_source_tokens(&source, &arena, &labels, &tokens, &errors);
+    double lex_time = bench_now() - start;
+
+    printf("lex time:                %.3f s (%.1f MB/s, %u tokens)\n", lex_time,
+           source.length / lex_time / 1e6, tokens.count);
+
+    // Copy each token out into a null terminated string up front, as the old lexer did, so the
+    // reference timing only covers the comparisons.
+    char * copies = malloc(source.length + tokens.count);
+    char ** strings = malloc(tokens.count * sizeof(char*));
+    char * walker = copies;
+    unsigned int i;
+
+    for(i = 0; i < tokens.count; i ++)
+    {
+        memcpy(walker, source.text + tokens.offsets[i], tokens.lengths[i]);
+        walker[tokens.lengths[i]] = '\0';
+        strings[i] = walker;
+        walker += tokens.lengths[i] + 1;
+    }
+
+    unsigned long checksum_before = 0;
+    start = bench_now();
+    for(i = 0; i < tokens.count; i ++)
+    {
+        if(tokens.types[i] == OPCODE)
+            checksum_before += bench_strcmp_instruction(strings[i]);
+        else
+            checksum_before += bench_strcmp_register(strings[i]);
+    }
+    double before = bench_now() - start;
+
+    unsigned long checksum_after = 0;
+    start = bench_now();
+    for(i = 0; i < tokens.count; i ++)
+    {
+        char * token = source.text + tokens.offsets[i];
+        if(tokens.types[i] == OPCODE)
+            checksum_after += asm_lex_instruction(token, tokens.lengths[i], &errors, 0);
+        else
+            checksum_after += asm_lex_register(token, tokens.lengths[i], &errors, 0);
+    }
+    double after = bench_now() - start;
+
+    printf("classify strcmp chains:  %.3f s (%.1f ns/token)\n", before,
+           before / tokens.count * 1e9);
+    printf("classify hash/switch:    %.3f s (%.1f ns/token)\n", after,
+           after / tokens.count * 1e9);
+    printf("speedup:                 %.2fx\n", before / after);
+
+    if(checksum_before != checksum_after || errors != 0)
+    {
+        printf("MISMATCH between reference and lexer classifiers!\n");
+        return 1;
+    }
+
+    free(strings);
+    free(copies);
+    free(source.text);
+    asm_intern_free(&labels);
+    asm_arena_free(&arena);
+    return 0;
+}
+
+//! }@
@@ -0,0 +1,161 @@
+/*!
+@ingroup sw-bench
+@{
+@file bench_scan.c
+@brief Benchmark for the lexer's text scanning kernels.
+@details Generates a large, comment heavy program in memory and lexes it once with each scanning
+kernel the machine supports, checking that every kernel produces exactly the same tokens and line
+numbers. The raw newline kernel is also timed on its own over the whole text.
+*/
+
+#include <time.h>
+
+#include "asm.h"
+
+#ifdef TIM_PRINT_PROMPT
+    #undef TIM_PRINT_PROMPT
+#endif
+#define TIM_PRINT_PROMPT "\e[1;36mbench>\e[0m "
+
+//! The number of lines generated when none is given on the command line.
+#define BENCH_DEFAULT_LINES 2000000
+
+//! Returns the current time in seconds.
+static double bench_now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+//! A small deterministic pseudo random number generator, so runs are reproducible.
+static unsigned int bench_random(unsigned int * state)
+{
+    unsigned int x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+/*!
+@brief Generates a program where half the lines are long comments and most instructions carry a
+trailing comment, as our generated sources do.
+*/
+static void bench_generate(unsigned int lines, asm_lex_source * source)
+{
+    static char * comments[] = {
+        "; ---------------------------------------------------------------------------------",
+        "; Spill the loop counter before calling into the runtime library helpers below.",
+        ";",
+        "; generated from node 0x4f2a, basic block 17, predecessors 12 14 16",
+    };
+    static char * instructions[] = {
+        "    IADD  $R1 $R2 $R3", "    LOAD  $R4 $R5 0x10", "    MOV   $R6 $R7",
+        "    PUSH  $R8", "    POP   $R8", "    TEST  $R1 $R2", "    NOP", "    HALT"
+    };
+
+    size_t capacity = (size_t)lines * 100 + 1;
+    char * text     = malloc(capacity);
+    size_t length   = 0;
+    unsigned int state = 0x2468ace1;
+    unsigned int i;
+
+    for(i = 0; i < lines; i ++)
+    {
+        unsigned int r = bench_random(&state);
+        if(r & 1)
+            length += sprintf(text + length, "%s\n", comments[(r >> 1) % 4]);
+        else if(r & 2)
+            length += sprintf(text + length, "%-32s%s\n", instructions[(r >> 2) % 8],
+                              comments[1 + (r >> 5) % 3]);
+        else
+            length += sprintf(text + length, "%s\n", instructions[(r >> 2) % 8]);
+    }
+
+    source -> text     = text;
+    source -> length   = length;
+    source -> capacity = capacity;
+    source -> mapped   = FALSE;
+}
+
+int main(int argc, char ** argv)
+{
+    unsigned int lines = BENCH_DEFAULT_LINES;
+    if(argc > 1)
+        lines = (unsigned int)strtoul(argv[1], NULL, 10);
+
+    asm_lex_source source;
+    bench_generate(lines, &source);
+
+    printf("lines:        %u\n", lines);
+    printf("source bytes: %lu\n", (unsigned long)source.length);
+    printf("%-8s %12s %12s %12s %12s\n", "kernel", "lex (s)", "lex MB/s", "newline (s)", "tokens");
+
+    asm_scan_kernel kernels[] = {SCAN_SCALAR, SCAN_SSE2, SCAN_AVX2};
+    unsigned long reference = 0;
+    int failed = 0;
+    unsigned int k;
+
+    for(k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k ++)
+    {
+        if(!asm_scan_select(kernels[k]))
+        {
+            printf("%-8s %12s\n", asm_scan_kernel_name(kernels[k]), "unsupported");
+            continue;
+        }
+
+        asm_arena       arena;
+        asm_intern_pool labels;
+        asm_lex_tokens  tokens;
+        int             errors = 0;
+
+        asm_arena_new(1 << 20, &arena);
+        asm_intern_new(&arena, &labels);
+
+        double start = bench_now();
+        asm_lex_source_tokens(&source, &arena, &labels, &tokens, &errors);
+        double lex_time = bench_now() - start;
+
+        // The newline kernel on its own, counting every line in the text.
+        char * cursor = source.text;
+        char * end    = source.text + source.length;
+        unsigned int newlines = 0;
+
+        start = bench_now();
+        while((cursor = asm_scan_newline(cursor, end)) < end)
+        {
+            newlines ++;
+            cursor ++;
+        }
+        double newline_time = bench_now() - start;
+
+        // Fold every token's position into a checksum so the kernels can be compared.
+        unsigned long checksum = tokens.count;
+        unsigned int i;
+        for(i = 0; i < tokens.count; i ++)
+            checksum = checksum * 31 + tokens.line_numbers[i] * 7 + tokens.offsets[i] +
+                       tokens.lengths[i];
+
+        printf("%-8s %12.3f %12.1f %12.3f %12u\n", asm_scan_kernel_name(kernels[k]), lex_time,
+               source.length / lex_time / 1e6, newline_time, tokens.count);
+
+        if(k == 0)
+            reference = checksum;
+        if(checksum != reference || errors != 0 || newlines != lines)
+        {
+            printf("MISMATCH: kernel %s disagrees with the scalar kernel!\n",
+                   asm_scan_kernel_name(kernels[k]));
+            failed = 1;
+        }
+
+        asm_intern_free(&labels);
+        asm_arena_free(&arena);
+    }
+
+    free(source.text);
+    return failed;
+}
+
+//! }@
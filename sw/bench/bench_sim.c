@@ -0,0 +1,335 @@
+/*!
+@ingroup sw-bench
+@{
+@file bench_sim.c
+@brief Compares the instructions per second of every simulator execution engine.
+@details A handful of small kernels, each an endless loop typical of firmware control code, are
+assembled in process, then run by each engine for the same number of instructions. The fastest
+of several runs is kept, and every engine must leave the machine in the same state as the
+reference engine, or the benchmark fails. Each kernel is also run traced, as tim-sim -x runs it,
+timed until the whole trace has been written to a temporary file, so the cost of tracing can be
+read against the predecode engine it runs on.
+*/
+
+#include <time.h>
+
+#include "sim.h"
+
+#ifdef TIM_PRINT_PROMPT
+    #undef TIM_PRINT_PROMPT
+#endif
+#define TIM_PRINT_PROMPT "\e[1;36mbench>\e[0m "
+
+//! A kernel to run, as assembly source.
+typedef struct bench_kernel_t{
+    //! Short name of the kernel, printed in the results.
+    char * name;
+    //! The source of the kernel.
+    char * source;
+} bench_kernel;
+
+//! The kernels, each an endless loop.
+static bench_kernel bench_kernels[] = {
+    {"countdown",
+        // A counted inner loop of ALU work closed by TEST and a conditional JUMP.
+        ".top\n"
+        "    MOV  $R1 0xFFFF\n"
+        ".loop\n"
+        "    ISUB $R1 $R1 0x1\n"
+        "    IADD $R4 $R4 $R1\n"
+        "    XOR  $R5 $R5 $R4\n"
+        "    TEST $R1 $R0\n"
+        "    ?F JUMP .loop\n"
+        "    JUMP .top\n"},
+    {"branch",
+        // A hashed four way switch, so which jump is taken is hard to predict.
+        "    MOV  $R6 0x1\n"
+        "    MOV  $R7 0x2\n"
+        ".top\n"
+        "    IADD $R1 $R1 0x1\n"
+        "    IMUL $R2 $R1 0x9E37\n"
+        "    LSR  $R2 $R2 0x5\n"
+        "    AND  $R2 $R2 0x3\n"
+        "    TEST $R2 $R0\n"
+        "    ?T JUMP .case0\n"
+        "    TEST $R2 $R6\n"
+        "    ?T JUMP .case1\n"
+        "    TEST $R2 $R7\n"
+        "    ?T JUMP .case2\n"
+        "    XOR  $R5 $R5 $R1\n"
+        "    JUMP .top\n"
+        ".case0\n"
+        "    IADD $R3 $R3 0x1\n"
+        "    JUMP .top\n"
+        ".case1\n"
+        "    ISUB $R4 $R4 $R1\n"
+        "    JUMP .top\n"
+        ".case2\n"
+        "    LSL  $R5 $R5 0x1\n"
+        "    JUMP .top\n"},
+    {"stack",
+        // Register saves and restores around a little work, as in a function prologue.
+        ".top\n"
+        "    PUSH $R1\n"
+        "    PUSH $R2\n"
+        "    PUSH $R3\n"
+        "    PUSH $R4\n"
+        "    IADD $R1 $R1 0x1\n"
+        "    IADD $R2 $R1 $R3\n"
+        "    POP  $R4\n"
+        "    POP  $R3\n"
+        "    POP  $R2\n"
+        "    POP  $R5\n"
+        "    ISUB $R3 $R3 0x1\n"
+        "    JUMP .top\n"}
+};
+
+//! The number of kernels.
+#define BENCH_KERNELS (sizeof(bench_kernels) / sizeof(bench_kernel))
+
+//! The number of engines.
+#define BENCH_ENGINES (SIM_JIT + 1)
+
+//! Stands for a traced run in the engine loop, after every real engine.
+#define BENCH_TRACED BENCH_ENGINES
+
+//! Returns the monotonic time in seconds.
+static double bench_now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+/*!
+@brief Assembles a kernel into a binary program image.
+@param kernel - The kernel to assemble.
+@param image - The file to emit the image to. It is rewound ready to be loaded.
+@returns The number of errors encountered.
+*/
+static int bench_assemble(bench_kernel * kernel, FILE * image)
+{
+    asm_arena       arena;
+    asm_symbol_table symbol_table;
+    asm_lex_source  text;
+    asm_lex_tokens  tokens;
+    asm_statements  statements;
+    int             errors = 0;
+
+    FILE * source = tmpfile();
+    if(source == NULL)
+        fatal("Could not create a temporary file\n");
+    fputs(kernel -> source, source);
+    rewind(source);
+
+    asm_arena_new(1 << 16, &arena);
+    asm_intern_new(&arena, &symbol_table.names);
+
+    if(!asm_lex_source_open(source, &text))
+        fatal("Could not read the %s kernel\n", kernel -> name);
+    asm_lex_source_tokens(&text, &arena, &symbol_table.names, &tokens, &errors);
+
+    if(errors == 0)
+        asm_parse_token_stream(&tokens, &symbol_table, &statements, &errors);
+    if(errors == 0)
+        errors += asm_calculate_addresses(&statements, 0, &symbol_table);
+    if(errors == 0)
+        errors += asm_emit_instructions(&statements, image, BINARY);
+
+    asm_intern_free(&symbol_table.names);
+    asm_arena_free(&arena);
+    asm_lex_source_close(&text);
+    fclose(source);
+    rewind(image);
+    return errors;
+}
+
+/*!
+@brief Loads a program image into a fresh machine and runs it with one engine.
+@param image - The program image, as written by bench_assemble.
+@param engine - The engine to run it with.
+@param instructions - How many instructions to run.
+@param tr - The machine after running. Free it with sim_machine_free.
+@returns The time taken to run, excluding loading and pre-decoding, but including translation.
+*/
+static double bench_run(FILE * image, sim_engine engine, unsigned long long instructions,
+                        sim_machine * tr)
+{
+    if(!sim_machine_new(SIM_DEFAULT_MEMORY, tr))
+        fatal("Could not allocate simulated memory\n");
+
+    rewind(image);
+    if(!sim_machine_load_file(tr, image, BINARY))
+        fatal("Could not load a kernel\n");
+    if(engine != SIM_DECODE && !sim_predecode_new(tr))
+        fatal("Could not allocate the decode cache\n");
+    if(engine == SIM_JIT && !sim_jit_new(tr))
+        warning("No JIT for this host, the jit engine runs threaded\n");
+
+    double start = bench_now();
+    sim_run_engine(tr, engine, instructions);
+    return bench_now() - start;
+}
+
+/*!
+@brief Loads a program image into a fresh machine and runs it traced, as tim-sim -x does.
+@param image - The program image, as written by bench_assemble.
+@param instructions - How many instructions to run.
+@param tr - The machine after running. Free it with sim_machine_free.
+@returns The time taken to run and write the whole trace, excluding loading and pre-decoding.
+*/
+static double bench_run_traced(FILE * image, unsigned long long instructions, sim_machine * tr)
+{
+    sim_trace      * trace;
+    sim_trace_ring * ring;
+
+    if(!sim_machine_new(SIM_DEFAULT_MEMORY, tr))
+        fatal("Could not allocate simulated memory\n");
+
+    rewind(image);
+    if(!sim_machine_load_file(tr, image, BINARY))
+        fatal("Could not load a kernel\n");
+    if(!sim_predecode_new(tr))
+        fatal("Could not allocate the decode cache\n");
+
+    FILE * file = tmpfile();
+    if(file == NULL)
+        fatal("Could not create a temporary file\n");
+
+    double start = bench_now();
+    if(!sim_trace_new(file, &trace) || !sim_trace_ring_new(trace, &ring))
+        fatal("Could not start the trace writer\n");
+    sim_trace_ring_start(ring, 0, tr -> registers[PC]);
+    sim_run_traced(tr, ring, instructions);
+    if(!sim_trace_free(trace))
+        fatal("Could not write the trace\n");
+    double seconds = bench_now() - start;
+
+    fclose(file);
+    return seconds;
+}
+
+//! Returns TRUE if two machines stopped in the same state.
+static BOOL bench_same_state(sim_machine * a, sim_machine * b)
+{
+    return a -> halt == b -> halt && a -> instructions == b -> instructions &&
+           memcmp(a -> registers, b -> registers, sizeof(a -> registers)) == 0 &&
+           memcmp(a -> memory, b -> memory, a -> memory_size) == 0;
+}
+
+static void usage(char ** argv)
+{
+    tprintf("Usage: $> %s [options]\n", argv[0]);
+    tprintf("  -n <instructions>    Instructions run per kernel and engine. Default 100000000.\n");
+    tprintf("  --repeat <n>         Runs per kernel and engine, keeping the fastest. Default 3.\n");
+    tprintf("  --kernel <name>      Only run the named kernel.\n");
+}
+
+int main(int argc, char ** argv)
+{
+    unsigned long long instructions = 100000000ULL;
+    unsigned int       repeat       = 3;
+    char             * only         = NULL;
+    FILE             * images[BENCH_KERNELS];
+    unsigned int       k;
+    int arg;
+
+    for(arg = 1; arg < argc; arg ++)
+    {
+        BOOL has_value = arg + 1 < argc;
+
+        if(strcmp(argv[arg], "-n") == 0 && has_value)
+            instructions = strtoull(argv[++arg], NULL, 10);
+        else if(strcmp(argv[arg], "--repeat") == 0 && has_value)
+            repeat = strtoul(argv[++arg], NULL, 10);
+        else if(strcmp(argv[arg], "--kernel") == 0 && has_value)
+            only = argv[++arg];
+        else
+        {
+            usage(argv);
+            return 1;
+        }
+    }
+
+    if(instructions == 0 || repeat == 0)
+    {
+        usage(argv);
+        return 1;
+    }
+
+    // Assemble everything up front, so the assembler's log comes before the results.
+    for(k = 0; k < BENCH_KERNELS; k ++)
+    {
+        images[k] = tmpfile();
+        if(images[k] == NULL || bench_assemble(&bench_kernels[k], images[k]) > 0)
+            fatal("Could not assemble the %s kernel\n", bench_kernels[k].name);
+    }
+
+    printf("kernel,engine,dispatch,instructions,seconds,mips,speedup\n");
+
+    int mismatches = 0;
+
+    for(k = 0; k < BENCH_KERNELS; k ++)
+    {
+        if(only != NULL && strcmp(only, bench_kernels[k].name) != 0)
+            continue;
+
+        sim_machine reference;
+        double reference_seconds = 0;
+        sim_engine engine;
+
+        for(engine = SIM_DECODE; engine <= BENCH_TRACED; engine ++)
+        {
+            sim_machine machine;
+            double best = 0;
+            unsigned int r;
+
+            for(r = 0; r < repeat; r ++)
+            {
+                double seconds = engine == BENCH_TRACED ?
+                                 bench_run_traced(images[k], instructions, &machine) :
+                                 bench_run(images[k], engine, instructions, &machine);
+                if(r == 0 || seconds < best)
+                    best = seconds;
+                if(r + 1 < repeat)
+                    sim_machine_free(&machine);
+            }
+
+            if(engine == SIM_DECODE)
+            {
+                reference         = machine;
+                reference_seconds = best;
+            }
+            else
+            {
+                if(!bench_same_state(&reference, &machine))
+                {
+                    error("%s engine disagrees with the decode engine on the %s kernel\n",
+                          engine == BENCH_TRACED ? "traced" : sim_engine_names[engine],
+                          bench_kernels[k].name);
+                    mismatches ++;
+                }
+                sim_machine_free(&machine);
+            }
+
+            printf("%s,%s,%s,%llu,%.4f,%.1f,%.2f\n", bench_kernels[k].name,
+                   engine == BENCH_TRACED ? "traced" : sim_engine_names[engine],
+                   engine == BENCH_TRACED ? "ring" :
+                   engine == SIM_JIT ? "native" :
+                   engine == SIM_THREADED ? sim_threaded_dispatch :
+                   engine == SIM_PREDECODE ? "call" : "switch",
+                   reference.instructions, best, reference.instructions / best / 1e6,
+                   reference_seconds / best);
+            fflush(stdout);
+        }
+
+        sim_machine_free(&reference);
+    }
+
+    for(k = 0; k < BENCH_KERNELS; k ++)
+        fclose(images[k]);
+
+    return mismatches > 0;
+}
+
+//! }@
@@ -169,15 +169,20 @@ typedef enum tim_instruction_opcode_e {
     FDIVR = 48, //!< Floating point Divide register X by register Y.
     FASRR = 49, //!< Floating point Arithmetic shift register X right value in register Y.
     SLEEP = 50, //!< Sleeps the core for a certain number of cycles.
-    NOT_EMITTED=51 //!< Used in the parse tree for instruction like DATA that are not emitted.
+    JUMPS = 51, //!< Jump by a signed 8 bit offset from the address of the next instruction.
+    CALLS = 52, //!< Call a function a signed 8 bit offset from the address of the next instruction.
+    MOVIS = 53, //!< Move a 4 bit immediate into general register X.
+    MOVIM = 54, //!< Move an 11 bit immediate into register X.
+    ANDIS = 55, //!< Bitwise AND register Y with an 8 bit immediate.
+    ORIS  = 56, //!< Bitwise OR register Y with an 8 bit immediate.
+    XORIS = 57, //!< Bitwise XOR register Y with an 8 bit immediate.
+    LSLIS = 58, //!< Logical shift left register Y by an 8 bit immediate.
+    LSRIS = 59, //!< Logical shift right register Y by an 8 bit immediate.
+    IADDIS= 60, //!< Integer Add an 8 bit immediate to register Y.
+    ISUBIS= 61, //!< Integer Subtract an 8 bit immediate from register Y.
+    NOPS  = 62, //!< Do nothing, in a single byte.
+    NOT_EMITTED=63 //!< Used in the parse tree for instruction like DATA that are not emitted.
 } tim_instruction_opcode;
-    
-
-//! The opcode of the instruction.
-tim_instruction_opcode opcode;
-
-//! The number of bytes the instruction occupies in memory.
-tim_instruction_size   size;
 
 //! A condition code for conditional execution.
 typedef enum tim_condition_e{
@@ -0,0 +1,357 @@
+/*!
+@ingroup sw-sim
+@{
+@file sim.c
+@brief Main source file for the instruction set simulator. Contains main function and argument
+parser.
+*/
+
+#include <time.h>
+
+#include "sim.h"
+
+//! The number of instructions run before giving up when no limit is given.
+#define SIM_DEFAULT_MAX_INSTRUCTIONS 1000000000ULL
+
+/*!
+@brief Contains all information for the program in a format that can be easily passed around.
+*/
+typedef struct sim_context_t
+{
+    //! The path of the program image to run.
+    char * input_file;
+    //! Whether the image is raw bytes or ascii bit strings.
+    asm_format format;
+    //! The size of simulated memory in bytes.
+    unsigned int memory_size;
+    //! Stop after this many instructions.
+    unsigned long long max_instructions;
+    //! How to execute the program.
+    sim_engine engine;
+    //! A checkpoint to start from instead of a program image, or NULL.
+    char * restore_file;
+    //! Where to write a checkpoint of the machine once it stops, or NULL.
+    char * checkpoint_file;
+    //! Where to write the report of the fetch timing model, "-" for stdout, or NULL to run the
+    //! program without it.
+    char * timing_file;
+    //! Where to write a binary trace of every instruction executed, or NULL.
+    char * trace_file;
+    //! Where to write the execution profile, "-" for stdout, or NULL to run without one.
+    char * profile_file;
+    //! The line table written by tim-asm --lines for the profile, or NULL.
+    char * lines_file;
+    //! Bus wait states for the timing model.
+    unsigned int wait_states;
+    //! Whether the timing model fetches aligned words.
+    BOOL aligned_fetch;
+    //! The machine being simulated.
+    sim_machine machine;
+} sim_context;
+
+/*!
+@brief prints usage instructions for the program.
+*/
+void usage(int argc, char ** argv)
+{
+    tprintf("TIM Instruction Set Simulator                                      \n");
+    tprintf("-------------------------------------------------------------------\n");
+    tprintf("                                                                   \n");
+    tprintf("Usage: $> %s -i <program> [-f binary|ascii] [-m bytes] [-n instructions]\n"
+            "                 [-e decode|predecode|threaded|jit] [-c checkpoint]\n"
+            "                 [-t report [-w wait states] [-a word|byte]] [-x trace]\n"
+            "                 [-p profile [-l line table]]\n", argv[0]);
+    tprintf("       $> %s -r <checkpoint> [-n instructions] [-e ...] [-c checkpoint]\n",
+            argv[0]);
+    tprintf("       -f  Format of the program image, as written by tim-asm. Default binary.\n");
+    tprintf("       -m  Size of simulated memory in bytes. Default %u.\n", SIM_DEFAULT_MEMORY);
+    tprintf("       -n  Stop after this many instructions. Default %llu.\n",
+            SIM_DEFAULT_MAX_INSTRUCTIONS);
+    tprintf("       -e  Execution engine. decode decodes each instruction as it is fetched,\n");
+    tprintf("           predecode decodes the whole program once when loaded, and threaded\n");
+    tprintf("           also dispatches with %s. jit translates basic blocks to x86-64\n",
+            sim_threaded_dispatch);
+    tprintf("           code, running threaded on other hosts. Default jit.\n");
+    tprintf("       -c  Write a checkpoint of the whole machine to this file once it stops.\n");
+    tprintf("       -r  Carry on from a checkpoint rather than load a program. -n then counts\n");
+    tprintf("           instructions from the checkpoint.\n");
+    tprintf("       -t  Run through a timing model of the core's fetch buffer and bus instead of\n");
+    tprintf("           -e, and write the cycles and fetch stalls of each opcode to this file,\n");
+    tprintf("           or - for stdout.\n");
+    tprintf("       -w  Bus wait states for -t. Default 0.\n");
+    tprintf("       -a  Whether -t fetches whole aligned words, or four bytes from any address.\n");
+    tprintf("           Default word.\n");
+    tprintf("       -x  Write a binary trace of every instruction executed to this file, for\n");
+    tprintf("           tim-sim-trace to decode. Runs the predecode engine instead of -e.\n");
+    tprintf("       -p  Count how often each instruction and basic block runs, and write the\n");
+    tprintf("           hottest blocks and a listing to this file, or - for stdout. Runs the\n");
+    tprintf("           predecode engine instead of -e.\n");
+    tprintf("       -l  Line table written by tim-asm --lines, so -p can list the source.\n");
+    tprintf("\n");
+}
+
+/*!
+@brief Parses the command line arguments passed to the program into a sim_context object.
+*/
+void parse_cmd_args(int argc, char ** argv, sim_context * cxt)
+{
+    int arg;
+
+    cxt -> format           = BINARY;
+    cxt -> memory_size      = SIM_DEFAULT_MEMORY;
+    cxt -> max_instructions = SIM_DEFAULT_MAX_INSTRUCTIONS;
+    cxt -> engine           = SIM_JIT;
+    cxt -> aligned_fetch    = TRUE;
+
+    for(arg = 1; arg < argc; arg++)
+    {
+        if(arg + 1 >= argc)
+        {
+            warning("Missing value for argument: '%s'\n", argv[arg]);
+            usage(argc, argv);
+            exit(1);
+        }
+
+        if(strcmp(argv[arg], "-i") == 0)
+            cxt -> input_file = argv[arg+1];
+        else if(strcmp(argv[arg], "-m") == 0)
+            cxt -> memory_size = strtoul(argv[arg+1], NULL, 0);
+        else if(strcmp(argv[arg], "-n") == 0)
+            cxt -> max_instructions = strtoull(argv[arg+1], NULL, 0);
+        else if(strcmp(argv[arg], "-c") == 0)
+            cxt -> checkpoint_file = argv[arg+1];
+        else if(strcmp(argv[arg], "-r") == 0)
+            cxt -> restore_file = argv[arg+1];
+        else if(strcmp(argv[arg], "-t") == 0)
+            cxt -> timing_file = argv[arg+1];
+        else if(strcmp(argv[arg], "-x") == 0)
+            cxt -> trace_file = argv[arg+1];
+        else if(strcmp(argv[arg], "-p") == 0)
+            cxt -> profile_file = argv[arg+1];
+        else if(strcmp(argv[arg], "-l") == 0)
+            cxt -> lines_file = argv[arg+1];
+        else if(strcmp(argv[arg], "-w") == 0)
+            cxt -> wait_states = strtoul(argv[arg+1], NULL, 0);
+        else if(strcmp(argv[arg], "-a") == 0)
+        {
+            if(strcmp(argv[arg+1], "word") == 0)
+                cxt -> aligned_fetch = TRUE;
+            else if(strcmp(argv[arg+1], "byte") == 0)
+                cxt -> aligned_fetch = FALSE;
+            else
+            {
+                usage(argc, argv);
+                fatal("Unknown fetch alignment: %s\n", argv[arg+1]);
+            }
+        }
+        else if(strcmp(argv[arg], "-f") == 0)
+        {
+            if(strcmp(argv[arg+1], "ascii") == 0)
+                cxt -> format = ASCII;
+            else if(strcmp(argv[arg+1], "binary") == 0)
+                cxt -> format = BINARY;
+            else
+            {
+                usage(argc, argv);
+                fatal("Unknown input format: %s\n", argv[arg+1]);
+            }
+        }
+        else if(strcmp(argv[arg], "-e") == 0)
+        {
+            if(strcmp(argv[arg+1], sim_engine_names[SIM_DECODE]) == 0)
+                cxt -> engine = SIM_DECODE;
+            else if(strcmp(argv[arg+1], sim_engine_names[SIM_PREDECODE]) == 0)
+                cxt -> engine = SIM_PREDECODE;
+            else if(strcmp(argv[arg+1], sim_engine_names[SIM_THREADED]) == 0)
+                cxt -> engine = SIM_THREADED;
+            else if(strcmp(argv[arg+1], sim_engine_names[SIM_JIT]) == 0)
+                cxt -> engine = SIM_JIT;
+            else
+            {
+                usage(argc, argv);
+                fatal("Unknown execution engine: %s\n", argv[arg+1]);
+            }
+        }
+        else
+        {
+            warning("Unknown argument: '%s'\n", argv[arg]);
+            usage(argc, argv);
+            exit(1);
+        }
+        arg++;
+    }
+}
+
+/*!
+@brief Main entry point for the application.
+@returns Zero if the program stopped at a HALT instruction, otherwise one.
+*/
+int main(int argc, char ** argv)
+{
+    sim_context cxt;
+    memset(&cxt, 0, sizeof(sim_context));
+    parse_cmd_args(argc, argv, &cxt);
+
+    if(cxt.input_file == NULL && cxt.restore_file == NULL)
+    {
+        usage(argc, argv);
+        exit(1);
+    }
+
+    if(cxt.restore_file != NULL)
+    {
+        sim_checkpoint checkpoint;
+
+        FILE * input = fopen(cxt.restore_file, "rb");
+        if(input == NULL)
+            fatal("Could not open checkpoint: %s\n", cxt.restore_file);
+        if(!sim_checkpoint_load(input, &checkpoint))
+            fatal("Could not read checkpoint: %s\n", cxt.restore_file);
+        fclose(input);
+
+        if(!sim_checkpoint_fork(&checkpoint, &cxt.machine))
+            fatal("Could not allocate %u bytes of simulated memory\n", checkpoint.memory_size);
+        sim_checkpoint_free(&checkpoint);
+
+        // Count the limit from the checkpoint, not from reset.
+        cxt.max_instructions += cxt.machine.instructions;
+
+        log("Restored:\t %s after %llu instructions\n", cxt.restore_file,
+            cxt.machine.instructions);
+    }
+    else
+    {
+        FILE * input = fopen(cxt.input_file, cxt.format == BINARY ? "rb" : "r");
+        if(input == NULL)
+            fatal("Could not open program image: %s\n", cxt.input_file);
+
+        if(!sim_machine_new(cxt.memory_size, &cxt.machine))
+            fatal("Could not allocate %u bytes of simulated memory\n", cxt.memory_size);
+
+        if(!sim_machine_load_file(&cxt.machine, input, cxt.format))
+            fatal("Could not load program image: %s\n", cxt.input_file);
+        fclose(input);
+
+        log("Program:\t %s (%u bytes)\n", cxt.input_file, cxt.machine.program_end);
+    }
+
+    // The timing model decodes as it fetches, and tracing and profiling run from the decode cache.
+    if((cxt.timing_file != NULL) + (cxt.trace_file != NULL) + (cxt.profile_file != NULL) > 1)
+        fatal("Only one of -t, -x and -p may be given\n");
+    if(cxt.timing_file != NULL)
+        cxt.engine = SIM_DECODE;
+    if(cxt.trace_file != NULL || cxt.profile_file != NULL)
+        cxt.engine = SIM_PREDECODE;
+
+    if(cxt.engine != SIM_DECODE && !sim_predecode_new(&cxt.machine))
+        fatal("Could not allocate the decode cache for %u bytes of program\n",
+              cxt.machine.program_end);
+
+    if(cxt.engine == SIM_JIT && !sim_jit_new(&cxt.machine))
+    {
+        warning("No JIT for this host, running the threaded engine instead\n");
+        cxt.engine = SIM_THREADED;
+    }
+
+    sim_timing       timing;
+    sim_profile      profile;
+    sim_trace      * trace  = NULL;
+    sim_trace_ring * ring   = NULL;
+    FILE           * traced = NULL;
+    sim_halt_reason  halt;
+    struct timespec  start, end;
+
+    sim_timing_new(cxt.wait_states, cxt.aligned_fetch, &timing);
+
+    if(cxt.trace_file != NULL)
+    {
+        traced = fopen(cxt.trace_file, "wb");
+        if(traced == NULL)
+            fatal("Could not open trace for writing: %s\n", cxt.trace_file);
+        if(!sim_trace_new(traced, &trace) || !sim_trace_ring_new(trace, &ring))
+            fatal("Could not start the trace writer\n");
+        sim_trace_ring_start(ring, 0, cxt.machine.registers[PC]);
+    }
+
+    if(cxt.profile_file != NULL)
+    {
+        if(!sim_profile_new(&cxt.machine, &profile))
+            fatal("Could not allocate the profile counts\n");
+        if(cxt.lines_file != NULL)
+        {
+            FILE * lines = fopen(cxt.lines_file, "r");
+            if(lines == NULL)
+                fatal("Could not open line table: %s\n", cxt.lines_file);
+            if(!sim_profile_load_lines(&profile, lines))
+                fatal("Could not read line table: %s\n", cxt.lines_file);
+            fclose(lines);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if(cxt.timing_file != NULL)
+        halt = sim_run_timed(&cxt.machine, &timing, cxt.max_instructions);
+    else if(cxt.profile_file != NULL)
+        halt = sim_run_profiled(&cxt.machine, &profile, cxt.max_instructions);
+    else if(trace != NULL)
+        halt = sim_run_traced(&cxt.machine, ring, cxt.max_instructions);
+    else
+        halt = sim_run_engine(&cxt.machine, cxt.engine, cxt.max_instructions);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if(trace != NULL)
+    {
+        if(!sim_trace_free(trace))
+            fatal("Could not write trace: %s\n", cxt.trace_file);
+        fclose(traced);
+    }
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+    log("Stopped:\t %s at 0x%08X\n", sim_halt_reason_names[halt], cxt.machine.registers[PC]);
+    log("Executed:\t %llu instructions in %.3f s (%.1f MIPS)\n", cxt.machine.instructions,
+        seconds, seconds > 0 ? cxt.machine.instructions / seconds / 1e6 : 0);
+
+    sim_machine_print(&cxt.machine, stdout);
+
+    if(cxt.timing_file != NULL)
+    {
+        FILE * output = strcmp(cxt.timing_file, "-") == 0 ? stdout : fopen(cxt.timing_file, "w");
+        if(output == NULL)
+            fatal("Could not open timing report for writing: %s\n", cxt.timing_file);
+        sim_timing_print(&timing, output);
+        if(output != stdout)
+            fclose(output);
+    }
+
+    if(cxt.profile_file != NULL)
+    {
+        FILE * output = strcmp(cxt.profile_file, "-") == 0 ? stdout : fopen(cxt.profile_file, "w");
+        if(output == NULL)
+            fatal("Could not open profile for writing: %s\n", cxt.profile_file);
+        sim_profile_print(&profile, &cxt.machine, output);
+        if(output != stdout)
+            fclose(output);
+        sim_profile_free(&profile);
+    }
+
+    if(cxt.checkpoint_file != NULL)
+    {
+        sim_checkpoint checkpoint;
+
+        FILE * output = fopen(cxt.checkpoint_file, "wb");
+        if(output == NULL)
+            fatal("Could not open checkpoint for writing: %s\n", cxt.checkpoint_file);
+        if(!sim_checkpoint_new(&cxt.machine, &checkpoint))
+            fatal("Could not allocate a checkpoint of %u bytes\n", cxt.machine.memory_size);
+        if(!sim_checkpoint_save(&checkpoint, output))
+            fatal("Could not write checkpoint: %s\n", cxt.checkpoint_file);
+        fclose(output);
+        sim_checkpoint_free(&checkpoint);
+    }
+
+    sim_machine_free(&cxt.machine);
+
+    return halt == SIM_HALTED ? 0 : 1;
+}
+
+//! }@
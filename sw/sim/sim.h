@@ -0,0 +1,803 @@
+/*!
+@ingroup sw-sim
+@{
+@file sim.h
+@brief Header file for data types and functions used by the instruction set simulator.
+*/
+
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+
+#include "common.h"
+#include "asm.h"
+
+#ifndef SIM_H
+#define SIM_H
+
+#ifdef TIM_PRINT_PROMPT
+    #undef TIM_PRINT_PROMPT
+#endif
+#define TIM_PRINT_PROMPT "\e[1;35msim>\e[0m "
+
+//! The number of registers addressable by a 5 bit register field.
+#define SIM_REGISTER_COUNT 32
+
+//! The default size of simulated memory in bytes, the reach of a 24 bit JUMPI immediate.
+#define SIM_DEFAULT_MEMORY (1 << 24)
+
+//! Memory is allocated with this many bytes past its end, so a word access never overruns it.
+#define SIM_MEMORY_SLACK 4
+
+//! The length in bytes of the longest instruction.
+#define SIM_INSTRUCTION_MAX_SIZE 4
+
+//! Status register zero flag. Set if the result of the last ALU operation was zero.
+#define SIM_SR_ZERO     0x01
+//! Status register carry flag. Set if the last add or subtract carried or borrowed.
+#define SIM_SR_CARRY    0x02
+//! Status register negative flag. Set if the last ALU result had its top bit set.
+#define SIM_SR_NEGATIVE 0x04
+//! Status register overflow flag. Set if the last arithmetic result did not fit in 32 bits.
+#define SIM_SR_OVERFLOW 0x08
+
+/*!
+@brief Why a simulated machine stopped running.
+*/
+typedef enum sim_halt_reason_e{
+    SIM_RUNNING     = 0, //!< The machine has not stopped.
+    SIM_HALTED      = 1, //!< A HALT instruction was executed.
+    SIM_END         = 2, //!< The program counter left the loaded program.
+    SIM_ILLEGAL     = 3, //!< An instruction with an unassigned opcode was fetched.
+    SIM_STEP_LIMIT  = 4  //!< The maximum number of instructions was executed.
+} sim_halt_reason;
+
+/*!
+@brief The ways the simulator can execute a program.
+*/
+typedef enum sim_engine_e{
+    SIM_DECODE      = 0, //!< Decode each instruction as it is fetched, with sim_run.
+    SIM_PREDECODE   = 1, //!< Call a handler for each pre-decoded instruction, sim_run_predecoded.
+    SIM_THREADED    = 2, //!< Threaded dispatch of pre-decoded instructions, sim_run_threaded.
+    SIM_JIT         = 3  //!< Translate basic blocks to host machine code, with sim_run_jit.
+} sim_engine;
+
+/*!
+@brief A single instruction, decoded from memory into separate fields.
+@details Fields an instruction does not use are zero. Register fields index the register file
+directly, as tim_register values.
+*/
+typedef struct sim_instruction_t{
+    //! The tim_instruction_opcode of the instruction.
+    unsigned char opcode;
+    //! The tim_condition under which the instruction executes.
+    unsigned char condition;
+    //! The length of the instruction in bytes.
+    unsigned char size;
+    //! The byte mask of LOADR and STORR, most significant byte in bit 3.
+    unsigned char byte_mask;
+    //! The first register operand, usually the destination.
+    unsigned char reg_1;
+    //! The second register operand.
+    unsigned char reg_2;
+    //! The third register operand.
+    unsigned char reg_3;
+    //! Unused, keeps the immediate aligned.
+    unsigned char reserved;
+    //! The immediate operand, zero extended.
+    unsigned int  immediate;
+} sim_instruction;
+
+//! Typedef for a pre-decoded instruction record.
+typedef struct sim_decoded_t sim_decoded;
+
+//! Typedef for the translation cache of the JIT engine.
+typedef struct sim_jit_t sim_jit;
+
+/*!
+@brief The complete state of one simulated TIM core and its memory.
+*/
+typedef struct sim_machine_t{
+    //! The register file, indexed by tim_register. PC holds the address of the next instruction.
+    unsigned int       registers[SIM_REGISTER_COUNT];
+
+    //! Simulated memory. Words are stored most significant byte first, as the assembler emits.
+    unsigned char    * memory;
+    //! The size of memory in bytes. Always a power of two.
+    unsigned int       memory_size;
+    //! The length of the private mapping of a checkpoint memory is, or zero if it was allocated.
+    size_t             memory_mapped;
+    //! Addresses are ANDed with this to wrap them into memory.
+    unsigned int       address_mask;
+
+    //! The address the program image was loaded at.
+    unsigned int       program_start;
+    //! The address one past the end of the loaded program image.
+    unsigned int       program_end;
+
+    //! The pre-decoded instruction at each address of the program, or NULL if the program has
+    //! not been pre-decoded.
+    sim_decoded      * decoded;
+    //! Stores to an address no more than this far below program_start may change an instruction.
+    unsigned int       watch_start;
+    //! The number of addresses from watch_start which stores must invalidate. Zero if the
+    //! program has not been pre-decoded.
+    unsigned int       watch_size;
+    //! The blocks of the program translated to host machine code, or NULL if the JIT engine is
+    //! not in use.
+    sim_jit          * jit;
+
+    //! The number of instructions fetched so far, whether or not their condition passed.
+    unsigned long long instructions;
+    //! Why the machine stopped, or SIM_RUNNING.
+    sim_halt_reason    halt;
+} sim_machine;
+
+//! The name of every register, indexed by tim_register.
+extern const char * sim_register_names[SIM_REGISTER_COUNT];
+
+//! The name of every halt reason, indexed by sim_halt_reason.
+extern const char * sim_halt_reason_names[];
+
+//! The name of every engine, indexed by sim_engine, as given to tim-sim -e.
+extern const char * sim_engine_names[];
+
+/*!
+@brief Reads a 32 bit big endian word from simulated memory.
+@param machine - The machine to read from.
+@param address - The byte address of the most significant byte. It is wrapped into memory.
+*/
+static inline unsigned int sim_read_word(sim_machine * machine, unsigned int address)
+{
+    unsigned char * p = machine -> memory + (address & machine -> address_mask);
+    return ((unsigned int)p[0] << 24) | ((unsigned int)p[1] << 16) |
+           ((unsigned int)p[2] <<  8) |  (unsigned int)p[3];
+}
+
+/*!
+@brief Marks every pre-decoded instruction which a store to a word may have changed, so that it is
+decoded again before it next runs.
+@param machine - The machine which was stored to.
+@param address - The wrapped address of the word stored to.
+*/
+void sim_predecode_invalidate(sim_machine * machine, unsigned int address);
+
+/*!
+@brief Writes a 32 bit big endian word to simulated memory.
+@details Stores which may overwrite a pre-decoded instruction invalidate it.
+@param machine - The machine to write to.
+@param address - The byte address of the most significant byte. It is wrapped into memory.
+@param value - The word to write.
+*/
+static inline void sim_write_word(sim_machine * machine, unsigned int address, unsigned int value)
+{
+    address &= machine -> address_mask;
+    if(address - machine -> watch_start < machine -> watch_size)
+        sim_predecode_invalidate(machine, address);
+
+    unsigned char * p = machine -> memory + address;
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >>  8;
+    p[3] = value;
+}
+
+/*!
+@brief Initialises a machine with zeroed memory and registers, ready to have a program loaded.
+@details The stack pointer starts at the top of memory, and the program counter at zero.
+@param memory_size - The size of memory in bytes. It is rounded up to a power of two.
+@param tr - The newly initialised machine. Memory space should already be declared.
+@returns TRUE if the memory could be allocated, otherwise FALSE.
+*/
+BOOL sim_machine_new(unsigned int memory_size, sim_machine * tr);
+
+/*!
+@brief Releases the memory held by a machine.
+@param machine - The machine to free.
+*/
+void sim_machine_free(sim_machine * machine);
+
+/*!
+@brief A snapshot of a machine, from which other machines can be forked.
+@details Holds everything sim_checkpoint_fork needs to recreate the machine, except its decode
+cache and translated code, which are rebuilt from memory.
+*/
+typedef struct sim_checkpoint_t{
+    //! The register file, indexed by tim_register.
+    unsigned int       registers[SIM_REGISTER_COUNT];
+    //! The size of memory in bytes. Always a power of two.
+    unsigned int       memory_size;
+    //! The address the program image was loaded at.
+    unsigned int       program_start;
+    //! The address one past the end of the loaded program image.
+    unsigned int       program_end;
+    //! The number of instructions the machine had executed.
+    unsigned long long instructions;
+    //! Why the machine had stopped, or SIM_RUNNING.
+    sim_halt_reason    halt;
+
+    //! A snapshot of the machine's memory. Not to be written once forked from.
+    unsigned char    * memory;
+    //! The length of the shared mapping memory is, or zero if it was allocated.
+    size_t             memory_mapped;
+    //! The memfd holding memory, which forks map privately, or -1 if there is none.
+    int                fd;
+} sim_checkpoint;
+
+/*!
+@brief Takes a checkpoint of a machine's registers, instruction count and memory.
+@details The machine is not changed, and may carry on running. Its decode cache and translated
+code are not part of the checkpoint.
+@param machine - The machine to snapshot.
+@param tr - The new checkpoint. Free it with sim_checkpoint_free.
+@returns TRUE if the checkpoint could be allocated, otherwise FALSE.
+*/
+BOOL sim_checkpoint_new(sim_machine * machine, sim_checkpoint * tr);
+
+/*!
+@brief Releases a checkpoint. Machines forked from it are unaffected.
+@param checkpoint - The checkpoint to free.
+*/
+void sim_checkpoint_free(sim_checkpoint * checkpoint);
+
+/*!
+@brief Initialises a machine in the state a checkpoint was taken in.
+@details Memory pages are shared with the checkpoint, and copied only when the machine first
+writes to them. A machine stopped only by its instruction limit is running again, but one which
+had halted stays halted. It has no decode cache until sim_predecode_new is called.
+@param checkpoint - The checkpoint to fork from.
+@param tr - The new machine. Free it with sim_machine_free.
+@returns TRUE if the machine's memory could be mapped or allocated, otherwise FALSE.
+*/
+BOOL sim_checkpoint_fork(sim_checkpoint * checkpoint, sim_machine * tr);
+
+/*!
+@brief Writes a checkpoint to a file, leaving out pages of memory which are all zero.
+@param checkpoint - The checkpoint to write.
+@param file - The file to write to, opened in binary mode.
+@returns TRUE if the file was written without error, otherwise FALSE.
+*/
+BOOL sim_checkpoint_save(sim_checkpoint * checkpoint, FILE * file);
+
+/*!
+@brief Reads a checkpoint written by sim_checkpoint_save.
+@param file - The file to read, opened in binary mode.
+@param tr - The checkpoint read. Free it with sim_checkpoint_free.
+@returns TRUE if the file held a valid checkpoint, otherwise FALSE.
+*/
+BOOL sim_checkpoint_load(FILE * file, sim_checkpoint * tr);
+
+/*!
+@brief Copies a program image into memory and points the program counter at its start.
+@param machine - The machine to load into.
+@param image - The machine code, as produced by asm_emit_instructions in binary format.
+@param length - The length of the image in bytes.
+@param address - Where in memory to load the image.
+@returns TRUE if the image fits in memory, otherwise FALSE.
+*/
+BOOL sim_machine_load(sim_machine * machine, unsigned char * image, size_t length,
+                      unsigned int address);
+
+/*!
+@brief Reads a program image from a file written by the assembler and loads it at address zero.
+@param machine - The machine to load into.
+@param file - The opened image file.
+@param format - Whether the file holds raw bytes or ascii bit strings.
+@returns TRUE if the file was read and loaded, otherwise FALSE.
+*/
+BOOL sim_machine_load_file(sim_machine * machine, FILE * file, asm_format format);
+
+/*!
+@brief Decodes the instruction at an address.
+@details Decoding is the exact reverse of asm_encode_statements. The first byte of every
+instruction holds its opcode and condition, and the opcode's asm_encodings entry gives its length
+and where each operand sits in the left aligned instruction word. The whole word is always read,
+since bytes beyond the end of the instruction fall outside every operand's mask.
+
+JUMPS and CALLS decode to the JUMPI and CALLI they stand for, with their offset from the next
+instruction turned into the absolute address it reaches, so the engines only ever see the
+absolute forms. The narrow immediate forms decode to the wide forms they stand for in the same
+way, their immediate already zero extended by its mask, and NOPS decodes to `MOV $R0 $R0`.
+@param machine - The machine whose memory to decode from.
+@param address - The address of the first byte of the instruction.
+@param tr - The decoded instruction.
+@returns FALSE if the opcode is not a valid instruction, otherwise TRUE.
+*/
+static inline BOOL sim_decode(sim_machine * machine, unsigned int address, sim_instruction * tr)
+{
+    unsigned int word   = sim_read_word(machine, address);
+    unsigned int opcode = word >> 26;
+
+    if(opcode >= NOT_EMITTED)
+    {
+        memset(tr, 0, sizeof(sim_instruction));
+        tr -> opcode = opcode;
+        tr -> size   = 1;
+        return FALSE;
+    }
+
+    const asm_encoding * e = &asm_encodings[opcode];
+
+    tr -> opcode    = opcode;
+    tr -> condition = (word >> 24) & 0x3;
+    tr -> size      = e -> size;
+    tr -> reg_1     = (word >> e -> shift[0]) & e -> mask[0];
+    tr -> reg_2     = (word >> e -> shift[1]) & e -> mask[1];
+    tr -> reg_3     = (word >> e -> shift[2]) & e -> mask[2];
+    tr -> reserved  = 0;
+    tr -> immediate = (word >> e -> shift[3]) & e -> mask[3];
+    tr -> byte_mask = (opcode == LOADR || opcode == STORR) ? (word >> 8) & 0xF : 0;
+
+    if(opcode == JUMPS || opcode == CALLS)
+    {
+        tr -> opcode    = opcode == JUMPS ? JUMPI : CALLI;
+        tr -> immediate = address + e -> size + (signed char)tr -> immediate;
+    }
+    else if(ASM_IS_NARROW(opcode))
+        tr -> opcode = asm_wide_forms[opcode - ASM_NARROW_FIRST];
+    else if(opcode == NOPS)
+        tr -> opcode = MOVR;
+
+    return TRUE;
+}
+
+/*!
+@brief Returns TRUE if the condition of an instruction is met by the current machine state.
+*/
+static inline BOOL sim_condition_passes(sim_machine * machine, unsigned int condition)
+{
+    // Bit n of passes is set if condition n is met, so the check is a shift and not a branch.
+    unsigned int test   = machine -> registers[TR] & 1;
+    unsigned int passes = 0x1 | (test << IFTRUE) | ((test ^ 1) << IFFALSE) |
+                          ((machine -> registers[SR] & SIM_SR_ZERO) << IFZERO);
+    return (passes >> condition) & 1;
+}
+
+/*!
+@brief Executes one decoded instruction. The program counter must already point past it.
+@param machine - The machine to execute on.
+@param instruction - The instruction to execute. Its condition is checked first.
+*/
+void sim_execute(sim_machine * machine, sim_instruction * instruction);
+
+/*!
+@brief Runs a machine until it halts or has executed a number of instructions.
+@param machine - The machine to run.
+@param max_instructions - Stop once the machine has executed this many instructions in total.
+@returns Why the machine stopped.
+*/
+sim_halt_reason sim_run(sim_machine * machine, unsigned long long max_instructions);
+
+/*!
+@brief A function which executes one instruction. It is only called once the condition of the
+instruction has passed, and PC points past it.
+*/
+typedef void (*sim_handler)(sim_machine * machine, sim_instruction * instruction);
+
+/*!
+@brief An instruction decoded ahead of time, as stored in the address indexed decode cache.
+*/
+struct sim_decoded_t{
+    //! Executes the instruction.
+    sim_handler     handler;
+    //! Where the threaded engine dispatches the instruction to, or NULL if the threaded engine has
+    //! not run it since it was last decoded.
+    const void    * dispatch;
+    //! The decoded operands of the instruction.
+    sim_instruction instruction;
+    //! The address of the following instruction.
+    unsigned int    next_pc;
+};
+
+/*!
+@brief Decodes the instruction at an address into its decode cache record.
+@param machine - The machine whose memory to decode from.
+@param address - The address of the instruction.
+@param tr - The record to fill in.
+*/
+void sim_predecode_record(sim_machine * machine, unsigned int address, sim_decoded * tr);
+
+/*!
+@brief Pre-decodes every byte address of the loaded program into the machine's decode cache.
+@details Instructions may start at any byte, so every address gets a record, whether or not
+execution ever reaches it. Stores into the program from then on invalidate the records they
+overlap.
+@param machine - The machine whose program to pre-decode. A program must already be loaded.
+@returns TRUE if the cache could be allocated, otherwise FALSE.
+*/
+BOOL sim_predecode_new(sim_machine * machine);
+
+/*!
+@brief The handler of every decode cache record which a store has invalidated. It decodes the
+record again, then runs the real instruction.
+*/
+void sim_handle_stale(sim_machine * machine, sim_instruction * instruction);
+
+/*!
+@brief Returns TRUE if a store has invalidated a decode cache record since it was decoded, so it
+must be decoded again with sim_predecode_record before its operands can be trusted.
+*/
+static inline BOOL sim_predecode_stale(sim_decoded * record)
+{
+    return record -> handler == sim_handle_stale;
+}
+
+/*!
+@brief Releases the decode cache of a machine. Stores stop being watched.
+@param machine - The machine whose cache to free.
+*/
+void sim_predecode_free(sim_machine * machine);
+
+/*!
+@brief Runs a machine from its decode cache until it halts or has executed a number of
+instructions.
+@details Behaves exactly as sim_run, but without decoding instructions as they are fetched. The
+program must have been pre-decoded with sim_predecode_new.
+@param machine - The machine to run.
+@param max_instructions - Stop once the machine has executed this many instructions in total.
+@returns Why the machine stopped.
+*/
+sim_halt_reason sim_run_predecoded(sim_machine * machine, unsigned long long max_instructions);
+
+//! How the threaded engine was built to dispatch, "computed goto" or "switch".
+extern const char * sim_threaded_dispatch;
+
+/*!
+@brief Runs a machine from its decode cache with threaded dispatch until it halts or has executed
+a number of instructions.
+@details Behaves exactly as sim_run, but jumps straight from each instruction to the code for the
+next, and runs common pairs of instructions as one. The program must have been pre-decoded with
+sim_predecode_new.
+@param machine - The machine to run.
+@param max_instructions - Stop once the machine has executed this many instructions in total.
+@returns Why the machine stopped.
+*/
+sim_halt_reason sim_run_threaded(sim_machine * machine, unsigned long long max_instructions);
+
+/*!
+@brief Creates the translation cache the JIT engine runs a machine with.
+@param machine - The machine to translate for. It must already be pre-decoded with
+sim_predecode_new, which also watches for stores into the program.
+@returns TRUE if the cache could be allocated, or FALSE if it could not, or the host is not
+x86-64 Linux.
+*/
+BOOL sim_jit_new(sim_machine * machine);
+
+/*!
+@brief Releases the translation cache of a machine.
+@param machine - The machine whose cache to free.
+*/
+void sim_jit_free(sim_machine * machine);
+
+/*!
+@brief Discards every translated block which a store to a word overwrote.
+@details Called by sim_predecode_invalidate, so only for stores which overlap the program.
+@param machine - The machine which was stored to.
+@param address - The wrapped address of the word stored to.
+*/
+void sim_jit_invalidate(sim_machine * machine, unsigned int address);
+
+/*!
+@brief Runs a machine with its program translated to host machine code until it halts or has
+executed a number of instructions.
+@details Behaves exactly as sim_run. Blocks are translated as they are first reached. Without a
+translation cache from sim_jit_new, or when fewer instructions remain than a whole block, the
+machine is run by sim_run_threaded instead.
+@param machine - The machine to run.
+@param max_instructions - Stop once the machine has executed this many instructions in total.
+@returns Why the machine stopped.
+*/
+sim_halt_reason sim_run_jit(sim_machine * machine, unsigned long long max_instructions);
+
+//! The opcode of a trace record which starts a new stream, with the stream number as its value.
+#define SIM_TRACE_STREAM      0xFF
+//! The register of a trace record for an instruction which wrote no register.
+#define SIM_TRACE_NO_REGISTER 0xFF
+//! The register of a trace record for a store, with the word written as its value.
+#define SIM_TRACE_MEMORY      0xFE
+//! Set in the flags of a trace record for an instruction whose condition failed.
+#define SIM_TRACE_SKIPPED     0x01
+//! The most records in one block of a trace file.
+#define SIM_TRACE_MAX_BLOCK   4096
+
+/*!
+@brief One executed instruction, as captured by the thread which ran it.
+*/
+typedef struct sim_trace_record_t{
+    //! The address of the instruction.
+    unsigned int  pc;
+    //! The value the instruction wrote to reg, or the word it wrote to memory.
+    unsigned int  value;
+    //! The address of the word a store wrote, for a SIM_TRACE_MEMORY record.
+    unsigned int  address;
+    //! The tim_instruction_opcode of the instruction, or SIM_TRACE_STREAM.
+    unsigned char opcode;
+    //! SIM_TRACE_SKIPPED, or zero.
+    unsigned char flags;
+    //! The tim_register written, SIM_TRACE_MEMORY or SIM_TRACE_NO_REGISTER.
+    unsigned char reg;
+    //! The tim_condition of the instruction.
+    unsigned char condition;
+} sim_trace_record;
+
+//! Typedef for a trace file and the thread writing it.
+typedef struct sim_trace_t sim_trace;
+
+//! Typedef for the ring one thread writes trace records into.
+typedef struct sim_trace_ring_t sim_trace_ring;
+
+//! Typedef for a trace file being read.
+typedef struct sim_trace_reader_t sim_trace_reader;
+
+/*!
+@brief Starts writing a trace to a file, with a writer thread to drain the rings into it.
+@param file - The file to write the trace to, opened in binary mode.
+@param tr - The new trace. Finish it with sim_trace_free.
+@returns TRUE if the header was written and the writer started, otherwise FALSE.
+*/
+BOOL sim_trace_new(FILE * file, sim_trace ** tr);
+
+/*!
+@brief Adds a ring to a trace, for one thread to write records into.
+@param trace - The trace the ring is drained into.
+@param tr - The new ring. It is freed along with the trace.
+@returns TRUE if the ring could be allocated, otherwise FALSE.
+*/
+BOOL sim_trace_ring_new(sim_trace * trace, sim_trace_ring ** tr);
+
+/*!
+@brief Marks the start of a new stream of records in a ring, such as one batch job.
+@param ring - The ring the stream is written to.
+@param stream - The number of the stream, which records up to the next stream belong to.
+@param pc - The address the stream starts from.
+*/
+void sim_trace_ring_start(sim_trace_ring * ring, unsigned int stream, unsigned int pc);
+
+/*!
+@brief Runs a machine from its decode cache until it halts or has executed a number of
+instructions, writing a record of every instruction to a trace ring.
+@details Behaves exactly as sim_run. Each record gives the register the instruction wrote and
+its new value: PC for jumps, calls and returns, TR for TEST, SP for PUSH, and the destination
+register for everything else. Stores give the address of the word they wrote and its new
+value.
+@param machine - The machine to run. It must have been pre-decoded with sim_predecode_new.
+@param ring - The ring to write records to.
+@param max_instructions - Stop once the machine has executed this many instructions in total.
+@returns Why the machine stopped.
+*/
+sim_halt_reason sim_run_traced(sim_machine * machine, sim_trace_ring * ring,
+                               unsigned long long max_instructions);
+
+/*!
+@brief Waits for the writer to drain every ring into the file, then frees the trace and its
+rings. The file is left open.
+@param trace - The trace to finish. No thread may still be writing to its rings.
+@returns TRUE if every record was written, otherwise FALSE.
+*/
+BOOL sim_trace_free(sim_trace * trace);
+
+/*!
+@brief Opens a trace for reading, checking its header.
+@param file - The trace file, opened in binary mode at its start.
+@param tr - The new reader. Free it with sim_trace_reader_free.
+@returns TRUE if the file is a trace of this format version, otherwise FALSE.
+*/
+BOOL sim_trace_reader_new(FILE * file, sim_trace_reader ** tr);
+
+/*!
+@brief Reads and decodes the next block of records from a trace.
+@param reader - The reader of the trace.
+@param ring - The index of the ring the block was written from.
+@param records - Where to decode the records to, with room for SIM_TRACE_MAX_BLOCK of them.
+@returns The number of records read, zero at the end of the file, or -1 if the file ends part way
+through a block or the block is malformed.
+*/
+int sim_trace_read_block(sim_trace_reader * reader, unsigned int * ring, sim_trace_record * records);
+
+/*!
+@brief Releases a trace reader. The file is left open.
+@param reader - The reader to free.
+*/
+void sim_trace_reader_free(sim_trace_reader * reader);
+
+/*!
+@brief The states of the core's fetch state machine, as named in tim_cpu_fetch_decode_arch.vhdl.
+*/
+typedef enum sim_fetch_state_e{
+    SIM_FETCH_RESET = 0, //!< Leaving reset. FETCH_RESET in the VHDL.
+    SIM_FETCH_IDLE  = 1, //!< Deciding whether to load a word or hand over an instruction.
+    SIM_FETCH_LOAD  = 2, //!< Waiting on a bus read. LOAD_WORD in the VHDL.
+    SIM_FETCH_FILL  = 3, //!< Appending the word read to the buffer. FILL_BUFFER in the VHDL.
+    SIM_FETCH_EMPTY = 4  //!< Handing over an instruction. EMPTY_BUFFER in the VHDL.
+} sim_fetch_state;
+
+/*!
+@brief The cycles counted by the timing model for one group of instructions.
+*/
+typedef struct sim_timing_stats_t{
+    //! The number of instructions executed, whether or not their condition passed.
+    unsigned long long instructions;
+    //! The cycles from handing over the previous instruction to handing over these.
+    unsigned long long cycles;
+    //! Cycles of those spent fetching words into the buffer.
+    unsigned long long fetch_stalls;
+    //! Cycles of those the bus was held by the previous instruction's memory access.
+    unsigned long long memory_stalls;
+} sim_timing_stats;
+
+/*!
+@brief A cycle approximate model of the core's fetch buffer and bus, and the cycles counted by it.
+*/
+typedef struct sim_timing_t{
+    //! Cycles a bus transfer takes, including wait states.
+    unsigned int       bus_cycles;
+    //! TRUE if a bus read returns the aligned word holding its address, FALSE if it returns the
+    //! four bytes from its address on.
+    BOOL               aligned_fetch;
+
+    //! The current state of the fetcher.
+    sim_fetch_state    state;
+    //! The number of bytes in the fetch buffer, from PC on.
+    unsigned int       stored;
+    //! Cycles left before the word being loaded arrives.
+    unsigned int       load_left;
+    //! Cycles left before a memory access by the execute stage releases the bus.
+    unsigned int       bus_held;
+
+    //! The total number of cycles run.
+    unsigned long long cycles;
+    //! The number of words read into the fetch buffer.
+    unsigned long long words_fetched;
+    //! The number of memory accesses made by instructions.
+    unsigned long long transfers;
+    //! The number of times a change of PC emptied the fetch buffer.
+    unsigned long long flushes;
+    //! The number of fetched bytes those flushes threw away.
+    unsigned long long bytes_discarded;
+
+    //! Counts for every instruction.
+    sim_timing_stats   total;
+    //! Counts for each opcode, indexed by tim_instruction_opcode.
+    sim_timing_stats   opcodes[NOT_EMITTED];
+    //! Counts for each instruction length in bytes.
+    sim_timing_stats   sizes[SIM_INSTRUCTION_MAX_SIZE + 1];
+} sim_timing;
+
+/*!
+@brief Initialises a timing model with its fetcher in reset and every count zero.
+@param wait_states - Cycles a bus transfer takes beyond the handshake itself.
+@param aligned_fetch - TRUE if a bus read returns the whole aligned word holding its address,
+FALSE if it returns the four bytes from its address on.
+@param tr - The new timing model.
+*/
+void sim_timing_new(unsigned int wait_states, BOOL aligned_fetch, sim_timing * tr);
+
+/*!
+@brief Runs a machine through the timing model until it halts or has executed a number of
+instructions, adding the cycles taken to the model's counts.
+@details Behaves exactly as sim_run, while stepping the fetch state machine of the core one clock
+at a time to count the cycles each instruction costs.
+@param machine - The machine to run.
+@param timing - The timing model, which carries the state of the fetcher between calls.
+@param max_instructions - Stop once the machine has executed this many instructions in total.
+@returns Why the machine stopped.
+*/
+sim_halt_reason sim_run_timed(sim_machine * machine, sim_timing * timing,
+                              unsigned long long max_instructions);
+
+/*!
+@brief Prints the cycles and stalls a timing model has counted, in total, for each opcode
+executed and for each instruction size.
+@param timing - The timing model to print.
+@param file - Where to print it.
+*/
+void sim_timing_print(sim_timing * timing, FILE * file);
+
+/*!
+@brief One entry of a line table written by `tim-asm --lines`.
+*/
+typedef struct sim_profile_line_t{
+    //! The address of the statement.
+    unsigned int address;
+    //! Its length in bytes.
+    unsigned int size;
+    //! The line of the source it was assembled from.
+    unsigned int line;
+} sim_profile_line;
+
+/*!
+@brief How many times each instruction of a program ran, and where its basic blocks start.
+*/
+typedef struct sim_profile_t{
+    //! The address of the first byte of the program.
+    unsigned int       program_start;
+    //! The length of the program in bytes.
+    unsigned int       program_size;
+    //! The number of times the instruction at each address was fetched, indexed by its offset
+    //! from program_start.
+    unsigned long long * counts;
+    //! The number of those times its condition failed, indexed as counts.
+    unsigned long long * skipped;
+    //! TRUE at the offset of every instruction which starts a basic block.
+    unsigned char      * leaders;
+    //! The address the last instruction run would fall through to.
+    unsigned int       next_pc;
+    //! TRUE if the last instruction run ended its basic block, or none has run yet.
+    BOOL               block_ended;
+
+    //! The source file named by the line table, or NULL.
+    char             * source;
+    //! The line table, in order of address, or NULL.
+    sim_profile_line * lines;
+    //! The number of entries in the line table.
+    unsigned int       line_count;
+} sim_profile;
+
+/*!
+@brief Initialises a profile of a machine's loaded program, with every count zero and no line
+table.
+@param machine - The machine to profile. A program must already be loaded.
+@param tr - The new profile. Free it with sim_profile_free.
+@returns TRUE if the counts could be allocated, otherwise FALSE.
+*/
+BOOL sim_profile_new(sim_machine * machine, sim_profile * tr);
+
+/*!
+@brief Reads a line table written by `tim-asm --lines` into a profile.
+@param profile - The profile to read the table into.
+@param file - The line table file.
+@returns TRUE if the table was read, FALSE if it is malformed or could not be allocated.
+*/
+BOOL sim_profile_load_lines(sim_profile * profile, FILE * file);
+
+/*!
+@brief Releases the counts and line table of a profile.
+@param profile - The profile to free.
+*/
+void sim_profile_free(sim_profile * profile);
+
+/*!
+@brief Runs a pre-decoded machine until it halts or has executed a number of instructions,
+counting every instruction fetched and marking where basic blocks start.
+@details Behaves exactly as sim_run_predecoded.
+@param machine - The machine to run. Its program must have been pre-decoded with
+sim_predecode_new.
+@param profile - The profile to count into, which carries where the last block ended between
+calls.
+@param max_instructions - Stop once the machine has executed this many instructions in total.
+@returns Why the machine stopped.
+*/
+sim_halt_reason sim_run_profiled(sim_machine * machine, sim_profile * profile,
+                                 unsigned long long max_instructions);
+
+/*!
+@brief Prints the flat profile of the basic blocks a profile counted, hottest first, then the
+source listing with the instructions executed on each line.
+@param profile - The profile to print.
+@param machine - The machine it was counted on, whose memory holds the program.
+@param file - Where to print it.
+*/
+void sim_profile_print(sim_profile * profile, sim_machine * machine, FILE * file);
+
+/*!
+@brief Runs a machine with a chosen engine until it halts or has executed a number of
+instructions.
+@param machine - The machine to run. It must have been pre-decoded unless the engine is
+SIM_DECODE.
+@param engine - Which engine to run it with.
+@param max_instructions - Stop once the machine has executed this many instructions in total.
+@returns Why the machine stopped.
+*/
+sim_halt_reason sim_run_engine(sim_machine * machine, sim_engine engine,
+                               unsigned long long max_instructions);
+
+/*!
+@brief Prints the register file and instruction count of a machine.
+@param machine - The machine to print.
+@param file - Where to print it.
+*/
+void sim_machine_print(sim_machine * machine, FILE * file);
+
+#endif
+
+//! }@
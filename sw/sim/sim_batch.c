@@ -0,0 +1,641 @@
+/*!
+@ingroup sw-sim
+@{
+@file sim_batch.c
+@brief Main source file for the batch simulator, which runs every program image listed in a
+manifest on a pool of threads and writes all of their final states to one file.
+@details Jobs are dealt out to the workers in equal runs of the manifest. Each worker takes jobs
+from the back of its own queue, and once that is empty steals from the front of the others', so
+workers given slow programs are helped out by those which finish early, and the pool keeps every
+core busy until the last job. Every job gets its own machine, so jobs share nothing but the
+read-only encoding tables, and results are written in manifest order however the jobs were run.
+
+Jobs may start from a checkpoint written by tim-sim -c rather than a program image. Each
+checkpoint is read once, and every job naming it forks its machine from the one copy, sharing
+memory pages until it writes to them.
+*/
+
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __GLIBC__
+    #include <malloc.h>
+#endif
+
+#include "sim.h"
+
+#ifdef TIM_PRINT_PROMPT
+    #undef TIM_PRINT_PROMPT
+#endif
+#define TIM_PRINT_PROMPT "\e[1;35mbatch>\e[0m "
+
+//! The number of instructions a job runs before giving up when no limit is given.
+#define SIM_BATCH_DEFAULT_MAX_INSTRUCTIONS 1000000000ULL
+
+//! The longest manifest line read.
+#define SIM_BATCH_LINE_LENGTH 4096
+
+/*!
+@brief One program to run, and the state to start it in.
+*/
+typedef struct sim_batch_job_t{
+    //! The path of the program image.
+    char             * image;
+    //! Whether the image is raw bytes or ascii bit strings.
+    asm_format         format;
+    //! TRUE if the image is a checkpoint, rather than a program.
+    BOOL               restore;
+    //! The checkpoint the job starts from, or NULL if it could not be read.
+    sim_checkpoint   * checkpoint;
+    //! The size of simulated memory in bytes.
+    unsigned int       memory_size;
+    //! Stop after this many instructions, counted from the checkpoint if there is one.
+    unsigned long long max_instructions;
+    //! Bit n is set if the manifest gives a starting value for register n.
+    unsigned int       registers_set;
+    //! The starting value of each register set by the manifest.
+    unsigned int       registers[SIM_REGISTER_COUNT];
+
+    //! The machine once the job has run. Its memory is freed, leaving the registers and counts.
+    sim_machine        result;
+    //! Why the job could not be run, or NULL if it ran.
+    const char       * error;
+} sim_batch_job;
+
+/*!
+@brief The jobs waiting for one worker. The owner takes from the back, thieves from the front.
+*/
+typedef struct sim_batch_queue_t{
+    //! Guards head and tail.
+    pthread_mutex_t lock;
+    //! The index into the job list of the first job waiting.
+    unsigned int    head;
+    //! One past the index of the last job waiting.
+    unsigned int    tail;
+    //! The number of jobs this worker took from other queues.
+    unsigned int    steals;
+} sim_batch_queue;
+
+/*!
+@brief Contains all information for the program in a format that can be easily passed around.
+*/
+typedef struct sim_batch_context_t{
+    //! The path of the manifest.
+    char          * manifest;
+    //! Where to write the results, or NULL for stdout.
+    char          * output_file;
+    //! How to execute the programs.
+    sim_engine      engine;
+    //! The number of worker threads.
+    unsigned int    threads;
+    //! Where to write a binary trace of every job, or NULL.
+    char          * trace_file;
+    //! The trace being written, or NULL.
+    sim_trace     * trace;
+    //! Defaults for jobs which do not give their own.
+    sim_batch_job   defaults;
+
+    //! Every job, in manifest order.
+    sim_batch_job * jobs;
+    //! The number of jobs.
+    unsigned int    job_count;
+    //! Every distinct checkpoint the jobs start from.
+    sim_checkpoint * checkpoints;
+    //! The number of checkpoints.
+    unsigned int    checkpoint_count;
+    //! One queue per worker.
+    sim_batch_queue * queues;
+} sim_batch_context;
+
+//! One worker, as passed to its thread.
+typedef struct sim_batch_worker_t{
+    //! The whole batch.
+    sim_batch_context * cxt;
+    //! Which queue is this worker's own.
+    unsigned int        index;
+    //! The ring this worker traces its jobs into, or NULL.
+    sim_trace_ring    * ring;
+} sim_batch_worker;
+
+/*!
+@brief prints usage instructions for the program.
+*/
+void usage(int argc, char ** argv)
+{
+    tprintf("TIM Batch Instruction Set Simulator                                \n");
+    tprintf("-------------------------------------------------------------------\n");
+    tprintf("                                                                   \n");
+    tprintf("Usage: $> %s -i <manifest> [-o results] [-j threads] [-m bytes]\n"
+            "                 [-n instructions] [-e decode|predecode|threaded|jit] [-x trace]\n",
+            argv[0]);
+    tprintf("       -o  Where to write every job's final state. Default stdout.\n");
+    tprintf("       -j  Number of worker threads. Default one per online core.\n");
+    tprintf("       -m  Default size of simulated memory in bytes. Default %u.\n",
+            SIM_DEFAULT_MEMORY);
+    tprintf("       -n  Default instruction limit per job. Default %llu.\n",
+            SIM_BATCH_DEFAULT_MAX_INSTRUCTIONS);
+    tprintf("       -e  Execution engine, as for tim-sim. Default jit.\n");
+    tprintf("       -x  Write a binary trace of every job to this file, as for tim-sim, with\n");
+    tprintf("           each job's records in a stream numbered by its index.\n");
+    tprintf("\n");
+    tprintf("Each manifest line is a program image followed by optional settings:\n");
+    tprintf("    <image> [format=binary|ascii|checkpoint] [memory=<bytes>]\n");
+    tprintf("            [max=<instructions>] [<register>=<value>]...\n");
+    tprintf("Jobs with format=checkpoint start from a file written by tim-sim -c, and count\n");
+    tprintf("max from it. Registers given override those of the program or checkpoint.\n");
+    tprintf("Registers are named as tim-sim prints them. Relative image paths are relative\n");
+    tprintf("to the manifest. Blank lines and lines starting with # are skipped.\n");
+    tprintf("\n");
+}
+
+/*!
+@brief Parses the command line arguments passed to the program into a sim_batch_context object.
+*/
+void parse_cmd_args(int argc, char ** argv, sim_batch_context * cxt)
+{
+    int arg;
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+    cxt -> engine                     = SIM_JIT;
+    cxt -> threads                    = cores > 0 ? (unsigned int)cores : 1;
+    cxt -> defaults.format            = BINARY;
+    cxt -> defaults.memory_size       = SIM_DEFAULT_MEMORY;
+    cxt -> defaults.max_instructions  = SIM_BATCH_DEFAULT_MAX_INSTRUCTIONS;
+
+    for(arg = 1; arg < argc; arg++)
+    {
+        if(arg + 1 >= argc)
+        {
+            warning("Missing value for argument: '%s'\n", argv[arg]);
+            usage(argc, argv);
+            exit(1);
+        }
+
+        if(strcmp(argv[arg], "-i") == 0)
+            cxt -> manifest = argv[arg+1];
+        else if(strcmp(argv[arg], "-o") == 0)
+            cxt -> output_file = argv[arg+1];
+        else if(strcmp(argv[arg], "-j") == 0)
+            cxt -> threads = strtoul(argv[arg+1], NULL, 0);
+        else if(strcmp(argv[arg], "-m") == 0)
+            cxt -> defaults.memory_size = strtoul(argv[arg+1], NULL, 0);
+        else if(strcmp(argv[arg], "-n") == 0)
+            cxt -> defaults.max_instructions = strtoull(argv[arg+1], NULL, 0);
+        else if(strcmp(argv[arg], "-x") == 0)
+            cxt -> trace_file = argv[arg+1];
+        else if(strcmp(argv[arg], "-e") == 0)
+        {
+            sim_engine engine;
+            for(engine = SIM_DECODE; engine <= SIM_JIT; engine ++)
+                if(strcmp(argv[arg+1], sim_engine_names[engine]) == 0)
+                    break;
+            if(engine > SIM_JIT)
+            {
+                usage(argc, argv);
+                fatal("Unknown execution engine: %s\n", argv[arg+1]);
+            }
+            cxt -> engine = engine;
+        }
+        else
+        {
+            warning("Unknown argument: '%s'\n", argv[arg]);
+            usage(argc, argv);
+            exit(1);
+        }
+        arg++;
+    }
+
+    if(cxt -> threads == 0)
+        cxt -> threads = 1;
+}
+
+/*!
+@brief Parses one setting from a manifest line into a job.
+@returns TRUE if the setting was understood, otherwise FALSE.
+*/
+static BOOL sim_batch_setting(char * setting, sim_batch_job * job)
+{
+    char * value = strchr(setting, '=');
+    char * end;
+    int    reg;
+
+    if(value == NULL || value[1] == '\0')
+        return FALSE;
+    *value++ = '\0';
+
+    if(strcmp(setting, "format") == 0)
+    {
+        if(strcmp(value, "binary") == 0)
+            job -> format = BINARY;
+        else if(strcmp(value, "ascii") == 0)
+            job -> format = ASCII;
+        else if(strcmp(value, "checkpoint") == 0)
+            job -> format = BINARY;
+        else
+            return FALSE;
+        job -> restore = strcmp(value, "checkpoint") == 0;
+        return TRUE;
+    }
+
+    unsigned long long number = strtoull(value, &end, 0);
+    if(*end != '\0')
+        return FALSE;
+
+    if(strcmp(setting, "memory") == 0)
+        job -> memory_size = (unsigned int)number;
+    else if(strcmp(setting, "max") == 0)
+        job -> max_instructions = number;
+    else
+    {
+        for(reg = 0; reg < SIM_REGISTER_COUNT; reg ++)
+            if(strcmp(setting, sim_register_names[reg]) == 0)
+                break;
+        if(reg == SIM_REGISTER_COUNT)
+            return FALSE;
+
+        job -> registers[reg]  = (unsigned int)number;
+        job -> registers_set  |= 1u << reg;
+    }
+    return TRUE;
+}
+
+/*!
+@brief Reads every job from the manifest.
+@returns The number of lines which could not be parsed.
+*/
+static int sim_batch_read_manifest(sim_batch_context * cxt)
+{
+    FILE * manifest = fopen(cxt -> manifest, "r");
+    if(manifest == NULL)
+        fatal("Could not open manifest: %s\n", cxt -> manifest);
+
+    // Relative image paths are taken from the directory holding the manifest.
+    const char * slash     = strrchr(cxt -> manifest, '/');
+    size_t       directory = slash == NULL ? 0 : (size_t)(slash - cxt -> manifest) + 1;
+
+    unsigned int capacity = 0;
+    unsigned int line     = 0;
+    int          errors   = 0;
+    char         text[SIM_BATCH_LINE_LENGTH];
+
+    while(fgets(text, sizeof(text), manifest) != NULL)
+    {
+        line ++;
+
+        char * field = strtok(text, " \t\r\n");
+        if(field == NULL || field[0] == '#')
+            continue;
+
+        if(cxt -> job_count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 256;
+            cxt -> jobs = realloc(cxt -> jobs, capacity * sizeof(sim_batch_job));
+            if(cxt -> jobs == NULL)
+                fatal("Could not allocate %u jobs\n", capacity);
+        }
+
+        sim_batch_job * job = &cxt -> jobs[cxt -> job_count ++];
+        *job = cxt -> defaults;
+
+        size_t prefix = field[0] == '/' ? 0 : directory;
+        job -> image  = malloc(prefix + strlen(field) + 1);
+        if(job -> image == NULL)
+            fatal("Could not allocate the path of job %u\n", cxt -> job_count);
+        memcpy(job -> image, cxt -> manifest, prefix);
+        strcpy(job -> image + prefix, field);
+
+        while((field = strtok(NULL, " \t\r\n")) != NULL)
+        {
+            if(!sim_batch_setting(field, job))
+            {
+                error("%s:%u: Unknown setting: %s\n", cxt -> manifest, line, field);
+                errors ++;
+            }
+        }
+    }
+
+    fclose(manifest);
+    return errors;
+}
+
+/*!
+@brief Reads every checkpoint the jobs start from, once each, and points the jobs at them.
+@details A job whose checkpoint can not be read is left without one, and reports the error when
+it is run.
+*/
+static void sim_batch_read_checkpoints(sim_batch_context * cxt)
+{
+    char      ** paths = calloc(cxt -> job_count + 1, sizeof(char *));
+    BOOL        * valid = calloc(cxt -> job_count + 1, sizeof(BOOL));
+    unsigned int  j;
+    unsigned int  c;
+
+    cxt -> checkpoints = calloc(cxt -> job_count + 1, sizeof(sim_checkpoint));
+    if(paths == NULL || valid == NULL || cxt -> checkpoints == NULL)
+        fatal("Could not allocate the checkpoint list\n");
+
+    for(j = 0; j < cxt -> job_count; j ++)
+    {
+        sim_batch_job * job = &cxt -> jobs[j];
+        if(!job -> restore)
+            continue;
+
+        for(c = 0; c < cxt -> checkpoint_count; c ++)
+            if(strcmp(paths[c], job -> image) == 0)
+                break;
+
+        if(c == cxt -> checkpoint_count)
+        {
+            FILE * input = fopen(job -> image, "rb");
+            paths[c] = job -> image;
+            valid[c] = input != NULL && sim_checkpoint_load(input, &cxt -> checkpoints[c]);
+            if(input != NULL)
+                fclose(input);
+            if(!valid[c])
+                error("Could not read checkpoint: %s\n", job -> image);
+            cxt -> checkpoint_count ++;
+        }
+
+        job -> checkpoint = valid[c] ? &cxt -> checkpoints[c] : NULL;
+    }
+
+    free(paths);
+    free(valid);
+}
+
+/*!
+@brief Loads and runs one job on a machine of its own.
+@param ring - The ring to trace the job into, or NULL if it is not traced.
+*/
+static void sim_batch_run_job(sim_batch_context * cxt, sim_batch_job * job, sim_trace_ring * ring)
+{
+    sim_machine      * machine = &job -> result;
+    unsigned long long max     = job -> max_instructions;
+    int reg;
+
+    if(job -> restore)
+    {
+        if(job -> checkpoint == NULL)
+        {
+            job -> error = "could not read checkpoint";
+            return;
+        }
+        if(!sim_checkpoint_fork(job -> checkpoint, machine))
+            job -> error = "could not map simulated memory";
+        max += job -> checkpoint -> instructions;
+    }
+    else
+    {
+        FILE * input = fopen(job -> image, job -> format == BINARY ? "rb" : "r");
+        if(input == NULL)
+        {
+            job -> error = "could not open program image";
+            return;
+        }
+
+        if(!sim_machine_new(job -> memory_size, machine))
+            job -> error = "could not allocate simulated memory";
+        else if(!sim_machine_load_file(machine, input, job -> format))
+            job -> error = "could not load program image";
+        fclose(input);
+    }
+
+    if(job -> error == NULL && cxt -> engine != SIM_DECODE && !sim_predecode_new(machine))
+        job -> error = "could not allocate the decode cache";
+
+    if(job -> error == NULL)
+    {
+        for(reg = 0; reg < SIM_REGISTER_COUNT; reg ++)
+            if(job -> registers_set & (1u << reg))
+                machine -> registers[reg] = job -> registers[reg];
+
+        // Without a JIT for this host, sim_run_jit runs the threaded engine.
+        if(cxt -> engine == SIM_JIT)
+            sim_jit_new(machine);
+
+        if(ring != NULL)
+        {
+            sim_trace_ring_start(ring, job - cxt -> jobs, machine -> registers[PC]);
+            sim_run_traced(machine, ring, max);
+        }
+        else
+            sim_run_engine(machine, cxt -> engine, max);
+    }
+
+    sim_machine_free(machine);
+}
+
+/*!
+@brief Takes the next job for a worker, first from its own queue, then from the others.
+@returns The index of the job, or the job count once every queue is empty.
+*/
+static unsigned int sim_batch_take(sim_batch_context * cxt, unsigned int index)
+{
+    sim_batch_queue * own = &cxt -> queues[index];
+    unsigned int      job = cxt -> job_count;
+    unsigned int      q;
+
+    pthread_mutex_lock(&own -> lock);
+    if(own -> head < own -> tail)
+        job = -- own -> tail;
+    pthread_mutex_unlock(&own -> lock);
+
+    // Jobs are never added once the pool starts, so one pass finding nothing means all are taken.
+    for(q = 1; q < cxt -> threads && job == cxt -> job_count; q ++)
+    {
+        sim_batch_queue * victim = &cxt -> queues[(index + q) % cxt -> threads];
+
+        pthread_mutex_lock(&victim -> lock);
+        if(victim -> head < victim -> tail)
+        {
+            job = victim -> head ++;
+            own -> steals ++;
+        }
+        pthread_mutex_unlock(&victim -> lock);
+    }
+
+    return job;
+}
+
+//! The body of every worker thread.
+static void * sim_batch_work(void * argument)
+{
+    sim_batch_worker  * worker = argument;
+    sim_batch_context * cxt    = worker -> cxt;
+    unsigned int        job;
+
+    while((job = sim_batch_take(cxt, worker -> index)) < cxt -> job_count)
+        sim_batch_run_job(cxt, &cxt -> jobs[job], worker -> ring);
+
+    return NULL;
+}
+
+/*!
+@brief Runs every job on the pool of workers, returning once all have finished.
+*/
+static void sim_batch_run(sim_batch_context * cxt)
+{
+    pthread_t        * threads = calloc(cxt -> threads, sizeof(pthread_t));
+    sim_batch_worker * workers = calloc(cxt -> threads, sizeof(sim_batch_worker));
+    unsigned int       t;
+
+    cxt -> queues = calloc(cxt -> threads, sizeof(sim_batch_queue));
+    if(threads == NULL || workers == NULL || cxt -> queues == NULL)
+        fatal("Could not allocate %u workers\n", cxt -> threads);
+
+    // Deal out equal runs of the manifest, so neighbouring jobs tend to run on the same core.
+    for(t = 0; t < cxt -> threads; t ++)
+    {
+        pthread_mutex_init(&cxt -> queues[t].lock, NULL);
+        cxt -> queues[t].head = (unsigned int)((unsigned long long)cxt -> job_count * t /
+                                               cxt -> threads);
+        cxt -> queues[t].tail = (unsigned int)((unsigned long long)cxt -> job_count * (t + 1) /
+                                               cxt -> threads);
+    }
+
+    for(t = 0; t < cxt -> threads; t ++)
+    {
+        workers[t].cxt   = cxt;
+        workers[t].index = t;
+        if(cxt -> trace != NULL && !sim_trace_ring_new(cxt -> trace, &workers[t].ring))
+            fatal("Could not allocate a trace ring for worker %u\n", t);
+        if(pthread_create(&threads[t], NULL, sim_batch_work, &workers[t]) != 0)
+            fatal("Could not start worker %u\n", t);
+    }
+
+    for(t = 0; t < cxt -> threads; t ++)
+    {
+        pthread_join(threads[t], NULL);
+        pthread_mutex_destroy(&cxt -> queues[t].lock);
+    }
+
+    free(workers);
+    free(threads);
+}
+
+/*!
+@brief Writes the final state of every job, in manifest order.
+@returns The number of jobs which did not stop at a HALT instruction.
+*/
+static unsigned int sim_batch_write_results(sim_batch_context * cxt, FILE * output)
+{
+    unsigned int failures = 0;
+    unsigned int j;
+
+    for(j = 0; j < cxt -> job_count; j ++)
+    {
+        sim_batch_job * job = &cxt -> jobs[j];
+
+        fprintf(output, "job          %u %s\n", j, job -> image);
+        if(job -> error != NULL)
+            fprintf(output, "error        %s\n", job -> error);
+        else
+            sim_machine_print(&job -> result, output);
+        fprintf(output, "\n");
+
+        if(job -> error != NULL || job -> result.halt != SIM_HALTED)
+            failures ++;
+    }
+
+    return failures;
+}
+
+/*!
+@brief Main entry point for the application.
+@returns Zero if every job stopped at a HALT instruction, otherwise one.
+*/
+int main(int argc, char ** argv)
+{
+    sim_batch_context cxt;
+    unsigned int      j;
+    unsigned int      t;
+
+    memset(&cxt, 0, sizeof(sim_batch_context));
+    parse_cmd_args(argc, argv, &cxt);
+
+#ifdef __GLIBC__
+    // Freeing simulated memory would otherwise raise glibc's mmap threshold above it, and every
+    // later job would then have to clear all of its memory, rather than get fresh zeroed pages.
+    mallopt(M_MMAP_THRESHOLD, 1 << 20);
+#endif
+
+    if(cxt.manifest == NULL)
+    {
+        usage(argc, argv);
+        exit(1);
+    }
+
+    if(sim_batch_read_manifest(&cxt) > 0)
+        fatal("Could not parse manifest: %s\n", cxt.manifest);
+    sim_batch_read_checkpoints(&cxt);
+
+    // There is no point waking more workers than there are jobs.
+    if(cxt.threads > cxt.job_count)
+        cxt.threads = cxt.job_count > 0 ? cxt.job_count : 1;
+
+    FILE * output = cxt.output_file == NULL ? stdout : fopen(cxt.output_file, "w");
+    if(output == NULL)
+        fatal("Could not open results file: %s\n", cxt.output_file);
+
+    // Traced jobs run from the decode cache.
+    FILE * traced = NULL;
+    if(cxt.trace_file != NULL)
+    {
+        traced = fopen(cxt.trace_file, "wb");
+        if(traced == NULL)
+            fatal("Could not open trace for writing: %s\n", cxt.trace_file);
+        if(!sim_trace_new(traced, &cxt.trace))
+            fatal("Could not start the trace writer\n");
+        cxt.engine = SIM_PREDECODE;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    sim_batch_run(&cxt);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if(cxt.trace != NULL)
+    {
+        if(!sim_trace_free(cxt.trace))
+            fatal("Could not write trace: %s\n", cxt.trace_file);
+        fclose(traced);
+    }
+
+    unsigned int failures = sim_batch_write_results(&cxt, output);
+    if(output != stdout)
+        fclose(output);
+
+    unsigned long long instructions = 0;
+    unsigned int       steals       = 0;
+    for(j = 0; j < cxt.job_count; j ++)
+    {
+        sim_checkpoint * checkpoint = cxt.jobs[j].checkpoint;
+        instructions += cxt.jobs[j].result.instructions;
+        if(checkpoint != NULL && cxt.jobs[j].error == NULL)
+            instructions -= checkpoint -> instructions;
+    }
+    for(t = 0; t < cxt.threads; t ++)
+        steals += cxt.queues[t].steals;
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+    log("Jobs:\t\t %u on %u threads, %u stolen\n", cxt.job_count, cxt.threads, steals);
+    log("Executed:\t %llu instructions in %.3f s (%.1f jobs/s, %.1f MIPS)\n", instructions,
+        seconds, seconds > 0 ? cxt.job_count / seconds : 0,
+        seconds > 0 ? instructions / seconds / 1e6 : 0);
+    log("Halted:\t %u of %u jobs\n", cxt.job_count - failures, cxt.job_count);
+
+    for(j = 0; j < cxt.job_count; j ++)
+        free(cxt.jobs[j].image);
+    // Checkpoints which could not be read hold no memory, and need no freeing.
+    for(j = 0; j < cxt.checkpoint_count; j ++)
+        if(cxt.checkpoints[j].memory != NULL)
+            sim_checkpoint_free(&cxt.checkpoints[j]);
+    free(cxt.checkpoints);
+    free(cxt.jobs);
+    free(cxt.queues);
+
+    return failures > 0;
+}
+
+//! }@
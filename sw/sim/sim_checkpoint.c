@@ -0,0 +1,311 @@
+/*!
+@ingroup sw-sim
+@{
+@file sim_checkpoint.c
+@brief Snapshots of a machine's registers and memory, which can be saved to a file, and from which
+any number of machines can be forked, sharing memory pages until they write to them.
+@details On Linux the memory of a checkpoint lives in an anonymous memfd, and each fork maps it
+privately, so the host kernel copies a page only when a fork first stores to it. A fork costs a
+single mmap however large simulated memory is, and machines keep their flat memory array, so no
+engine pays for a page table on every access. Elsewhere each fork copies the whole of memory.
+
+Checkpoint files hold the registers, instruction count and program bounds, then only the pages of
+memory which are not all zero, so a checkpoint of a small program in a large memory stays small.
+*/
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+    #define _GNU_SOURCE
+#endif
+
+#include "sim.h"
+
+#ifdef __linux__
+    #include <sys/mman.h>
+    #include <unistd.h>
+#endif
+
+//! The first eight bytes of every checkpoint file, ending in the format version.
+static const unsigned char sim_checkpoint_magic[8] = {'T', 'I', 'M', 'C', 'K', 'P', 'T', 1};
+
+//! The size of the pages checkpoint files store memory in.
+#define SIM_CHECKPOINT_PAGE 4096
+
+//! Marks the end of the pages in a checkpoint file.
+#define SIM_CHECKPOINT_END 0xFFFFFFFFu
+
+/*!
+@brief Allocates zeroed memory for a checkpoint, backed by a memfd where possible.
+@returns TRUE if the memory could be allocated, otherwise FALSE.
+*/
+static BOOL sim_checkpoint_allocate(sim_checkpoint * checkpoint)
+{
+    size_t length = (size_t)checkpoint -> memory_size + SIM_MEMORY_SLACK;
+
+    checkpoint -> fd = -1;
+
+#ifdef __linux__
+    long page = sysconf(_SC_PAGESIZE);
+    length = (length + page - 1) / page * page;
+
+    checkpoint -> fd = memfd_create("tim-sim-checkpoint", MFD_CLOEXEC);
+    if(checkpoint -> fd >= 0)
+    {
+        void * view = MAP_FAILED;
+        if(ftruncate(checkpoint -> fd, length) == 0)
+            view = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, checkpoint -> fd, 0);
+
+        if(view != MAP_FAILED)
+        {
+            checkpoint -> memory        = view;
+            checkpoint -> memory_mapped = length;
+            return TRUE;
+        }
+
+        close(checkpoint -> fd);
+        checkpoint -> fd = -1;
+    }
+#endif
+
+    checkpoint -> memory        = calloc(length, 1);
+    checkpoint -> memory_mapped = 0;
+    return checkpoint -> memory != NULL;
+}
+
+//! Returns TRUE if every byte of a block of memory is zero.
+static BOOL sim_checkpoint_empty(const unsigned char * bytes, size_t length)
+{
+    return bytes[0] == 0 && memcmp(bytes, bytes + 1, length - 1) == 0;
+}
+
+/*!
+@brief Takes a checkpoint of a machine's registers, instruction count and memory.
+@details The machine is not changed, and may carry on running. Its decode cache and translated
+code are not part of the checkpoint.
+@param machine - The machine to snapshot.
+@param tr - The new checkpoint. Free it with sim_checkpoint_free.
+@returns TRUE if the checkpoint could be allocated, otherwise FALSE.
+*/
+BOOL sim_checkpoint_new(sim_machine * machine, sim_checkpoint * tr)
+{
+    unsigned int offset;
+
+    memset(tr, 0, sizeof(sim_checkpoint));
+    memcpy(tr -> registers, machine -> registers, sizeof(tr -> registers));
+    tr -> memory_size   = machine -> memory_size;
+    tr -> program_start = machine -> program_start;
+    tr -> program_end   = machine -> program_end;
+    tr -> instructions  = machine -> instructions;
+    tr -> halt          = machine -> halt;
+
+    if(!sim_checkpoint_allocate(tr))
+        return FALSE;
+
+    // Leave pages which are still zero untouched, so they take no space in the memfd. The slack
+    // after memory is kept too, as word stores to the last three addresses write into it.
+    for(offset = 0; offset < tr -> memory_size + SIM_MEMORY_SLACK; offset += SIM_CHECKPOINT_PAGE)
+    {
+        unsigned int length = tr -> memory_size + SIM_MEMORY_SLACK - offset;
+        if(length > SIM_CHECKPOINT_PAGE)
+            length = SIM_CHECKPOINT_PAGE;
+
+        if(!sim_checkpoint_empty(machine -> memory + offset, length))
+            memcpy(tr -> memory + offset, machine -> memory + offset, length);
+    }
+
+    return TRUE;
+}
+
+/*!
+@brief Releases a checkpoint. Machines forked from it are unaffected.
+@param checkpoint - The checkpoint to free.
+*/
+void sim_checkpoint_free(sim_checkpoint * checkpoint)
+{
+#ifdef __linux__
+    if(checkpoint -> memory_mapped > 0)
+        munmap(checkpoint -> memory, checkpoint -> memory_mapped);
+    else
+        free(checkpoint -> memory);
+    if(checkpoint -> fd >= 0)
+        close(checkpoint -> fd);
+#else
+    free(checkpoint -> memory);
+#endif
+
+    checkpoint -> memory        = NULL;
+    checkpoint -> memory_mapped = 0;
+    checkpoint -> fd            = -1;
+}
+
+/*!
+@brief Initialises a machine in the state a checkpoint was taken in.
+@details Memory pages are shared with the checkpoint, and copied only when the machine first
+writes to them. A machine stopped only by its instruction limit is running again, but one which
+had halted stays halted. It has no decode cache until sim_predecode_new is called.
+@param checkpoint - The checkpoint to fork from.
+@param tr - The new machine. Free it with sim_machine_free.
+@returns TRUE if the machine's memory could be mapped or allocated, otherwise FALSE.
+*/
+BOOL sim_checkpoint_fork(sim_checkpoint * checkpoint, sim_machine * tr)
+{
+    memset(tr, 0, sizeof(sim_machine));
+
+#ifdef __linux__
+    if(checkpoint -> fd >= 0)
+    {
+        void * view = mmap(NULL, checkpoint -> memory_mapped, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE, checkpoint -> fd, 0);
+        if(view == MAP_FAILED)
+            return FALSE;
+
+        tr -> memory        = view;
+        tr -> memory_mapped = checkpoint -> memory_mapped;
+    }
+#endif
+
+    if(tr -> memory == NULL)
+    {
+        size_t length = (size_t)checkpoint -> memory_size + SIM_MEMORY_SLACK;
+        tr -> memory = malloc(length);
+        if(tr -> memory == NULL)
+            return FALSE;
+        memcpy(tr -> memory, checkpoint -> memory, length);
+    }
+
+    memcpy(tr -> registers, checkpoint -> registers, sizeof(tr -> registers));
+    tr -> memory_size   = checkpoint -> memory_size;
+    tr -> address_mask  = checkpoint -> memory_size - 1;
+    tr -> program_start = checkpoint -> program_start;
+    tr -> program_end   = checkpoint -> program_end;
+    tr -> instructions  = checkpoint -> instructions;
+    tr -> halt          = checkpoint -> halt == SIM_STEP_LIMIT ? SIM_RUNNING : checkpoint -> halt;
+    return TRUE;
+}
+
+//! Writes a 32 bit big endian word to a file.
+static void sim_checkpoint_put(FILE * file, unsigned int value)
+{
+    fputc(value >> 24, file);
+    fputc(value >> 16, file);
+    fputc(value >>  8, file);
+    fputc(value,       file);
+}
+
+//! Reads a 32 bit big endian word from a file. Check the file with ferror and feof afterwards.
+static unsigned int sim_checkpoint_get(FILE * file)
+{
+    unsigned char bytes[4] = {0, 0, 0, 0};
+    if(fread(bytes, 1, 4, file) != 4)
+        return 0;
+    return ((unsigned int)bytes[0] << 24) | ((unsigned int)bytes[1] << 16) |
+           ((unsigned int)bytes[2] <<  8) |  (unsigned int)bytes[3];
+}
+
+/*!
+@brief Writes a checkpoint to a file, leaving out pages of memory which are all zero.
+@details Memory is written with the slack which follows it, so the last page may be short.
+@param checkpoint - The checkpoint to write.
+@param file - The file to write to, opened in binary mode.
+@returns TRUE if the file was written without error, otherwise FALSE.
+*/
+BOOL sim_checkpoint_save(sim_checkpoint * checkpoint, FILE * file)
+{
+    unsigned int reg;
+    unsigned int offset;
+
+    fwrite(sim_checkpoint_magic, 1, sizeof(sim_checkpoint_magic), file);
+    sim_checkpoint_put(file, checkpoint -> memory_size);
+    sim_checkpoint_put(file, checkpoint -> program_start);
+    sim_checkpoint_put(file, checkpoint -> program_end);
+    sim_checkpoint_put(file, (unsigned int)(checkpoint -> instructions >> 32));
+    sim_checkpoint_put(file, (unsigned int)checkpoint -> instructions);
+    sim_checkpoint_put(file, checkpoint -> halt);
+    sim_checkpoint_put(file, SIM_REGISTER_COUNT);
+    for(reg = 0; reg < SIM_REGISTER_COUNT; reg ++)
+        sim_checkpoint_put(file, checkpoint -> registers[reg]);
+
+    // Each page which is not all zero, as its index and then its bytes.
+    for(offset = 0; offset < checkpoint -> memory_size + SIM_MEMORY_SLACK;
+        offset += SIM_CHECKPOINT_PAGE)
+    {
+        unsigned int length = checkpoint -> memory_size + SIM_MEMORY_SLACK - offset;
+        if(length > SIM_CHECKPOINT_PAGE)
+            length = SIM_CHECKPOINT_PAGE;
+
+        if(sim_checkpoint_empty(checkpoint -> memory + offset, length))
+            continue;
+
+        sim_checkpoint_put(file, offset / SIM_CHECKPOINT_PAGE);
+        fwrite(checkpoint -> memory + offset, 1, length, file);
+    }
+    sim_checkpoint_put(file, SIM_CHECKPOINT_END);
+
+    return !ferror(file);
+}
+
+/*!
+@brief Reads a checkpoint written by sim_checkpoint_save.
+@param file - The file to read, opened in binary mode.
+@param tr - The checkpoint read. Free it with sim_checkpoint_free.
+@returns TRUE if the file held a valid checkpoint, otherwise FALSE.
+*/
+BOOL sim_checkpoint_load(FILE * file, sim_checkpoint * tr)
+{
+    unsigned char magic[sizeof(sim_checkpoint_magic)];
+    unsigned int  reg;
+
+    memset(tr, 0, sizeof(sim_checkpoint));
+    tr -> fd = -1;
+
+    if(fread(magic, 1, sizeof(magic), file) != sizeof(magic) ||
+       memcmp(magic, sim_checkpoint_magic, sizeof(magic)) != 0)
+        return FALSE;
+
+    tr -> memory_size   = sim_checkpoint_get(file);
+    tr -> program_start = sim_checkpoint_get(file);
+    tr -> program_end   = sim_checkpoint_get(file);
+    tr -> instructions  = (unsigned long long)sim_checkpoint_get(file) << 32;
+    tr -> instructions |= sim_checkpoint_get(file);
+    tr -> halt          = sim_checkpoint_get(file);
+
+    if(sim_checkpoint_get(file) != SIM_REGISTER_COUNT)
+        return FALSE;
+    for(reg = 0; reg < SIM_REGISTER_COUNT; reg ++)
+        tr -> registers[reg] = sim_checkpoint_get(file);
+
+    // Memory is a power of two, at least one word, and the program must lie within it.
+    if(ferror(file) || feof(file) ||
+       tr -> halt > SIM_STEP_LIMIT || tr -> memory_size < 4 || (tr -> memory_size & (tr -> memory_size - 1)) != 0 ||
+       tr -> program_start > tr -> program_end || tr -> program_end > tr -> memory_size)
+        return FALSE;
+
+    if(!sim_checkpoint_allocate(tr))
+        return FALSE;
+
+    unsigned int pages = (tr -> memory_size + SIM_MEMORY_SLACK - 1) / SIM_CHECKPOINT_PAGE + 1;
+    unsigned int page;
+
+    while((page = sim_checkpoint_get(file)) != SIM_CHECKPOINT_END)
+    {
+        unsigned int offset = page * SIM_CHECKPOINT_PAGE;
+        unsigned int length = tr -> memory_size + SIM_MEMORY_SLACK - offset;
+        if(length > SIM_CHECKPOINT_PAGE)
+            length = SIM_CHECKPOINT_PAGE;
+
+        if(ferror(file) || feof(file) || page >= pages ||
+           fread(tr -> memory + offset, 1, length, file) != length)
+        {
+            sim_checkpoint_free(tr);
+            return FALSE;
+        }
+    }
+
+    if(ferror(file))
+    {
+        sim_checkpoint_free(tr);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+//! }@
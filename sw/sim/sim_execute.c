@@ -0,0 +1,105 @@
+/*!
+@ingroup sw-sim
+@{
+@file sim_execute.c
+@brief The reference fetch, decode and execute loop, which decodes every instruction as it is run.
+*/
+
+#include <math.h>
+
+#include "sim.h"
+#include "sim_ops.h"
+
+/*!
+@brief Executes one decoded instruction. The program counter must already point past it.
+@details Inlined into sim_run, and exported through sim_execute for other engines to fall back on.
+*/
+static inline void sim_execute_inline(sim_machine * m, sim_instruction * i)
+{
+    unsigned int * r = m -> registers;
+
+    if(!sim_condition_passes(m, i -> condition))
+        return;
+
+    switch(i -> opcode)
+    {
+        #define SIM_CASE(opcode, ...) case opcode: { __VA_ARGS__; break; }
+        SIM_OPERATIONS(SIM_CASE)
+        #undef SIM_CASE
+
+        default:    m -> halt = SIM_ILLEGAL; break;
+    }
+}
+
+/*!
+@brief Executes one decoded instruction. The program counter must already point past it.
+@param machine - The machine to execute on.
+@param instruction - The instruction to execute. Its condition is checked first.
+*/
+void sim_execute(sim_machine * machine, sim_instruction * instruction)
+{
+    sim_execute_inline(machine, instruction);
+}
+
+/*!
+@brief Runs a machine until it halts or has executed a number of instructions.
+@param machine - The machine to run.
+@param max_instructions - Stop once the machine has executed this many instructions in total.
+@returns Why the machine stopped.
+*/
+sim_halt_reason sim_run(sim_machine * machine, unsigned long long max_instructions)
+{
+    sim_instruction instruction;
+    unsigned long long count = machine -> instructions;
+
+    while(machine -> halt == SIM_RUNNING)
+    {
+        unsigned int pc = machine -> registers[PC];
+
+        if(count >= max_instructions)
+        {
+            machine -> halt = SIM_STEP_LIMIT;
+            break;
+        }
+        if(pc - machine -> program_start >= machine -> program_end - machine -> program_start)
+        {
+            machine -> halt = SIM_END;
+            break;
+        }
+        if(!sim_decode(machine, pc, &instruction))
+        {
+            machine -> halt = SIM_ILLEGAL;
+            break;
+        }
+
+        machine -> registers[PC] = pc + instruction.size;
+        count ++;
+        sim_execute_inline(machine, &instruction);
+    }
+
+    machine -> instructions = count;
+    return machine -> halt;
+}
+
+/*!
+@brief Runs a machine with a chosen engine until it halts or has executed a number of
+instructions.
+@param machine - The machine to run. It must have been pre-decoded unless the engine is
+SIM_DECODE.
+@param engine - Which engine to run it with.
+@param max_instructions - Stop once the machine has executed this many instructions in total.
+@returns Why the machine stopped.
+*/
+sim_halt_reason sim_run_engine(sim_machine * machine, sim_engine engine,
+                               unsigned long long max_instructions)
+{
+    switch(engine)
+    {
+        case SIM_PREDECODE: return sim_run_predecoded(machine, max_instructions);
+        case SIM_THREADED:  return sim_run_threaded(machine, max_instructions);
+        case SIM_JIT:       return sim_run_jit(machine, max_instructions);
+        default:            return sim_run(machine, max_instructions);
+    }
+}
+
+//! }@
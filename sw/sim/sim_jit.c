@@ -0,0 +1,908 @@
+/*!
+@ingroup sw-sim
+@{
+@file sim_jit.c
+@brief An execution engine which translates basic blocks of TIM code into x86-64 machine code.
+@details A block starts at the address it is first entered at, and runs to the first JUMP, CALL,
+RETURN or HALT, or to an instruction which writes PC, up to SIM_JIT_BLOCK_INSTRUCTIONS
+instructions. Moves, tests and the integer ALU instructions other than division and arithmetic
+shift are translated to native code which works on the register file in memory. Every other
+instruction is run by calling its sim_predecode handler.
+
+Translated blocks live in one executable mmap region, and are found through an array holding
+the entry point of the block starting at each address of the program. A block which ends at a
+known address jumps back to the dispatcher the first time, which then patches the jump to go
+straight to the next block, so hot loops run without leaving translated code. Blocks which end
+at an address held in a register look the next block up in the array themselves.
+
+The instruction limit is kept in r12. Each block checks on entry that it can run to the end
+without passing it, and otherwise hands back to the dispatcher, which finishes with the threaded
+engine. Stores which overwrite translated code patch the entry of every block they touch to
+return to the dispatcher, and end the block doing the store, so self modifying programs stay
+exact. When the code region fills up, every block is thrown away.
+
+Only x86-64 Linux hosts are supported. Elsewhere sim_jit_new fails, and sim_run_jit runs the
+threaded engine.
+*/
+
+#include <math.h>
+#include <stddef.h>
+
+#include "sim.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+
+#include <sys/mman.h>
+
+//! The size of the executable region translated code is written to.
+#define SIM_JIT_CODE_SIZE (16 << 20)
+
+//! The most instructions translated into one block.
+#define SIM_JIT_BLOCK_INSTRUCTIONS 64
+
+//! Space enough for the largest possible translated block, in bytes.
+#define SIM_JIT_BLOCK_SPACE (SIM_JIT_BLOCK_INSTRUCTIONS * 160 + 256)
+
+//! The number of decoded instructions helper calls can refer to before every block is flushed.
+#define SIM_JIT_RECORDS (1 << 18)
+
+//! A helper return code: go back to the dispatcher, as the machine halted or code changed.
+#define SIM_JIT_RETURN 1
+//! A helper return code: the instruction changed PC, so the block can not carry on.
+#define SIM_JIT_BRANCH 2
+
+//! x86 register numbers, as used in ModRM bytes.
+#define X86_EAX 0
+#define X86_ECX 1
+#define X86_EDX 2
+
+//! The offset of a TIM register from the machine pointer held in rbx.
+#define SIM_JIT_REG(reg) ((unsigned char)((reg) * 4))
+
+/*!
+@brief Where translated code goes when it returns to the dispatcher.
+@details Returned in rax and rdx, as the x86-64 System V ABI does for a two word struct.
+*/
+typedef struct sim_jit_exit_t{
+    //! The jump to patch with the address of the next block, or NULL.
+    unsigned char    * link;
+    //! How many more instructions may be run.
+    unsigned long long budget;
+} sim_jit_exit;
+
+//! The trampoline from C into translated code.
+typedef sim_jit_exit (*sim_jit_enter)(sim_machine * machine, unsigned char * entry,
+                                      unsigned long long budget, unsigned char ** blocks);
+
+/*!
+@brief A translated block, as recorded for invalidation.
+*/
+typedef struct sim_jit_block_t{
+    //! The offset into the program of the first instruction.
+    unsigned int    start;
+    //! The offset into the program one past the last byte of the last instruction.
+    unsigned int    end;
+    //! The entry point of the translated code.
+    unsigned char * entry;
+} sim_jit_block;
+
+/*!
+@brief The translation cache of a machine.
+*/
+struct sim_jit_t{
+    //! The executable region holding the trampolines and every translated block.
+    unsigned char * code;
+    //! The number of bytes of the region in use.
+    size_t          code_used;
+    //! The number of bytes used by the trampolines at the start of the region.
+    size_t          code_fixed;
+    //! Calls into translated code.
+    sim_jit_enter   enter;
+    //! Returns from translated code to the dispatcher without asking for a link.
+    unsigned char * exit;
+    //! Returns from translated code to the dispatcher, with rax already set.
+    unsigned char * epilogue;
+
+    //! The address of the first instruction of the program.
+    unsigned int    program_start;
+    //! The length of the program in bytes.
+    unsigned int    program_size;
+    //! The entry point of the block starting at each offset into the program, or NULL.
+    unsigned char ** blocks;
+    //! Non zero for each byte of the program some translated block was made from.
+    unsigned char * translated;
+
+    //! Every block translated since the last flush.
+    sim_jit_block * list;
+    //! The number of blocks in list.
+    unsigned int    list_count;
+    //! The number of blocks list has space for.
+    unsigned int    list_capacity;
+
+    //! The decoded instructions which helper calls run.
+    sim_decoded   * records;
+    //! The number of records in use.
+    unsigned int    record_count;
+
+    //! The number of times every block has been thrown away.
+    unsigned long long flushes;
+    //! Set when a store overwrites translated code, to end the running block.
+    BOOL            stale;
+};
+
+//! Appends bytes to the code region.
+static void sim_jit_emit(sim_jit * jit, const unsigned char * bytes, size_t length)
+{
+    memcpy(jit -> code + jit -> code_used, bytes, length);
+    jit -> code_used += length;
+}
+
+//! Appends a list of byte values to the code region.
+#define SIM_EMIT(jit, ...) sim_jit_emit(jit, (const unsigned char[]){__VA_ARGS__}, \
+                                        sizeof((const unsigned char[]){__VA_ARGS__}))
+
+//! Appends a 32 bit little endian value to the code region.
+static void sim_jit_emit_32(sim_jit * jit, unsigned int value)
+{
+    sim_jit_emit(jit, (const unsigned char *)&value, 4);
+}
+
+//! Appends a 64 bit little endian value to the code region.
+static void sim_jit_emit_64(sim_jit * jit, unsigned long long value)
+{
+    sim_jit_emit(jit, (const unsigned char *)&value, 8);
+}
+
+//! Writes the 32 bit displacement at site so that it jumps to target.
+static void sim_jit_patch(unsigned char * site, unsigned char * target)
+{
+    int rel = (int)(target - (site + 4));
+    memcpy(site, &rel, 4);
+}
+
+//! Appends a jmp rel32 to target.
+static void sim_jit_jump(sim_jit * jit, unsigned char * target)
+{
+    SIM_EMIT(jit, 0xE9);
+    sim_jit_emit_32(jit, 0);
+    sim_jit_patch(jit -> code + jit -> code_used - 4, target);
+}
+
+//! Appends mov x86, [rbx + reg].
+static void sim_jit_load(sim_jit * jit, unsigned int x86, unsigned int reg)
+{
+    SIM_EMIT(jit, 0x8B, 0x43 | (x86 << 3), SIM_JIT_REG(reg));
+}
+
+//! Appends mov [rbx + reg], x86.
+static void sim_jit_store(sim_jit * jit, unsigned int x86, unsigned int reg)
+{
+    SIM_EMIT(jit, 0x89, 0x43 | (x86 << 3), SIM_JIT_REG(reg));
+}
+
+//! Appends mov dword [rbx + reg], value.
+static void sim_jit_store_immediate(sim_jit * jit, unsigned int reg, unsigned int value)
+{
+    SIM_EMIT(jit, 0xC7, 0x43, SIM_JIT_REG(reg));
+    sim_jit_emit_32(jit, value);
+}
+
+/*!
+@brief Appends a branch over the code for an instruction if its condition fails.
+@returns The displacement to patch once the end of the instruction is known, or NULL if the
+instruction always runs.
+*/
+static unsigned char * sim_jit_condition(sim_jit * jit, unsigned int condition)
+{
+    if(condition == ALWAYS)
+        return NULL;
+
+    // test byte [rbx + TR or SR], 1, then jz or jnz rel32.
+    SIM_EMIT(jit, 0xF6, 0x43, SIM_JIT_REG(condition == IFZERO ? SR : TR), 0x01);
+    SIM_EMIT(jit, 0x0F, condition == IFFALSE ? 0x85 : 0x84);
+    sim_jit_emit_32(jit, 0);
+    return jit -> code + jit -> code_used - 4;
+}
+
+//! Points a branch from sim_jit_condition at the current end of the code.
+static void sim_jit_condition_end(sim_jit * jit, unsigned char * skip)
+{
+    if(skip != NULL)
+        sim_jit_patch(skip, jit -> code + jit -> code_used);
+}
+
+/*!
+@brief Appends code to set SR from the result in eax, as sim_flags does.
+@param carry - Also set carry and overflow from the x86 flags, as sim_add and sim_sub do. The
+               add or subtract must be the instruction just emitted.
+*/
+static void sim_jit_flags(sim_jit * jit, BOOL carry)
+{
+    if(carry)
+    {
+        // setc cl, seto dl, then ecx = carry << 1 | overflow << 3.
+        SIM_EMIT(jit, 0x0F, 0x92, 0xC1, 0x0F, 0x90, 0xC2, 0x0F, 0xB6, 0xC9, 0x0F, 0xB6, 0xD2,
+                      0xD1, 0xE1, 0xC1, 0xE2, 0x03, 0x09, 0xD1);
+    }
+
+    // esi = SR with the flags being set cleared.
+    SIM_EMIT(jit, 0x8B, 0x73, SIM_JIT_REG(SR), 0x83, 0xE6,
+                  carry ? (unsigned char)~0x0F : (unsigned char)~(SIM_SR_ZERO | SIM_SR_NEGATIVE));
+    if(carry)
+        SIM_EMIT(jit, 0x09, 0xCE);
+
+    // test eax, eax; sete dl; movzx edx, dl; or esi, edx
+    SIM_EMIT(jit, 0x85, 0xC0, 0x0F, 0x94, 0xC2, 0x0F, 0xB6, 0xD2, 0x09, 0xD6);
+    // mov edx, eax; shr edx, 29; and edx, 4; or esi, edx
+    SIM_EMIT(jit, 0x89, 0xC2, 0xC1, 0xEA, 0x1D, 0x83, 0xE2, SIM_SR_NEGATIVE, 0x09, 0xD6);
+    // mov [rbx + SR], esi
+    SIM_EMIT(jit, 0x89, 0x73, SIM_JIT_REG(SR));
+}
+
+/*!
+@brief Appends a return to the dispatcher which asks for the jump just emitted to be linked.
+@details Stores the target in PC, and jumps to the code after it, which returns to the
+dispatcher. If the target is already translated, the jump goes straight to it instead.
+*/
+static void sim_jit_exit_to(sim_jit * jit, unsigned int target)
+{
+    sim_jit_store_immediate(jit, PC, target);
+
+    SIM_EMIT(jit, 0xE9);
+    sim_jit_emit_32(jit, 0);
+    unsigned char * site = jit -> code + jit -> code_used - 4;
+
+    unsigned int offset = target - jit -> program_start;
+    if(offset < jit -> program_size && jit -> blocks[offset] != NULL)
+        sim_jit_patch(site, jit -> blocks[offset]);
+
+    // mov rax, site; jmp epilogue
+    SIM_EMIT(jit, 0x48, 0xB8);
+    sim_jit_emit_64(jit, (unsigned long long)(size_t)site);
+    sim_jit_jump(jit, jit -> epilogue);
+}
+
+/*!
+@brief Appends a jump to the block starting at the address in PC, returning to the dispatcher if
+it is not yet translated or is outside the program.
+*/
+static void sim_jit_exit_indirect(sim_jit * jit)
+{
+    sim_jit_load(jit, X86_EAX, PC);
+    SIM_EMIT(jit, 0x2D);                            // sub eax, program_start
+    sim_jit_emit_32(jit, jit -> program_start);
+    SIM_EMIT(jit, 0x3D);                            // cmp eax, program_size
+    sim_jit_emit_32(jit, jit -> program_size);
+    SIM_EMIT(jit, 0x73, 12,                         // jae exit
+                  0x49, 0x8B, 0x44, 0xC5, 0x00,     // mov rax, [r13 + rax * 8]
+                  0x48, 0x85, 0xC0,                 // test rax, rax
+                  0x74, 2,                          // jz exit
+                  0xFF, 0xE0);                      // jmp rax
+    sim_jit_jump(jit, jit -> exit);
+}
+
+/*!
+@brief Runs one instruction for translated code.
+@returns SIM_JIT_RETURN if translated code must return to the dispatcher, SIM_JIT_BRANCH if the
+instruction changed PC, otherwise zero.
+*/
+static int sim_jit_helper(sim_machine * machine, sim_decoded * d)
+{
+    machine -> registers[PC] = d -> next_pc;
+    if(sim_condition_passes(machine, d -> instruction.condition))
+        d -> handler(machine, &d -> instruction);
+
+    if(machine -> halt != SIM_RUNNING || machine -> jit -> stale)
+        return SIM_JIT_RETURN;
+    return machine -> registers[PC] != d -> next_pc ? SIM_JIT_BRANCH : 0;
+}
+
+/*!
+@brief Appends a call to the sim_predecode handler of an instruction, through sim_jit_helper.
+@returns The record the call runs.
+*/
+static sim_decoded * sim_jit_call(sim_machine * machine, unsigned int address)
+{
+    sim_jit     * jit = machine -> jit;
+    sim_decoded * d   = &jit -> records[jit -> record_count ++];
+
+    sim_predecode_record(machine, address, d);
+
+    SIM_EMIT(jit, 0x48, 0x89, 0xDF);                // mov rdi, rbx
+    SIM_EMIT(jit, 0x48, 0xBE);                      // mov rsi, d
+    sim_jit_emit_64(jit, (unsigned long long)(size_t)d);
+    SIM_EMIT(jit, 0x48, 0xB8);                      // mov rax, sim_jit_helper
+    sim_jit_emit_64(jit, (unsigned long long)(size_t)sim_jit_helper);
+    SIM_EMIT(jit, 0xFF, 0xD0);                      // call rax
+    return d;
+}
+
+/*!
+@brief Appends a call to the handler of an instruction in the middle of a block, returning to the
+dispatcher if it changes PC.
+@returns The displacement to patch with the number of instructions in the rest of the block, which
+are given back to the budget when it returns early.
+*/
+static unsigned char * sim_jit_call_inline(sim_machine * machine, unsigned int address)
+{
+    sim_jit * jit = machine -> jit;
+
+    sim_jit_call(machine, address);
+    SIM_EMIT(jit, 0x85, 0xC0, 0x74, 12);            // test eax, eax; jz over
+    SIM_EMIT(jit, 0x49, 0x81, 0xC4);                // add r12, refund
+    sim_jit_emit_32(jit, 0);
+    unsigned char * refund = jit -> code + jit -> code_used - 4;
+    sim_jit_jump(jit, jit -> exit);
+    return refund;
+}
+
+/*!
+@brief Throws away every translated block.
+*/
+static void sim_jit_flush(sim_jit * jit)
+{
+    jit -> code_used    = jit -> code_fixed;
+    jit -> list_count   = 0;
+    jit -> record_count = 0;
+    jit -> flushes ++;
+    memset(jit -> blocks, 0, (size_t)jit -> program_size * sizeof(unsigned char *));
+    memset(jit -> translated, 0, jit -> program_size);
+}
+
+/*!
+@brief Appends the native code for an integer ALU instruction, leaving the result in eax.
+@returns FALSE if the instruction has no native translation.
+*/
+static BOOL sim_jit_alu(sim_jit * jit, sim_instruction * i)
+{
+    BOOL immediate;
+
+    switch(i -> opcode)
+    {
+        case ANDI: case NANDI: case ORI: case NORI: case XORI: case LSLI: case LSRI:
+        case IADDI: case ISUBI: case IMULI:
+            immediate = TRUE;
+            break;
+        case ANDR: case NANDR: case ORR: case NORR: case XORR: case LSLR: case LSRR: case NOTR:
+        case IADDR: case ISUBR: case IMULR:
+            immediate = FALSE;
+            break;
+        default:
+            return FALSE;
+    }
+
+    sim_jit_load(jit, X86_EAX, i -> reg_2);
+    if(immediate)
+    {
+        SIM_EMIT(jit, 0xB9);                        // mov ecx, immediate
+        sim_jit_emit_32(jit, i -> immediate);
+    }
+    else
+        sim_jit_load(jit, X86_ECX, i -> reg_3);
+
+    switch(i -> opcode)
+    {
+        case ANDI:  case ANDR:  SIM_EMIT(jit, 0x21, 0xC8);             break;
+        case NANDI: case NANDR: SIM_EMIT(jit, 0x21, 0xC8, 0xF7, 0xD0); break;
+        case ORI:   case ORR:   SIM_EMIT(jit, 0x09, 0xC8);             break;
+        case NORI:  case NORR:  SIM_EMIT(jit, 0x09, 0xC8, 0xF7, 0xD0); break;
+        case XORI:  case XORR:  SIM_EMIT(jit, 0x31, 0xC8);             break;
+        case NOTR:              SIM_EMIT(jit, 0xF7, 0xD0);             break;
+        case IMULI: case IMULR: SIM_EMIT(jit, 0x0F, 0xAF, 0xC1);       break;
+        case IADDI: case IADDR: SIM_EMIT(jit, 0x01, 0xC8);             break;
+        case ISUBI: case ISUBR: SIM_EMIT(jit, 0x29, 0xC8);             break;
+
+        // x86 shifts count modulo 32, so give zero for counts above 31 with a cmova.
+        case LSLI:  case LSLR:
+            SIM_EMIT(jit, 0x31, 0xD2, 0xD3, 0xE0, 0x83, 0xF9, 0x1F, 0x0F, 0x47, 0xC2);
+            break;
+        case LSRI:  case LSRR:
+            SIM_EMIT(jit, 0x31, 0xD2, 0xD3, 0xE8, 0x83, 0xF9, 0x1F, 0x0F, 0x47, 0xC2);
+            break;
+    }
+
+    sim_jit_flags(jit, i -> opcode == IADDI || i -> opcode == IADDR ||
+                       i -> opcode == ISUBI || i -> opcode == ISUBR);
+    return TRUE;
+}
+
+//! Appends a 32 bit displacement from rbx to a field of the machine.
+#define SIM_EMIT_FIELD(jit, field) sim_jit_emit_32(jit, (unsigned int)offsetof(sim_machine, field))
+
+/*!
+@brief Appends the native code for a PUSH which does not store into the watched program.
+@returns The displacement to patch with the address of the code which runs the PUSH by calling
+its handler instead, for pushes which do.
+*/
+static unsigned char * sim_jit_push(sim_jit * jit, sim_instruction * i)
+{
+    // edx = SP - 4, eax = edx wrapped, and go the slow way if it is watched.
+    sim_jit_load(jit, X86_EAX, SP);
+    SIM_EMIT(jit, 0x83, 0xE8, 0x04, 0x89, 0xC2);    // sub eax, 4; mov edx, eax
+    SIM_EMIT(jit, 0x23, 0x83);                      // and eax, [rbx + address_mask]
+    SIM_EMIT_FIELD(jit, address_mask);
+    SIM_EMIT(jit, 0x89, 0xC1, 0x2B, 0x8B);          // mov ecx, eax; sub ecx, [rbx + watch_start]
+    SIM_EMIT_FIELD(jit, watch_start);
+    SIM_EMIT(jit, 0x3B, 0x8B);                      // cmp ecx, [rbx + watch_size]
+    SIM_EMIT_FIELD(jit, watch_size);
+    SIM_EMIT(jit, 0x0F, 0x82);                      // jb slow
+    sim_jit_emit_32(jit, 0);
+    unsigned char * slow = jit -> code + jit -> code_used - 4;
+
+    sim_jit_store(jit, X86_EDX, SP);
+    SIM_EMIT(jit, 0x48, 0x8B, 0x93);                // mov rdx, [rbx + memory]
+    SIM_EMIT_FIELD(jit, memory);
+    sim_jit_load(jit, X86_ECX, i -> reg_1);
+    SIM_EMIT(jit, 0x0F, 0xC9, 0x89, 0x0C, 0x02);    // bswap ecx; mov [rdx + rax], ecx
+    return slow;
+}
+
+//! Appends the native code for a POP into any register but PC.
+static void sim_jit_pop(sim_jit * jit, sim_instruction * i)
+{
+    sim_jit_load(jit, X86_EAX, SP);
+    SIM_EMIT(jit, 0x8D, 0x50, 0x04);                // lea edx, [rax + 4]
+    sim_jit_store(jit, X86_EDX, SP);
+    SIM_EMIT(jit, 0x23, 0x83);                      // and eax, [rbx + address_mask]
+    SIM_EMIT_FIELD(jit, address_mask);
+    SIM_EMIT(jit, 0x48, 0x8B, 0x93);                // mov rdx, [rbx + memory]
+    SIM_EMIT_FIELD(jit, memory);
+    SIM_EMIT(jit, 0x8B, 0x04, 0x02, 0x0F, 0xC8);    // mov eax, [rdx + rax]; bswap eax
+    sim_jit_store(jit, X86_EAX, i -> reg_1);
+}
+
+//! Returns TRUE if any register field of an instruction names PC.
+static BOOL sim_jit_reads_pc(sim_instruction * i)
+{
+    return i -> reg_1 == PC || i -> reg_2 == PC || i -> reg_3 == PC;
+}
+
+/*!
+@brief Translates the block starting at an offset into the program.
+@returns The entry point of the block, or NULL if the first instruction is illegal.
+*/
+static unsigned char * sim_jit_translate(sim_machine * machine, unsigned int offset)
+{
+    sim_jit * jit = machine -> jit;
+
+    if(jit -> code_used + SIM_JIT_BLOCK_SPACE > SIM_JIT_CODE_SIZE ||
+       jit -> record_count + SIM_JIT_BLOCK_INSTRUCTIONS > SIM_JIT_RECORDS)
+        sim_jit_flush(jit);
+
+    if(jit -> list_count == jit -> list_capacity)
+    {
+        unsigned int capacity = jit -> list_capacity ? jit -> list_capacity * 2 : 1024;
+        sim_jit_block * grown = realloc(jit -> list, capacity * sizeof(sim_jit_block));
+        if(grown == NULL)
+            return NULL;
+        jit -> list          = grown;
+        jit -> list_capacity = capacity;
+    }
+
+    sim_instruction i;
+    unsigned int    address = jit -> program_start + offset;
+
+    if(!sim_decode(machine, address, &i) || i.opcode >= NOT_EMITTED)
+        return NULL;
+
+    // The instruction count sits just before the entry point, for the dispatcher.
+    unsigned char * count_site = jit -> code + jit -> code_used;
+    sim_jit_emit_32(jit, 0);
+    unsigned char * entry = jit -> code + jit -> code_used;
+
+    // cmp r12, count; jb exit; sub r12, count
+    SIM_EMIT(jit, 0x49, 0x81, 0xFC);
+    sim_jit_emit_32(jit, 0);
+    SIM_EMIT(jit, 0x0F, 0x82);
+    sim_jit_emit_32(jit, 0);
+    sim_jit_patch(jit -> code + jit -> code_used - 4, jit -> exit);
+    SIM_EMIT(jit, 0x49, 0x81, 0xEC);
+    sim_jit_emit_32(jit, 0);
+    unsigned char * budget_sites[2] = {entry + 3, entry + 16};
+
+    // Early exits add back the instructions they did not run, once the count is known.
+    unsigned char * refunds[SIM_JIT_BLOCK_INSTRUCTIONS];
+    unsigned int    refund_counts[SIM_JIT_BLOCK_INSTRUCTIONS];
+    unsigned int    refund_total = 0;
+
+    unsigned int count = 0;
+    unsigned int end   = offset;
+    BOOL         ended = FALSE;
+
+    while(!ended)
+    {
+        unsigned int next = address + i.size;
+        count ++;
+
+        // Instructions may run past the end of the program into memory which is not watched.
+        end = next - jit -> program_start;
+        if(end > jit -> program_size)
+            end = jit -> program_size;
+        memset(jit -> translated + (address - jit -> program_start), 1,
+               end - (address - jit -> program_start));
+
+        switch(i.opcode)
+        {
+            case JUMPI:
+            {
+                unsigned char * skip = sim_jit_condition(jit, i.condition);
+                sim_jit_exit_to(jit, i.immediate);
+                if(skip != NULL)
+                {
+                    sim_jit_condition_end(jit, skip);
+                    sim_jit_exit_to(jit, next);
+                }
+                ended = TRUE;
+                break;
+            }
+
+            case JUMPR:
+            {
+                sim_jit_store_immediate(jit, PC, next);
+                unsigned char * skip = sim_jit_condition(jit, i.condition);
+                sim_jit_load(jit, X86_EAX, i.reg_1);
+                sim_jit_store(jit, X86_EAX, PC);
+                sim_jit_condition_end(jit, skip);
+                sim_jit_exit_indirect(jit);
+                ended = TRUE;
+                break;
+            }
+
+            case CALLR: case CALLI: case RETURN:
+                sim_jit_call(machine, address);
+                SIM_EMIT(jit, 0xA8, SIM_JIT_RETURN, 0x74, 5);  // test al, RETURN; jz over
+                sim_jit_jump(jit, jit -> exit);
+                sim_jit_exit_indirect(jit);
+                ended = TRUE;
+                break;
+
+            case HALT:
+            {
+                sim_jit_store_immediate(jit, PC, next);
+                unsigned char * skip = sim_jit_condition(jit, i.condition);
+                SIM_EMIT(jit, 0xC7, 0x83);                      // mov dword [rbx + halt]
+                sim_jit_emit_32(jit, (unsigned int)offsetof(sim_machine, halt));
+                sim_jit_emit_32(jit, SIM_HALTED);
+                sim_jit_jump(jit, jit -> exit);
+                if(skip != NULL)
+                {
+                    sim_jit_condition_end(jit, skip);
+                    sim_jit_exit_to(jit, next);
+                }
+                ended = TRUE;
+                break;
+            }
+
+            case SLEEP:
+                break;
+
+            case PUSH: case POP:
+            {
+                if(i.opcode == POP && i.reg_1 == PC)
+                    goto sim_jit_call_handler;
+                if(i.reg_1 == PC)
+                    sim_jit_store_immediate(jit, PC, next);
+
+                unsigned char * skip = sim_jit_condition(jit, i.condition);
+                unsigned char * slow = NULL;
+                if(i.opcode == PUSH)
+                    slow = sim_jit_push(jit, &i);
+                else
+                    sim_jit_pop(jit, &i);
+
+                if(slow != NULL)
+                {
+                    // Pushes which may overwrite code run the handler, and so invalidate.
+                    SIM_EMIT(jit, 0xE9);
+                    sim_jit_emit_32(jit, 0);
+                    unsigned char * done = jit -> code + jit -> code_used - 4;
+                    sim_jit_condition_end(jit, slow);
+                    refunds[refund_total]         = sim_jit_call_inline(machine, address);
+                    refund_counts[refund_total++] = count;
+                    sim_jit_condition_end(jit, done);
+                }
+
+                sim_jit_condition_end(jit, skip);
+                break;
+            }
+
+            case MOVR: case MOVI: case TEST:
+            case ANDR: case NANDR: case ORR: case NORR: case XORR: case LSLR: case LSRR: case NOTR:
+            case ANDI: case NANDI: case ORI: case NORI: case XORI: case LSLI: case LSRI:
+            case IADDI: case ISUBI: case IMULI: case IADDR: case ISUBR: case IMULR:
+            {
+                if(sim_jit_reads_pc(&i))
+                    sim_jit_store_immediate(jit, PC, next);
+
+                unsigned char * skip = sim_jit_condition(jit, i.condition);
+
+                if(i.opcode == MOVI)
+                    sim_jit_store_immediate(jit, i.reg_1, i.immediate);
+                else if(i.opcode == MOVR)
+                {
+                    sim_jit_load(jit, X86_EAX, i.reg_2);
+                    sim_jit_store(jit, X86_EAX, i.reg_1);
+                }
+                else if(i.opcode == TEST)
+                {
+                    // cmp eax, ecx; sete dl; movzx edx, dl; TR = TR << 1 | edx
+                    sim_jit_load(jit, X86_EAX, i.reg_1);
+                    sim_jit_load(jit, X86_ECX, i.reg_2);
+                    SIM_EMIT(jit, 0x39, 0xC8, 0x0F, 0x94, 0xC2, 0x0F, 0xB6, 0xD2);
+                    sim_jit_load(jit, X86_ECX, TR);
+                    SIM_EMIT(jit, 0x01, 0xC9, 0x09, 0xD1);
+                    sim_jit_store(jit, X86_ECX, TR);
+                }
+                else
+                {
+                    sim_jit_alu(jit, &i);
+                    sim_jit_store(jit, X86_EAX, i.reg_1);
+                }
+
+                sim_jit_condition_end(jit, skip);
+
+                if(i.reg_1 == PC && i.opcode != TEST)
+                {
+                    sim_jit_exit_indirect(jit);
+                    ended = TRUE;
+                }
+                break;
+            }
+
+            default:
+            sim_jit_call_handler:
+                // Everything else runs its handler, and leaves the block if it changes PC.
+                refunds[refund_total]         = sim_jit_call_inline(machine, address);
+                refund_counts[refund_total++] = count;
+                break;
+        }
+
+        if(ended)
+            break;
+
+        address = next;
+        if(count == SIM_JIT_BLOCK_INSTRUCTIONS ||
+           address - jit -> program_start >= jit -> program_size ||
+           !sim_decode(machine, address, &i) || i.opcode >= NOT_EMITTED)
+        {
+            sim_jit_exit_to(jit, address);
+            break;
+        }
+    }
+
+    unsigned int r;
+    memcpy(count_site, &count, 4);
+    memcpy(budget_sites[0], &count, 4);
+    memcpy(budget_sites[1], &count, 4);
+    for(r = 0; r < refund_total; r ++)
+    {
+        unsigned int refund = count - refund_counts[r];
+        memcpy(refunds[r], &refund, 4);
+    }
+
+    sim_jit_block * block = &jit -> list[jit -> list_count ++];
+    block -> start = offset;
+    block -> end   = end;
+    block -> entry = entry;
+
+    jit -> blocks[offset] = entry;
+    return entry;
+}
+
+/*!
+@brief Writes the trampolines into and out of translated code at the start of the region.
+*/
+static void sim_jit_trampolines(sim_jit * jit)
+{
+    jit -> code_used = 0;
+    jit -> enter     = (sim_jit_enter)(void *)jit -> code;
+
+    SIM_EMIT(jit, 0x53, 0x41, 0x54, 0x41, 0x55,     // push rbx, r12, r13, r14, r15, rbp
+                  0x41, 0x56, 0x41, 0x57, 0x55,
+                  0x48, 0x83, 0xEC, 0x08,           // sub rsp, 8
+                  0x48, 0x89, 0xFB,                 // mov rbx, rdi
+                  0x49, 0x89, 0xD4,                 // mov r12, rdx
+                  0x49, 0x89, 0xCD,                 // mov r13, rcx
+                  0xFF, 0xE6);                      // jmp rsi
+
+    jit -> exit = jit -> code + jit -> code_used;
+    SIM_EMIT(jit, 0x31, 0xC0);                      // xor eax, eax
+
+    jit -> epilogue = jit -> code + jit -> code_used;
+    SIM_EMIT(jit, 0x4C, 0x89, 0xE2,                 // mov rdx, r12
+                  0x48, 0x83, 0xC4, 0x08,           // add rsp, 8
+                  0x5D, 0x41, 0x5F, 0x41, 0x5E,     // pop rbp, r15, r14, r13, r12, rbx
+                  0x41, 0x5D, 0x41, 0x5C, 0x5B,
+                  0xC3);                            // ret
+
+    jit -> code_fixed = jit -> code_used;
+}
+
+/*!
+@brief Creates the translation cache of a machine.
+@param machine - The machine to translate for. It must already be pre-decoded with
+sim_predecode_new, which also watches for stores into the program.
+@returns TRUE if the cache could be allocated, or FALSE if it could not, or the host is not
+x86-64 Linux.
+*/
+BOOL sim_jit_new(sim_machine * machine)
+{
+    sim_jit_free(machine);
+    if(machine -> decoded == NULL)
+        return FALSE;
+
+    sim_jit * jit = calloc(1, sizeof(sim_jit));
+    if(jit == NULL)
+        return FALSE;
+
+    jit -> program_start = machine -> program_start;
+    jit -> program_size  = machine -> program_end - machine -> program_start;
+    jit -> blocks        = calloc((size_t)jit -> program_size + 1, sizeof(unsigned char *));
+    jit -> translated    = calloc((size_t)jit -> program_size + 1, 1);
+    jit -> records       = malloc(SIM_JIT_RECORDS * sizeof(sim_decoded));
+    jit -> code          = mmap(NULL, SIM_JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    machine -> jit = jit;
+
+    if(jit -> code == MAP_FAILED)
+        jit -> code = NULL;
+    if(jit -> blocks == NULL || jit -> translated == NULL || jit -> records == NULL ||
+       jit -> code == NULL)
+    {
+        sim_jit_free(machine);
+        return FALSE;
+    }
+
+    sim_jit_trampolines(jit);
+    return TRUE;
+}
+
+/*!
+@brief Releases the translation cache of a machine.
+@param machine - The machine whose cache to free.
+*/
+void sim_jit_free(sim_machine * machine)
+{
+    sim_jit * jit = machine -> jit;
+    if(jit == NULL)
+        return;
+
+    if(jit -> code != NULL)
+        munmap(jit -> code, SIM_JIT_CODE_SIZE);
+    free(jit -> blocks);
+    free(jit -> translated);
+    free(jit -> records);
+    free(jit -> list);
+    free(jit);
+    machine -> jit = NULL;
+}
+
+/*!
+@brief Discards every translated block which a store to a word overwrote.
+@param machine - The machine which was stored to.
+@param address - The wrapped address of the word stored to.
+*/
+void sim_jit_invalidate(sim_machine * machine, unsigned int address)
+{
+    sim_jit    * jit   = machine -> jit;
+    unsigned int first = jit -> program_size;
+    unsigned int last  = 0;
+    unsigned int b;
+
+    // The offsets into the program of the bytes stored to which translated code was made from.
+    for(b = 0; b < 4; b ++)
+    {
+        unsigned int offset = address + b - jit -> program_start;
+        if(offset < jit -> program_size && jit -> translated[offset])
+        {
+            if(offset < first)
+                first = offset;
+            last = offset;
+        }
+    }
+    if(first > last)
+        return;
+
+    for(b = 0; b < jit -> list_count; b ++)
+    {
+        sim_jit_block * block = &jit -> list[b];
+        if(block -> entry == NULL || block -> start > last || block -> end <= first)
+            continue;
+
+        // Blocks linked to this one jump to its entry, so make the entry go to the dispatcher.
+        unsigned char * site = block -> entry;
+        site[0] = 0xE9;
+        sim_jit_patch(site + 1, jit -> exit);
+
+        if(jit -> blocks[block -> start] == block -> entry)
+            jit -> blocks[block -> start] = NULL;
+        block -> entry = NULL;
+        jit -> stale   = TRUE;
+    }
+}
+
+/*!
+@brief Runs a machine with the translated code of its program until it halts or has executed a
+number of instructions.
+@param machine - The machine to run.
+@param max_instructions - Stop once the machine has executed this many instructions in total.
+@returns Why the machine stopped.
+*/
+sim_halt_reason sim_run_jit(sim_machine * machine, unsigned long long max_instructions)
+{
+    sim_jit       * jit     = machine -> jit;
+    unsigned char * link    = NULL;
+    unsigned long long flushes = 0;
+
+    if(jit == NULL)
+        return sim_run_threaded(machine, max_instructions);
+
+    while(machine -> halt == SIM_RUNNING)
+    {
+        unsigned int offset = machine -> registers[PC] - jit -> program_start;
+
+        if(machine -> instructions >= max_instructions)
+        {
+            machine -> halt = SIM_STEP_LIMIT;
+            break;
+        }
+        if(offset >= jit -> program_size)
+        {
+            machine -> halt = SIM_END;
+            break;
+        }
+
+        unsigned char * entry = jit -> blocks[offset];
+        if(entry == NULL)
+        {
+            entry = sim_jit_translate(machine, offset);
+            if(entry == NULL)
+                return sim_run_threaded(machine, max_instructions);
+        }
+
+        // Link the jump which just left translated code, unless its block has since been flushed.
+        if(link != NULL && flushes == jit -> flushes)
+            sim_jit_patch(link, entry);
+
+        unsigned int count;
+        memcpy(&count, entry - 4, 4);
+
+        unsigned long long budget = max_instructions - machine -> instructions;
+        if(count > budget)
+            return sim_run_threaded(machine, max_instructions);
+
+        jit -> stale = FALSE;
+        flushes      = jit -> flushes;
+
+        sim_jit_exit exit = jit -> enter(machine, entry, budget, jit -> blocks);
+        machine -> instructions = max_instructions - exit.budget;
+        link = exit.link;
+    }
+
+    return machine -> halt;
+}
+
+#else
+
+BOOL sim_jit_new(sim_machine * machine)
+{
+    return FALSE;
+}
+
+void sim_jit_free(sim_machine * machine)
+{
+}
+
+void sim_jit_invalidate(sim_machine * machine, unsigned int address)
+{
+}
+
+sim_halt_reason sim_run_jit(sim_machine * machine, unsigned long long max_instructions)
+{
+    return sim_run_threaded(machine, max_instructions);
+}
+
+#endif
+
+//! }@
@@ -0,0 +1,184 @@
+/*!
+@ingroup sw-sim
+@{
+@file sim_machine.c
+@brief Contains all functions that create, load and print a sim_machine.
+*/
+
+#include "sim.h"
+
+#ifdef __linux__
+    #include <sys/mman.h>
+#endif
+
+const char * sim_register_names[SIM_REGISTER_COUNT] = {
+    "R0", "R1", "R2", "R3", "R4", "R5", "R6", "R7", "R8", "R9", "R10", "R11", "R12", "R13", "R14",
+    "R15", "PC", "SP", "LR", "TR", "SR", "IR", "IS", "RES", "T0", "T1", "T2", "T3", "T4", "T5",
+    "T6", "T7"
+};
+
+const char * sim_halt_reason_names[] = {
+    "running", "halted", "end of program", "illegal instruction", "instruction limit"
+};
+
+const char * sim_engine_names[] = {
+    "decode", "predecode", "threaded", "jit"
+};
+
+/*!
+@brief Initialises a machine with zeroed memory and registers, ready to have a program loaded.
+@param memory_size - The size of memory in bytes. It is rounded up to a power of two.
+@param tr - The newly initialised machine. Memory space should already be declared.
+@returns TRUE if the memory could be allocated, otherwise FALSE.
+*/
+BOOL sim_machine_new(unsigned int memory_size, sim_machine * tr)
+{
+    unsigned int size = 4;
+    while(size < memory_size && size < 0x80000000u)
+        size <<= 1;
+
+    memset(tr, 0, sizeof(sim_machine));
+
+    tr -> memory = calloc((size_t)size + SIM_MEMORY_SLACK, 1);
+    if(tr -> memory == NULL)
+        return FALSE;
+
+    tr -> memory_size   = size;
+    tr -> address_mask  = size - 1;
+    tr -> registers[SP] = size;
+    tr -> halt          = SIM_RUNNING;
+    return TRUE;
+}
+
+/*!
+@brief Releases the memory held by a machine.
+@param machine - The machine to free.
+*/
+void sim_machine_free(sim_machine * machine)
+{
+    sim_jit_free(machine);
+    sim_predecode_free(machine);
+
+#ifdef __linux__
+    if(machine -> memory_mapped > 0)
+        munmap(machine -> memory, machine -> memory_mapped);
+    else
+#endif
+    free(machine -> memory);
+
+    machine -> memory        = NULL;
+    machine -> memory_size   = 0;
+    machine -> memory_mapped = 0;
+}
+
+/*!
+@brief Copies a program image into memory and points the program counter at its start.
+@param machine - The machine to load into.
+@param image - The machine code, as produced by asm_emit_instructions in binary format.
+@param length - The length of the image in bytes.
+@param address - Where in memory to load the image.
+@returns TRUE if the image fits in memory, otherwise FALSE.
+*/
+BOOL sim_machine_load(sim_machine * machine, unsigned char * image, size_t length,
+                      unsigned int address)
+{
+    if(address > machine -> memory_size || length > machine -> memory_size - address)
+        return FALSE;
+
+    memcpy(machine -> memory + address, image, length);
+
+    machine -> program_start = address;
+    machine -> program_end   = address + (unsigned int)length;
+    machine -> registers[PC] = address;
+    return TRUE;
+}
+
+/*!
+@brief Reads a program image from a file written by the assembler and loads it at address zero.
+@details Ascii images are read as lines of '1' and '0' characters, eight to a byte. The zero
+padding the assembler adds to the last line is loaded along with the program.
+@param machine - The machine to load into.
+@param file - The opened image file.
+@param format - Whether the file holds raw bytes or ascii bit strings.
+@returns TRUE if the file was read and loaded, otherwise FALSE.
+*/
+BOOL sim_machine_load_file(sim_machine * machine, FILE * file, asm_format format)
+{
+    size_t capacity = 1 << 16;
+    size_t length   = 0;
+    unsigned char * image = malloc(capacity);
+    if(image == NULL)
+        return FALSE;
+
+    if(format == BINARY)
+    {
+        size_t read;
+        while((read = fread(image + length, 1, capacity - length, file)) > 0)
+        {
+            length += read;
+            if(length == capacity)
+            {
+                unsigned char * grown = realloc(image, capacity * 2);
+                if(grown == NULL)
+                    break;
+                image     = grown;
+                capacity *= 2;
+            }
+        }
+    }
+    else
+    {
+        unsigned int byte = 0;
+        unsigned int bits = 0;
+        int c;
+
+        while((c = fgetc(file)) != EOF)
+        {
+            if(c != '0' && c != '1')
+                continue;
+
+            byte = (byte << 1) | (c - '0');
+            bits ++;
+
+            if(bits == 8)
+            {
+                if(length == capacity)
+                {
+                    unsigned char * grown = realloc(image, capacity * 2);
+                    if(grown == NULL)
+                        break;
+                    image     = grown;
+                    capacity *= 2;
+                }
+                image[length ++] = byte;
+                byte = 0;
+                bits = 0;
+            }
+        }
+    }
+
+    BOOL tr = !ferror(file) && sim_machine_load(machine, image, length, 0);
+    free(image);
+    return tr;
+}
+
+/*!
+@brief Prints the register file and instruction count of a machine.
+@param machine - The machine to print.
+@param file - Where to print it.
+*/
+void sim_machine_print(sim_machine * machine, FILE * file)
+{
+    int reg;
+
+    fprintf(file, "halt         %s\n", sim_halt_reason_names[machine -> halt]);
+    fprintf(file, "instructions %llu\n", machine -> instructions);
+
+    for(reg = 0; reg < SIM_REGISTER_COUNT; reg ++)
+    {
+        fprintf(file, "%-4s 0x%08X%s", sim_register_names[reg], machine -> registers[reg],
+                reg % 4 == 3 ? "\n" : "   ");
+    }
+}
+
+//! }@
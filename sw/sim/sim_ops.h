@@ -0,0 +1,211 @@
+/*!
+@ingroup sw-sim
+@{
+@file sim_ops.h
+@brief The semantics of every instruction, shared by all of the simulator's execution engines.
+@details Where the ISA specification leaves behaviour open, the simulator does the following:
+- Memory words are big endian and may sit at any byte address.
+- PUSH decrements SP by four then stores, POP loads then increments SP by four.
+- CALL pushes the old LR, then puts the address of the next instruction in LR. RETURN jumps to
+  LR and pops the old LR back off the stack.
+- TEST shifts TR left by one and sets its LSB if its two registers are equal. The assembler does
+  not yet encode a choice of comparison.
+- ALU results update the zero and negative flags of SR. Integer add and subtract also update
+  carry and overflow. Division by zero gives zero and sets the overflow flag.
+- Immediates are zero extended. Floating point instructions treat registers as IEEE singles, and
+  their immediate operands as integers converted to floating point. FASR halves its operand once
+  per place shifted. Every NaN result is the quiet NaN 0x7FC00000, since which operand's payload
+  the host propagates depends on how the compiler orders them.
+- SLEEP does nothing, as the simulator has no notion of time.
+
+SIM_OPERATIONS lists the body of every instruction once. Each engine expands it with its own
+definition of OP to build a switch, a set of handler functions or a table of labels. A body may
+use `m`, the sim_machine, `r`, its register file, and `i`, the sim_instruction being executed,
+and runs only once the instruction's condition has passed and PC points past it.
+
+The floating point bodies need math.h, which must be included before sim.h, as common.h defines a
+macro called log.
+*/
+
+#ifndef SIM_OPS_H
+#define SIM_OPS_H
+
+//! Sets the zero and negative flags of SR from an ALU result.
+static inline unsigned int sim_flags(sim_machine * machine, unsigned int result)
+{
+    unsigned int sr = machine -> registers[SR] & ~(SIM_SR_ZERO | SIM_SR_NEGATIVE);
+    if(result == 0)         sr |= SIM_SR_ZERO;
+    if(result & 0x80000000) sr |= SIM_SR_NEGATIVE;
+    machine -> registers[SR] = sr;
+    return result;
+}
+
+//! Adds two words, setting every SR flag.
+static inline unsigned int sim_add(sim_machine * machine, unsigned int a, unsigned int b)
+{
+    unsigned int result = sim_flags(machine, a + b);
+    unsigned int sr     = machine -> registers[SR] & ~(SIM_SR_CARRY | SIM_SR_OVERFLOW);
+    if(result < a)                          sr |= SIM_SR_CARRY;
+    if(~(a ^ b) & (a ^ result) & 0x80000000) sr |= SIM_SR_OVERFLOW;
+    machine -> registers[SR] = sr;
+    return result;
+}
+
+//! Subtracts one word from another, setting every SR flag.
+static inline unsigned int sim_sub(sim_machine * machine, unsigned int a, unsigned int b)
+{
+    unsigned int result = sim_flags(machine, a - b);
+    unsigned int sr     = machine -> registers[SR] & ~(SIM_SR_CARRY | SIM_SR_OVERFLOW);
+    if(a < b)                              sr |= SIM_SR_CARRY;
+    if((a ^ b) & (a ^ result) & 0x80000000) sr |= SIM_SR_OVERFLOW;
+    machine -> registers[SR] = sr;
+    return result;
+}
+
+//! Divides one word by another, giving zero and setting the overflow flag on division by zero.
+static inline unsigned int sim_div(sim_machine * machine, unsigned int a, unsigned int b)
+{
+    if(b == 0)
+    {
+        machine -> registers[SR] |= SIM_SR_OVERFLOW;
+        return sim_flags(machine, 0);
+    }
+    return sim_flags(machine, a / b);
+}
+
+//! Shifts left, giving zero for shifts of 32 places or more.
+static inline unsigned int sim_lsl(unsigned int a, unsigned int b)
+{
+    return b < 32 ? a << b : 0;
+}
+
+//! Shifts right, giving zero for shifts of 32 places or more.
+static inline unsigned int sim_lsr(unsigned int a, unsigned int b)
+{
+    return b < 32 ? a >> b : 0;
+}
+
+//! Shifts right, copying the sign bit into the vacated places.
+static inline unsigned int sim_asr(unsigned int a, unsigned int b)
+{
+    unsigned int sign = (a & 0x80000000) ? 0xFFFFFFFFu : 0;
+    return b < 32 ? (a >> b) | (sign & ~(0xFFFFFFFFu >> b)) : sign;
+}
+
+//! Reinterprets a register as a float.
+static inline float sim_float(unsigned int word)
+{
+    float tr;
+    memcpy(&tr, &word, sizeof(float));
+    return tr;
+}
+
+//! Reinterprets a float as a register, setting the zero and negative flags.
+static inline unsigned int sim_word(sim_machine * machine, float value)
+{
+    unsigned int tr = 0x7FC00000;
+    if(value == value)
+        memcpy(&tr, &value, sizeof(float));
+    sim_flags(machine, value == 0.0f ? 0 : tr);
+    return tr;
+}
+
+//! Returns a 32 bit mask with every byte selected by a 4 bit byte mask set.
+static inline unsigned int sim_byte_mask(unsigned int byte_mask)
+{
+    return ((byte_mask & 0x8) ? 0xFF000000u : 0) | ((byte_mask & 0x4) ? 0x00FF0000u : 0) |
+           ((byte_mask & 0x2) ? 0x0000FF00u : 0) | ((byte_mask & 0x1) ? 0x000000FFu : 0);
+}
+
+//! Pushes a word onto the stack.
+static inline void sim_push(sim_machine * machine, unsigned int value)
+{
+    machine -> registers[SP] -= 4;
+    sim_write_word(machine, machine -> registers[SP], value);
+}
+
+//! Pops a word off the stack.
+static inline unsigned int sim_pop(sim_machine * machine)
+{
+    unsigned int tr = sim_read_word(machine, machine -> registers[SP]);
+    machine -> registers[SP] += 4;
+    return tr;
+}
+
+//! Shifts the result of comparing two registers into the test register.
+static inline unsigned int sim_test(unsigned int tr, unsigned int a, unsigned int b)
+{
+    return (tr << 1) | (a == b);
+}
+
+/*!
+@brief Expands OP(opcode, body) once for every executable tim_instruction_opcode.
+*/
+#define SIM_OPERATIONS(OP)                                                                        \
+    OP(LOADR, unsigned int mask = sim_byte_mask(i -> byte_mask);                                  \
+              unsigned int word = sim_read_word(m, r[i -> reg_2] + r[i -> reg_3]);                \
+              r[i -> reg_1] = (r[i -> reg_1] & ~mask) | (word & mask))                            \
+    OP(LOADI, r[i -> reg_1] = sim_read_word(m, r[i -> reg_2] + i -> immediate))                   \
+    OP(STORR, unsigned int address = r[i -> reg_2] + r[i -> reg_3];                               \
+              unsigned int mask    = sim_byte_mask(i -> byte_mask);                               \
+              unsigned int word    = sim_read_word(m, address);                                   \
+              sim_write_word(m, address, (word & ~mask) | (r[i -> reg_1] & mask)))                \
+    OP(STORI, sim_write_word(m, r[i -> reg_2] + i -> immediate, r[i -> reg_1]))                   \
+    OP(PUSH,  sim_push(m, r[i -> reg_1]))                                                         \
+    OP(POP,   r[i -> reg_1] = sim_pop(m))                                                         \
+    OP(MOVR,  r[i -> reg_1] = r[i -> reg_2])                                                      \
+    OP(MOVI,  r[i -> reg_1] = i -> immediate)                                                     \
+    OP(JUMPR, r[PC] = r[i -> reg_1])                                                              \
+    OP(JUMPI, r[PC] = i -> immediate)                                                             \
+    OP(CALLR, unsigned int target = r[i -> reg_1];                                                \
+              sim_push(m, r[LR]); r[LR] = r[PC]; r[PC] = target)                                  \
+    OP(CALLI, sim_push(m, r[LR]); r[LR] = r[PC]; r[PC] = i -> immediate)                          \
+    OP(RETURN, r[PC] = r[LR]; r[LR] = sim_pop(m))                                                 \
+    OP(TEST,  r[TR] = sim_test(r[TR], r[i -> reg_1], r[i -> reg_2]))                              \
+    OP(HALT,  m -> halt = SIM_HALTED)                                                             \
+                                                                                                  \
+    OP(ANDR,  r[i -> reg_1] = sim_flags(m,   r[i -> reg_2] & r[i -> reg_3]))                      \
+    OP(NANDR, r[i -> reg_1] = sim_flags(m, ~(r[i -> reg_2] & r[i -> reg_3])))                     \
+    OP(ORR,   r[i -> reg_1] = sim_flags(m,   r[i -> reg_2] | r[i -> reg_3]))                      \
+    OP(NORR,  r[i -> reg_1] = sim_flags(m, ~(r[i -> reg_2] | r[i -> reg_3])))                     \
+    OP(XORR,  r[i -> reg_1] = sim_flags(m,   r[i -> reg_2] ^ r[i -> reg_3]))                      \
+    OP(LSLR,  r[i -> reg_1] = sim_flags(m, sim_lsl(r[i -> reg_2], r[i -> reg_3])))                \
+    OP(LSRR,  r[i -> reg_1] = sim_flags(m, sim_lsr(r[i -> reg_2], r[i -> reg_3])))                \
+    OP(NOTR,  r[i -> reg_1] = sim_flags(m, ~r[i -> reg_2]))                                       \
+                                                                                                  \
+    OP(ANDI,  r[i -> reg_1] = sim_flags(m,   r[i -> reg_2] & i -> immediate))                     \
+    OP(NANDI, r[i -> reg_1] = sim_flags(m, ~(r[i -> reg_2] & i -> immediate)))                    \
+    OP(ORI,   r[i -> reg_1] = sim_flags(m,   r[i -> reg_2] | i -> immediate))                     \
+    OP(NORI,  r[i -> reg_1] = sim_flags(m, ~(r[i -> reg_2] | i -> immediate)))                    \
+    OP(XORI,  r[i -> reg_1] = sim_flags(m,   r[i -> reg_2] ^ i -> immediate))                     \
+    OP(LSLI,  r[i -> reg_1] = sim_flags(m, sim_lsl(r[i -> reg_2], i -> immediate)))               \
+    OP(LSRI,  r[i -> reg_1] = sim_flags(m, sim_lsr(r[i -> reg_2], i -> immediate)))               \
+                                                                                                  \
+    OP(IADDI, r[i -> reg_1] = sim_add(m, r[i -> reg_2], i -> immediate))                          \
+    OP(ISUBI, r[i -> reg_1] = sim_sub(m, r[i -> reg_2], i -> immediate))                          \
+    OP(IMULI, r[i -> reg_1] = sim_flags(m, r[i -> reg_2] * i -> immediate))                       \
+    OP(IDIVI, r[i -> reg_1] = sim_div(m, r[i -> reg_2], i -> immediate))                          \
+    OP(IASRI, r[i -> reg_1] = sim_flags(m, sim_asr(r[i -> reg_2], i -> immediate)))               \
+    OP(IADDR, r[i -> reg_1] = sim_add(m, r[i -> reg_2], r[i -> reg_3]))                           \
+    OP(ISUBR, r[i -> reg_1] = sim_sub(m, r[i -> reg_2], r[i -> reg_3]))                           \
+    OP(IMULR, r[i -> reg_1] = sim_flags(m, r[i -> reg_2] * r[i -> reg_3]))                        \
+    OP(IDIVR, r[i -> reg_1] = sim_div(m, r[i -> reg_2], r[i -> reg_3]))                           \
+    OP(IASRR, r[i -> reg_1] = sim_flags(m, sim_asr(r[i -> reg_2], r[i -> reg_3])))                \
+                                                                                                  \
+    OP(FADDI, r[i -> reg_1] = sim_word(m, sim_float(r[i -> reg_2]) + (float)i -> immediate))      \
+    OP(FSUBI, r[i -> reg_1] = sim_word(m, sim_float(r[i -> reg_2]) - (float)i -> immediate))      \
+    OP(FMULI, r[i -> reg_1] = sim_word(m, sim_float(r[i -> reg_2]) * (float)i -> immediate))      \
+    OP(FDIVI, r[i -> reg_1] = sim_word(m, sim_float(r[i -> reg_2]) / (float)i -> immediate))      \
+    OP(FASRI, r[i -> reg_1] = sim_word(m, ldexpf(sim_float(r[i -> reg_2]), -(int)i -> immediate)))\
+    OP(FADDR, r[i -> reg_1] = sim_word(m, sim_float(r[i -> reg_2]) + sim_float(r[i -> reg_3])))   \
+    OP(FSUBR, r[i -> reg_1] = sim_word(m, sim_float(r[i -> reg_2]) - sim_float(r[i -> reg_3])))   \
+    OP(FMULR, r[i -> reg_1] = sim_word(m, sim_float(r[i -> reg_2]) * sim_float(r[i -> reg_3])))   \
+    OP(FDIVR, r[i -> reg_1] = sim_word(m, sim_float(r[i -> reg_2]) / sim_float(r[i -> reg_3])))   \
+    OP(FASRR, r[i -> reg_1] = sim_word(m, ldexpf(sim_float(r[i -> reg_2]),                       \
+                                                 -(int)(r[i -> reg_3] & 0xFF))))                  \
+                                                                                                  \
+    OP(SLEEP, (void)0)
+
+#endif
+
+//! }@
@@ -0,0 +1,199 @@
+/*!
+@ingroup sw-sim
+@{
+@file sim_predecode.c
+@brief An execution engine which decodes the whole program once, when it is loaded, into an
+address indexed array of instruction records.
+@details Running an instruction then costs a single indexed load of its record and an indirect
+call, rather than a read of memory, a lookup in asm_encodings and four shift and mask steps. The
+record also holds the address of the next instruction, so the fetch of one instruction no longer
+waits on the decode of the last.
+
+Stores which overlap the program invalidate the records of every instruction they may have
+changed, by pointing them at a handler which decodes the instruction again the next time it runs.
+Programs which never write to their own code pay only for the range check in sim_write_word.
+*/
+
+#include <math.h>
+#include <stddef.h>
+
+#include "sim.h"
+#include "sim_ops.h"
+
+// One handler per opcode, each running the same body as the reference switch in sim_execute.c.
+#define SIM_HANDLER(opcode, ...)                                            \
+    static void sim_handle_##opcode(sim_machine * m, sim_instruction * i)  \
+    {                                                                       \
+        unsigned int * r = m -> registers;                                  \
+        __VA_ARGS__;                                                        \
+        (void)r; (void)i;                                                   \
+    }
+SIM_OPERATIONS(SIM_HANDLER)
+#undef SIM_HANDLER
+
+/*!
+@brief Handles a fetched instruction with an unassigned opcode.
+@details The reference engine stops before counting such an instruction or moving PC past it, so
+PC is put back, and sim_run_predecoded takes the instruction back off the count.
+*/
+static void sim_handle_illegal(sim_machine * m, sim_instruction * i)
+{
+    m -> registers[PC] -= i -> size;
+    m -> halt = SIM_ILLEGAL;
+}
+
+//! The handler for every opcode, or NULL if the opcode is not assigned.
+static const sim_handler sim_handlers[NOT_EMITTED] = {
+    #define SIM_HANDLER_ENTRY(opcode, ...) [opcode] = sim_handle_##opcode,
+    SIM_OPERATIONS(SIM_HANDLER_ENTRY)
+    #undef SIM_HANDLER_ENTRY
+};
+
+/*!
+@brief Decodes the instruction at an address into its decode cache record.
+@param machine - The machine whose memory to decode from.
+@param address - The address of the instruction.
+@param tr - The record to fill in.
+*/
+void sim_predecode_record(sim_machine * machine, unsigned int address, sim_decoded * tr)
+{
+    if(sim_decode(machine, address, &tr -> instruction) && sim_handlers[tr -> instruction.opcode])
+        tr -> handler = sim_handlers[tr -> instruction.opcode];
+    else
+    {
+        // Run unconditionally, as the reference engine stops whatever the condition.
+        tr -> handler = sim_handle_illegal;
+        tr -> instruction.condition = ALWAYS;
+    }
+
+    tr -> dispatch = NULL;
+    tr -> next_pc  = address + tr -> instruction.size;
+}
+
+/*!
+@brief Handles an instruction whose record was invalidated by a store.
+@details The record is decoded again, and then the real instruction run in its place. Stale
+records always have the ALWAYS condition, so the condition of the real instruction is checked
+here, and PC corrected to the real instruction's length.
+*/
+void sim_handle_stale(sim_machine * m, sim_instruction * i)
+{
+    sim_decoded * d = (sim_decoded *)((char *)i - offsetof(sim_decoded, instruction));
+    unsigned int address = m -> program_start + (unsigned int)(d - m -> decoded);
+
+    sim_predecode_record(m, address, d);
+    m -> registers[PC] = d -> next_pc;
+
+    if(sim_condition_passes(m, d -> instruction.condition))
+        d -> handler(m, &d -> instruction);
+}
+
+/*!
+@brief Marks every pre-decoded instruction which a store to a word may have changed, so that it is
+decoded again before it next runs.
+@details A word store changes the four bytes from address, and the longest instruction is four
+bytes, so instructions starting up to three bytes either side of the address are invalidated.
+Translated blocks made from any of the four bytes are discarded too.
+@param machine - The machine which was stored to.
+@param address - The wrapped address of the word stored to.
+*/
+void sim_predecode_invalidate(sim_machine * machine, unsigned int address)
+{
+    unsigned int size  = machine -> program_end - machine -> program_start;
+    unsigned int first = address - machine -> watch_start;
+    unsigned int index;
+
+    // first is the offset into the program of the lowest instruction affected, plus three.
+    for(index = first < 6 ? 0 : first - 6; index <= first && index < size; index ++)
+    {
+        sim_decoded * d = &machine -> decoded[index];
+        d -> handler  = sim_handle_stale;
+        d -> dispatch = NULL;
+        d -> instruction.condition = ALWAYS;
+    }
+
+    if(machine -> jit != NULL)
+        sim_jit_invalidate(machine, address);
+}
+
+/*!
+@brief Pre-decodes every byte address of the loaded program into the machine's decode cache.
+@param machine - The machine whose program to pre-decode. A program must already be loaded.
+@returns TRUE if the cache could be allocated, otherwise FALSE.
+*/
+BOOL sim_predecode_new(sim_machine * machine)
+{
+    unsigned int size = machine -> program_end - machine -> program_start;
+    unsigned int index;
+
+    sim_predecode_free(machine);
+
+    machine -> decoded = malloc(((size_t)size + 1) * sizeof(sim_decoded));
+    if(machine -> decoded == NULL)
+        return FALSE;
+
+    for(index = 0; index < size; index ++)
+        sim_predecode_record(machine, machine -> program_start + index, &machine -> decoded[index]);
+
+    machine -> watch_start = machine -> program_start - (SIM_INSTRUCTION_MAX_SIZE - 1);
+    machine -> watch_size  = size + (SIM_INSTRUCTION_MAX_SIZE - 1);
+    return TRUE;
+}
+
+/*!
+@brief Releases the decode cache of a machine. Stores stop being watched.
+@param machine - The machine whose cache to free.
+*/
+void sim_predecode_free(sim_machine * machine)
+{
+    free(machine -> decoded);
+    machine -> decoded     = NULL;
+    machine -> watch_start = 0;
+    machine -> watch_size  = 0;
+}
+
+/*!
+@brief Runs a machine from its decode cache until it halts or has executed a number of
+instructions.
+@param machine - The machine to run.
+@param max_instructions - Stop once the machine has executed this many instructions in total.
+@returns Why the machine stopped.
+*/
+sim_halt_reason sim_run_predecoded(sim_machine * machine, unsigned long long max_instructions)
+{
+    sim_decoded * decoded = machine -> decoded;
+    unsigned int  start   = machine -> program_start;
+    unsigned int  size    = machine -> program_end - start;
+    unsigned long long count = machine -> instructions;
+
+    while(machine -> halt == SIM_RUNNING)
+    {
+        unsigned int offset = machine -> registers[PC] - start;
+
+        if(count >= max_instructions)
+        {
+            machine -> halt = SIM_STEP_LIMIT;
+            break;
+        }
+        if(offset >= size)
+        {
+            machine -> halt = SIM_END;
+            break;
+        }
+
+        sim_decoded * d = &decoded[offset];
+        machine -> registers[PC] = d -> next_pc;
+        count ++;
+
+        if(sim_condition_passes(machine, d -> instruction.condition))
+            d -> handler(machine, &d -> instruction);
+    }
+
+    if(machine -> halt == SIM_ILLEGAL)
+        count --;
+
+    machine -> instructions = count;
+    return machine -> halt;
+}
+
+//! }@
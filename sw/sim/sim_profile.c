@@ -0,0 +1,449 @@
+/*!
+@ingroup sw-sim
+@{
+@file sim_profile.c
+@brief A profiling executor, which counts how often each instruction and basic block of a program
+runs, and reports where the time went against the program's source.
+@details sim_run_profiled runs from the decode cache exactly as sim_run_predecoded does, and adds
+one to the count of the address of every instruction fetched, whether its condition passed or
+not. Basic blocks are found as the program runs: an instruction starts one if it is the first
+run, if control reached it other than by falling through from the one before, or if the one
+before was a jump, call, return or halt, taken or not. A block runs on until the next of these,
+so its entry count is the count of its first instruction.
+
+The report has two parts. The flat profile lists every basic block which ran, hottest first, by
+the number of instructions executed in it. The listing then gives the count of every line of the
+source, from the line table written by `tim-asm --lines`, or of every instruction executed if
+there is no line table or its source cannot be read.
+*/
+
+#include <math.h>
+
+#include "sim.h"
+
+//! The longest piece of a source line read at once when printing the listing.
+#define SIM_PROFILE_LINE_LENGTH 1024
+
+/*!
+@brief One basic block of the flat profile.
+*/
+typedef struct sim_profile_block_t{
+    //! The address of the first instruction.
+    unsigned int       start;
+    //! The address following the last instruction.
+    unsigned int       end;
+    //! The number of times control entered the block.
+    unsigned long long entries;
+    //! The number of instructions executed in the block.
+    unsigned long long instructions;
+} sim_profile_block;
+
+/*!
+@brief Returns TRUE if an instruction always ends its basic block, whether or not it runs.
+*/
+static inline BOOL sim_profile_ends_block(unsigned int opcode)
+{
+    switch(opcode)
+    {
+        case JUMPR: case JUMPI:
+        case CALLR: case CALLI: case RETURN:
+        case HALT:
+            return TRUE;
+        default:
+            return FALSE;
+    }
+}
+
+/*!
+@brief Initialises a profile of a machine's loaded program, with every count zero and no line
+table.
+@param machine - The machine to profile. A program must already be loaded.
+@param tr - The new profile. Free it with sim_profile_free.
+@returns TRUE if the counts could be allocated, otherwise FALSE.
+*/
+BOOL sim_profile_new(sim_machine * machine, sim_profile * tr)
+{
+    memset(tr, 0, sizeof(sim_profile));
+    tr -> program_start = machine -> program_start;
+    tr -> program_size  = machine -> program_end - machine -> program_start;
+    tr -> block_ended   = TRUE;
+
+    // One spare entry, so an empty program still allocates.
+    tr -> counts  = calloc(tr -> program_size + 1, sizeof(unsigned long long));
+    tr -> skipped = calloc(tr -> program_size + 1, sizeof(unsigned long long));
+    tr -> leaders = calloc(tr -> program_size + 1, sizeof(unsigned char));
+    if(tr -> counts == NULL || tr -> skipped == NULL || tr -> leaders == NULL)
+    {
+        sim_profile_free(tr);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/*!
+@brief Reads a line table written by `tim-asm --lines` into a profile.
+@param profile - The profile to read the table into.
+@param file - The line table file.
+@returns TRUE if the table was read, FALSE if it is malformed or could not be allocated.
+*/
+BOOL sim_profile_load_lines(sim_profile * profile, FILE * file)
+{
+    char         text[SIM_PROFILE_LINE_LENGTH];
+    unsigned int capacity = 0;
+
+    while(fgets(text, sizeof(text), file) != NULL)
+    {
+        sim_profile_line line;
+        size_t           length = strlen(text);
+
+        if(length > 0 && text[length - 1] == '\n')
+            text[-- length] = '\0';
+
+        if(text[0] == '#' || length == 0)
+            continue;
+        if(strncmp(text, "source ", 7) == 0)
+        {
+            free(profile -> source);
+            profile -> source = malloc(length - 7 + 1);
+            if(profile -> source == NULL)
+                return FALSE;
+            strcpy(profile -> source, text + 7);
+            continue;
+        }
+        if(sscanf(text, "%x %u %u", &line.address, &line.size, &line.line) != 3)
+            return FALSE;
+
+        if(profile -> line_count == capacity)
+        {
+            capacity = capacity == 0 ? 256 : capacity * 2;
+            sim_profile_line * lines = realloc(profile -> lines, capacity * sizeof(sim_profile_line));
+            if(lines == NULL)
+                return FALSE;
+            profile -> lines = lines;
+        }
+        profile -> lines[profile -> line_count ++] = line;
+    }
+
+    return !ferror(file);
+}
+
+/*!
+@brief Releases the counts and line table of a profile.
+@param profile - The profile to free.
+*/
+void sim_profile_free(sim_profile * profile)
+{
+    free(profile -> counts);
+    free(profile -> skipped);
+    free(profile -> leaders);
+    free(profile -> lines);
+    free(profile -> source);
+    memset(profile, 0, sizeof(sim_profile));
+}
+
+/*!
+@brief Runs a pre-decoded machine until it halts or has executed a number of instructions,
+counting every instruction fetched and marking where basic blocks start.
+@param machine - The machine to run. Its program must have been pre-decoded with
+sim_predecode_new.
+@param profile - The profile to count into, which carries where the last block ended between
+calls.
+@param max_instructions - Stop once the machine has executed this many instructions in total.
+@returns Why the machine stopped.
+*/
+sim_halt_reason sim_run_profiled(sim_machine * machine, sim_profile * profile,
+                                 unsigned long long max_instructions)
+{
+    sim_decoded  * decoded = machine -> decoded;
+    unsigned int * r       = machine -> registers;
+    unsigned int   start   = machine -> program_start;
+    unsigned int   size    = machine -> program_end - start;
+    unsigned int   offset  = 0;
+    unsigned long long count = machine -> instructions;
+
+    while(machine -> halt == SIM_RUNNING)
+    {
+        offset = r[PC] - start;
+
+        if(count >= max_instructions)
+        {
+            machine -> halt = SIM_STEP_LIMIT;
+            break;
+        }
+        if(offset >= size)
+        {
+            machine -> halt = SIM_END;
+            break;
+        }
+
+        sim_decoded     * d = &decoded[offset];
+        sim_instruction * i = &d -> instruction;
+        if(sim_predecode_stale(d))
+            sim_predecode_record(machine, start + offset, d);
+
+        if(profile -> block_ended || r[PC] != profile -> next_pc)
+            profile -> leaders[offset] = TRUE;
+        profile -> counts[offset] ++;
+
+        r[PC] = d -> next_pc;
+        count ++;
+
+        if(sim_condition_passes(machine, i -> condition))
+            d -> handler(machine, i);
+        else
+            profile -> skipped[offset] ++;
+
+        profile -> next_pc     = d -> next_pc;
+        profile -> block_ended = sim_profile_ends_block(i -> opcode);
+    }
+
+    // Illegal instructions are not counted.
+    if(machine -> halt == SIM_ILLEGAL)
+    {
+        count --;
+        profile -> counts[offset] --;
+    }
+
+    machine -> instructions = count;
+    return machine -> halt;
+}
+
+/*!
+@brief Returns the source line of the instruction at an address, or zero if the line table does
+not cover it.
+*/
+static unsigned int sim_profile_line_of(sim_profile * profile, unsigned int address)
+{
+    unsigned int low  = 0;
+    unsigned int high = profile -> line_count;
+
+    // The table is in program order, so in order of address.
+    while(low < high)
+    {
+        unsigned int middle = low + (high - low) / 2;
+        sim_profile_line * line = &profile -> lines[middle];
+
+        if(address < line -> address)
+            high = middle;
+        else if(address >= line -> address + line -> size)
+            low = middle + 1;
+        else
+            return line -> line;
+    }
+    return 0;
+}
+
+//! Orders basic blocks by the number of instructions executed in them, most first.
+static int sim_profile_compare_blocks(const void * a, const void * b)
+{
+    const sim_profile_block * x = a;
+    const sim_profile_block * y = b;
+
+    if(x -> instructions != y -> instructions)
+        return x -> instructions < y -> instructions ? 1 : -1;
+    return x -> start < y -> start ? -1 : x -> start > y -> start;
+}
+
+/*!
+@brief Finds the basic blocks which ran from the counts of a profile.
+@returns The number of blocks found, or zero if they could not be allocated.
+*/
+static unsigned int sim_profile_blocks(sim_profile * profile, sim_machine * machine,
+                                       sim_profile_block ** tr)
+{
+    unsigned int        size   = profile -> program_size;
+    unsigned int        count  = 0;
+    unsigned int        offset;
+    sim_profile_block * blocks;
+
+    for(offset = 0; offset < size; offset ++)
+        if(profile -> leaders[offset] && profile -> counts[offset] > 0)
+            count ++;
+
+    blocks = calloc(count + 1, sizeof(sim_profile_block));
+    if(blocks == NULL)
+        return 0;
+
+    count = 0;
+    for(offset = 0; offset < size; offset ++)
+    {
+        if(!profile -> leaders[offset] || profile -> counts[offset] == 0)
+            continue;
+
+        sim_profile_block * block = &blocks[count ++];
+        unsigned int        o     = offset;
+
+        block -> start   = profile -> program_start + offset;
+        block -> entries = profile -> counts[offset];
+
+        while(TRUE)
+        {
+            sim_instruction instruction;
+            BOOL            legal = sim_decode(machine, profile -> program_start + o, &instruction);
+            unsigned int    next  = o + (legal ? instruction.size : 1);
+
+            block -> instructions += profile -> counts[o];
+            if(!legal || sim_profile_ends_block(instruction.opcode) || next >= size ||
+               profile -> leaders[next] || profile -> counts[next] == 0)
+            {
+                block -> end = profile -> program_start + next;
+                break;
+            }
+            o = next;
+        }
+    }
+
+    *tr = blocks;
+    return count;
+}
+
+/*!
+@brief Prints the source listing of a profile, each line with the instructions executed on it.
+@returns TRUE if the source could be read, otherwise FALSE.
+*/
+static BOOL sim_profile_print_source(sim_profile * profile, unsigned long long total, FILE * file)
+{
+    FILE               * source;
+    unsigned long long * counts;
+    unsigned int         lines = 0;
+    unsigned int         line  = 1;
+    unsigned int         i;
+    char                 text[SIM_PROFILE_LINE_LENGTH];
+    BOOL                 line_start = TRUE;
+
+    if(profile -> source == NULL || (source = fopen(profile -> source, "r")) == NULL)
+        return FALSE;
+
+    for(i = 0; i < profile -> line_count; i ++)
+        if(profile -> lines[i].line >= lines)
+            lines = profile -> lines[i].line + 1;
+
+    counts = calloc(lines + 1, sizeof(unsigned long long));
+    if(counts == NULL)
+    {
+        fclose(source);
+        return FALSE;
+    }
+
+    // A row may cover several instructions, such as the NOPS of alignment padding.
+    for(i = 0; i < profile -> line_count; i ++)
+    {
+        unsigned int offset = profile -> lines[i].address - profile -> program_start;
+        unsigned int end    = offset + profile -> lines[i].size;
+        for(; offset < end && offset < profile -> program_size; offset ++)
+            counts[profile -> lines[i].line] += profile -> counts[offset];
+    }
+
+    fprintf(file, "\nListing of %s:\n\n", profile -> source);
+    while(fgets(text, sizeof(text), source) != NULL)
+    {
+        if(line_start)
+        {
+            if(line < lines && counts[line] > 0)
+                fprintf(file, "%14llu %6.2f%%  %5u  ", counts[line], 100.0 * counts[line] / total,
+                        line);
+            else
+                fprintf(file, "%14s %7s  %5u  ", "", "", line);
+        }
+
+        fputs(text, file);
+        line_start = text[strlen(text) - 1] == '\n';
+        if(line_start)
+            line ++;
+    }
+    if(!line_start)
+        fprintf(file, "\n");
+
+    free(counts);
+    fclose(source);
+    return TRUE;
+}
+
+/*!
+@brief Prints every instruction of a profile which ran, with the number of times it did.
+*/
+static void sim_profile_print_instructions(sim_profile * profile, sim_machine * machine,
+                                           unsigned long long total, FILE * file)
+{
+    unsigned int offset;
+
+    // Every listed block starts with a blank line, the first included.
+    fprintf(file, "\nListing of executed instructions:\n");
+    for(offset = 0; offset < profile -> program_size; offset ++)
+    {
+        sim_instruction instruction;
+        unsigned int    address = profile -> program_start + offset;
+
+        if(profile -> counts[offset] == 0)
+            continue;
+
+        if(profile -> leaders[offset])
+            fprintf(file, "\n");
+        fprintf(file, "%14llu %6.2f%%  0x%08X  ", profile -> counts[offset],
+                100.0 * profile -> counts[offset] / total, address);
+        const char * name = sim_decode(machine, address, &instruction) ?
+                            asm_encodings[instruction.opcode].name : "?";
+        if(profile -> skipped[offset] > 0)
+            fprintf(file, "%-6s  %llu skipped\n", name, profile -> skipped[offset]);
+        else
+            fprintf(file, "%s\n", name);
+    }
+}
+
+/*!
+@brief Prints the flat profile of the basic blocks a profile counted, hottest first, then the
+source listing with the instructions executed on each line.
+@param profile - The profile to print.
+@param machine - The machine it was counted on, whose memory holds the program.
+@param file - Where to print it.
+*/
+void sim_profile_print(sim_profile * profile, sim_machine * machine, FILE * file)
+{
+    sim_profile_block * blocks = NULL;
+    unsigned long long  total  = 0;
+    unsigned long long  sum    = 0;
+    unsigned int        count;
+    unsigned int        i;
+
+    for(i = 0; i < profile -> program_size; i ++)
+        total += profile -> counts[i];
+
+    count = sim_profile_blocks(profile, machine, &blocks);
+    fprintf(file, "instructions      %llu\n", total);
+    fprintf(file, "basic blocks      %u executed\n", count);
+    fprintf(file, "line table        %s\n", profile -> line_count > 0 ? profile -> source : "none");
+    if(total == 0 || blocks == NULL)
+    {
+        free(blocks);
+        return;
+    }
+
+    qsort(blocks, count, sizeof(sim_profile_block), sim_profile_compare_blocks);
+
+    fprintf(file, "\nFlat profile of basic blocks:\n\n");
+    fprintf(file, "%7s %7s %14s %12s %10s %10s %6s  %s\n", "%", "cum %", "instructions",
+            "entries", "start", "end", "bytes", "lines");
+    for(i = 0; i < count; i ++)
+    {
+        sim_profile_block * b = &blocks[i];
+        unsigned int first = sim_profile_line_of(profile, b -> start);
+        unsigned int last  = sim_profile_line_of(profile, b -> end - 1);
+
+        sum += b -> instructions;
+        fprintf(file, "%6.2f%% %6.2f%% %14llu %12llu 0x%08X 0x%08X %6u  ",
+                100.0 * b -> instructions / total, 100.0 * sum / total, b -> instructions,
+                b -> entries, b -> start, b -> end, b -> end - b -> start);
+        if(first == 0)
+            fprintf(file, "-\n");
+        else if(last == first || last == 0)
+            fprintf(file, "%u\n", first);
+        else
+            fprintf(file, "%u-%u\n", first, last);
+    }
+    free(blocks);
+
+    if(profile -> line_count == 0 || !sim_profile_print_source(profile, total, file))
+        sim_profile_print_instructions(profile, machine, total, file);
+}
+
+//! }@
@@ -0,0 +1,253 @@
+/*!
+@ingroup sw-sim
+@{
+@file sim_threaded.c
+@brief A direct threaded execution engine, which runs the decode cache with one computed goto per
+instruction and fuses common instruction pairs into superinstructions.
+@details Each decode cache record holds the address of the code which runs it. Every operation
+ends with its own copy of the dispatch sequence, so the host's branch predictor learns which
+instruction tends to follow each operation, rather than sharing one indirect branch between all
+of them as a switch in a loop does.
+
+Three superinstructions cover the sequences firmware control code spends most of its time in:
+- A TEST followed by a ?T or ?F JUMP runs both, and resolves the jump without dispatching it.
+- A PUSH followed by another PUSH, and a POP not into PC followed by another POP, run the next
+  one directly, so a run of register saves or restores costs one dispatch.
+
+Fusion is decided when a record is first run, and checked again when the fused instruction is
+reached, so a store which changes either half of a pair simply stops it being fused. Fused pairs
+still count as two instructions, and stop between the two if the instruction limit is reached.
+
+PC is kept in a local variable, and written to the register file before every instruction but
+only read back after instructions which can change it. Conditional instructions are sent to a
+shared trampoline which checks the condition, so unconditional ones never evaluate it.
+
+Building with SIM_SWITCH_DISPATCH, or with a compiler which lacks computed goto, replaces the goto
+with a single switch over the operation, for comparison and for portability.
+*/
+
+#include <math.h>
+#include <stdint.h>
+
+#include "sim.h"
+#include "sim_ops.h"
+
+#if !defined(__GNUC__) && !defined(SIM_SWITCH_DISPATCH)
+    #define SIM_SWITCH_DISPATCH
+#endif
+
+/*!
+@brief Operations of the threaded engine beyond the single instructions, numbered on from the
+last tim_instruction_opcode.
+*/
+typedef enum sim_threaded_operation_e{
+    SIM_TEST_JUMP = NOT_EMITTED, //!< TEST, then a ?T or ?F JUMPI or JUMPR.
+    SIM_PUSH_RUN,                //!< PUSH, then another PUSH.
+    SIM_POP_RUN,                 //!< POP into any register but PC, then another POP.
+    SIM_CONDITIONAL,             //!< Any instruction with a condition other than ALWAYS.
+    SIM_THREADED_OPERATIONS      //!< The number of operations.
+} sim_threaded_operation;
+
+#ifdef SIM_SWITCH_DISPATCH
+const char * sim_threaded_dispatch = "switch";
+
+// Records hold one more than their operation, so that NULL still marks an unprepared record.
+#define SIM_TARGET(operation) ((const void *)(uintptr_t)((operation) + 1))
+#define SIM_GOTO(target)      do{ operation = (uintptr_t)(target) - 1; goto sim_switch; } while(0)
+#define SIM_THREADED_FUNCTION
+#else
+const char * sim_threaded_dispatch = "computed goto";
+
+#define SIM_TARGET(operation) (sim_labels[operation])
+#define SIM_GOTO(target)      goto *(target)
+// Records keep label addresses between calls, so there must only ever be one copy of the code.
+#define SIM_THREADED_FUNCTION __attribute__((noinline, noclone))
+#endif
+
+//! TRUE for the opcodes which always write PC. Any other instruction only does if reg_1 is PC.
+#define SIM_WRITES_PC(opcode) ((opcode) == JUMPR || (opcode) == JUMPI || (opcode) == CALLR || \
+                               (opcode) == CALLI || (opcode) == RETURN)
+
+/*!
+@brief Fetches the next instruction and jumps to the code which runs it.
+@details Stops if PC has left the program or the instruction limit is reached, and prepares
+records the threaded engine has not yet run.
+*/
+#define SIM_DISPATCH()                                                          \
+    do{                                                                         \
+        offset = pc - start;                                                    \
+        if(offset >= size || count >= max_instructions)                         \
+            goto sim_stop;                                                      \
+        d = decoded + offset;                                                   \
+        if(d -> dispatch == NULL)                                               \
+            goto sim_prepare;                                                   \
+        i = &d -> instruction;                                                  \
+        pc = d -> next_pc;                                                      \
+        r[PC] = pc;                                                             \
+        count ++;                                                               \
+        SIM_GOTO(d -> dispatch);                                                \
+    } while(0)
+
+/*!
+@brief Runs a machine from its decode cache with threaded dispatch until it halts or has executed
+a number of instructions.
+@param machine - The machine to run.
+@param max_instructions - Stop once the machine has executed this many instructions in total.
+@returns Why the machine stopped.
+*/
+SIM_THREADED_FUNCTION
+sim_halt_reason sim_run_threaded(sim_machine * machine, unsigned long long max_instructions)
+{
+    sim_machine      * m       = machine;
+    unsigned int     * r       = machine -> registers;
+    sim_decoded      * decoded = machine -> decoded;
+    unsigned int       start   = machine -> program_start;
+    unsigned int       size    = machine -> program_end - start;
+    unsigned long long count   = machine -> instructions;
+    unsigned int       pc      = machine -> registers[PC];
+    unsigned int       offset;
+    unsigned int       operation;
+    sim_decoded      * d;
+    sim_decoded      * n;
+    sim_instruction  * i;
+
+#ifndef SIM_SWITCH_DISPATCH
+    static const void * const sim_labels[SIM_THREADED_OPERATIONS] = {
+        #define SIM_LABEL(opcode, ...) [opcode] = &&sim_op_##opcode,
+        SIM_OPERATIONS(SIM_LABEL)
+        #undef SIM_LABEL
+        [SIM_TEST_JUMP]   = &&sim_test_jump,
+        [SIM_PUSH_RUN]    = &&sim_push_run,
+        [SIM_POP_RUN]     = &&sim_pop_run,
+        [SIM_CONDITIONAL] = &&sim_conditional
+    };
+#endif
+
+    if(m -> halt != SIM_RUNNING)
+        return m -> halt;
+
+    SIM_DISPATCH();
+
+    // Every instruction, each followed by its own dispatch.
+    #define SIM_BODY(opcode, ...)                           \
+        sim_op_##opcode:                                    \
+        {                                                   \
+            __VA_ARGS__;                                    \
+        }                                                   \
+        if(opcode == HALT)                                  \
+            goto sim_stop;                                  \
+        if(SIM_WRITES_PC(opcode) || i -> reg_1 == PC)       \
+            pc = r[PC];                                     \
+        SIM_DISPATCH();
+    SIM_OPERATIONS(SIM_BODY)
+    #undef SIM_BODY
+
+sim_conditional:
+    if(!sim_condition_passes(m, i -> condition))
+        SIM_DISPATCH();
+    SIM_GOTO(SIM_TARGET(i -> opcode));
+
+    // A fused instruction is only run if its record is prepared, and so up to date.
+sim_test_jump:
+    r[TR] = sim_test(r[TR], r[i -> reg_1], r[i -> reg_2]);
+    n = d + i -> size;
+    if(count < max_instructions && n -> dispatch != NULL &&
+       (n -> instruction.opcode == JUMPI || n -> instruction.opcode == JUMPR))
+    {
+        pc = n -> next_pc;
+        r[PC] = pc;
+        count ++;
+        if(sim_condition_passes(m, n -> instruction.condition))
+            pc = n -> instruction.opcode == JUMPI ? n -> instruction.immediate
+                                                  : r[n -> instruction.reg_1];
+    }
+    SIM_DISPATCH();
+
+sim_push_run:
+    sim_push(m, r[i -> reg_1]);
+    n = d + i -> size;
+    if(count < max_instructions && n -> dispatch != NULL && n -> instruction.opcode == PUSH &&
+       n -> instruction.condition == ALWAYS)
+    {
+        d = n;
+        i = &d -> instruction;
+        pc = d -> next_pc;
+        r[PC] = pc;
+        count ++;
+        SIM_GOTO(d -> dispatch);
+    }
+    SIM_DISPATCH();
+
+sim_pop_run:
+    r[i -> reg_1] = sim_pop(m);
+    n = d + i -> size;
+    if(count < max_instructions && n -> dispatch != NULL && n -> instruction.opcode == POP &&
+       n -> instruction.condition == ALWAYS)
+    {
+        d = n;
+        i = &d -> instruction;
+        pc = d -> next_pc;
+        r[PC] = pc;
+        count ++;
+        SIM_GOTO(d -> dispatch);
+    }
+    SIM_DISPATCH();
+
+sim_prepare:
+    // Decode the record again, in case a store invalidated it, then choose its operation. The
+    // following record is only a hint here, as it is checked again whenever the pair is run.
+    sim_predecode_record(m, pc, d);
+    i = &d -> instruction;
+
+    if(i -> opcode >= NOT_EMITTED)
+    {
+        m -> halt = SIM_ILLEGAL;
+        goto sim_stop;
+    }
+
+    operation = i -> opcode;
+    if(i -> condition != ALWAYS)
+        operation = SIM_CONDITIONAL;
+    else if(offset + i -> size < size)
+    {
+        sim_instruction * next = &d[i -> size].instruction;
+
+        if(i -> opcode == TEST && (next -> opcode == JUMPI || next -> opcode == JUMPR) &&
+           (next -> condition == IFTRUE || next -> condition == IFFALSE))
+            operation = SIM_TEST_JUMP;
+        else if(i -> opcode == PUSH && next -> opcode == PUSH)
+            operation = SIM_PUSH_RUN;
+        else if(i -> opcode == POP && i -> reg_1 != PC && next -> opcode == POP)
+            operation = SIM_POP_RUN;
+    }
+
+    d -> dispatch = SIM_TARGET(operation);
+    pc = d -> next_pc;
+    r[PC] = pc;
+    count ++;
+    SIM_GOTO(d -> dispatch);
+
+#ifdef SIM_SWITCH_DISPATCH
+sim_switch:
+    switch(operation)
+    {
+        #define SIM_CASE(opcode, ...) case opcode: goto sim_op_##opcode;
+        SIM_OPERATIONS(SIM_CASE)
+        #undef SIM_CASE
+        case SIM_TEST_JUMP:   goto sim_test_jump;
+        case SIM_PUSH_RUN:    goto sim_push_run;
+        case SIM_POP_RUN:     goto sim_pop_run;
+        case SIM_CONDITIONAL: goto sim_conditional;
+    }
+#endif
+
+sim_stop:
+    r[PC] = pc;
+    if(m -> halt == SIM_RUNNING)
+        m -> halt = count >= max_instructions ? SIM_STEP_LIMIT : SIM_END;
+
+    m -> instructions = count;
+    return m -> halt;
+}
+
+//! }@
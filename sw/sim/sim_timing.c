@@ -0,0 +1,264 @@
+/*!
+@ingroup sw-sim
+@{
+@file sim_timing.c
+@brief A cycle approximate timing model of the core's instruction fetch, which runs a program
+while following the fetch & decode state machine and the bus handshake it fetches over.
+@details The model steps hw/cpu/tim_cpu_fetch_decode_arch.vhdl one clock at a time:
+- FETCH_RESET lasts one cycle, then loads a word.
+- IDLE loads a word while the buffer holds four bytes or fewer, and otherwise hands the next
+  instruction to the execute stage once it is ready for it.
+- LOAD_WORD holds the bus request until it completes. With mem_bus_bram behind the handshake in
+  hw/bus/bus_device_master.vhdl that takes two cycles, the request and the completion, plus any
+  wait states the model is given.
+- FILL_BUFFER appends the fetched word to the buffer, and EMPTY_BUFFER shifts the instruction out
+  of it, each in one cycle.
+
+So an instruction costs at least two cycles, IDLE and EMPTY_BUFFER, and each refill of the buffer
+adds four more. Every cycle spent in FETCH_RESET, LOAD_WORD, FILL_BUFFER, or deciding in IDLE to
+load a word, is a fetch stall, charged to the instruction it was fetching for.
+
+The VHDL has no execute stage or branch handling yet, so the model assumes what they will need:
+- An instruction which reads or writes memory, counting the stack accesses of PUSH, POP, CALL and
+  RETURN, holds the bus for one transfer after it is handed over, so the fetcher can neither load
+  a word nor hand over the next instruction until it is done. These are memory stalls.
+- An instruction which moves PC anywhere but the next instruction discards the buffer, and
+  fetching starts again from the new PC.
+- With word aligned fetch, as from a BRAM which ignores the bottom two address bits, a word
+  fetched for an address which is not a multiple of four brings in only the bytes from that
+  address on. Byte aligned fetch, as the VHDL asks for, always brings in four.
+
+Instructions are decoded and executed exactly as sim_run does, from memory, at the point they
+leave the buffer.
+*/
+
+#include <math.h>
+
+#include "sim.h"
+
+//! The number of cycles LOAD_WORD lasts with no wait states: the request, then its completion.
+#define SIM_TIMING_BUS_CYCLES 2
+
+//! The most bytes the buffer can hold and still load another word, as checked in IDLE.
+#define SIM_TIMING_REFILL_LEVEL 4
+
+/*!
+@brief Returns the number of bus transfers an instruction makes once it is executed.
+*/
+static unsigned int sim_timing_transfers(unsigned int opcode)
+{
+    switch(opcode)
+    {
+        case LOADR: case LOADI: case STORR: case STORI:
+        case PUSH:  case POP:
+        case CALLR: case CALLI: case RETURN:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/*!
+@brief Initialises a timing model with its fetcher in reset and every count zero.
+@param wait_states - Cycles a bus transfer takes beyond the handshake itself.
+@param aligned_fetch - TRUE if a bus read returns the whole aligned word holding its address,
+FALSE if it returns the four bytes from its address on.
+@param tr - The new timing model.
+*/
+void sim_timing_new(unsigned int wait_states, BOOL aligned_fetch, sim_timing * tr)
+{
+    memset(tr, 0, sizeof(sim_timing));
+    tr -> bus_cycles    = SIM_TIMING_BUS_CYCLES + wait_states;
+    tr -> aligned_fetch = aligned_fetch;
+}
+
+/*!
+@brief Adds one instruction's cycles to a row of the timing report.
+*/
+static void sim_timing_count(sim_timing_stats * stats, unsigned long long cycles,
+                             unsigned long long fetch_stalls, unsigned long long memory_stalls)
+{
+    stats -> instructions  ++;
+    stats -> cycles        += cycles;
+    stats -> fetch_stalls  += fetch_stalls;
+    stats -> memory_stalls += memory_stalls;
+}
+
+/*!
+@brief Runs a machine through the timing model until it halts or has executed a number of
+instructions, adding the cycles taken to the model's counts.
+@param machine - The machine to run.
+@param timing - The timing model, which carries the state of the fetcher between calls.
+@param max_instructions - Stop once the machine has executed this many instructions in total.
+@returns Why the machine stopped.
+*/
+sim_halt_reason sim_run_timed(sim_machine * machine, sim_timing * timing,
+                              unsigned long long max_instructions)
+{
+    sim_timing      * t = timing;
+    sim_instruction   instruction;
+    unsigned long long count = machine -> instructions;
+
+    while(machine -> halt == SIM_RUNNING)
+    {
+        unsigned int pc = machine -> registers[PC];
+
+        if(count >= max_instructions)
+        {
+            machine -> halt = SIM_STEP_LIMIT;
+            break;
+        }
+        if(pc - machine -> program_start >= machine -> program_end - machine -> program_start)
+        {
+            machine -> halt = SIM_END;
+            break;
+        }
+        if(!sim_decode(machine, pc, &instruction))
+        {
+            machine -> halt = SIM_ILLEGAL;
+            break;
+        }
+
+        // Step the fetcher until it hands this instruction over.
+        unsigned long long cycles        = 0;
+        unsigned long long fetch_stalls  = 0;
+        unsigned long long memory_stalls = 0;
+        BOOL               delivered     = FALSE;
+
+        while(!delivered)
+        {
+            BOOL bus_held = t -> bus_held > 0;
+            if(bus_held)
+                t -> bus_held --;
+            cycles ++;
+
+            switch(t -> state)
+            {
+                case SIM_FETCH_RESET:
+                    fetch_stalls ++;
+                    t -> state     = SIM_FETCH_LOAD;
+                    t -> load_left = t -> bus_cycles;
+                    break;
+
+                case SIM_FETCH_IDLE:
+                    if(t -> stored <= SIM_TIMING_REFILL_LEVEL)
+                    {
+                        fetch_stalls ++;
+                        t -> state     = SIM_FETCH_LOAD;
+                        t -> load_left = t -> bus_cycles;
+                    }
+                    else if(bus_held)
+                        memory_stalls ++;
+                    else
+                        t -> state = SIM_FETCH_EMPTY;
+                    break;
+
+                case SIM_FETCH_LOAD:
+                    if(bus_held)
+                        memory_stalls ++;
+                    else
+                    {
+                        fetch_stalls ++;
+                        if(-- t -> load_left == 0)
+                            t -> state = SIM_FETCH_FILL;
+                    }
+                    break;
+
+                case SIM_FETCH_FILL:
+                {
+                    unsigned int address = pc + t -> stored;
+                    fetch_stalls ++;
+                    t -> stored += t -> aligned_fetch ? 4 - (address & 0x3) : 4;
+                    t -> words_fetched ++;
+                    t -> state = SIM_FETCH_IDLE;
+                    break;
+                }
+
+                case SIM_FETCH_EMPTY:
+                    delivered = TRUE;
+                    t -> state = SIM_FETCH_IDLE;
+                    break;
+            }
+        }
+
+        BOOL passes = sim_condition_passes(machine, instruction.condition);
+
+        machine -> registers[PC] = pc + instruction.size;
+        count ++;
+        sim_execute(machine, &instruction);
+
+        t -> stored -= instruction.size;
+        if(passes)
+        {
+            t -> bus_held  += sim_timing_transfers(instruction.opcode) * t -> bus_cycles;
+            t -> transfers += sim_timing_transfers(instruction.opcode);
+        }
+        if(machine -> registers[PC] != pc + instruction.size)
+        {
+            t -> flushes         ++;
+            t -> bytes_discarded += t -> stored;
+            t -> stored           = 0;
+        }
+
+        t -> cycles += cycles;
+        sim_timing_count(&t -> total, cycles, fetch_stalls, memory_stalls);
+        sim_timing_count(&t -> opcodes[instruction.opcode], cycles, fetch_stalls, memory_stalls);
+        sim_timing_count(&t -> sizes[instruction.size], cycles, fetch_stalls, memory_stalls);
+    }
+
+    machine -> instructions = count;
+    return machine -> halt;
+}
+
+/*!
+@brief Prints one row of the timing report.
+*/
+static void sim_timing_print_row(FILE * file, const char * name, sim_timing_stats * stats)
+{
+    fprintf(file, "%-8s %12llu %14llu %14llu %14llu %8.2f %8.2f\n", name, stats -> instructions,
+            stats -> cycles, stats -> fetch_stalls, stats -> memory_stalls,
+            (double)stats -> cycles / stats -> instructions,
+            (double)stats -> fetch_stalls / stats -> instructions);
+}
+
+/*!
+@brief Prints the cycles and stalls a timing model has counted, in total, for each opcode
+executed and for each instruction size.
+@param timing - The timing model to print.
+@param file - Where to print it.
+*/
+void sim_timing_print(sim_timing * timing, FILE * file)
+{
+    unsigned int i;
+    char         name[16];
+
+    fprintf(file, "cycles            %llu\n", timing -> cycles);
+    fprintf(file, "bus cycles        %u per transfer, %s aligned fetch\n", timing -> bus_cycles,
+            timing -> aligned_fetch ? "word" : "byte");
+    fprintf(file, "words fetched     %llu\n", timing -> words_fetched);
+    fprintf(file, "data transfers    %llu\n", timing -> transfers);
+    fprintf(file, "buffer flushes    %llu, discarding %llu bytes\n", timing -> flushes,
+            timing -> bytes_discarded);
+    if(timing -> total.instructions == 0)
+        return;
+
+    fprintf(file, "\n%-8s %12s %14s %14s %14s %8s %8s\n", "opcode", "count", "cycles",
+            "fetch stalls", "memory stalls", "cpi", "stall/i");
+    for(i = 0; i < NOT_EMITTED; i ++)
+        if(timing -> opcodes[i].instructions > 0)
+            sim_timing_print_row(file, asm_encodings[i].name, &timing -> opcodes[i]);
+
+    fprintf(file, "\n");
+    for(i = 0; i <= SIM_INSTRUCTION_MAX_SIZE; i ++)
+    {
+        if(timing -> sizes[i].instructions == 0)
+            continue;
+        snprintf(name, sizeof(name), "%u byte", i);
+        sim_timing_print_row(file, name, &timing -> sizes[i]);
+    }
+
+    fprintf(file, "\n");
+    sim_timing_print_row(file, "total", &timing -> total);
+}
+
+//! }@
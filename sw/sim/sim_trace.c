@@ -0,0 +1,764 @@
+/*!
+@ingroup sw-sim
+@{
+@file sim_trace.c
+@brief Captures a binary trace of every instruction a machine executes, through lock-free ring
+buffers which a background thread drains to a file.
+@details Each thread running a machine encodes every record as it is captured into a block of up
+to SIM_TRACE_PUBLISH records, small enough to stay in cache. Each full block, and the last of
+every run, is copied into a ring of bytes of the thread's own, which holds exactly what is to be
+written to the file, and only that thread ever advances the ring's head. The writer thread only
+ever writes bytes out of the ring and advances its tail. Each side publishes its index with a
+release store and reads the other's with an acquire load, so blocks cross between them without
+locks, and the atomic store is paid for once a block rather than every instruction. A thread
+which fills its ring waits for the writer to catch up rather than drop records, since a trace
+with holes in it is no use for finding a fault.
+
+Encoding while the record is still in registers costs less than storing it whole and having the
+writer read it back and encode it later, and leaves the writer nothing to do but write. Each
+record is encoded against the one before it from the same ring:
+- A byte holding whether the address follows on from the last record in its top bit,
+  SIM_TRACE_SKIPPED in the next, and the register written in the low six, with SIM_TRACE_MEMORY
+  and SIM_TRACE_NO_REGISTER cut to their low six bits.
+- The opcode in the low six bits of a byte and the condition in the top two, or 0xFF for a
+  SIM_TRACE_STREAM record.
+- The address, only if it does not follow on, as a variable length integer. An address follows
+  on if it is where the last instruction left the program counter, so the target of a taken
+  branch follows on from the branch, whose record already gave it.
+- The difference between the value written and the one last recorded for that register, as a
+  variable length integer. Stores give the difference of the address stored to from the last
+  one, then of the word written from the last word stored.
+
+So an ALU instruction in a loop usually takes three bytes rather than twelve. Variable length
+integers are written seven bits at a time, least significant first, with the top bit set on every
+byte but the last, and differences are zigzag encoded so small negative ones stay short.
+
+The file starts with the eight characters `TIMTRACE` and a big endian format version. Then come
+any number of blocks, each the index of the ring it came from, its count of records and its
+length in bytes, as big endian words, then the encoded records. Decoding a ring needs every block
+of it before, so a trace can only be read from the start.
+
+A ring's records are in the order its thread executed them, but blocks from different rings
+interleave. Each run on a ring starts with a SIM_TRACE_STREAM record naming the stream, so one
+ring can carry many jobs one after another.
+*/
+
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "sim.h"
+
+//! The number of bytes in each ring. Always a power of two.
+#define SIM_TRACE_RING_SIZE (1 << 22)
+
+//! The most records encoded into one block before it is copied into the ring and published.
+#define SIM_TRACE_PUBLISH 1024
+
+//! The length of the header before the records of every block: its ring, count and length.
+#define SIM_TRACE_BLOCK_HEADER 12
+
+//! How long the writer sleeps, in nanoseconds, when it finds every ring empty.
+#define SIM_TRACE_WRITER_SLEEP 1000000
+
+//! The identifying characters at the start of every trace file.
+static const char sim_trace_magic[8] = {'T', 'I', 'M', 'T', 'R', 'A', 'C', 'E'};
+
+//! The version of the trace format, which follows the magic characters.
+#define SIM_TRACE_VERSION 3
+
+//! Set in the first byte of an encoded record whose address follows on from the last one.
+#define SIM_TRACE_FOLLOWS       0x80
+//! The bits of the first byte of an encoded record which hold the register it wrote.
+#define SIM_TRACE_REGISTER_BITS 0x3F
+
+//! The most bytes one record encodes to: two bytes, the address, then the address stored to and
+//! the value.
+#define SIM_TRACE_MAX_ENCODED 17
+
+//! The coder slot of the last address stored to.
+#define SIM_TRACE_STORE_ADDRESS SIM_REGISTER_COUNT
+//! The coder slot of the last word stored.
+#define SIM_TRACE_STORE_VALUE   (SIM_REGISTER_COUNT + 1)
+
+//! The number of values a coder remembers: one per register, then the last store's address and
+//! word.
+#define SIM_TRACE_SLOTS (SIM_REGISTER_COUNT + 2)
+
+//! Assumed size of a host cache line, which the two sides of a ring keep their indices apart by.
+#define SIM_TRACE_CACHE_LINE 64
+
+/*!
+@brief What the encoding of the next record from a ring depends on, kept alike by the writer and
+the reader.
+*/
+typedef struct sim_trace_coder_t{
+    //! The address the next record follows on from: where the last record's instruction left
+    //! the program counter, or the address of the last record if it was a stream record.
+    unsigned int next;
+    //! The last value recorded for each register, then the last address and word stored.
+    unsigned int values[SIM_TRACE_SLOTS];
+} sim_trace_coder;
+
+/*!
+@brief A single producer, single consumer ring of encoded trace blocks.
+*/
+struct sim_trace_ring_t{
+    //! The bytes of the ring, SIM_TRACE_RING_SIZE of them.
+    unsigned char    * bytes;
+    //! The index of this ring, as written in the header of its blocks.
+    unsigned int       index;
+    //! The next ring the writer drains, or NULL.
+    sim_trace_ring   * next;
+    //! The state the producer encodes this ring's records against.
+    sim_trace_coder    coder;
+    //! The block being encoded, starting with room for its header.
+    unsigned char    * block;
+    //! Where the next record of the block is encoded.
+    unsigned char    * out;
+    //! The number of records in the block so far.
+    unsigned int       count;
+
+    //! The total number of bytes the producer has written. Only the producer touches this.
+    unsigned long long head;
+    //! The producer's last sight of tail.
+    unsigned long long tail_seen;
+
+    char               pad_0[SIM_TRACE_CACHE_LINE];
+    //! The head as last published to the writer.
+    unsigned long long published;
+
+    char               pad_1[SIM_TRACE_CACHE_LINE];
+    //! The total number of bytes the writer has taken. Only the writer changes this.
+    unsigned long long tail;
+};
+
+/*!
+@brief A trace file, and the writer thread draining every ring into it.
+*/
+struct sim_trace_t{
+    //! Where the trace is written.
+    FILE             * file;
+    //! The writer thread.
+    pthread_t          writer;
+    //! Guards adding rings to the list.
+    pthread_mutex_t    lock;
+    //! Every ring, most recently added first.
+    sim_trace_ring   * rings;
+    //! The number of rings added.
+    unsigned int       ring_count;
+    //! Set once every producer has finished, telling the writer to drain the rings and stop.
+    int                stop;
+    //! Set by the writer if a write to the file failed.
+    BOOL               failed;
+};
+
+/*!
+@brief Reads a trace file written by sim_trace_new, a block at a time.
+*/
+struct sim_trace_reader_t{
+    //! The trace file.
+    FILE             * file;
+    //! The state each ring's records are decoded against, indexed by ring.
+    sim_trace_coder  * coders;
+    //! The number of rings which have a coder.
+    unsigned int       ring_count;
+    //! The encoded bytes of the block being read.
+    unsigned char    * encoded;
+};
+
+//! Writes a 32 bit big endian word to a buffer, returning the byte after it.
+static unsigned char * sim_trace_put_word(unsigned char * out, unsigned int value)
+{
+    out[0] = value >> 24;
+    out[1] = value >> 16;
+    out[2] = value >>  8;
+    out[3] = value;
+    return out + 4;
+}
+
+//! Reads a 32 bit big endian word from a buffer.
+static unsigned int sim_trace_get_word(const unsigned char * in)
+{
+    return ((unsigned int)in[0] << 24) | ((unsigned int)in[1] << 16) |
+           ((unsigned int)in[2] <<  8) |  (unsigned int)in[3];
+}
+
+//! Writes a variable length integer to a buffer, returning the byte after it.
+static inline unsigned char * sim_trace_put_varint(unsigned char * out, unsigned int value)
+{
+    while(value >= 0x80)
+    {
+        *out ++ = value | 0x80;
+        value >>= 7;
+    }
+    *out ++ = value;
+    return out;
+}
+
+/*!
+@brief Reads a variable length integer from a buffer.
+@returns The byte after it, or NULL if it runs past end.
+*/
+static inline const unsigned char * sim_trace_get_varint(const unsigned char * in,
+                                                         const unsigned char * end,
+                                                         unsigned int * value)
+{
+    unsigned int shift = 0;
+
+    *value = 0;
+    while(in < end && shift < 35)
+    {
+        *value |= (unsigned int)(*in & 0x7F) << shift;
+        if(!(*in ++ & 0x80))
+            return in;
+        shift += 7;
+    }
+    return NULL;
+}
+
+//! Writes the zigzag encoded difference of a value from the last one in a slot, and keeps it.
+static inline unsigned char * sim_trace_put_delta(unsigned char * out, unsigned int * last,
+                                                  unsigned int value)
+{
+    unsigned int delta = value - *last;
+    *last = value;
+    return sim_trace_put_varint(out, (delta << 1) ^ (unsigned int)((int)delta >> 31));
+}
+
+/*!
+@brief Reads a difference written by sim_trace_put_delta, and applies it to a slot.
+@returns The byte after it, or NULL if it runs past end.
+*/
+static inline const unsigned char * sim_trace_get_delta(const unsigned char * in,
+                                                        const unsigned char * end,
+                                                        unsigned int * last, unsigned int * value)
+{
+    unsigned int delta;
+
+    if((in = sim_trace_get_varint(in, end, &delta)) == NULL)
+        return NULL;
+    *last  = *last + ((delta >> 1) ^ (0u - (delta & 1)));
+    *value = *last;
+    return in;
+}
+
+/*!
+@brief Encodes one record against the ring's last, returning the byte after it.
+*/
+static inline unsigned char * sim_trace_encode(sim_trace_coder * coder, sim_trace_record * record,
+                                               unsigned char * out)
+{
+    BOOL         stream  = record -> opcode == SIM_TRACE_STREAM;
+    BOOL         follows = record -> pc == coder -> next;
+    unsigned int reg     = record -> reg;
+
+    *out ++ = (follows ? SIM_TRACE_FOLLOWS : 0) | (record -> flags & SIM_TRACE_SKIPPED) << 6 |
+              (reg & SIM_TRACE_REGISTER_BITS);
+    *out ++ = stream ? SIM_TRACE_STREAM : record -> opcode | record -> condition << 6;
+    if(!follows)
+        out = sim_trace_put_varint(out, record -> pc);
+
+    if(stream)
+        out = sim_trace_put_varint(out, record -> value);
+    else if(reg == SIM_TRACE_MEMORY)
+    {
+        out = sim_trace_put_delta(out, &coder -> values[SIM_TRACE_STORE_ADDRESS],
+                                  record -> address);
+        out = sim_trace_put_delta(out, &coder -> values[SIM_TRACE_STORE_VALUE], record -> value);
+    }
+    else if(reg != SIM_TRACE_NO_REGISTER)
+        out = sim_trace_put_delta(out, &coder -> values[reg], record -> value);
+
+    if(stream)
+        coder -> next = record -> pc;
+    else if(reg == PC)
+        coder -> next = record -> value;
+    else
+        coder -> next = record -> pc + asm_encodings[record -> opcode].size;
+    return out;
+}
+
+/*!
+@brief Decodes one record against the ring's last.
+@returns The byte after it, or NULL if it is malformed or runs past end.
+*/
+static const unsigned char * sim_trace_decode(sim_trace_coder * coder, const unsigned char * in,
+                                              const unsigned char * end, sim_trace_record * tr)
+{
+    unsigned int header;
+    unsigned int opcode;
+
+    if(end - in < 2)
+        return NULL;
+    header = *in ++;
+    opcode = *in ++;
+
+    memset(tr, 0, sizeof(sim_trace_record));
+    tr -> flags = (header >> 6) & SIM_TRACE_SKIPPED;
+    tr -> reg   = header & SIM_TRACE_REGISTER_BITS;
+    tr -> pc    = coder -> next;
+    if(tr -> reg >= (SIM_TRACE_MEMORY & SIM_TRACE_REGISTER_BITS))
+        tr -> reg |= ~SIM_TRACE_REGISTER_BITS & 0xFF;
+    else if(tr -> reg >= SIM_REGISTER_COUNT)
+        return NULL;
+
+    if(opcode == SIM_TRACE_STREAM)
+        tr -> opcode = SIM_TRACE_STREAM;
+    else
+    {
+        tr -> opcode    = opcode & 0x3F;
+        tr -> condition = opcode >> 6;
+        if(tr -> opcode >= NOT_EMITTED)
+            return NULL;
+    }
+
+    if(!(header & SIM_TRACE_FOLLOWS) && (in = sim_trace_get_varint(in, end, &tr -> pc)) == NULL)
+        return NULL;
+
+    if(tr -> opcode == SIM_TRACE_STREAM)
+        in = sim_trace_get_varint(in, end, &tr -> value);
+    else if(tr -> reg == SIM_TRACE_MEMORY)
+    {
+        in = sim_trace_get_delta(in, end, &coder -> values[SIM_TRACE_STORE_ADDRESS],
+                                 &tr -> address);
+        if(in != NULL)
+            in = sim_trace_get_delta(in, end, &coder -> values[SIM_TRACE_STORE_VALUE],
+                                     &tr -> value);
+    }
+    else if(tr -> reg != SIM_TRACE_NO_REGISTER)
+        in = sim_trace_get_delta(in, end, &coder -> values[tr -> reg], &tr -> value);
+    if(in == NULL)
+        return NULL;
+
+    if(tr -> opcode == SIM_TRACE_STREAM)
+        coder -> next = tr -> pc;
+    else if(tr -> reg == PC)
+        coder -> next = tr -> value;
+    else
+        coder -> next = tr -> pc + asm_encodings[tr -> opcode].size;
+    return in;
+}
+
+/*!
+@brief Writes every byte published in a ring to the trace file.
+@returns The number of bytes written.
+*/
+static unsigned long long sim_trace_drain(sim_trace * trace, sim_trace_ring * ring)
+{
+    unsigned long long head   = __atomic_load_n(&ring -> published, __ATOMIC_ACQUIRE);
+    unsigned long long tail   = ring -> tail;
+    size_t             length = head - tail;
+    size_t             start  = tail & (SIM_TRACE_RING_SIZE - 1);
+    size_t             first  = length < SIM_TRACE_RING_SIZE - start ? length :
+                                                                     SIM_TRACE_RING_SIZE - start;
+
+    if(length == 0)
+        return 0;
+
+    // The bytes are written before the tail moves past them, as the producer may then reuse them.
+    if(fwrite(ring -> bytes + start, 1, first, trace -> file) != first ||
+       fwrite(ring -> bytes, 1, length - first, trace -> file) != length - first)
+        trace -> failed = TRUE;
+    __atomic_store_n(&ring -> tail, head, __ATOMIC_RELEASE);
+
+    return length;
+}
+
+//! The body of the writer thread.
+static void * sim_trace_write(void * argument)
+{
+    sim_trace     * trace = argument;
+    struct timespec nap   = {0, SIM_TRACE_WRITER_SLEEP};
+
+    for(;;)
+    {
+        // Stop is read before the pass, so a pass which starts after it drains everything.
+        int                stop    = __atomic_load_n(&trace -> stop, __ATOMIC_ACQUIRE);
+        unsigned long long written = 0;
+        sim_trace_ring   * ring;
+
+        pthread_mutex_lock(&trace -> lock);
+        ring = trace -> rings;
+        pthread_mutex_unlock(&trace -> lock);
+
+        for(; ring != NULL; ring = ring -> next)
+            written += sim_trace_drain(trace, ring);
+
+        if(written == 0)
+        {
+            if(stop)
+                break;
+            nanosleep(&nap, NULL);
+        }
+    }
+
+    return NULL;
+}
+
+/*!
+@brief Starts writing a trace to a file, with a writer thread to drain the rings into it.
+@param file - The file to write the trace to, opened in binary mode.
+@param tr - The new trace. Finish it with sim_trace_free.
+@returns TRUE if the header was written and the writer started, otherwise FALSE.
+*/
+BOOL sim_trace_new(FILE * file, sim_trace ** tr)
+{
+    unsigned char version[4];
+    sim_trace   * trace = calloc(1, sizeof(sim_trace));
+
+    if(trace == NULL)
+        return FALSE;
+
+    trace -> file = file;
+    sim_trace_put_word(version, SIM_TRACE_VERSION);
+    if(fwrite(sim_trace_magic, sizeof(sim_trace_magic), 1, file) != 1 ||
+       fwrite(version, sizeof(version), 1, file) != 1)
+    {
+        free(trace);
+        return FALSE;
+    }
+
+    pthread_mutex_init(&trace -> lock, NULL);
+    if(pthread_create(&trace -> writer, NULL, sim_trace_write, trace) != 0)
+    {
+        pthread_mutex_destroy(&trace -> lock);
+        free(trace);
+        return FALSE;
+    }
+
+    *tr = trace;
+    return TRUE;
+}
+
+/*!
+@brief Adds a ring to a trace, for one thread to write records into.
+@param trace - The trace the ring is drained into.
+@param tr - The new ring. It is freed along with the trace.
+@returns TRUE if the ring could be allocated, otherwise FALSE.
+*/
+BOOL sim_trace_ring_new(sim_trace * trace, sim_trace_ring ** tr)
+{
+    sim_trace_ring * ring = calloc(1, sizeof(sim_trace_ring));
+
+    if(ring == NULL)
+        return FALSE;
+    ring -> bytes = malloc(SIM_TRACE_RING_SIZE);
+    ring -> block = malloc(SIM_TRACE_BLOCK_HEADER + SIM_TRACE_PUBLISH * SIM_TRACE_MAX_ENCODED);
+    if(ring -> bytes == NULL || ring -> block == NULL)
+    {
+        free(ring -> bytes);
+        free(ring -> block);
+        free(ring);
+        return FALSE;
+    }
+    ring -> out = ring -> block + SIM_TRACE_BLOCK_HEADER;
+
+    pthread_mutex_lock(&trace -> lock);
+    ring -> index  = trace -> ring_count ++;
+    ring -> next   = trace -> rings;
+    trace -> rings = ring;
+    pthread_mutex_unlock(&trace -> lock);
+
+    *tr = ring;
+    return TRUE;
+}
+
+/*!
+@brief Waits until the writer has made room in a ring for a number of bytes.
+*/
+static void sim_trace_wait(sim_trace_ring * ring, size_t size)
+{
+    for(;;)
+    {
+        ring -> tail_seen = __atomic_load_n(&ring -> tail, __ATOMIC_ACQUIRE);
+        if(ring -> head + size - ring -> tail_seen <= SIM_TRACE_RING_SIZE)
+            return;
+        sched_yield();
+    }
+}
+
+/*!
+@brief Copies the block being encoded into a ring, if it has any records, and makes it visible
+to the writer.
+*/
+static void sim_trace_flush(sim_trace_ring * ring)
+{
+    size_t size  = ring -> out - ring -> block;
+    size_t start = ring -> head & (SIM_TRACE_RING_SIZE - 1);
+    size_t first = size < SIM_TRACE_RING_SIZE - start ? size : SIM_TRACE_RING_SIZE - start;
+
+    if(ring -> count == 0)
+        return;
+
+    sim_trace_put_word(sim_trace_put_word(sim_trace_put_word(ring -> block, ring -> index),
+                                          ring -> count), size - SIM_TRACE_BLOCK_HEADER);
+
+    if(ring -> head + size - ring -> tail_seen > SIM_TRACE_RING_SIZE)
+        sim_trace_wait(ring, size);
+    memcpy(ring -> bytes + start, ring -> block, first);
+    memcpy(ring -> bytes, ring -> block + first, size - first);
+
+    ring -> head += size;
+    __atomic_store_n(&ring -> published, ring -> head, __ATOMIC_RELEASE);
+
+    ring -> out   = ring -> block + SIM_TRACE_BLOCK_HEADER;
+    ring -> count = 0;
+}
+
+//! Encodes a record into the block being built, copying the block into the ring once it is full.
+static inline void sim_trace_put(sim_trace_ring * ring, unsigned int pc, sim_instruction * i,
+                                 unsigned int flags, unsigned int reg, unsigned int value,
+                                 unsigned int address)
+{
+    sim_trace_record record;
+
+    record.pc        = pc;
+    record.value     = value;
+    record.address   = address;
+    record.opcode    = i -> opcode;
+    record.flags     = flags;
+    record.reg       = reg;
+    record.condition = i -> condition;
+    ring -> out = sim_trace_encode(&ring -> coder, &record, ring -> out);
+
+    if(++ ring -> count == SIM_TRACE_PUBLISH)
+        sim_trace_flush(ring);
+}
+
+//! An entry of sim_trace_destinations for an instruction which writes its first register operand.
+#define SIM_TRACE_FIRST_OPERAND 0
+
+/*!
+@brief The register each opcode writes, SIM_TRACE_MEMORY for a store, or SIM_TRACE_NO_REGISTER,
+looked up rather than switched on as it is needed for every instruction traced.
+*/
+static const unsigned char sim_trace_destinations[NOT_EMITTED] = {
+    [STORR]  = SIM_TRACE_MEMORY,      [STORI] = SIM_TRACE_MEMORY,      [PUSH]  = SP,
+    [JUMPR]  = PC,                    [JUMPI] = PC,                    [JUMPS] = PC,
+    [CALLR]  = PC,                    [CALLI] = PC,                    [CALLS] = PC,
+    [RETURN] = PC,                    [TEST]  = TR,
+    [HALT]   = SIM_TRACE_NO_REGISTER, [SLEEP] = SIM_TRACE_NO_REGISTER, [NOPS]  = SIM_TRACE_NO_REGISTER
+};
+
+//! Returns the register an executed instruction wrote, SIM_TRACE_MEMORY or SIM_TRACE_NO_REGISTER.
+static inline unsigned int sim_trace_destination(sim_instruction * i)
+{
+    unsigned int reg = sim_trace_destinations[i -> opcode];
+    return reg == SIM_TRACE_FIRST_OPERAND ? i -> reg_1 : reg;
+}
+
+/*!
+@brief Marks the start of a new stream of records in a ring, such as one batch job.
+@param ring - The ring the stream is written to.
+@param stream - The number of the stream, which records up to the next stream belong to.
+@param pc - The address the stream starts from.
+*/
+void sim_trace_ring_start(sim_trace_ring * ring, unsigned int stream, unsigned int pc)
+{
+    sim_instruction marker;
+
+    memset(&marker, 0, sizeof(sim_instruction));
+    marker.opcode = SIM_TRACE_STREAM;
+    sim_trace_put(ring, pc, &marker, 0, SIM_TRACE_NO_REGISTER, stream, 0);
+}
+
+/*!
+@brief Runs a machine from its decode cache until it halts or has executed a number of
+instructions, writing a record of every instruction to a trace ring.
+@param machine - The machine to run. It must have been pre-decoded with sim_predecode_new.
+@param ring - The ring to write records to.
+@param max_instructions - Stop once the machine has executed this many instructions in total.
+@returns Why the machine stopped.
+*/
+sim_halt_reason sim_run_traced(sim_machine * machine, sim_trace_ring * ring,
+                               unsigned long long max_instructions)
+{
+    sim_decoded  * decoded = machine -> decoded;
+    unsigned int * r       = machine -> registers;
+    unsigned int   start   = machine -> program_start;
+    unsigned int   size    = machine -> program_end - start;
+    unsigned long long count = machine -> instructions;
+
+    while(machine -> halt == SIM_RUNNING)
+    {
+        unsigned int offset = r[PC] - start;
+
+        if(count >= max_instructions)
+        {
+            machine -> halt = SIM_STEP_LIMIT;
+            break;
+        }
+        if(offset >= size)
+        {
+            machine -> halt = SIM_END;
+            break;
+        }
+
+        // Stale records only know their real condition once decoded again.
+        sim_decoded     * d = &decoded[offset];
+        sim_instruction * i = &d -> instruction;
+        if(sim_predecode_stale(d))
+            sim_predecode_record(machine, start + offset, d);
+
+        r[PC] = d -> next_pc;
+        count ++;
+
+        unsigned int reg     = SIM_TRACE_NO_REGISTER;
+        unsigned int flags   = SIM_TRACE_SKIPPED;
+        unsigned int value   = 0;
+        unsigned int address = 0;
+
+        if(sim_condition_passes(machine, i -> condition))
+        {
+            d -> handler(machine, i);
+
+            // Illegal instructions are not counted, so are not traced either.
+            if(machine -> halt == SIM_ILLEGAL)
+                break;
+
+            reg   = sim_trace_destination(i);
+            flags = 0;
+            if(reg < SIM_REGISTER_COUNT)
+                value = r[reg];
+            else if(reg == SIM_TRACE_MEMORY)
+            {
+                address = r[i -> reg_2] + (i -> opcode == STORR ? r[i -> reg_3] : i -> immediate);
+                address = address & machine -> address_mask;
+                value   = sim_read_word(machine, address);
+            }
+        }
+
+        sim_trace_put(ring, start + offset, i, flags, reg, value, address);
+    }
+
+    if(machine -> halt == SIM_ILLEGAL)
+        count --;
+
+    sim_trace_flush(ring);
+    machine -> instructions = count;
+    return machine -> halt;
+}
+
+/*!
+@brief Waits for the writer to drain every ring into the file, then frees the trace and its
+rings. The file is left open.
+@param trace - The trace to finish. No thread may still be writing to its rings.
+@returns TRUE if every record was written, otherwise FALSE.
+*/
+BOOL sim_trace_free(sim_trace * trace)
+{
+    BOOL ok;
+
+    __atomic_store_n(&trace -> stop, 1, __ATOMIC_RELEASE);
+    pthread_join(trace -> writer, NULL);
+    ok = !trace -> failed;
+
+    while(trace -> rings != NULL)
+    {
+        sim_trace_ring * ring = trace -> rings;
+        trace -> rings = ring -> next;
+        free(ring -> bytes);
+        free(ring -> block);
+        free(ring);
+    }
+
+    pthread_mutex_destroy(&trace -> lock);
+    free(trace);
+    return ok;
+}
+
+/*!
+@brief Opens a trace for reading, checking its header.
+@param file - The trace file, opened in binary mode at its start.
+@param tr - The new reader. Free it with sim_trace_reader_free.
+@returns TRUE if the file is a trace of this format version, otherwise FALSE.
+*/
+BOOL sim_trace_reader_new(FILE * file, sim_trace_reader ** tr)
+{
+    char               magic[sizeof(sim_trace_magic)];
+    unsigned char      version[4];
+    sim_trace_reader * reader;
+
+    if(fread(magic, sizeof(magic), 1, file) != 1 || fread(version, sizeof(version), 1, file) != 1 ||
+       memcmp(magic, sim_trace_magic, sizeof(magic)) != 0 ||
+       sim_trace_get_word(version) != SIM_TRACE_VERSION)
+        return FALSE;
+
+    reader = calloc(1, sizeof(sim_trace_reader));
+    if(reader == NULL)
+        return FALSE;
+    reader -> file    = file;
+    reader -> encoded = malloc(SIM_TRACE_MAX_BLOCK * SIM_TRACE_MAX_ENCODED);
+    if(reader -> encoded == NULL)
+    {
+        free(reader);
+        return FALSE;
+    }
+
+    *tr = reader;
+    return TRUE;
+}
+
+/*!
+@brief Reads and decodes the next block of records from a trace.
+@param reader - The reader of the trace.
+@param ring - The index of the ring the block was written from.
+@param records - Where to decode the records to, with room for SIM_TRACE_MAX_BLOCK of them.
+@returns The number of records read, zero at the end of the file, or -1 if the file ends part way
+through a block or the block is malformed.
+*/
+int sim_trace_read_block(sim_trace_reader * reader, unsigned int * ring, sim_trace_record * records)
+{
+    unsigned char         header[12];
+    size_t                got = fread(header, 1, sizeof(header), reader -> file);
+    unsigned int          index, count, length, r;
+    const unsigned char * in;
+    const unsigned char * end;
+
+    if(got == 0)
+        return 0;
+    if(got != sizeof(header))
+        return -1;
+
+    index  = sim_trace_get_word(header);
+    count  = sim_trace_get_word(header + 4);
+    length = sim_trace_get_word(header + 8);
+    if(count == 0 || count > SIM_TRACE_MAX_BLOCK || length > SIM_TRACE_MAX_BLOCK *
+       SIM_TRACE_MAX_ENCODED || fread(reader -> encoded, 1, length, reader -> file) != length)
+        return -1;
+
+    if(index >= reader -> ring_count)
+    {
+        sim_trace_coder * coders = realloc(reader -> coders, (index + 1) * sizeof(sim_trace_coder));
+        if(coders == NULL)
+            return -1;
+        memset(coders + reader -> ring_count, 0,
+               (index + 1 - reader -> ring_count) * sizeof(sim_trace_coder));
+        reader -> coders     = coders;
+        reader -> ring_count = index + 1;
+    }
+
+    in  = reader -> encoded;
+    end = reader -> encoded + length;
+    for(r = 0; r < count; r ++)
+        if((in = sim_trace_decode(&reader -> coders[index], in, end, &records[r])) == NULL)
+            return -1;
+
+    *ring = index;
+    return count;
+}
+
+/*!
+@brief Releases a trace reader. The file is left open.
+@param reader - The reader to free.
+*/
+void sim_trace_reader_free(sim_trace_reader * reader)
+{
+    free(reader -> coders);
+    free(reader -> encoded);
+    free(reader);
+}
+
+//! }@
@@ -0,0 +1,222 @@
+/*!
+@ingroup sw-sim
+@{
+@file sim_trace_decode.c
+@brief Main source file for the trace decoder, which renders a binary trace written by tim-sim -x
+or tim-sim-batch -x as one line of text per instruction.
+@details Instructions are named with the assembler's own mnemonics from asm_lex.h, so a trace
+reads like the source it was assembled from. Records are printed in the order the writer took
+them from the rings, which keeps each stream in order but may interleave the streams of different
+threads; -s picks out a single stream.
+*/
+
+#include "sim.h"
+#include "asm_lex.h"
+
+#ifdef TIM_PRINT_PROMPT
+    #undef TIM_PRINT_PROMPT
+#endif
+#define TIM_PRINT_PROMPT "\e[1;35mtrace>\e[0m "
+
+//! The assembler mnemonic of every opcode, indexed by tim_instruction_opcode.
+static const char * sim_trace_mnemonics[NOT_EMITTED] = {
+    [LOADR] = lex_tok_LOAD,  [LOADI] = lex_tok_LOAD,  [STORI] = lex_tok_STORE,
+    [STORR] = lex_tok_STORE, [PUSH]  = lex_tok_PUSH,  [POP]   = lex_tok_POP,
+    [MOVR]  = lex_tok_MOV,   [MOVI]  = lex_tok_MOV,   [JUMPR] = lex_tok_JUMP,
+    [JUMPI] = lex_tok_JUMP,  [CALLR] = lex_tok_CALL,  [CALLI] = lex_tok_CALL,
+    [RETURN]= lex_tok_RETURN,[TEST]  = lex_tok_TEST,  [HALT]  = lex_tok_HALT,
+    [ANDR]  = lex_tok_AND,   [NANDR] = lex_tok_NAND,  [ORR]   = lex_tok_OR,
+    [NORR]  = lex_tok_NOR,   [XORR]  = lex_tok_XOR,   [LSLR]  = lex_tok_LSL,
+    [LSRR]  = lex_tok_LSR,   [NOTR]  = lex_tok_NOT,   [ANDI]  = lex_tok_AND,
+    [NANDI] = lex_tok_NAND,  [ORI]   = lex_tok_OR,    [NORI]  = lex_tok_NOR,
+    [XORI]  = lex_tok_XOR,   [LSLI]  = lex_tok_LSL,   [LSRI]  = lex_tok_LSR,
+    [IADDI] = lex_tok_IADD,  [ISUBI] = lex_tok_ISUB,  [IMULI] = lex_tok_IMUL,
+    [IDIVI] = lex_tok_IDIV,  [IASRI] = lex_tok_IASR,  [IADDR] = lex_tok_IADD,
+    [ISUBR] = lex_tok_ISUB,  [IMULR] = lex_tok_IMUL,  [IDIVR] = lex_tok_IDIV,
+    [IASRR] = lex_tok_IASR,  [FADDI] = lex_tok_FADD,  [FSUBI] = lex_tok_FSUB,
+    [FMULI] = lex_tok_FMUL,  [FDIVI] = lex_tok_FDIV,  [FASRI] = lex_tok_FASR,
+    [FADDR] = lex_tok_FADD,  [FSUBR] = lex_tok_FSUB,  [FMULR] = lex_tok_FMUL,
+    [FDIVR] = lex_tok_FDIV,  [FASRR] = lex_tok_FASR,  [SLEEP] = lex_tok_SLEEP,
+    [JUMPS] = lex_tok_JUMP,  [CALLS] = lex_tok_CALL
+};
+
+//! Each condition as the assembler writes it, indexed by tim_condition.
+static const char * sim_trace_conditions[] = {"  ", "?T", "?F", "?Z"};
+
+//! The most rings a trace is expected to have, which each need a current stream.
+#define SIM_TRACE_DECODE_MAX_RINGS 4096
+
+/*!
+@brief Contains all information for the program in a format that can be easily passed around.
+*/
+typedef struct sim_trace_decode_context_t{
+    //! The path of the trace to decode.
+    char             * input_file;
+    //! Where to write the text, or NULL or - for stdout.
+    char             * output_file;
+    //! Only print records of this stream.
+    unsigned int       stream;
+    //! TRUE if stream was given.
+    BOOL               one_stream;
+    //! The stream each ring is carrying, indexed by ring.
+    unsigned int     * streams;
+    //! The number of records printed of each ring's current stream, indexed by ring.
+    unsigned long long * counts;
+} sim_trace_decode_context;
+
+/*!
+@brief prints usage instructions for the program.
+*/
+void usage(int argc, char ** argv)
+{
+    tprintf("TIM Trace Decoder                                                  \n");
+    tprintf("-------------------------------------------------------------------\n");
+    tprintf("                                                                   \n");
+    tprintf("Usage: $> %s -i <trace> [-o text] [-s stream]\n", argv[0]);
+    tprintf("       -o  Where to write the decoded trace, or - for stdout. Default stdout.\n");
+    tprintf("       -s  Only decode this stream, the job index for tim-sim-batch traces.\n");
+    tprintf("\n");
+    tprintf("Each line gives the stream, the instruction's place in it, its address, its\n");
+    tprintf("condition and mnemonic, and the register it wrote or the word it stored.\n");
+    tprintf("\n");
+}
+
+/*!
+@brief Parses the command line arguments passed to the program into a context object.
+*/
+void parse_cmd_args(int argc, char ** argv, sim_trace_decode_context * cxt)
+{
+    int arg;
+
+    for(arg = 1; arg < argc; arg++)
+    {
+        if(arg + 1 >= argc)
+        {
+            warning("Missing value for argument: '%s'\n", argv[arg]);
+            usage(argc, argv);
+            exit(1);
+        }
+
+        if(strcmp(argv[arg], "-i") == 0)
+            cxt -> input_file = argv[arg+1];
+        else if(strcmp(argv[arg], "-o") == 0)
+            cxt -> output_file = argv[arg+1];
+        else if(strcmp(argv[arg], "-s") == 0)
+        {
+            cxt -> stream     = strtoul(argv[arg+1], NULL, 0);
+            cxt -> one_stream = TRUE;
+        }
+        else
+        {
+            warning("Unknown argument: '%s'\n", argv[arg]);
+            usage(argc, argv);
+            exit(1);
+        }
+        arg++;
+    }
+}
+
+/*!
+@brief Writes one record as a line of text.
+*/
+static void sim_trace_decode_record(FILE * output, unsigned int stream, unsigned long long count,
+                                    sim_trace_record * record)
+{
+    const char * mnemonic = record -> opcode < NOT_EMITTED ?
+                            sim_trace_mnemonics[record -> opcode] : NULL;
+
+    fprintf(output, "%-4u %10llu  0x%08X  %s %-6s ", stream, count, record -> pc,
+            sim_trace_conditions[record -> condition & 0x3], mnemonic != NULL ? mnemonic : "?");
+
+    if(record -> flags & SIM_TRACE_SKIPPED)
+        fprintf(output, " skipped\n");
+    else if(record -> reg == SIM_TRACE_MEMORY)
+        fprintf(output, " [0x%08X] = 0x%08X\n", record -> address, record -> value);
+    else if(record -> reg < SIM_REGISTER_COUNT)
+        fprintf(output, " %-4s = 0x%08X\n", sim_register_names[record -> reg], record -> value);
+    else
+        fprintf(output, "\n");
+}
+
+/*!
+@brief Main entry point for the application.
+@returns Zero if the whole trace was decoded, otherwise one.
+*/
+int main(int argc, char ** argv)
+{
+    sim_trace_decode_context cxt;
+    sim_trace_reader       * reader;
+    sim_trace_record       * records;
+    unsigned int             ring;
+    int                      count;
+    int                      r;
+
+    memset(&cxt, 0, sizeof(sim_trace_decode_context));
+    parse_cmd_args(argc, argv, &cxt);
+
+    if(cxt.input_file == NULL)
+    {
+        usage(argc, argv);
+        exit(1);
+    }
+
+    FILE * input = fopen(cxt.input_file, "rb");
+    if(input == NULL)
+        fatal("Could not open trace: %s\n", cxt.input_file);
+    if(!sim_trace_reader_new(input, &reader))
+        fatal("Not a trace: %s\n", cxt.input_file);
+
+    FILE * output = cxt.output_file == NULL || strcmp(cxt.output_file, "-") == 0 ?
+                    stdout : fopen(cxt.output_file, "w");
+    if(output == NULL)
+        fatal("Could not open output file: %s\n", cxt.output_file);
+
+    records     = malloc(SIM_TRACE_MAX_BLOCK * sizeof(sim_trace_record));
+    cxt.streams = calloc(SIM_TRACE_DECODE_MAX_RINGS, sizeof(unsigned int));
+    cxt.counts  = calloc(SIM_TRACE_DECODE_MAX_RINGS, sizeof(unsigned long long));
+    if(records == NULL || cxt.streams == NULL || cxt.counts == NULL)
+        fatal("Could not allocate the decode buffers\n");
+
+    unsigned long long total = 0;
+    while((count = sim_trace_read_block(reader, &ring, records)) > 0)
+    {
+        if(ring >= SIM_TRACE_DECODE_MAX_RINGS)
+            fatal("Trace has more than %u rings\n", SIM_TRACE_DECODE_MAX_RINGS);
+
+        for(r = 0; r < count; r ++)
+        {
+            sim_trace_record * record = &records[r];
+
+            if(record -> opcode == SIM_TRACE_STREAM)
+            {
+                cxt.streams[ring] = record -> value;
+                cxt.counts[ring]  = 0;
+                if(!cxt.one_stream || record -> value == cxt.stream)
+                    fprintf(output, "%-4u stream from 0x%08X\n", record -> value, record -> pc);
+                continue;
+            }
+
+            if(!cxt.one_stream || cxt.streams[ring] == cxt.stream)
+                sim_trace_decode_record(output, cxt.streams[ring], cxt.counts[ring], record);
+            cxt.counts[ring] ++;
+            total ++;
+        }
+    }
+
+    BOOL complete = count == 0;
+    sim_trace_reader_free(reader);
+    fclose(input);
+    if(output != stdout)
+        fclose(output);
+
+    if(!complete)
+        warning("Trace is truncated after %llu records: %s\n", total, cxt.input_file);
+
+    free(records);
+    free(cxt.streams);
+    free(cxt.counts);
+
+    return complete ? 0 : 1;
+}
+
+//! }@
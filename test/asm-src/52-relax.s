@@ -0,0 +1,51 @@
+; Tests branch relaxation where growing one short branch puts another out of reach.
+; .middle is 126 bytes past the end of JUMP .middle while JUMP .end is short, and 128 once
+; JUMP .end grows to reach .end, so tim-asm --relax must grow both. JUMP .done stays short.
+; None of the IADDs of R1 by 1 are ever executed.
+
+MOV $R1 0x0
+MOV $R3 0x0
+JUMP .middle
+.back
+JUMP .end
+IADD $R1 $R1 0x1
+IADD $R1 $R1 0x1
+IADD $R1 $R1 0x1
+IADD $R1 $R1 0x1
+IADD $R1 $R1 0x1
+IADD $R1 $R1 0x1
+IADD $R1 $R1 0x1
+IADD $R1 $R1 0x1
+IADD $R1 $R1 0x1
+IADD $R1 $R1 0x1
+IADD $R1 $R1 0x1
+IADD $R1 $R1 0x1
+IADD $R1 $R1 0x1
+IADD $R1 $R1 0x1
+IADD $R1 $R1 0x1
+IADD $R1 $R1 0x1
+IADD $R1 $R1 0x1
+IADD $R1 $R1 0x1
+IADD $R1 $R1 0x1
+IADD $R1 $R1 0x1
+IADD $R1 $R1 0x1
+IADD $R1 $R1 0x1
+IADD $R1 $R1 0x1
+IADD $R1 $R1 0x1
+IADD $R1 $R1 0x1
+IADD $R1 $R1 0x1
+IADD $R1 $R1 0x1
+IADD $R1 $R1 0x1
+IADD $R1 $R1 0x1
+IADD $R1 $R1 0x1
+IADD $R1 $R1 0x1
+.middle
+IADD $R3 $R3 0x1
+JUMP .back
+IADD $R1 $R1 0x1
+.end
+JUMP .done
+IADD $R1 $R1 0x1
+.done
+IADD $R1 $R1 0x100
+HALT
@@ -0,0 +1,19 @@
+; Tests that the statements tim-asm -O removes or rewrites change nothing the program can see.
+; The NOP sits between the ISUB which sets Z and the ?Z MOV which reads it, so it must leave
+; SR alone, and R3 ends up 0x7 with or without -O.
+
+MOV $R0 0x5
+MOV $R1 0x3
+ISUB $R2 $R1 $R1
+NOP
+?Z MOV $R3 0x7
+MOV $R1 $R1
+JUMP .next
+.next
+MOV $R4 0x44
+PUSH $R4
+POP $R4
+MOV $R5 0x55
+PUSH $R5
+POP $R6
+HALT
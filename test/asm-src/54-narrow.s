@@ -0,0 +1,20 @@
+; Tests tim-asm --narrow at the edges of every narrow immediate form. Each MOV and ALU
+; immediate is either the largest value its narrow form holds or one more, which must stay wide.
+
+MOV $R1 0xF
+MOV $R2 0x10
+MOV $R3 0x7FF
+MOV $R4 0x800
+MOV $T0 0xF
+MOV $R5 $T0
+IADD $R6 $R1 0xFF
+IADD $R7 $R1 0x100
+ISUB $R8 $R4 0xFF
+ISUB $R9 $R4 0x100
+AND $R10 $R3 0xFF
+OR $R11 $R2 0xFF
+XOR $R12 $R3 0x100
+LSL $R13 $R3 0xFF
+LSL $R14 $R1 0x4
+LSR $R15 $R4 0x8
+HALT
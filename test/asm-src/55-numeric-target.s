@@ -0,0 +1,9 @@
+; Tests that a JUMP to a numeric address still lands on the MOV of R2 at 0xC however it is
+; assembled. -O, --narrow, --dce, --relax and --align would all move it, so tim-asm must warn and
+; leave the program as written, keeping the MOV which only the numeric JUMP reaches.
+
+MOV $R1 0x1
+JUMP 0xC
+MOV $R1 0x2
+MOV $R2 0x3
+HALT
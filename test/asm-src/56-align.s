@@ -0,0 +1,49 @@
+; Tests tim-asm --align 3 with --relax. JUMP .start starts short, 127 bytes from .start, and the
+; padding before .start puts it out of reach, so it must grow. .loop is padded too, and is
+; reached both by falling through its padding and by a short ?F JUMP back to it. None of the
+; IADDs of R5 are ever executed.
+
+MOV $R1 0x3
+MOV $R2 0x0
+JUMP .start
+IADD $R5 $R5 $R5
+IADD $R5 $R5 0x1
+IADD $R5 $R5 0x1
+IADD $R5 $R5 0x1
+IADD $R5 $R5 0x1
+IADD $R5 $R5 0x1
+IADD $R5 $R5 0x1
+IADD $R5 $R5 0x1
+IADD $R5 $R5 0x1
+IADD $R5 $R5 0x1
+IADD $R5 $R5 0x1
+IADD $R5 $R5 0x1
+IADD $R5 $R5 0x1
+IADD $R5 $R5 0x1
+IADD $R5 $R5 0x1
+IADD $R5 $R5 0x1
+IADD $R5 $R5 0x1
+IADD $R5 $R5 0x1
+IADD $R5 $R5 0x1
+IADD $R5 $R5 0x1
+IADD $R5 $R5 0x1
+IADD $R5 $R5 0x1
+IADD $R5 $R5 0x1
+IADD $R5 $R5 0x1
+IADD $R5 $R5 0x1
+IADD $R5 $R5 0x1
+IADD $R5 $R5 0x1
+IADD $R5 $R5 0x1
+IADD $R5 $R5 0x1
+IADD $R5 $R5 0x1
+IADD $R5 $R5 0x1
+IADD $R5 $R5 0x1
+.start
+MOV $R3 0x1
+IADD $R4 $R4 $R3
+.loop
+IADD $R2 $R2 0x1
+ISUB $R1 $R1 0x1
+TEST $R1 $R0
+?F JUMP .loop
+HALT
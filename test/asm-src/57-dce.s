@@ -0,0 +1,30 @@
+; Tests that tim-asm --dce keeps everything control can reach and moves labels off the code it
+; removes. The MOV of R2 is only reached by falling through a conditional JUMP, and the MOV of R4
+; only by falling through a conditional HALT which never halts. .dead and .gone mark statements
+; only dead code reaches and .unused a subroutine nothing calls, so all three go, and .end, which
+; follows .gone, must still mark the MOV of R5.
+
+MOV $R1 0x2
+.top
+ISUB $R1 $R1 0x1
+TEST $R1 $R0
+?F JUMP .top
+MOV $R2 0x5
+CALL .sub
+?F HALT
+MOV $R4 0x7
+JUMP .end
+.dead
+MOV $R3 0x9
+JUMP .gone
+.gone
+JUMP .dead
+.end
+MOV $R5 0x11
+HALT
+.sub
+MOV $R6 0x13
+RETURN
+.unused
+MOV $R7 0x15
+RETURN
@@ -0,0 +1,50 @@
+#!/bin/bash
+#
+# Checks that the assembler's instruction encoding table agrees with the opcode values and
+# instruction lengths declared in hw/instructions.vhdl.
+#
+# Usage: tools/check-encodings.sh [path to tim-asm]
+#
+
+ROOT="$(cd "$(dirname "$0")/.." && pwd)"
+ASM="${1:-$ROOT/build/tim-asm}"
+VHDL="$ROOT/hw/instructions.vhdl"
+
+if [ ! -x "$ASM" ]; then
+    echo "Cannot find the assembler at $ASM, build it or pass its path."
+    exit 1
+fi
+
+# Collect "NAME OPCODE WIDTH" for every instruction declared in the VHDL package.
+from_vhdl() {
+    awk '
+        /constant opcode_[A-Z]+ *:/ {
+            match($0, /opcode_[A-Z]+/);  name = substr($0, RSTART + 7, RLENGTH - 7);
+            match($0, /to_unsigned\( *[0-9]+/);
+            value = substr($0, RSTART, RLENGTH); gsub(/[^0-9]/, "", value);
+            opcode[name] = value;
+        }
+        /constant opcode_width_[A-Z]+ *:/ {
+            match($0, /opcode_width_[A-Z]+/); name = substr($0, RSTART + 13, RLENGTH - 13);
+            match($0, /:= *[0-9]+/);
+            value = substr($0, RSTART, RLENGTH); gsub(/[^0-9]/, "", value);
+            width[name] = value;
+        }
+        END { for(name in opcode) print name, opcode[name], width[name] }
+    ' "$VHDL" | sort
+}
+
+from_asm() {
+    "$ASM" --encodings | awk '{print $1, $2, $3}' | sort
+}
+
+if diff <(from_vhdl) <(from_asm) > /tmp/check-encodings.$$; then
+    echo "Encodings match $VHDL"
+    rm -f /tmp/check-encodings.$$
+    exit 0
+else
+    echo "Encodings differ from $VHDL (< vhdl, > tim-asm):"
+    cat /tmp/check-encodings.$$
+    rm -f /tmp/check-encodings.$$
+    exit 1
+fi
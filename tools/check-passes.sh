@@ -0,0 +1,77 @@
+#!/bin/bash
+#
+# Checks that the assembler's optional passes and the simulator's engines agree. Every program in
+# test/asm-src is assembled plainly and run with the decode engine, then assembled with each pass
+# alone and all of them together and run with every engine, and traced. Each run must stop for
+# the same reason with the same general purpose registers, SP, TR and SR. PC and LR are not
+# compared, since the passes move code.
+#
+# Usage: tools/check-passes.sh [directory holding tim-asm and tim-sim]
+#
+
+ROOT="$(cd "$(dirname "$0")/.." && pwd)"
+BIN="${1:-$ROOT/build}"
+ASM="$BIN/tim-asm"
+SIM="$BIN/tim-sim"
+LIMIT=100000
+
+for tool in "$ASM" "$SIM"; do
+    if [ ! -x "$tool" ]; then
+        echo "Cannot find $tool, build it or pass the directory holding it."
+        exit 1
+    fi
+done
+
+PASSES=("" "-O" "--narrow" "--dce" "--relax" "--align 3" "-O --narrow --dce --relax --align 3")
+ENGINES=("decode" "predecode" "threaded" "jit")
+WORK="$(mktemp -d)"
+trap 'rm -rf "$WORK"' EXIT
+
+# Prints the parts of a tim-sim register dump which every assembly of a program must agree on.
+state() {
+    "$SIM" -i "$WORK/program.bin" -f binary -n $LIMIT "$@" 2>/dev/null | awk '
+        /^halt/                 { print $2 }
+        /^R(0|4|8|12) /         { print }
+        /^PC /                  { print $3, $4, $7, $8 }
+        /^SR /                  { print $1, $2 }'
+}
+
+failures=0
+for source in "$ROOT"/test/asm-src/*.s; do
+    name="$(basename "$source")"
+
+    # Fixtures which are meant not to assemble have nothing to compare.
+    if ! "$ASM" -i "$source" -o "$WORK/program.bin" -f binary > /dev/null 2>&1; then
+        echo "skip  $name"
+        continue
+    fi
+    state -e decode > "$WORK/expected"
+    before=$failures
+
+    for passes in "${PASSES[@]}"; do
+        if ! "$ASM" -i "$source" -o "$WORK/program.bin" -f binary $passes > /dev/null 2>&1; then
+            echo "FAIL  $name: tim-asm $passes does not assemble it"
+            failures=$((failures + 1))
+            continue
+        fi
+        for engine in "${ENGINES[@]}" "trace"; do
+            if [ "$engine" = "trace" ]; then
+                state -x "$WORK/program.trace" > "$WORK/actual"
+            else
+                state -e $engine > "$WORK/actual"
+            fi
+            if ! diff "$WORK/expected" "$WORK/actual" > "$WORK/diff"; then
+                echo "FAIL  $name: tim-asm ${passes:-with no passes}, $engine (< plain, > this):"
+                cat "$WORK/diff"
+                failures=$((failures + 1))
+            fi
+        done
+    done
+    [ $failures -eq $before ] && echo "ok    $name"
+done
+
+if [ $failures -ne 0 ]; then
+    echo "$failures runs disagreed"
+    exit 1
+fi
+echo "Every pass and engine agrees"